@@ -0,0 +1,190 @@
+/*
+ *      Summary: SIMD search in sorted key blocks of AA Tree
+ *         Date: 2022.01.30
+ *   Programmer: Kurdun Andrei
+ *   Code Style: Yandex
+ */
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+// Keys compared lane by lane: 32- and 64-bit integers, float and double
+template<class TKey>
+struct TIsSimdBlockKey : std::bool_constant<
+       std::is_floating_point_v<TKey> && (sizeof(TKey) == 4 || sizeof(TKey) == 8)
+    || std::is_integral_v<TKey> && !std::is_same_v<TKey, bool> && (sizeof(TKey) == 4 || sizeof(TKey) == 8)
+> {
+};
+
+/*
+ *  In a sorted block the number of keys less than the wanted one is its lower bound index,
+ *  so the whole block is compared at once and the lane masks are counted, no branch per key:
+ *
+ *      keys     [ 3  7 12 20 | 31 40 45 52 ]   wanted 25
+ *      less     [ 1  1  1  1 |  0  0  0  0 ]   -> 4
+ */
+template<class TKey>
+inline size_t BlockCountLessPortable(const TKey* keys, size_t count, TKey wantedKey) {
+    size_t lessCount = 0;
+    for (size_t keyIndex = 0; keyIndex < count; ++keyIndex) {
+        lessCount += (keys[keyIndex] < wantedKey);
+    }
+    return lessCount;
+}
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+
+template<class TKey>
+__attribute__((target("avx2"))) size_t BlockCountLessAvx2(const TKey* keys, size_t count, TKey wantedKey) {
+    constexpr size_t LaneCount = 32 / sizeof(TKey);
+    size_t lessCount = 0;
+    size_t keyIndex = 0;
+    if constexpr (std::is_same_v<TKey, float>) {
+        __m256 wantedVector = _mm256_set1_ps(wantedKey);
+        for (; keyIndex + LaneCount <= count; keyIndex += LaneCount) {
+            __m256 lessMask = _mm256_cmp_ps(_mm256_loadu_ps(keys + keyIndex), wantedVector, _CMP_LT_OQ);
+            lessCount += __builtin_popcount(_mm256_movemask_ps(lessMask));
+        }
+    } else if constexpr (std::is_same_v<TKey, double>) {
+        __m256d wantedVector = _mm256_set1_pd(wantedKey);
+        for (; keyIndex + LaneCount <= count; keyIndex += LaneCount) {
+            __m256d lessMask = _mm256_cmp_pd(_mm256_loadu_pd(keys + keyIndex), wantedVector, _CMP_LT_OQ);
+            lessCount += __builtin_popcount(_mm256_movemask_pd(lessMask));
+        }
+    } else if constexpr (sizeof(TKey) == 4) {
+        // AVX2 compares signed lanes only, unsigned keys are shifted by the sign bit
+        __m256i signFlip = _mm256_set1_epi32(std::is_signed_v<TKey> ? 0 : INT32_MIN);
+        __m256i wantedVector = _mm256_xor_si256(_mm256_set1_epi32(static_cast<int32_t>(wantedKey)), signFlip);
+        for (; keyIndex + LaneCount <= count; keyIndex += LaneCount) {
+            __m256i keyVector = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(keys + keyIndex));
+            __m256i lessMask = _mm256_cmpgt_epi32(wantedVector, _mm256_xor_si256(keyVector, signFlip));
+            lessCount += __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(lessMask)));
+        }
+    } else {
+        __m256i signFlip = _mm256_set1_epi64x(std::is_signed_v<TKey> ? 0 : INT64_MIN);
+        __m256i wantedVector = _mm256_xor_si256(_mm256_set1_epi64x(static_cast<int64_t>(wantedKey)), signFlip);
+        for (; keyIndex + LaneCount <= count; keyIndex += LaneCount) {
+            __m256i keyVector = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(keys + keyIndex));
+            __m256i lessMask = _mm256_cmpgt_epi64(wantedVector, _mm256_xor_si256(keyVector, signFlip));
+            lessCount += __builtin_popcount(_mm256_movemask_pd(_mm256_castsi256_pd(lessMask)));
+        }
+    }
+    for (; keyIndex < count; ++keyIndex) {
+        lessCount += (keys[keyIndex] < wantedKey);
+    }
+    return lessCount;
+}
+
+// The tail is a masked load, so a block of up to 16/8 keys is a single compare
+template<class TKey>
+__attribute__((target("avx512f"))) size_t BlockCountLessAvx512(const TKey* keys, size_t count, TKey wantedKey) {
+    constexpr size_t LaneCount = 64 / sizeof(TKey);
+    size_t lessCount = 0;
+    for (size_t keyIndex = 0; keyIndex < count; keyIndex += LaneCount) {
+        size_t laneCount = (count - keyIndex < LaneCount ? count - keyIndex : LaneCount);
+        uint32_t laneMask = (1u << laneCount) - 1;
+        const TKey* laneKeys = keys + keyIndex;
+        if constexpr (std::is_same_v<TKey, float>) {
+            __m512 keyVector = _mm512_maskz_loadu_ps(laneMask, laneKeys);
+            lessCount += __builtin_popcount(_mm512_mask_cmp_ps_mask(laneMask, keyVector, _mm512_set1_ps(wantedKey), _CMP_LT_OQ));
+        } else if constexpr (std::is_same_v<TKey, double>) {
+            __m512d keyVector = _mm512_maskz_loadu_pd(laneMask, laneKeys);
+            lessCount += __builtin_popcount(_mm512_mask_cmp_pd_mask(laneMask, keyVector, _mm512_set1_pd(wantedKey), _CMP_LT_OQ));
+        } else if constexpr (sizeof(TKey) == 4) {
+            __m512i keyVector = _mm512_maskz_loadu_epi32(laneMask, laneKeys);
+            __m512i wantedVector = _mm512_set1_epi32(static_cast<int32_t>(wantedKey));
+            if constexpr (std::is_signed_v<TKey>) {
+                lessCount += __builtin_popcount(_mm512_mask_cmplt_epi32_mask(laneMask, keyVector, wantedVector));
+            } else {
+                lessCount += __builtin_popcount(_mm512_mask_cmplt_epu32_mask(laneMask, keyVector, wantedVector));
+            }
+        } else {
+            __m512i keyVector = _mm512_maskz_loadu_epi64(laneMask, laneKeys);
+            __m512i wantedVector = _mm512_set1_epi64(static_cast<int64_t>(wantedKey));
+            if constexpr (std::is_signed_v<TKey>) {
+                lessCount += __builtin_popcount(_mm512_mask_cmplt_epi64_mask(laneMask, keyVector, wantedVector));
+            } else {
+                lessCount += __builtin_popcount(_mm512_mask_cmplt_epu64_mask(laneMask, keyVector, wantedVector));
+            }
+        }
+    }
+    return lessCount;
+}
+
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+
+// NEON is always present on AArch64, no dispatch is needed
+template<class TKey>
+size_t BlockCountLessNeon(const TKey* keys, size_t count, TKey wantedKey) {
+    constexpr size_t LaneCount = 16 / sizeof(TKey);
+    size_t lessCount = 0;
+    size_t keyIndex = 0;
+    for (; keyIndex + LaneCount <= count; keyIndex += LaneCount) {
+        const TKey* laneKeys = keys + keyIndex;
+        if constexpr (std::is_same_v<TKey, float>) {
+            lessCount += vaddvq_u32(vshrq_n_u32(vcltq_f32(vld1q_f32(laneKeys), vdupq_n_f32(wantedKey)), 31));
+        } else if constexpr (std::is_same_v<TKey, double>) {
+            lessCount += vaddvq_u64(vshrq_n_u64(vcltq_f64(vld1q_f64(laneKeys), vdupq_n_f64(wantedKey)), 63));
+        } else if constexpr (sizeof(TKey) == 4 && std::is_signed_v<TKey>) {
+            int32x4_t keyVector = vld1q_s32(reinterpret_cast<const int32_t*>(laneKeys));
+            lessCount += vaddvq_u32(vshrq_n_u32(vcltq_s32(keyVector, vdupq_n_s32(wantedKey)), 31));
+        } else if constexpr (sizeof(TKey) == 4) {
+            uint32x4_t keyVector = vld1q_u32(reinterpret_cast<const uint32_t*>(laneKeys));
+            lessCount += vaddvq_u32(vshrq_n_u32(vcltq_u32(keyVector, vdupq_n_u32(wantedKey)), 31));
+        } else if constexpr (std::is_signed_v<TKey>) {
+            int64x2_t keyVector = vld1q_s64(reinterpret_cast<const int64_t*>(laneKeys));
+            lessCount += vaddvq_u64(vshrq_n_u64(vcltq_s64(keyVector, vdupq_n_s64(wantedKey)), 63));
+        } else {
+            uint64x2_t keyVector = vld1q_u64(reinterpret_cast<const uint64_t*>(laneKeys));
+            lessCount += vaddvq_u64(vshrq_n_u64(vcltq_u64(keyVector, vdupq_n_u64(wantedKey)), 63));
+        }
+    }
+    for (; keyIndex < count; ++keyIndex) {
+        lessCount += (keys[keyIndex] < wantedKey);
+    }
+    return lessCount;
+}
+
+#endif
+
+template<class TKey>
+using TBlockCountLessFunction = size_t (*)(const TKey* keys, size_t count, TKey wantedKey);
+
+// The widest instruction set of the running CPU, checked once per key type
+template<class TKey>
+TBlockCountLessFunction<TKey> SelectBlockCountLess() {
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        return &BlockCountLessAvx512<TKey>;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        return &BlockCountLessAvx2<TKey>;
+    }
+#endif
+    return &BlockCountLessPortable<TKey>;
+}
+
+// Number of keys less than the wanted one in a block sorted by operator<
+template<class TKey>
+inline size_t BlockCountLess(const TKey* keys, size_t count, TKey wantedKey) {
+    if constexpr (!TIsSimdBlockKey<TKey>::value) {
+        return BlockCountLessPortable(keys, count, wantedKey);
+    } else {
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+        static const TBlockCountLessFunction<TKey> countLess = SelectBlockCountLess<TKey>();
+        return countLess(keys, count, wantedKey);
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+        return BlockCountLessNeon(keys, count, wantedKey);
+#else
+        return BlockCountLessPortable(keys, count, wantedKey);
+#endif
+    }
+}
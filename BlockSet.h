@@ -0,0 +1,689 @@
+/*
+ *      Summary: AA Tree of sorted key blocks
+ *         Date: 2022.01.30
+ *   Programmer: Kurdun Andrei
+ *   Code Style: Yandex
+ */
+#pragma once
+#include "BlockSearch.h"
+#include "Set.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <initializer_list>
+#include <iterator>
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+template<class TKey, size_t Capacity>
+struct TKeyBlock;
+template<class TBlockSet>
+class TBlockIterator;
+
+/*
+ *  Every node of the AA tree holds a sorted array of up to BlockCapacity keys, blocks do not overlap:
+ *
+ *                  [40 41 45 52]
+ *                 /             \
+ *     [3 7 12 20 31]           [60 64]
+ *
+ *  A search descends the short tree of blocks comparing only the block ends, then scans one block
+ *  (see BlockSearch.h for arithmetic keys).
+ *  Full blocks split in halves, blocks under a quarter full absorb their right neighbour.
+ *  The interface is the one of Set, but keys move inside and between blocks, so unlike Set
+ *  iterators are invalidated by any insert or erase.
+ */
+template<
+      class TKey
+    , class TCompare = std::less<TKey>
+    , class TAllocator = std::allocator<TKey>
+    , size_t BlockBytes = 128
+>
+class BlockSet {
+public:
+    using value_type = TKey;
+    using key_compare = TCompare;
+    using allocator_type = TAllocator;
+    using iterator = TBlockIterator<BlockSet>;
+
+    // Keys and the counter fill BlockBytes
+    static constexpr size_t BlockCapacity = std::max<size_t>((BlockBytes - sizeof(uint32_t)) / sizeof(TKey), 4);
+
+    BlockSet() = default;
+
+    explicit BlockSet(const TCompare& compare, const TAllocator& allocator = TAllocator())
+        : Blocks_(TBlockCompare{compare}, TBlockAllocator(allocator))
+        , Compare_(compare)
+    {
+    }
+
+    BlockSet(
+          const std::initializer_list<TKey>& initializerList
+        , const TCompare& compare = TCompare()
+        , const TAllocator& allocator = TAllocator()
+    )
+        : BlockSet(compare, allocator)
+    {
+        Assign(initializerList.begin(), initializerList.end());
+    }
+
+    // Sorted forward ranges are detected and built in O(n), anything else is inserted one by one
+    template<typename Iterator>
+    BlockSet(Iterator first, Iterator last, const TCompare& compare = TCompare(), const TAllocator& allocator = TAllocator())
+        : BlockSet(compare, allocator)
+    {
+        Assign(first, last);
+    }
+
+    template<typename Iterator>
+    BlockSet(
+          TSorted
+        , Iterator first
+        , Iterator last
+        , const TCompare& compare = TCompare()
+        , const TAllocator& allocator = TAllocator()
+    )
+        : BlockSet(compare, allocator)
+    {
+        BuildSorted(first, last);
+    }
+
+    BlockSet(const BlockSet& set) = default;
+
+    // The moved-from set is left empty and usable
+    BlockSet(BlockSet&& set) noexcept
+        : Blocks_(std::move(set.Blocks_))
+        , Size_(std::exchange(set.Size_, 0))
+        , Compare_(set.Compare_)
+    {
+    }
+
+    BlockSet& operator=(const BlockSet& set) = default;
+    BlockSet& operator=(BlockSet&& set) noexcept(std::is_nothrow_move_assignable_v<TBlocks>);
+
+    void swap(BlockSet& set) noexcept;
+
+    friend class TBlockIterator<BlockSet>;
+
+    inline size_t size() const;
+    inline bool empty() const;
+    inline size_t block_count() const;
+
+    iterator begin() const;
+    iterator end() const;
+
+    iterator lower_bound(const TKey& wantedKey) const;
+    iterator upper_bound(const TKey& wantedKey) const;
+    iterator find(const TKey& wantedKey) const;
+    bool contains(const TKey& wantedKey) const;
+    size_t count(const TKey& wantedKey) const;
+    std::pair<iterator, iterator> equal_range(const TKey& wantedKey) const;
+
+    std::pair<iterator, bool> insert(const TKey& insertedKey);
+    std::pair<iterator, bool> insert(TKey&& insertedKey);
+    // The hint is used when the key belongs right before it, the search is skipped then
+    iterator insert(iterator hint, const TKey& insertedKey);
+    iterator insert(iterator hint, TKey&& insertedKey);
+    template<class... TArgs>
+    std::pair<iterator, bool> emplace(TArgs&&... args);
+    template<class... TArgs>
+    iterator emplace_hint(iterator hint, TArgs&&... args);
+
+    size_t erase(const TKey& erasedKey);
+    // Returns the key after the erased one
+    iterator erase(iterator position);
+    void clear();
+
+    inline TCompare key_comp() const;
+    inline TAllocator get_allocator() const;
+
+private:
+    using TBlock = TKeyBlock<TKey, BlockCapacity>;
+
+    // Transparent: a key is compared with the first and the last key of a block
+    struct TBlockCompare {
+        using is_transparent = void;
+
+        bool operator()(const TBlock& leftBlock, const TBlock& rightBlock) const {
+            return Compare(leftBlock.Keys[leftBlock.Count - 1], rightBlock.Keys[0]);
+        }
+
+        bool operator()(const TKey& key, const TBlock& block) const {
+            return Compare(key, block.Keys[0]);
+        }
+
+        bool operator()(const TBlock& block, const TKey& key) const {
+            return Compare(block.Keys[block.Count - 1], key);
+        }
+
+        TCompare Compare;
+    };
+
+    using TBlockAllocator = typename std::allocator_traits<TAllocator>::template rebind_alloc<TBlock>;
+    using TBlocks = Set<TBlock, TBlockCompare, TBlockAllocator>;
+    using TBlocksIterator = typename TBlocks::iterator;
+
+    // Where a key is or would be inserted within its block
+    struct TKeyPosition {
+        TBlocksIterator BlockIterator;
+        size_t KeyIndex = 0;
+        bool IsPresent = false;
+    };
+
+    // Blocks of a sorted build keep room for a few inserts before they split
+    static constexpr size_t SortedBlockCount = std::max<size_t>(BlockCapacity * 3 / 4, 1);
+
+    // Arithmetic keys in ascending order compare a whole block with vector instructions
+    static constexpr bool IsSimdSearch = TIsSimdBlockKey<TKey>::value
+        && (std::is_same_v<TCompare, std::less<TKey>> || std::is_same_v<TCompare, std::less<>>);
+
+    template<typename Iterator>
+    void Assign(Iterator first, Iterator last);
+    template<typename Iterator>
+    void BuildSorted(Iterator first, Iterator last);
+
+    // Index of the first key of the block that is not less than the wanted one
+    inline size_t BlockLowerBound(const TBlock& block, const TKey& wantedKey) const;
+    inline TKeyPosition FindKeyPosition(const TKey& insertedKey) const;
+    inline TKeyPosition FindKeyPosition(iterator hint, const TKey& insertedKey) const;
+    template<class TArg>
+    iterator InsertKey(TKeyPosition position, TArg&& insertedKey);
+    void EraseKey(TBlocksIterator blockIterator, size_t erasedIndex);
+    void MergeWithNext(TBlocksIterator blockIterator);
+
+private:
+    TBlocks Blocks_;
+    size_t Size_ = 0;
+    TCompare Compare_ = TCompare();
+};
+
+template<class TKey, size_t Capacity>
+struct TKeyBlock {
+    static_assert(std::is_default_constructible_v<TKey>, "Block keys are default constructed");
+    static_assert(std::is_nothrow_move_assignable_v<TKey>, "Block keys are shifted by moves");
+    static_assert(std::is_nothrow_move_constructible_v<TKey>, "Split halves are moved back when linking fails");
+
+    uint32_t Count = 0;
+    TKey Keys[Capacity];
+};
+
+template<class TKey, class TCompare, class TAllocator, size_t BlockBytes>
+BlockSet<TKey, TCompare, TAllocator, BlockBytes>& BlockSet<TKey, TCompare, TAllocator, BlockBytes>::operator=(
+    BlockSet&& set
+) noexcept(std::is_nothrow_move_assignable_v<TBlocks>) {
+    if (this == &set) {
+        return *this;
+    }
+
+    Blocks_ = std::move(set.Blocks_);
+    // Blocks of a foreign allocator are copied rather than stolen
+    set.Blocks_.clear();
+    Size_ = std::exchange(set.Size_, 0);
+    Compare_ = set.Compare_;
+
+    return *this;
+}
+
+template<class TKey, class TCompare, class TAllocator, size_t BlockBytes>
+void BlockSet<TKey, TCompare, TAllocator, BlockBytes>::swap(BlockSet& set) noexcept {
+    Blocks_.swap(set.Blocks_);
+    std::swap(Size_, set.Size_);
+    std::swap(Compare_, set.Compare_);
+}
+
+template<class TKey, class TCompare, class TAllocator, size_t BlockBytes>
+size_t BlockSet<TKey, TCompare, TAllocator, BlockBytes>::size() const {
+    return Size_;
+}
+
+template<class TKey, class TCompare, class TAllocator, size_t BlockBytes>
+bool BlockSet<TKey, TCompare, TAllocator, BlockBytes>::empty() const {
+    return (Size_ == 0);
+}
+
+template<class TKey, class TCompare, class TAllocator, size_t BlockBytes>
+size_t BlockSet<TKey, TCompare, TAllocator, BlockBytes>::block_count() const {
+    return Blocks_.size();
+}
+
+template<class TKey, class TCompare, class TAllocator, size_t BlockBytes>
+typename BlockSet<TKey, TCompare, TAllocator, BlockBytes>::iterator BlockSet<TKey, TCompare, TAllocator, BlockBytes>::begin() const {
+    return iterator(Blocks_.begin(), 0);
+}
+
+template<class TKey, class TCompare, class TAllocator, size_t BlockBytes>
+typename BlockSet<TKey, TCompare, TAllocator, BlockBytes>::iterator BlockSet<TKey, TCompare, TAllocator, BlockBytes>::end() const {
+    return iterator(Blocks_.end(), 0);
+}
+
+template<class TKey, class TCompare, class TAllocator, size_t BlockBytes>
+typename BlockSet<TKey, TCompare, TAllocator, BlockBytes>::iterator BlockSet<TKey, TCompare, TAllocator, BlockBytes>::lower_bound(
+    const TKey& wantedKey
+) const {
+    // The first block whose last key is not less than the wanted one
+    TBlocksIterator blockIterator = Blocks_.lower_bound(wantedKey);
+    if (blockIterator == Blocks_.end()) {
+        return end();
+    }
+    return iterator(blockIterator, BlockLowerBound(*blockIterator, wantedKey));
+}
+
+template<class TKey, class TCompare, class TAllocator, size_t BlockBytes>
+typename BlockSet<TKey, TCompare, TAllocator, BlockBytes>::iterator BlockSet<TKey, TCompare, TAllocator, BlockBytes>::upper_bound(
+    const TKey& wantedKey
+) const {
+    iterator foundIterator = lower_bound(wantedKey);
+    if (foundIterator != end() && !Compare_(wantedKey, *foundIterator)) {
+        ++foundIterator;
+    }
+    return foundIterator;
+}
+
+template<class TKey, class TCompare, class TAllocator, size_t BlockBytes>
+typename BlockSet<TKey, TCompare, TAllocator, BlockBytes>::iterator BlockSet<TKey, TCompare, TAllocator, BlockBytes>::find(
+    const TKey& wantedKey
+) const {
+    iterator foundIterator = lower_bound(wantedKey);
+    if (foundIterator == end() || Compare_(wantedKey, *foundIterator)) {
+        return end();
+    }
+    return foundIterator;
+}
+
+template<class TKey, class TCompare, class TAllocator, size_t BlockBytes>
+bool BlockSet<TKey, TCompare, TAllocator, BlockBytes>::contains(const TKey& wantedKey) const {
+    return (find(wantedKey) != end());
+}
+
+template<class TKey, class TCompare, class TAllocator, size_t BlockBytes>
+size_t BlockSet<TKey, TCompare, TAllocator, BlockBytes>::count(const TKey& wantedKey) const {
+    return (contains(wantedKey) ? 1 : 0);
+}
+
+template<class TKey, class TCompare, class TAllocator, size_t BlockBytes>
+std::pair<typename BlockSet<TKey, TCompare, TAllocator, BlockBytes>::iterator, typename BlockSet<TKey, TCompare, TAllocator, BlockBytes>::iterator>
+BlockSet<TKey, TCompare, TAllocator, BlockBytes>::equal_range(const TKey& wantedKey) const {
+    iterator lowerIterator = lower_bound(wantedKey);
+    iterator upperIterator = lowerIterator;
+    if (upperIterator != end() && !Compare_(wantedKey, *upperIterator)) {
+        ++upperIterator;
+    }
+    return {lowerIterator, upperIterator};
+}
+
+template<class TKey, class TCompare, class TAllocator, size_t BlockBytes>
+std::pair<typename BlockSet<TKey, TCompare, TAllocator, BlockBytes>::iterator, bool>
+BlockSet<TKey, TCompare, TAllocator, BlockBytes>::insert(const TKey& insertedKey) {
+    TKeyPosition position = FindKeyPosition(insertedKey);
+    if (position.IsPresent) {
+        return {iterator(position.BlockIterator, position.KeyIndex), false};
+    }
+    return {InsertKey(position, insertedKey), true};
+}
+
+template<class TKey, class TCompare, class TAllocator, size_t BlockBytes>
+std::pair<typename BlockSet<TKey, TCompare, TAllocator, BlockBytes>::iterator, bool>
+BlockSet<TKey, TCompare, TAllocator, BlockBytes>::insert(TKey&& insertedKey) {
+    TKeyPosition position = FindKeyPosition(insertedKey);
+    if (position.IsPresent) {
+        return {iterator(position.BlockIterator, position.KeyIndex), false};
+    }
+    return {InsertKey(position, std::move(insertedKey)), true};
+}
+
+template<class TKey, class TCompare, class TAllocator, size_t BlockBytes>
+typename BlockSet<TKey, TCompare, TAllocator, BlockBytes>::iterator BlockSet<TKey, TCompare, TAllocator, BlockBytes>::insert(iterator hint, const TKey& insertedKey) {
+    TKeyPosition position = FindKeyPosition(hint, insertedKey);
+    if (position.IsPresent) {
+        return iterator(position.BlockIterator, position.KeyIndex);
+    }
+    return InsertKey(position, insertedKey);
+}
+
+template<class TKey, class TCompare, class TAllocator, size_t BlockBytes>
+typename BlockSet<TKey, TCompare, TAllocator, BlockBytes>::iterator BlockSet<TKey, TCompare, TAllocator, BlockBytes>::insert(iterator hint, TKey&& insertedKey) {
+    TKeyPosition position = FindKeyPosition(hint, insertedKey);
+    if (position.IsPresent) {
+        return iterator(position.BlockIterator, position.KeyIndex);
+    }
+    return InsertKey(position, std::move(insertedKey));
+}
+
+// Blocks store keys, not nodes, so the key is built first and moved into its block
+template<class TKey, class TCompare, class TAllocator, size_t BlockBytes>
+template<class... TArgs>
+std::pair<typename BlockSet<TKey, TCompare, TAllocator, BlockBytes>::iterator, bool> BlockSet<TKey, TCompare, TAllocator, BlockBytes>::emplace(TArgs&&... args) {
+    return insert(TKey(std::forward<TArgs>(args)...));
+}
+
+template<class TKey, class TCompare, class TAllocator, size_t BlockBytes>
+template<class... TArgs>
+typename BlockSet<TKey, TCompare, TAllocator, BlockBytes>::iterator BlockSet<TKey, TCompare, TAllocator, BlockBytes>::emplace_hint(iterator hint, TArgs&&... args) {
+    return insert(hint, TKey(std::forward<TArgs>(args)...));
+}
+
+template<class TKey, class TCompare, class TAllocator, size_t BlockBytes>
+size_t BlockSet<TKey, TCompare, TAllocator, BlockBytes>::erase(const TKey& erasedKey) {
+    TBlocksIterator blockIterator = Blocks_.find(erasedKey);
+    if (blockIterator == Blocks_.end()) {
+        return 0;
+    }
+    size_t erasedIndex = BlockLowerBound(*blockIterator, erasedKey);
+    if (erasedIndex == blockIterator->Count || Compare_(erasedKey, blockIterator->Keys[erasedIndex])) {
+        return 0;
+    }
+    EraseKey(blockIterator, erasedIndex);
+    return 1;
+}
+
+template<class TKey, class TCompare, class TAllocator, size_t BlockBytes>
+typename BlockSet<TKey, TCompare, TAllocator, BlockBytes>::iterator BlockSet<TKey, TCompare, TAllocator, BlockBytes>::erase(iterator position) {
+    TBlocksIterator blockIterator = position.BlockIterator_;
+    size_t erasedIndex = position.KeyIndex_;
+    if (blockIterator->Count == 1) {
+        TBlocksIterator nextIterator = Blocks_.erase(blockIterator);
+        --Size_;
+        return iterator(nextIterator, 0);
+    }
+    // A merge only appends keys to the block, so the index of the next key stays the same
+    EraseKey(blockIterator, erasedIndex);
+    if (erasedIndex == blockIterator->Count) {
+        ++blockIterator;
+        erasedIndex = 0;
+    }
+    return iterator(blockIterator, erasedIndex);
+}
+
+template<class TKey, class TCompare, class TAllocator, size_t BlockBytes>
+void BlockSet<TKey, TCompare, TAllocator, BlockBytes>::clear() {
+    Blocks_.clear();
+    Size_ = 0;
+}
+
+template<class TKey, class TCompare, class TAllocator, size_t BlockBytes>
+TCompare BlockSet<TKey, TCompare, TAllocator, BlockBytes>::key_comp() const {
+    return Compare_;
+}
+
+template<class TKey, class TCompare, class TAllocator, size_t BlockBytes>
+TAllocator BlockSet<TKey, TCompare, TAllocator, BlockBytes>::get_allocator() const {
+    return TAllocator(Blocks_.get_allocator());
+}
+
+template<class TKey, class TCompare, class TAllocator, size_t BlockBytes>
+template<typename Iterator>
+void BlockSet<TKey, TCompare, TAllocator, BlockBytes>::Assign(Iterator first, Iterator last) {
+    using TCategory = typename std::iterator_traits<Iterator>::iterator_category;
+    if constexpr (std::is_base_of_v<std::forward_iterator_tag, TCategory>) {
+        if (std::is_sorted(first, last, Compare_)) {
+            BuildSorted(first, last);
+            return;
+        }
+    }
+    for (; first != last; ++first) {
+        insert(*first);
+    }
+}
+
+// Keys are packed into blocks in one pass and the blocks are linked by the O(n) build of Set
+template<class TKey, class TCompare, class TAllocator, size_t BlockBytes>
+template<typename Iterator>
+void BlockSet<TKey, TCompare, TAllocator, BlockBytes>::BuildSorted(Iterator first, Iterator last) {
+    std::vector<TBlock> blocks;
+    TBlock block;
+    size_t size = 0;
+    for (; first != last; ++first) {
+        const TBlock* lastBlock = (block.Count != 0 ? &block : (blocks.empty() ? nullptr : &blocks.back()));
+        if (lastBlock != nullptr && !Compare_(lastBlock->Keys[lastBlock->Count - 1], *first)) {
+            continue;
+        }
+        if (block.Count == SortedBlockCount) {
+            blocks.push_back(std::move(block));
+            block.Count = 0;
+        }
+        block.Keys[block.Count++] = *first;
+        ++size;
+    }
+    if (block.Count != 0) {
+        blocks.push_back(std::move(block));
+    }
+    Blocks_ = TBlocks(
+          Sorted
+        , std::make_move_iterator(blocks.begin())
+        , std::make_move_iterator(blocks.end())
+        , TBlockCompare{Compare_}
+        , Blocks_.get_allocator()
+    );
+    Size_ = size;
+}
+
+template<class TKey, class TCompare, class TAllocator, size_t BlockBytes>
+size_t BlockSet<TKey, TCompare, TAllocator, BlockBytes>::BlockLowerBound(const TBlock& block, const TKey& wantedKey) const {
+    if constexpr (IsSimdSearch) {
+        return BlockCountLess(block.Keys, block.Count, wantedKey);
+    }
+    size_t keyIndex = 0;
+    while (keyIndex < block.Count && Compare_(block.Keys[keyIndex], wantedKey)) {
+        ++keyIndex;
+    }
+    return keyIndex;
+}
+
+template<class TKey, class TCompare, class TAllocator, size_t BlockBytes>
+typename BlockSet<TKey, TCompare, TAllocator, BlockBytes>::TKeyPosition BlockSet<TKey, TCompare, TAllocator, BlockBytes>::FindKeyPosition(const TKey& insertedKey) const {
+    if (Blocks_.empty()) {
+        return {Blocks_.end(), 0, false};
+    }
+    // A key greater than everything goes to the last block
+    TBlocksIterator blockIterator = Blocks_.lower_bound(insertedKey);
+    if (blockIterator == Blocks_.end()) {
+        --blockIterator;
+    }
+    size_t keyIndex = BlockLowerBound(*blockIterator, insertedKey);
+    bool isPresent = (keyIndex < blockIterator->Count && !Compare_(insertedKey, blockIterator->Keys[keyIndex]));
+    return {blockIterator, keyIndex, isPresent};
+}
+
+// The key belongs right before the hint when it lies between the hint and the key in front of it
+template<class TKey, class TCompare, class TAllocator, size_t BlockBytes>
+typename BlockSet<TKey, TCompare, TAllocator, BlockBytes>::TKeyPosition BlockSet<TKey, TCompare, TAllocator, BlockBytes>::FindKeyPosition(iterator hint, const TKey& insertedKey) const {
+    if (Blocks_.empty()) {
+        return {Blocks_.end(), 0, false};
+    }
+    TBlocksIterator blockIterator = hint.BlockIterator_;
+    size_t keyIndex = hint.KeyIndex_;
+    if (blockIterator == Blocks_.end()) {
+        --blockIterator;
+        keyIndex = blockIterator->Count;
+    } else if (!Compare_(insertedKey, blockIterator->Keys[keyIndex])) {
+        return FindKeyPosition(insertedKey);
+    }
+    if (keyIndex != 0) {
+        if (!Compare_(blockIterator->Keys[keyIndex - 1], insertedKey)) {
+            return FindKeyPosition(insertedKey);
+        }
+    } else if (blockIterator != Blocks_.begin()) {
+        TBlocksIterator previousIterator = blockIterator;
+        --previousIterator;
+        if (!Compare_(previousIterator->Keys[previousIterator->Count - 1], insertedKey)) {
+            return FindKeyPosition(insertedKey);
+        }
+    }
+    return {blockIterator, keyIndex, false};
+}
+
+template<class TKey, class TCompare, class TAllocator, size_t BlockBytes>
+template<class TArg>
+typename BlockSet<TKey, TCompare, TAllocator, BlockBytes>::iterator BlockSet<TKey, TCompare, TAllocator, BlockBytes>::InsertKey(TKeyPosition position, TArg&& insertedKey) {
+    // Copied before anything moves, so a throwing copy leaves the set as it was
+    TKey keyCopy(std::forward<TArg>(insertedKey));
+    if (Blocks_.empty()) {
+        TBlock firstBlock;
+        firstBlock.Keys[0] = std::move(keyCopy);
+        firstBlock.Count = 1;
+        TBlocksIterator blockIterator = Blocks_.insert(Blocks_.end(), std::move(firstBlock));
+        ++Size_;
+        return iterator(blockIterator, 0);
+    }
+
+    TBlocksIterator blockIterator = position.BlockIterator;
+    size_t insertedIndex = position.KeyIndex;
+    if (blockIterator->Count == BlockCapacity) {
+        //  [a b c d e f] -> [a b c] [d e f], the upper half is linked right after the lower one
+        TBlock& lowerBlock = *blockIterator;
+        TBlock upperBlock;
+        size_t lowerCount = BlockCapacity / 2;
+        std::move(lowerBlock.Keys + lowerCount, lowerBlock.Keys + BlockCapacity, upperBlock.Keys);
+        upperBlock.Count = BlockCapacity - lowerCount;
+        lowerBlock.Count = lowerCount;
+
+        TBlocksIterator nextIterator = blockIterator;
+        ++nextIterator;
+        TBlocksIterator upperIterator;
+        try {
+            upperIterator = Blocks_.insert(nextIterator, std::move(upperBlock));
+        } catch (...) {
+            // The node was not linked, the upper half goes back where it was
+            std::move(upperBlock.Keys, upperBlock.Keys + upperBlock.Count, lowerBlock.Keys + lowerCount);
+            lowerBlock.Count = BlockCapacity;
+            throw;
+        }
+        if (insertedIndex > lowerCount) {
+            blockIterator = upperIterator;
+            insertedIndex -= lowerCount;
+        }
+    }
+
+    TBlock& block = *blockIterator;
+    std::move_backward(block.Keys + insertedIndex, block.Keys + block.Count, block.Keys + block.Count + 1);
+    block.Keys[insertedIndex] = std::move(keyCopy);
+    ++block.Count;
+    ++Size_;
+    return iterator(blockIterator, insertedIndex);
+}
+
+template<class TKey, class TCompare, class TAllocator, size_t BlockBytes>
+void BlockSet<TKey, TCompare, TAllocator, BlockBytes>::EraseKey(TBlocksIterator blockIterator, size_t erasedIndex) {
+    --Size_;
+    TBlock& block = *blockIterator;
+    if (block.Count == 1) {
+        Blocks_.erase(blockIterator);
+        return;
+    }
+    std::move(block.Keys + erasedIndex + 1, block.Keys + block.Count, block.Keys + erasedIndex);
+    --block.Count;
+    if (block.Count < BlockCapacity / 4) {
+        MergeWithNext(blockIterator);
+    }
+}
+
+template<class TKey, class TCompare, class TAllocator, size_t BlockBytes>
+void BlockSet<TKey, TCompare, TAllocator, BlockBytes>::MergeWithNext(TBlocksIterator blockIterator) {
+    TBlocksIterator nextIterator = blockIterator;
+    ++nextIterator;
+    if (nextIterator == Blocks_.end() || blockIterator->Count + nextIterator->Count > BlockCapacity * 3 / 4) {
+        return;
+    }
+    // The neighbour is taken out first, so the grown block never overlaps a linked one
+    TBlock nextBlock = std::move(*nextIterator);
+    Blocks_.erase(nextIterator);
+    TBlock& block = *blockIterator;
+    std::move(nextBlock.Keys, nextBlock.Keys + nextBlock.Count, block.Keys + block.Count);
+    block.Count += nextBlock.Count;
+}
+
+//----------------TBlockIterator----------------
+
+template<class TBlockSet>
+class TBlockIterator {
+public:
+    using iterator_category = std::bidirectional_iterator_tag;
+    using value_type = typename TBlockSet::value_type;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const value_type*;
+    using reference = const value_type&;
+
+    TBlockIterator() = default;
+
+    TBlockIterator(typename TBlockSet::TBlocksIterator blockIterator, size_t keyIndex)
+        : BlockIterator_(blockIterator)
+        , KeyIndex_(keyIndex)
+    {
+    }
+
+    friend TBlockSet;
+
+    TBlockIterator& operator++();
+    const TBlockIterator operator++(int);
+
+    TBlockIterator& operator--();
+    const TBlockIterator operator--(int);
+
+    inline const value_type& operator*() const;
+    inline const value_type* operator->() const;
+
+    inline bool operator==(const TBlockIterator& iter) const;
+    inline bool operator!=(const TBlockIterator& iter) const;
+
+private:
+    typename TBlockSet::TBlocksIterator BlockIterator_;
+    size_t KeyIndex_ = 0;
+};
+
+template<class TBlockSet>
+TBlockIterator<TBlockSet>& TBlockIterator<TBlockSet>::operator++() {
+    if (++KeyIndex_ == BlockIterator_->Count) {
+        ++BlockIterator_;
+        KeyIndex_ = 0;
+    }
+    return *this;
+}
+
+template<class TBlockSet>
+const TBlockIterator<TBlockSet> TBlockIterator<TBlockSet>::operator++(int) {
+    TBlockIterator<TBlockSet> copy = *this;
+    ++*this;
+    return copy;
+}
+
+template<class TBlockSet>
+TBlockIterator<TBlockSet>& TBlockIterator<TBlockSet>::operator--() {
+    // end() is the first key of the past-the-end block, so it steps back into the last block
+    if (KeyIndex_ == 0) {
+        --BlockIterator_;
+        KeyIndex_ = BlockIterator_->Count;
+    }
+    --KeyIndex_;
+    return *this;
+}
+
+template<class TBlockSet>
+const TBlockIterator<TBlockSet> TBlockIterator<TBlockSet>::operator--(int) {
+    TBlockIterator<TBlockSet> copy = *this;
+    --*this;
+    return copy;
+}
+
+template<class TBlockSet>
+const typename TBlockIterator<TBlockSet>::value_type& TBlockIterator<TBlockSet>::operator*() const {
+    return BlockIterator_->Keys[KeyIndex_];
+}
+
+template<class TBlockSet>
+const typename TBlockIterator<TBlockSet>::value_type* TBlockIterator<TBlockSet>::operator->() const {
+    return &BlockIterator_->Keys[KeyIndex_];
+}
+
+template<class TBlockSet>
+bool TBlockIterator<TBlockSet>::operator==(const TBlockIterator& iter) const {
+    return (BlockIterator_ == iter.BlockIterator_ && KeyIndex_ == iter.KeyIndex_);
+}
+
+template<class TBlockSet>
+bool TBlockIterator<TBlockSet>::operator!=(const TBlockIterator& iter) const {
+    return !(*this == iter);
+}
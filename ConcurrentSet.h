@@ -0,0 +1,336 @@
+/*
+ *      Summary: AA Tree with wait-free readers and serialized writers
+ *         Date: 2022.01.30
+ *   Programmer: Kurdun Andrei
+ *   Code Style: Yandex
+ */
+#pragma once
+#include "PathCopyTree.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <utility>
+#include <vector>
+
+template<class TValueType>
+struct TConcurrentNode;
+
+/*
+ *  Published nodes are never changed. A writer copies the search path, rebalances the copies and
+ *  swings Root_, so a reader always walks one consistent version of the tree (see PathCopyTree.h).
+ *  Replaced nodes are retired and freed once every reader that could still see them is gone:
+ *  readers announce themselves in a striped pair of counters selected by the epoch parity,
+ *  the writer flips the epoch twice and waits for the old parity to drain.
+ *  Readers never wait and never retry; writers are serialized by a mutex.
+ */
+template<
+      class TValueType
+    , class TCompare = std::less<TValueType>
+    , class TAllocator = std::allocator<TValueType>
+>
+class ConcurrentSet
+    : private TPathCopyTree<TConcurrentNode<TValueType>, TValueType, TCompare, TAllocator, ConcurrentSet<TValueType, TCompare, TAllocator>>
+{
+public:
+    using value_type = TValueType;
+    using key_compare = TCompare;
+    using allocator_type = TAllocator;
+
+    ConcurrentSet() = default;
+
+    explicit ConcurrentSet(const TCompare& compare, const TAllocator& allocator = TAllocator())
+        : TBase(compare, allocator)
+    {
+    }
+
+    ConcurrentSet(const ConcurrentSet&) = delete;
+    ConcurrentSet& operator=(const ConcurrentSet&) = delete;
+
+    // No reader may be active any more
+    ~ConcurrentSet();
+
+    // Readers: wait-free, from any number of threads
+    bool contains(const TValueType& wantedValue) const;
+    std::optional<TValueType> find(const TValueType& wantedValue) const;
+    std::optional<TValueType> lower_bound(const TValueType& wantedValue) const;
+    inline size_t size() const;
+    inline bool empty() const;
+
+    // Writers: serialized, a throwing copy or allocation leaves the published tree untouched
+    bool insert(const TValueType& insertedValue);
+    bool insert(TValueType&& insertedValue);
+    bool erase(const TValueType& erasedValue);
+
+    // Frees all retired nodes now instead of at the next ReclaimThreshold
+    void reclaim();
+
+private:
+    using TNodeType = TConcurrentNode<TValueType>;
+    using TBase = TPathCopyTree<TNodeType, TValueType, TCompare, TAllocator, ConcurrentSet>;
+    friend TBase;
+
+    using TBase::Compare_;
+    using TBase::Version_;
+    using TBase::FreshNodes_;
+    using TBase::Insert;
+    using TBase::Erase;
+    using TBase::Find;
+    using TBase::LowerBound;
+    using TBase::DropFreshNodes;
+    using TBase::DestroyNode;
+
+    struct alignas(64) TReaderCounters {
+        std::atomic<size_t> Counts[2] = {{0}, {0}};
+    };
+
+    // Pins the current epoch for the lifetime of a lookup
+    class TReadGuard {
+    public:
+        explicit TReadGuard(const ConcurrentSet& set)
+            : Counts_(set.Readers_[ReaderStripe()].Counts)
+            , Parity_(set.Epoch_.load() & 1)
+        {
+            Counts_[Parity_].fetch_add(1);
+        }
+
+        TReadGuard(const TReadGuard&) = delete;
+        TReadGuard& operator=(const TReadGuard&) = delete;
+
+        ~TReadGuard() {
+            Counts_[Parity_].fetch_sub(1);
+        }
+
+    private:
+        std::atomic<size_t>* Counts_;
+        size_t Parity_;
+    };
+
+    static inline size_t ReaderStripe();
+
+    template<class TArg>
+    inline bool InsertValue(TArg&& insertedValue);
+
+    // Hook of TPathCopyTree: a node copied or dropped by the running write is retired once it commits
+    inline void OnReplaced(const TNodeType* replacedNode);
+    // The only allocation of a commit, made while the write can still be aborted
+    inline void ReserveRetired();
+    // Publishes the new root and cannot fail once ReserveRetired() has succeeded
+    inline void Commit(const TNodeType* rootNode);
+    inline void Abort();
+    inline void ReclaimLocked();
+    inline void WaitForReaders();
+
+    inline void DestroyTree(const TNodeType* currentNode);
+
+private:
+    static constexpr size_t ReaderStripeCount = 64;
+    static constexpr size_t ReclaimThreshold = 1024;
+
+    std::atomic<const TNodeType*> Root_ = nullptr;
+    std::atomic<size_t> Size_ = 0;
+    std::atomic<size_t> Epoch_ = 0;
+    mutable std::array<TReaderCounters, ReaderStripeCount> Readers_;
+
+    std::mutex WriterMutex_;
+    std::vector<const TNodeType*> ReplacedNodes_;
+    std::vector<const TNodeType*> RetiredNodes_;
+};
+
+template<class TValueType, class TCompare, class TAllocator>
+ConcurrentSet<TValueType, TCompare, TAllocator>::~ConcurrentSet() {
+    DestroyTree(Root_.load());
+    for (const TNodeType* currentNode : RetiredNodes_) {
+        DestroyNode(currentNode);
+    }
+}
+
+template<class TValueType, class TCompare, class TAllocator>
+bool ConcurrentSet<TValueType, TCompare, TAllocator>::contains(const TValueType& wantedValue) const {
+    TReadGuard guard(*this);
+    return (Find(Root_.load(), wantedValue) != nullptr);
+}
+
+template<class TValueType, class TCompare, class TAllocator>
+std::optional<TValueType> ConcurrentSet<TValueType, TCompare, TAllocator>::find(const TValueType& wantedValue) const {
+    TReadGuard guard(*this);
+    const TNodeType* foundNode = Find(Root_.load(), wantedValue);
+    if (foundNode == nullptr) {
+        return std::nullopt;
+    }
+    return foundNode->Value;
+}
+
+template<class TValueType, class TCompare, class TAllocator>
+std::optional<TValueType> ConcurrentSet<TValueType, TCompare, TAllocator>::lower_bound(const TValueType& wantedValue) const {
+    TReadGuard guard(*this);
+    const TNodeType* foundNode = LowerBound(Root_.load(), wantedValue);
+    if (foundNode == nullptr) {
+        return std::nullopt;
+    }
+    return foundNode->Value;
+}
+
+template<class TValueType, class TCompare, class TAllocator>
+size_t ConcurrentSet<TValueType, TCompare, TAllocator>::size() const {
+    return Size_.load(std::memory_order_relaxed);
+}
+
+template<class TValueType, class TCompare, class TAllocator>
+bool ConcurrentSet<TValueType, TCompare, TAllocator>::empty() const {
+    return (size() == 0);
+}
+
+template<class TValueType, class TCompare, class TAllocator>
+bool ConcurrentSet<TValueType, TCompare, TAllocator>::insert(const TValueType& insertedValue) {
+    return InsertValue(insertedValue);
+}
+
+template<class TValueType, class TCompare, class TAllocator>
+bool ConcurrentSet<TValueType, TCompare, TAllocator>::insert(TValueType&& insertedValue) {
+    return InsertValue(std::move(insertedValue));
+}
+
+template<class TValueType, class TCompare, class TAllocator>
+bool ConcurrentSet<TValueType, TCompare, TAllocator>::erase(const TValueType& erasedValue) {
+    std::lock_guard<std::mutex> lock(WriterMutex_);
+    ++Version_;
+    bool isErased = false;
+    const TNodeType* rootNode = nullptr;
+    try {
+        rootNode = Erase(Root_.load(), erasedValue, isErased);
+        ReserveRetired();
+    } catch (...) {
+        Abort();
+        throw;
+    }
+    if (isErased) {
+        Commit(rootNode);
+        Size_.fetch_sub(1, std::memory_order_relaxed);
+    }
+    return isErased;
+}
+
+template<class TValueType, class TCompare, class TAllocator>
+void ConcurrentSet<TValueType, TCompare, TAllocator>::reclaim() {
+    std::lock_guard<std::mutex> lock(WriterMutex_);
+    ReclaimLocked();
+}
+
+template<class TValueType, class TCompare, class TAllocator>
+size_t ConcurrentSet<TValueType, TCompare, TAllocator>::ReaderStripe() {
+    static std::atomic<size_t> nextStripe = 0;
+    static thread_local size_t stripe = nextStripe.fetch_add(1, std::memory_order_relaxed) % ReaderStripeCount;
+    return stripe;
+}
+
+template<class TValueType, class TCompare, class TAllocator>
+template<class TArg>
+bool ConcurrentSet<TValueType, TCompare, TAllocator>::InsertValue(TArg&& insertedValue) {
+    std::lock_guard<std::mutex> lock(WriterMutex_);
+    ++Version_;
+    bool isInserted = false;
+    const TNodeType* rootNode = nullptr;
+    try {
+        rootNode = Insert(Root_.load(), std::forward<TArg>(insertedValue), isInserted);
+        ReserveRetired();
+    } catch (...) {
+        Abort();
+        throw;
+    }
+    if (isInserted) {
+        Commit(rootNode);
+        Size_.fetch_add(1, std::memory_order_relaxed);
+    }
+    return isInserted;
+}
+
+template<class TValueType, class TCompare, class TAllocator>
+void ConcurrentSet<TValueType, TCompare, TAllocator>::OnReplaced(const TNodeType* replacedNode) {
+    ReplacedNodes_.push_back(replacedNode);
+}
+
+template<class TValueType, class TCompare, class TAllocator>
+void ConcurrentSet<TValueType, TCompare, TAllocator>::ReserveRetired() {
+    RetiredNodes_.reserve(RetiredNodes_.size() + ReplacedNodes_.size());
+}
+
+template<class TValueType, class TCompare, class TAllocator>
+void ConcurrentSet<TValueType, TCompare, TAllocator>::Commit(const TNodeType* rootNode) {
+    Root_.store(rootNode);
+    RetiredNodes_.insert(RetiredNodes_.end(), ReplacedNodes_.begin(), ReplacedNodes_.end());
+    ReplacedNodes_.clear();
+    FreshNodes_.clear();
+    if (RetiredNodes_.size() >= ReclaimThreshold) {
+        ReclaimLocked();
+    }
+}
+
+template<class TValueType, class TCompare, class TAllocator>
+void ConcurrentSet<TValueType, TCompare, TAllocator>::Abort() {
+    DropFreshNodes();
+    ReplacedNodes_.clear();
+}
+
+template<class TValueType, class TCompare, class TAllocator>
+void ConcurrentSet<TValueType, TCompare, TAllocator>::ReclaimLocked() {
+    if (RetiredNodes_.empty()) {
+        return;
+    }
+    WaitForReaders();
+    for (const TNodeType* currentNode : RetiredNodes_) {
+        DestroyNode(currentNode);
+    }
+    RetiredNodes_.clear();
+}
+
+/*
+ *  A reader that may still hold a retired node entered before that node was unlinked, under the
+ *  current epoch or the one before it. Two flips, each waiting until the old parity drains,
+ *  therefore outlast all of them; readers that enter meanwhile only see the new tree.
+ */
+template<class TValueType, class TCompare, class TAllocator>
+void ConcurrentSet<TValueType, TCompare, TAllocator>::WaitForReaders() {
+    for (size_t flip = 0; flip < 2; ++flip) {
+        size_t oldParity = Epoch_.fetch_add(1) & 1;
+        for (const TReaderCounters& readerCounters : Readers_) {
+            while (readerCounters.Counts[oldParity].load() != 0) {
+                std::this_thread::yield();
+            }
+        }
+    }
+}
+
+template<class TValueType, class TCompare, class TAllocator>
+void ConcurrentSet<TValueType, TCompare, TAllocator>::DestroyTree(const TNodeType* currentNode) {
+    if (currentNode == nullptr) {
+        return;
+    }
+    DestroyTree(currentNode->LeftNode);
+    DestroyTree(currentNode->RightNode);
+    DestroyNode(currentNode);
+}
+
+//----------------TConcurrentNode----------------
+
+// No parent link: a path copy would have to copy every node below as well
+template<class TValueType>
+struct TConcurrentNode {
+    template<class... TArgs>
+    explicit TConcurrentNode(std::in_place_t, TArgs&&... args) : Value(std::forward<TArgs>(args)...) {
+    }
+
+    const TConcurrentNode* LeftNode = nullptr;
+    const TConcurrentNode* RightNode = nullptr;
+    // The write that created the node, it may change the node in place until it is published
+    uint64_t Version = 0;
+    uint32_t Level = 1;
+    TValueType Value;
+};
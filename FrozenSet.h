@@ -0,0 +1,555 @@
+/*
+ *      Summary: Read-only AA Tree snapshot in Eytzinger layout
+ *         Date: 2022.01.30
+ *   Programmer: Kurdun Andrei
+ *   Code Style: Yandex
+ */
+#pragma once
+#include "Set.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iosfwd>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <utility>
+
+template<class TFrozenSet>
+class TFrozenIterator;
+
+/*
+ *  Keys are stored in one array in the breadth-first order of a complete search tree,
+ *  the sons of the key at position k are at 2k and 2k + 1 (positions counted from 1):
+ *
+ *             40
+ *           /    \
+ *         12      60        ->   [40 | 12 60 | 3 31 52 64]
+ *        /  \    /  \
+ *       3   31  52   64
+ *
+ *  A descent has no pointers to follow and the keys several levels below share one cache line,
+ *  which is prefetched while the current level is compared.
+ */
+template<
+      class TValueType
+    , class TCompare = std::less<TValueType>
+    , class TAllocator = std::allocator<TValueType>
+>
+class FrozenSet {
+public:
+    using value_type = TValueType;
+    using key_compare = TCompare;
+    using allocator_type = TAllocator;
+    using iterator = TFrozenIterator<FrozenSet>;
+
+    FrozenSet() = default;
+
+    explicit FrozenSet(const TCompare& compare, const TAllocator& allocator = TAllocator())
+        : Compare_(compare)
+        , Allocator_(allocator)
+    {
+    }
+
+    // Sorted forward range, equal neighbours are collapsed; two passes, O(n)
+    template<typename Iterator>
+    FrozenSet(
+          TSorted
+        , Iterator first
+        , Iterator last
+        , const TCompare& compare = TCompare()
+        , const TAllocator& allocator = TAllocator()
+    )
+        : Compare_(compare)
+        , Allocator_(allocator)
+    {
+        BuildSorted(first, last);
+    }
+
+    // Keys in external storage, such as a mapped file, are shared instead of copied
+    FrozenSet(const FrozenSet& set)
+        : Compare_(set.Compare_)
+        , Allocator_(TAllocatorTraits::select_on_container_copy_construction(set.Allocator_))
+    {
+        if (set.Storage_ != nullptr) {
+            Keys_ = set.Keys_;
+            Size_ = set.Size_;
+            Storage_ = set.Storage_;
+            return;
+        }
+        BuildSorted(set.begin(), set.end());
+    }
+
+    FrozenSet(FrozenSet&& set) noexcept
+        : Keys_(std::exchange(set.Keys_, nullptr))
+        , Size_(std::exchange(set.Size_, 0))
+        , Storage_(std::move(set.Storage_))
+        , Compare_(set.Compare_)
+        , Allocator_(set.Allocator_)
+    {
+    }
+
+    ~FrozenSet() {
+        if (Keys_ != nullptr) {
+            DestroyKeys(Size_);
+        }
+    }
+
+    FrozenSet& operator=(const FrozenSet& set);
+    // The allocator always moves together with the keys
+    FrozenSet& operator=(FrozenSet&& set) noexcept;
+
+    void swap(FrozenSet& set) noexcept;
+
+    friend class TFrozenIterator<FrozenSet>;
+
+    inline size_t size() const;
+    inline bool empty() const;
+
+    iterator begin() const;
+    iterator end() const;
+
+    iterator lower_bound(const TValueType& wantedValue) const;
+    iterator upper_bound(const TValueType& wantedValue) const;
+    iterator find(const TValueType& wantedValue) const;
+    bool contains(const TValueType& wantedValue) const;
+
+    template<class TKey, class TKeyCompare = TCompare, class = typename TKeyCompare::is_transparent>
+    iterator lower_bound(const TKey& wantedKey) const;
+    template<class TKey, class TKeyCompare = TCompare, class = typename TKeyCompare::is_transparent>
+    iterator upper_bound(const TKey& wantedKey) const;
+    template<class TKey, class TKeyCompare = TCompare, class = typename TKeyCompare::is_transparent>
+    iterator find(const TKey& wantedKey) const;
+    template<class TKey, class TKeyCompare = TCompare, class = typename TKeyCompare::is_transparent>
+    bool contains(const TKey& wantedKey) const;
+
+    // Mutable copy, O(n)
+    template<class TTraits = TDefaultSetTraits>
+    Set<TValueType, TCompare, TAllocator, TTraits> thaw() const;
+
+    // Binary files of trivially copyable keys, defined in SetFile.h. save() writes the layout as is,
+    // so map() serves lookups straight from the read-only mapping of such a file
+    void save(std::ostream& out) const;
+    static FrozenSet load(std::istream& in, const TCompare& compare = TCompare(), const TAllocator& allocator = TAllocator());
+    static FrozenSet map(const std::string& path, const TCompare& compare = TCompare());
+
+    inline TCompare key_comp() const;
+    inline TAllocator get_allocator() const;
+
+private:
+    using TAllocatorTraits = std::allocator_traits<TAllocator>;
+
+    // Sons this many positions apart start one cache line, 4 levels below for 4-byte keys
+    static constexpr size_t PrefetchStride = std::max<size_t>(64 / sizeof(TValueType), 2);
+
+    // In-order neighbours of a position, 0 stands for end()
+    inline size_t FirstPosition() const;
+    inline size_t LastPosition() const;
+    inline size_t NextPosition(size_t position) const;
+    inline size_t PreviousPosition(size_t position) const;
+
+    template<class TKey>
+    inline size_t LowerBoundPosition(const TKey& wantedKey) const;
+    template<class TKey>
+    inline size_t UpperBoundPosition(const TKey& wantedKey) const;
+    template<class TKey>
+    inline size_t FindPosition(const TKey& wantedKey) const;
+    inline void Prefetch(size_t position) const;
+
+    template<typename Iterator>
+    void BuildSorted(Iterator first, Iterator last);
+    // Destroys the first keys in order and frees the array of Size_ keys
+    void DestroyKeys(size_t count);
+
+private:
+    TValueType* Keys_ = nullptr;
+    size_t Size_ = 0;
+    // Owner of the keys when they are not allocated by the set; read-only
+    std::shared_ptr<const void> Storage_;
+    TCompare Compare_ = TCompare();
+    TAllocator Allocator_;
+};
+
+template<class TValueType, class TCompare, class TAllocator>
+FrozenSet<TValueType, TCompare, TAllocator>& FrozenSet<TValueType, TCompare, TAllocator>::operator=(const FrozenSet& set) {
+    if (this == &set) {
+        return *this;
+    }
+    FrozenSet copy(set);
+    swap(copy);
+    return *this;
+}
+
+template<class TValueType, class TCompare, class TAllocator>
+FrozenSet<TValueType, TCompare, TAllocator>& FrozenSet<TValueType, TCompare, TAllocator>::operator=(FrozenSet&& set) noexcept {
+    if (this == &set) {
+        return *this;
+    }
+    DestroyKeys(Size_);
+    Keys_ = std::exchange(set.Keys_, nullptr);
+    Size_ = std::exchange(set.Size_, 0);
+    Storage_ = std::move(set.Storage_);
+    Compare_ = set.Compare_;
+    Allocator_ = set.Allocator_;
+    return *this;
+}
+
+template<class TValueType, class TCompare, class TAllocator>
+void FrozenSet<TValueType, TCompare, TAllocator>::swap(FrozenSet& set) noexcept {
+    std::swap(Keys_, set.Keys_);
+    std::swap(Size_, set.Size_);
+    std::swap(Storage_, set.Storage_);
+    std::swap(Compare_, set.Compare_);
+    std::swap(Allocator_, set.Allocator_);
+}
+
+template<class TValueType, class TCompare, class TAllocator>
+size_t FrozenSet<TValueType, TCompare, TAllocator>::size() const {
+    return Size_;
+}
+
+template<class TValueType, class TCompare, class TAllocator>
+bool FrozenSet<TValueType, TCompare, TAllocator>::empty() const {
+    return (Size_ == 0);
+}
+
+template<class TValueType, class TCompare, class TAllocator>
+typename FrozenSet<TValueType, TCompare, TAllocator>::iterator FrozenSet<TValueType, TCompare, TAllocator>::begin() const {
+    return iterator(this, FirstPosition());
+}
+
+template<class TValueType, class TCompare, class TAllocator>
+typename FrozenSet<TValueType, TCompare, TAllocator>::iterator FrozenSet<TValueType, TCompare, TAllocator>::end() const {
+    return iterator(this, 0);
+}
+
+template<class TValueType, class TCompare, class TAllocator>
+typename FrozenSet<TValueType, TCompare, TAllocator>::iterator FrozenSet<TValueType, TCompare, TAllocator>::lower_bound(
+    const TValueType& wantedValue
+) const {
+    return iterator(this, LowerBoundPosition(wantedValue));
+}
+
+template<class TValueType, class TCompare, class TAllocator>
+typename FrozenSet<TValueType, TCompare, TAllocator>::iterator FrozenSet<TValueType, TCompare, TAllocator>::upper_bound(
+    const TValueType& wantedValue
+) const {
+    return iterator(this, UpperBoundPosition(wantedValue));
+}
+
+template<class TValueType, class TCompare, class TAllocator>
+typename FrozenSet<TValueType, TCompare, TAllocator>::iterator FrozenSet<TValueType, TCompare, TAllocator>::find(
+    const TValueType& wantedValue
+) const {
+    return iterator(this, FindPosition(wantedValue));
+}
+
+template<class TValueType, class TCompare, class TAllocator>
+bool FrozenSet<TValueType, TCompare, TAllocator>::contains(const TValueType& wantedValue) const {
+    return (FindPosition(wantedValue) != 0);
+}
+
+template<class TValueType, class TCompare, class TAllocator>
+template<class TKey, class, class>
+typename FrozenSet<TValueType, TCompare, TAllocator>::iterator FrozenSet<TValueType, TCompare, TAllocator>::lower_bound(
+    const TKey& wantedKey
+) const {
+    return iterator(this, LowerBoundPosition(wantedKey));
+}
+
+template<class TValueType, class TCompare, class TAllocator>
+template<class TKey, class, class>
+typename FrozenSet<TValueType, TCompare, TAllocator>::iterator FrozenSet<TValueType, TCompare, TAllocator>::upper_bound(
+    const TKey& wantedKey
+) const {
+    return iterator(this, UpperBoundPosition(wantedKey));
+}
+
+template<class TValueType, class TCompare, class TAllocator>
+template<class TKey, class, class>
+typename FrozenSet<TValueType, TCompare, TAllocator>::iterator FrozenSet<TValueType, TCompare, TAllocator>::find(
+    const TKey& wantedKey
+) const {
+    return iterator(this, FindPosition(wantedKey));
+}
+
+template<class TValueType, class TCompare, class TAllocator>
+template<class TKey, class, class>
+bool FrozenSet<TValueType, TCompare, TAllocator>::contains(const TKey& wantedKey) const {
+    return (FindPosition(wantedKey) != 0);
+}
+
+template<class TValueType, class TCompare, class TAllocator>
+template<class TTraits>
+Set<TValueType, TCompare, TAllocator, TTraits> FrozenSet<TValueType, TCompare, TAllocator>::thaw() const {
+    return Set<TValueType, TCompare, TAllocator, TTraits>::from_sorted(begin(), end(), Compare_, Allocator_);
+}
+
+template<class TValueType, class TCompare, class TAllocator>
+TCompare FrozenSet<TValueType, TCompare, TAllocator>::key_comp() const {
+    return Compare_;
+}
+
+template<class TValueType, class TCompare, class TAllocator>
+TAllocator FrozenSet<TValueType, TCompare, TAllocator>::get_allocator() const {
+    return Allocator_;
+}
+
+template<class TValueType, class TCompare, class TAllocator>
+size_t FrozenSet<TValueType, TCompare, TAllocator>::FirstPosition() const {
+    if (Size_ == 0) {
+        return 0;
+    }
+    size_t position = 1;
+    while (2 * position <= Size_) {
+        position = 2 * position;
+    }
+    return position;
+}
+
+template<class TValueType, class TCompare, class TAllocator>
+size_t FrozenSet<TValueType, TCompare, TAllocator>::LastPosition() const {
+    if (Size_ == 0) {
+        return 0;
+    }
+    size_t position = 1;
+    while (2 * position + 1 <= Size_) {
+        position = 2 * position + 1;
+    }
+    return position;
+}
+
+template<class TValueType, class TCompare, class TAllocator>
+size_t FrozenSet<TValueType, TCompare, TAllocator>::NextPosition(size_t position) const {
+    // The leftmost key of the right subtree, otherwise the first ancestor reached from the left
+    if (2 * position + 1 <= Size_) {
+        position = 2 * position + 1;
+        while (2 * position <= Size_) {
+            position = 2 * position;
+        }
+        return position;
+    }
+    while ((position & 1) != 0) {
+        position >>= 1;
+    }
+    return (position >> 1);
+}
+
+template<class TValueType, class TCompare, class TAllocator>
+size_t FrozenSet<TValueType, TCompare, TAllocator>::PreviousPosition(size_t position) const {
+    if (position == 0) {
+        return LastPosition();
+    }
+    if (2 * position <= Size_) {
+        position = 2 * position;
+        while (2 * position + 1 <= Size_) {
+            position = 2 * position + 1;
+        }
+        return position;
+    }
+    while (position != 1 && (position & 1) == 0) {
+        position >>= 1;
+    }
+    return (position >> 1);
+}
+
+/*
+ *  The descent goes left on "not less" and right on "less" without a branch. The answer is the last
+ *  node where it went left: the right turns taken after it are the trailing ones of the position,
+ *  followed by that left turn.
+ */
+template<class TValueType, class TCompare, class TAllocator>
+template<class TKey>
+size_t FrozenSet<TValueType, TCompare, TAllocator>::LowerBoundPosition(const TKey& wantedKey) const {
+    size_t position = 1;
+    while (position <= Size_) {
+        Prefetch(position * PrefetchStride);
+        position = 2 * position + static_cast<size_t>(Compare_(Keys_[position - 1], wantedKey));
+    }
+    while ((position & 1) != 0) {
+        position >>= 1;
+    }
+    return (position >> 1);
+}
+
+template<class TValueType, class TCompare, class TAllocator>
+template<class TKey>
+size_t FrozenSet<TValueType, TCompare, TAllocator>::UpperBoundPosition(const TKey& wantedKey) const {
+    size_t position = 1;
+    while (position <= Size_) {
+        Prefetch(position * PrefetchStride);
+        position = 2 * position + static_cast<size_t>(!Compare_(wantedKey, Keys_[position - 1]));
+    }
+    while ((position & 1) != 0) {
+        position >>= 1;
+    }
+    return (position >> 1);
+}
+
+template<class TValueType, class TCompare, class TAllocator>
+template<class TKey>
+size_t FrozenSet<TValueType, TCompare, TAllocator>::FindPosition(const TKey& wantedKey) const {
+    size_t position = LowerBoundPosition(wantedKey);
+    if (position == 0 || Compare_(wantedKey, Keys_[position - 1])) {
+        return 0;
+    }
+    return position;
+}
+
+template<class TValueType, class TCompare, class TAllocator>
+void FrozenSet<TValueType, TCompare, TAllocator>::Prefetch(size_t position) const {
+#if defined(__GNUC__) || defined(__clang__)
+    // The position may be past the array: the address is only a hint and is never dereferenced
+    uintptr_t address = reinterpret_cast<uintptr_t>(Keys_) + (position - 1) * sizeof(TValueType);
+    __builtin_prefetch(reinterpret_cast<const void*>(address));
+#else
+    (void)position;
+#endif
+}
+
+template<class TValueType, class TCompare, class TAllocator>
+template<typename Iterator>
+void FrozenSet<TValueType, TCompare, TAllocator>::BuildSorted(Iterator first, Iterator last) {
+    size_t distinctCount = 0;
+    for (Iterator previous = first, current = first; current != last; ++current) {
+        if (current == first || Compare_(*previous, *current)) {
+            ++distinctCount;
+        }
+        previous = current;
+    }
+    if (distinctCount == 0) {
+        return;
+    }
+
+    // The keys come in order, so positions are filled along the in-order walk of the layout
+    Keys_ = TAllocatorTraits::allocate(Allocator_, distinctCount);
+    Size_ = distinctCount;
+    size_t constructedCount = 0;
+    size_t position = FirstPosition();
+    size_t previousPosition = 0;
+    try {
+        for (; first != last; ++first) {
+            if (previousPosition != 0 && !Compare_(Keys_[previousPosition - 1], *first)) {
+                continue;
+            }
+            TAllocatorTraits::construct(Allocator_, Keys_ + (position - 1), *first);
+            ++constructedCount;
+            previousPosition = position;
+            position = NextPosition(position);
+        }
+    } catch (...) {
+        DestroyKeys(constructedCount);
+        throw;
+    }
+}
+
+template<class TValueType, class TCompare, class TAllocator>
+void FrozenSet<TValueType, TCompare, TAllocator>::DestroyKeys(size_t count) {
+    if (Keys_ == nullptr) {
+        return;
+    }
+    if (Storage_ != nullptr) {
+        Storage_.reset();
+        Keys_ = nullptr;
+        Size_ = 0;
+        return;
+    }
+    if constexpr (!std::is_trivially_destructible_v<TValueType>) {
+        for (size_t position = FirstPosition(); count != 0; position = NextPosition(position), --count) {
+            TAllocatorTraits::destroy(Allocator_, Keys_ + (position - 1));
+        }
+    }
+    TAllocatorTraits::deallocate(Allocator_, Keys_, Size_);
+    Keys_ = nullptr;
+    Size_ = 0;
+}
+
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+FrozenSet<TValueType, TCompare, TAllocator> TAATree<TValueType, TCompare, TAllocator, TTraits>::freeze() const {
+    static_assert(IsPlainSet, "freeze() needs a Set");
+    return FrozenSet<TValueType, TCompare, TAllocator>(Sorted, begin(), end(), Compare_, TAllocator(Allocator_));
+}
+
+//----------------TFrozenIterator----------------
+
+template<class TFrozenSet>
+class TFrozenIterator {
+public:
+    using iterator_category = std::bidirectional_iterator_tag;
+    using value_type = typename TFrozenSet::value_type;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const value_type*;
+    using reference = const value_type&;
+
+    TFrozenIterator() = default;
+
+    TFrozenIterator(const TFrozenSet* set, size_t position) : Set_(set), Position_(position) {
+    }
+
+    friend TFrozenSet;
+
+    TFrozenIterator& operator++();
+    const TFrozenIterator operator++(int);
+
+    TFrozenIterator& operator--();
+    const TFrozenIterator operator--(int);
+
+    inline const value_type& operator*() const;
+    inline const value_type* operator->() const;
+
+    inline bool operator==(const TFrozenIterator& iter) const;
+    inline bool operator!=(const TFrozenIterator& iter) const;
+
+private:
+    const TFrozenSet* Set_ = nullptr;
+    // Position in the layout counted from 1, 0 is end()
+    size_t Position_ = 0;
+};
+
+template<class TFrozenSet>
+TFrozenIterator<TFrozenSet>& TFrozenIterator<TFrozenSet>::operator++() {
+    Position_ = Set_->NextPosition(Position_);
+    return *this;
+}
+
+template<class TFrozenSet>
+const TFrozenIterator<TFrozenSet> TFrozenIterator<TFrozenSet>::operator++(int) {
+    TFrozenIterator<TFrozenSet> copy = *this;
+    ++*this;
+    return copy;
+}
+
+template<class TFrozenSet>
+TFrozenIterator<TFrozenSet>& TFrozenIterator<TFrozenSet>::operator--() {
+    Position_ = Set_->PreviousPosition(Position_);
+    return *this;
+}
+
+template<class TFrozenSet>
+const TFrozenIterator<TFrozenSet> TFrozenIterator<TFrozenSet>::operator--(int) {
+    TFrozenIterator<TFrozenSet> copy = *this;
+    --*this;
+    return copy;
+}
+
+template<class TFrozenSet>
+const typename TFrozenIterator<TFrozenSet>::value_type& TFrozenIterator<TFrozenSet>::operator*() const {
+    return Set_->Keys_[Position_ - 1];
+}
+
+template<class TFrozenSet>
+const typename TFrozenIterator<TFrozenSet>::value_type* TFrozenIterator<TFrozenSet>::operator->() const {
+    return &Set_->Keys_[Position_ - 1];
+}
+
+template<class TFrozenSet>
+bool TFrozenIterator<TFrozenSet>::operator==(const TFrozenIterator& iter) const {
+    return (Set_ == iter.Set_ && Position_ == iter.Position_);
+}
+
+template<class TFrozenSet>
+bool TFrozenIterator<TFrozenSet>::operator!=(const TFrozenIterator& iter) const {
+    return !(*this == iter);
+}
@@ -0,0 +1,157 @@
+/*
+ *      Summary: AA Tree maps: the Set core with key-value nodes
+ *         Date: 2022.01.30
+ *   Programmer: Kurdun Andrei
+ *   Code Style: Yandex
+ */
+#pragma once
+#include "Set.h"
+
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+// The key of a key-value pair
+struct TFirstKey {
+    template<class TValueType>
+    using TKeyType = std::remove_const_t<typename TValueType::first_type>;
+
+    template<class TValueType>
+    static const typename TValueType::first_type& Key(const TValueType& value) {
+        return value.first;
+    }
+};
+
+template<class TTraits>
+struct TMapKeyTraits : TTraits {
+    using TKeyOfValue = TFirstKey;
+};
+
+/*
+ *  Ordered map on the AA tree core: a node holds std::pair<const TKey, TMapped>, so one descent finds
+ *  both the key and its value. Rotations, pooled allocators, batches and the set algebra are those of Set;
+ *  the algebra compares keys only and keeps the value of the left operand.
+ */
+template<
+      class TKey
+    , class TMapped
+    , class TCompare = std::less<TKey>
+    , class TAllocator = std::allocator<std::pair<const TKey, TMapped>>
+    , class TTraits = TDefaultSetTraits
+>
+class Map : public TAATree<std::pair<const TKey, TMapped>, TCompare, TAllocator, TMapKeyTraits<TTraits>> {
+    using TBase = TAATree<std::pair<const TKey, TMapped>, TCompare, TAllocator, TMapKeyTraits<TTraits>>;
+
+public:
+    using mapped_type = TMapped;
+    using typename TBase::iterator;
+
+    using TBase::TBase;
+
+    Map() = default;
+
+    // The static operations of the core, such as join() and set_union(), return the core type
+    Map(TBase&& tree) : TBase(std::move(tree)) {
+    }
+
+    // The mapped value is built from args only when the key is missing
+    template<class... TArgs>
+    std::pair<iterator, bool> try_emplace(const TKey& key, TArgs&&... args);
+    template<class... TArgs>
+    std::pair<iterator, bool> try_emplace(TKey&& key, TArgs&&... args);
+    template<class TValue>
+    std::pair<iterator, bool> insert_or_assign(const TKey& key, TValue&& value);
+    template<class TValue>
+    std::pair<iterator, bool> insert_or_assign(TKey&& key, TValue&& value);
+
+    // Value-initializes a missing mapped value
+    TMapped& operator[](const TKey& key);
+    TMapped& operator[](TKey&& key);
+    // Throws std::out_of_range for a missing key
+    TMapped& at(const TKey& key);
+    const TMapped& at(const TKey& key) const;
+};
+
+// Ordered multimap: equal keys keep their insertion order
+template<
+      class TKey
+    , class TMapped
+    , class TCompare = std::less<TKey>
+    , class TAllocator = std::allocator<std::pair<const TKey, TMapped>>
+    , class TTraits = TDefaultSetTraits
+>
+using MultiMap = TAATree<std::pair<const TKey, TMapped>, TCompare, TAllocator, TMultiKeyTraits<TMapKeyTraits<TTraits>>>;
+
+template<class TKey, class TMapped, class TCompare, class TAllocator, class TTraits>
+template<class... TArgs>
+std::pair<typename Map<TKey, TMapped, TCompare, TAllocator, TTraits>::iterator, bool> Map<TKey, TMapped, TCompare, TAllocator, TTraits>::try_emplace(
+      const TKey& key
+    , TArgs&&... args
+) {
+    return this->TryEmplace(key, std::forward<TArgs>(args)...);
+}
+
+template<class TKey, class TMapped, class TCompare, class TAllocator, class TTraits>
+template<class... TArgs>
+std::pair<typename Map<TKey, TMapped, TCompare, TAllocator, TTraits>::iterator, bool> Map<TKey, TMapped, TCompare, TAllocator, TTraits>::try_emplace(
+      TKey&& key
+    , TArgs&&... args
+) {
+    return this->TryEmplace(std::move(key), std::forward<TArgs>(args)...);
+}
+
+template<class TKey, class TMapped, class TCompare, class TAllocator, class TTraits>
+template<class TValue>
+std::pair<typename Map<TKey, TMapped, TCompare, TAllocator, TTraits>::iterator, bool> Map<TKey, TMapped, TCompare, TAllocator, TTraits>::insert_or_assign(
+      const TKey& key
+    , TValue&& value
+) {
+    auto result = this->TryEmplace(key, std::forward<TValue>(value));
+    if (!result.second) {
+        result.first->second = std::forward<TValue>(value);
+    }
+    return result;
+}
+
+template<class TKey, class TMapped, class TCompare, class TAllocator, class TTraits>
+template<class TValue>
+std::pair<typename Map<TKey, TMapped, TCompare, TAllocator, TTraits>::iterator, bool> Map<TKey, TMapped, TCompare, TAllocator, TTraits>::insert_or_assign(
+      TKey&& key
+    , TValue&& value
+) {
+    auto result = this->TryEmplace(std::move(key), std::forward<TValue>(value));
+    if (!result.second) {
+        result.first->second = std::forward<TValue>(value);
+    }
+    return result;
+}
+
+template<class TKey, class TMapped, class TCompare, class TAllocator, class TTraits>
+TMapped& Map<TKey, TMapped, TCompare, TAllocator, TTraits>::operator[](const TKey& key) {
+    return this->TryEmplace(key).first->second;
+}
+
+template<class TKey, class TMapped, class TCompare, class TAllocator, class TTraits>
+TMapped& Map<TKey, TMapped, TCompare, TAllocator, TTraits>::operator[](TKey&& key) {
+    return this->TryEmplace(std::move(key)).first->second;
+}
+
+template<class TKey, class TMapped, class TCompare, class TAllocator, class TTraits>
+TMapped& Map<TKey, TMapped, TCompare, TAllocator, TTraits>::at(const TKey& key) {
+    iterator foundIterator = this->find(key);
+    if (foundIterator == this->end()) {
+        throw std::out_of_range("Map::at: missing key");
+    }
+    return foundIterator->second;
+}
+
+template<class TKey, class TMapped, class TCompare, class TAllocator, class TTraits>
+const TMapped& Map<TKey, TMapped, TCompare, TAllocator, TTraits>::at(const TKey& key) const {
+    iterator foundIterator = this->find(key);
+    if (foundIterator == this->end()) {
+        throw std::out_of_range("Map::at: missing key");
+    }
+    return foundIterator->second;
+}
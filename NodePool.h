@@ -0,0 +1,220 @@
+/*
+ *      Summary: Slab node pool and allocators for AA Tree
+ *         Date: 2022.01.30
+ *   Programmer: Kurdun Andrei
+ *   Code Style: Yandex
+ */
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <type_traits>
+
+// Slab storage for equally sized blocks.
+// Block size is fixed by the first single-object request; other sizes go to global new.
+// Not thread safe: a pool is meant to be owned by one container.
+class TSlabPool {
+public:
+    explicit TSlabPool(bool reuseFreedBlocks, size_t blocksPerSlab = 256)
+        : ReuseFreedBlocks_(reuseFreedBlocks)
+        , BlocksPerSlab_(blocksPerSlab == 0 ? 1 : blocksPerSlab)
+    {
+    }
+
+    TSlabPool(const TSlabPool&) = delete;
+    TSlabPool& operator=(const TSlabPool&) = delete;
+
+    ~TSlabPool();
+
+    inline void* Allocate(size_t blockSize, size_t blockAlign);
+    inline void Deallocate(void* block, size_t blockSize, size_t blockAlign) noexcept;
+
+    inline size_t SlabCount() const;
+
+private:
+    struct TFreeBlock {
+        TFreeBlock* Next;
+    };
+
+    struct TSlabHeader {
+        TSlabHeader* Next;
+    };
+
+    inline bool IsPoolBlock(size_t blockSize, size_t blockAlign) const;
+    inline void AllocateSlab();
+
+private:
+    bool ReuseFreedBlocks_ = true;
+    size_t BlocksPerSlab_ = 0;
+    size_t BlockSize_ = 0;
+    size_t BlockAlign_ = 0;
+    size_t HeaderSize_ = 0;
+    size_t SlabCount_ = 0;
+    TFreeBlock* FreeList_ = nullptr;
+    TSlabHeader* Slabs_ = nullptr;
+    char* Cursor_ = nullptr;
+    char* SlabEnd_ = nullptr;
+};
+
+inline TSlabPool::~TSlabPool() {
+    while (Slabs_ != nullptr) {
+        TSlabHeader* nextSlab = Slabs_->Next;
+        ::operator delete(static_cast<void*>(Slabs_), std::align_val_t(BlockAlign_));
+        Slabs_ = nextSlab;
+    }
+}
+
+void* TSlabPool::Allocate(size_t blockSize, size_t blockAlign) {
+    if (BlockSize_ == 0) {
+        BlockAlign_ = std::max(blockAlign, alignof(TFreeBlock));
+        BlockAlign_ = std::max(BlockAlign_, alignof(TSlabHeader));
+        BlockSize_ = std::max(blockSize, sizeof(TFreeBlock));
+        BlockSize_ = (BlockSize_ + BlockAlign_ - 1) / BlockAlign_ * BlockAlign_;
+        HeaderSize_ = (sizeof(TSlabHeader) + BlockAlign_ - 1) / BlockAlign_ * BlockAlign_;
+    }
+    if (!IsPoolBlock(blockSize, blockAlign)) {
+        return ::operator new(blockSize, std::align_val_t(blockAlign));
+    }
+    if (FreeList_ != nullptr) {
+        TFreeBlock* block = FreeList_;
+        FreeList_ = block->Next;
+        return block;
+    }
+    if (Cursor_ == SlabEnd_) {
+        AllocateSlab();
+    }
+    void* block = Cursor_;
+    Cursor_ += BlockSize_;
+    return block;
+}
+
+void TSlabPool::Deallocate(void* block, size_t blockSize, size_t blockAlign) noexcept {
+    if (!IsPoolBlock(blockSize, blockAlign)) {
+        ::operator delete(block, std::align_val_t(blockAlign));
+        return;
+    }
+    if (ReuseFreedBlocks_) {
+        auto* freeBlock = static_cast<TFreeBlock*>(block);
+        freeBlock->Next = FreeList_;
+        FreeList_ = freeBlock;
+    }
+}
+
+size_t TSlabPool::SlabCount() const {
+    return SlabCount_;
+}
+
+bool TSlabPool::IsPoolBlock(size_t blockSize, size_t blockAlign) const {
+    return (blockSize <= BlockSize_ && blockAlign <= BlockAlign_ && BlockSize_ - blockSize < BlockAlign_);
+}
+
+void TSlabPool::AllocateSlab() {
+    void* memory = ::operator new(HeaderSize_ + BlockSize_ * BlocksPerSlab_, std::align_val_t(BlockAlign_));
+    auto* slab = static_cast<TSlabHeader*>(memory);
+    slab->Next = Slabs_;
+    Slabs_ = slab;
+    ++SlabCount_;
+    Cursor_ = static_cast<char*>(memory) + HeaderSize_;
+    SlabEnd_ = Cursor_ + BlockSize_ * BlocksPerSlab_;
+}
+
+//----------------TPoolAllocator----------------
+
+// Std-compatible allocator backed by a shared TSlabPool.
+// Copies and rebinds share the pool; ReuseFreedBlocks selects free-list reuse or monotonic growth.
+template<class TValueType, bool ReuseFreedBlocks>
+class TBasicPoolAllocator {
+public:
+    using value_type = TValueType;
+    using propagate_on_container_copy_assignment = std::false_type;
+    using propagate_on_container_move_assignment = std::true_type;
+    using propagate_on_container_swap = std::true_type;
+    using is_always_equal = std::false_type;
+
+    template<class TOtherType>
+    struct rebind {
+        using other = TBasicPoolAllocator<TOtherType, ReuseFreedBlocks>;
+    };
+
+    TBasicPoolAllocator() : Pool_(std::make_shared<TSlabPool>(ReuseFreedBlocks)) {
+    }
+
+    explicit TBasicPoolAllocator(size_t blocksPerSlab)
+        : Pool_(std::make_shared<TSlabPool>(ReuseFreedBlocks, blocksPerSlab))
+    {
+    }
+
+    template<class TOtherType>
+    TBasicPoolAllocator(const TBasicPoolAllocator<TOtherType, ReuseFreedBlocks>& allocator) noexcept
+        : Pool_(allocator.Pool_)
+    {
+    }
+
+    TValueType* allocate(size_t count) {
+        if (count != 1) {
+            return static_cast<TValueType*>(::operator new(count * sizeof(TValueType), std::align_val_t(alignof(TValueType))));
+        }
+        return static_cast<TValueType*>(Pool_->Allocate(sizeof(TValueType), alignof(TValueType)));
+    }
+
+    void deallocate(TValueType* pointer, size_t count) noexcept {
+        if (count != 1) {
+            ::operator delete(static_cast<void*>(pointer), std::align_val_t(alignof(TValueType)));
+            return;
+        }
+        Pool_->Deallocate(pointer, sizeof(TValueType), alignof(TValueType));
+    }
+
+    // Every copy of a set gets a pool of its own
+    TBasicPoolAllocator select_on_container_copy_construction() const {
+        return TBasicPoolAllocator();
+    }
+
+    const TSlabPool& pool() const {
+        return *Pool_;
+    }
+
+    template<class TOtherType>
+    bool operator==(const TBasicPoolAllocator<TOtherType, ReuseFreedBlocks>& allocator) const noexcept {
+        return (Pool_ == allocator.Pool_);
+    }
+
+    template<class TOtherType>
+    bool operator!=(const TBasicPoolAllocator<TOtherType, ReuseFreedBlocks>& allocator) const noexcept {
+        return (Pool_ != allocator.Pool_);
+    }
+
+private:
+    template<class TOtherType, bool OtherReuseFreedBlocks>
+    friend class TBasicPoolAllocator;
+
+    std::shared_ptr<TSlabPool> Pool_;
+};
+
+// Free-list pool: erased nodes are handed out again by the next insertions
+template<class TValueType>
+using TPoolAllocator = TBasicPoolAllocator<TValueType, true>;
+
+// Monotonic arena: memory only grows and is released slab by slab when the last owner goes away
+template<class TValueType>
+using TArenaAllocator = TBasicPoolAllocator<TValueType, false>;
+
+// Allocators whose deallocate is a no-op, so a container may drop its nodes without visiting them
+template<class TAllocator>
+struct TIsMonotonicAllocator : std::false_type {
+};
+
+template<class TValueType>
+struct TIsMonotonicAllocator<TBasicPoolAllocator<TValueType, false>> : std::true_type {
+};
+
+// Allocators that may allocate and free from several threads at once, as parallel bulk operations do
+template<class TAllocator>
+struct TIsThreadSafeAllocator : std::false_type {
+};
+
+template<class TValueType>
+struct TIsThreadSafeAllocator<std::allocator<TValueType>> : std::true_type {
+};
@@ -0,0 +1,306 @@
+/*
+ *      Summary: Path-copying AA Tree core shared by PersistentSet and ConcurrentSet
+ *         Date: 2022.01.30
+ *   Programmer: Kurdun Andrei
+ *   Code Style: Yandex
+ */
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+/*
+ *  Updates never change a node reachable from an older root. An update gets a fresh Version_;
+ *  nodes stamped with it are its own and are changed in place, any other node on the search path
+ *  is copied first and handed to TDerived::OnReplaced(), where ConcurrentSet retires it and
+ *  PersistentSet leaves it to the reference counts. Every node allocated by the update is listed
+ *  in FreshNodes_ until the owner commits or calls DropFreshNodes().
+ *
+ *  TNodeType needs LeftNode, RightNode (pointers to const), Version, Level, Value and a constructor
+ *  taking std::in_place and the value arguments.
+ */
+template<class TNodeType, class TValueType, class TCompare, class TAllocator, class TDerived>
+class TPathCopyTree {
+protected:
+    using TNodeAllocator = typename std::allocator_traits<TAllocator>::template rebind_alloc<TNodeType>;
+    using TNodeAllocatorTraits = std::allocator_traits<TNodeAllocator>;
+
+    TPathCopyTree() = default;
+
+    TPathCopyTree(const TCompare& compare, const TAllocator& allocator)
+        : Compare_(compare)
+        , Allocator_(allocator)
+    {
+    }
+
+    inline const TNodeType* Find(const TNodeType* rootNode, const TValueType& wantedValue) const;
+    inline const TNodeType* LowerBound(const TNodeType* rootNode, const TValueType& wantedValue) const;
+
+    // Return the new root of the subtree, the flags tell whether anything changed at all
+    template<class TArg>
+    inline const TNodeType* Insert(const TNodeType* currentNode, TArg&& insertedValue, bool& isInserted);
+    inline const TNodeType* Erase(const TNodeType* currentNode, const TValueType& erasedValue, bool& isErased);
+
+    inline const TNodeType* Skew(const TNodeType* currentNode);
+    inline const TNodeType* Split(const TNodeType* currentNode);
+    inline void DecreaseLevel(TNodeType* currentNode);
+    inline TNodeType* Rebalance(TNodeType* currentNode);
+    static inline uint32_t LevelOf(const TNodeType* currentNode);
+
+    // Nodes created by the running update are changed in place, older ones are copied and replaced
+    inline TNodeType* Mutable(const TNodeType* currentNode);
+    template<class... TArgs>
+    inline TNodeType* CreateFreshNode(TArgs&&... args);
+    // Frees the nodes of a failed update, nothing else has seen them
+    inline void DropFreshNodes();
+    inline void DestroyNode(const TNodeType* currentNode);
+
+    TCompare Compare_;
+    TNodeAllocator Allocator_;
+
+    // State of the running update
+    uint64_t Version_ = 0;
+    std::vector<TNodeType*> FreshNodes_;
+};
+
+template<class TNodeType, class TValueType, class TCompare, class TAllocator, class TDerived>
+const TNodeType* TPathCopyTree<TNodeType, TValueType, TCompare, TAllocator, TDerived>::Find(
+      const TNodeType* rootNode
+    , const TValueType& wantedValue
+) const {
+    const TNodeType* currentNode = rootNode;
+    while (currentNode != nullptr) {
+        if (Compare_(wantedValue, currentNode->Value)) {
+            currentNode = currentNode->LeftNode;
+        } else if (Compare_(currentNode->Value, wantedValue)) {
+            currentNode = currentNode->RightNode;
+        } else {
+            return currentNode;
+        }
+    }
+    return nullptr;
+}
+
+template<class TNodeType, class TValueType, class TCompare, class TAllocator, class TDerived>
+const TNodeType* TPathCopyTree<TNodeType, TValueType, TCompare, TAllocator, TDerived>::LowerBound(
+      const TNodeType* rootNode
+    , const TValueType& wantedValue
+) const {
+    const TNodeType* resultNode = nullptr;
+    const TNodeType* currentNode = rootNode;
+    while (currentNode != nullptr) {
+        if (Compare_(currentNode->Value, wantedValue)) {
+            currentNode = currentNode->RightNode;
+        } else {
+            resultNode = currentNode;
+            currentNode = currentNode->LeftNode;
+        }
+    }
+    return resultNode;
+}
+
+// Nodes are copied on the way back up, so a present key copies nothing
+template<class TNodeType, class TValueType, class TCompare, class TAllocator, class TDerived>
+template<class TArg>
+const TNodeType* TPathCopyTree<TNodeType, TValueType, TCompare, TAllocator, TDerived>::Insert(
+      const TNodeType* currentNode
+    , TArg&& insertedValue
+    , bool& isInserted
+) {
+    if (currentNode == nullptr) {
+        isInserted = true;
+        return CreateFreshNode(std::forward<TArg>(insertedValue));
+    }
+    TNodeType* copiedNode = nullptr;
+    if (Compare_(insertedValue, currentNode->Value)) {
+        const TNodeType* leftNode = Insert(currentNode->LeftNode, std::forward<TArg>(insertedValue), isInserted);
+        if (!isInserted) {
+            return currentNode;
+        }
+        copiedNode = Mutable(currentNode);
+        copiedNode->LeftNode = leftNode;
+    } else if (Compare_(currentNode->Value, insertedValue)) {
+        const TNodeType* rightNode = Insert(currentNode->RightNode, std::forward<TArg>(insertedValue), isInserted);
+        if (!isInserted) {
+            return currentNode;
+        }
+        copiedNode = Mutable(currentNode);
+        copiedNode->RightNode = rightNode;
+    } else {
+        return currentNode;
+    }
+    return Split(Skew(copiedNode));
+}
+
+// An inner node takes over the value of its in-order neighbour, which is a leaf and is erased instead
+template<class TNodeType, class TValueType, class TCompare, class TAllocator, class TDerived>
+const TNodeType* TPathCopyTree<TNodeType, TValueType, TCompare, TAllocator, TDerived>::Erase(
+      const TNodeType* currentNode
+    , const TValueType& erasedValue
+    , bool& isErased
+) {
+    if (currentNode == nullptr) {
+        return nullptr;
+    }
+    TNodeType* copiedNode = nullptr;
+    if (Compare_(erasedValue, currentNode->Value)) {
+        const TNodeType* leftNode = Erase(currentNode->LeftNode, erasedValue, isErased);
+        if (!isErased) {
+            return currentNode;
+        }
+        copiedNode = Mutable(currentNode);
+        copiedNode->LeftNode = leftNode;
+    } else if (Compare_(currentNode->Value, erasedValue)) {
+        const TNodeType* rightNode = Erase(currentNode->RightNode, erasedValue, isErased);
+        if (!isErased) {
+            return currentNode;
+        }
+        copiedNode = Mutable(currentNode);
+        copiedNode->RightNode = rightNode;
+    } else if (currentNode->LeftNode == nullptr && currentNode->RightNode == nullptr) {
+        isErased = true;
+        static_cast<TDerived*>(this)->OnReplaced(currentNode);
+        return nullptr;
+    } else if (currentNode->LeftNode == nullptr) {
+        const TNodeType* successorNode = currentNode->RightNode;
+        while (successorNode->LeftNode != nullptr) {
+            successorNode = successorNode->LeftNode;
+        }
+        const TNodeType* rightNode = Erase(currentNode->RightNode, successorNode->Value, isErased);
+        copiedNode = Mutable(currentNode);
+        copiedNode->Value = successorNode->Value;
+        copiedNode->RightNode = rightNode;
+    } else {
+        const TNodeType* predecessorNode = currentNode->LeftNode;
+        while (predecessorNode->RightNode != nullptr) {
+            predecessorNode = predecessorNode->RightNode;
+        }
+        const TNodeType* leftNode = Erase(currentNode->LeftNode, predecessorNode->Value, isErased);
+        copiedNode = Mutable(currentNode);
+        copiedNode->Value = predecessorNode->Value;
+        copiedNode->LeftNode = leftNode;
+    }
+    return Rebalance(copiedNode);
+}
+
+// Skew and Split of Set.h, rotating copies instead of the shared nodes
+template<class TNodeType, class TValueType, class TCompare, class TAllocator, class TDerived>
+const TNodeType* TPathCopyTree<TNodeType, TValueType, TCompare, TAllocator, TDerived>::Skew(const TNodeType* currentNode) {
+    if (
+           currentNode == nullptr
+        || currentNode->LeftNode == nullptr
+        || currentNode->Level != currentNode->LeftNode->Level
+    ) {
+        return currentNode;
+    }
+    TNodeType* copiedNode = Mutable(currentNode);
+    TNodeType* leftNode = Mutable(currentNode->LeftNode);
+    copiedNode->LeftNode = leftNode->RightNode;
+    leftNode->RightNode = copiedNode;
+    return leftNode;
+}
+
+template<class TNodeType, class TValueType, class TCompare, class TAllocator, class TDerived>
+const TNodeType* TPathCopyTree<TNodeType, TValueType, TCompare, TAllocator, TDerived>::Split(const TNodeType* currentNode) {
+    if (
+           currentNode == nullptr
+        || currentNode->RightNode == nullptr
+        || currentNode->RightNode->RightNode == nullptr
+        || currentNode->Level != currentNode->RightNode->RightNode->Level
+    ) {
+        return currentNode;
+    }
+    TNodeType* copiedNode = Mutable(currentNode);
+    TNodeType* rightNode = Mutable(currentNode->RightNode);
+    copiedNode->RightNode = rightNode->LeftNode;
+    rightNode->LeftNode = copiedNode;
+    ++rightNode->Level;
+    return rightNode;
+}
+
+template<class TNodeType, class TValueType, class TCompare, class TAllocator, class TDerived>
+void TPathCopyTree<TNodeType, TValueType, TCompare, TAllocator, TDerived>::DecreaseLevel(TNodeType* currentNode) {
+    uint32_t expectedLevel = std::min(LevelOf(currentNode->LeftNode), LevelOf(currentNode->RightNode)) + 1;
+    if (expectedLevel < currentNode->Level) {
+        currentNode->Level = expectedLevel;
+        if (expectedLevel < LevelOf(currentNode->RightNode)) {
+            TNodeType* rightNode = Mutable(currentNode->RightNode);
+            rightNode->Level = expectedLevel;
+            currentNode->RightNode = rightNode;
+        }
+    }
+}
+
+// Same sequence as the erase of Set.h; a son is copied only when its link really changes
+template<class TNodeType, class TValueType, class TCompare, class TAllocator, class TDerived>
+TNodeType* TPathCopyTree<TNodeType, TValueType, TCompare, TAllocator, TDerived>::Rebalance(TNodeType* currentNode) {
+    DecreaseLevel(currentNode);
+    currentNode = Mutable(Skew(currentNode));
+    currentNode->RightNode = Skew(currentNode->RightNode);
+    if (currentNode->RightNode != nullptr) {
+        const TNodeType* rightRightNode = Skew(currentNode->RightNode->RightNode);
+        if (rightRightNode != currentNode->RightNode->RightNode) {
+            TNodeType* rightNode = Mutable(currentNode->RightNode);
+            rightNode->RightNode = rightRightNode;
+            currentNode->RightNode = rightNode;
+        }
+    }
+    currentNode = Mutable(Split(currentNode));
+    currentNode->RightNode = Split(currentNode->RightNode);
+    return currentNode;
+}
+
+template<class TNodeType, class TValueType, class TCompare, class TAllocator, class TDerived>
+uint32_t TPathCopyTree<TNodeType, TValueType, TCompare, TAllocator, TDerived>::LevelOf(const TNodeType* currentNode) {
+    return (currentNode != nullptr ? currentNode->Level : 0);
+}
+
+template<class TNodeType, class TValueType, class TCompare, class TAllocator, class TDerived>
+TNodeType* TPathCopyTree<TNodeType, TValueType, TCompare, TAllocator, TDerived>::Mutable(const TNodeType* currentNode) {
+    if (currentNode->Version == Version_) {
+        return const_cast<TNodeType*>(currentNode);
+    }
+    TNodeType* copiedNode = CreateFreshNode(currentNode->Value);
+    copiedNode->LeftNode = currentNode->LeftNode;
+    copiedNode->RightNode = currentNode->RightNode;
+    copiedNode->Level = currentNode->Level;
+    static_cast<TDerived*>(this)->OnReplaced(currentNode);
+    return copiedNode;
+}
+
+// The slot is reserved before the allocation, so a listed node is never lost
+template<class TNodeType, class TValueType, class TCompare, class TAllocator, class TDerived>
+template<class... TArgs>
+TNodeType* TPathCopyTree<TNodeType, TValueType, TCompare, TAllocator, TDerived>::CreateFreshNode(TArgs&&... args) {
+    FreshNodes_.push_back(nullptr);
+    TNodeType* currentNode = TNodeAllocatorTraits::allocate(Allocator_, 1);
+    try {
+        TNodeAllocatorTraits::construct(Allocator_, currentNode, std::in_place, std::forward<TArgs>(args)...);
+    } catch (...) {
+        TNodeAllocatorTraits::deallocate(Allocator_, currentNode, 1);
+        throw;
+    }
+    currentNode->Version = Version_;
+    FreshNodes_.back() = currentNode;
+    return currentNode;
+}
+
+template<class TNodeType, class TValueType, class TCompare, class TAllocator, class TDerived>
+void TPathCopyTree<TNodeType, TValueType, TCompare, TAllocator, TDerived>::DropFreshNodes() {
+    for (TNodeType* freshNode : FreshNodes_) {
+        if (freshNode != nullptr) {
+            DestroyNode(freshNode);
+        }
+    }
+    FreshNodes_.clear();
+}
+
+template<class TNodeType, class TValueType, class TCompare, class TAllocator, class TDerived>
+void TPathCopyTree<TNodeType, TValueType, TCompare, TAllocator, TDerived>::DestroyNode(const TNodeType* currentNode) {
+    TNodeType* destroyedNode = const_cast<TNodeType*>(currentNode);
+    TNodeAllocatorTraits::destroy(Allocator_, destroyedNode);
+    TNodeAllocatorTraits::deallocate(Allocator_, destroyedNode, 1);
+}
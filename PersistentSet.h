@@ -0,0 +1,360 @@
+/*
+ *      Summary: Persistent AA Tree with path copying
+ *         Date: 2022.01.30
+ *   Programmer: Kurdun Andrei
+ *   Code Style: Yandex
+ */
+#pragma once
+#include "PathCopyTree.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <initializer_list>
+#include <memory>
+#include <utility>
+#include <vector>
+
+template<class TValueType>
+struct TPersistentNode;
+
+/*
+ *  Every version is an immutable AA tree. insert() and erase() copy the search path and return a new
+ *  version sharing all untouched subtrees with the old one (see PathCopyTree.h), so copies and
+ *  snapshot() are O(1).
+ *  Nodes are reference counted by their parents and by the versions holding them as root.
+ *  Different threads may use different versions at once; the last one to drop a node frees it,
+ *  so the allocator must allow that. A single PersistentSet object is not synchronized.
+ */
+template<
+      class TValueType
+    , class TCompare = std::less<TValueType>
+    , class TAllocator = std::allocator<TValueType>
+>
+class PersistentSet
+    : private TPathCopyTree<TPersistentNode<TValueType>, TValueType, TCompare, TAllocator, PersistentSet<TValueType, TCompare, TAllocator>>
+{
+public:
+    using value_type = TValueType;
+    using key_compare = TCompare;
+    using allocator_type = TAllocator;
+
+    PersistentSet() = default;
+
+    explicit PersistentSet(const TCompare& compare, const TAllocator& allocator = TAllocator())
+        : TBase(compare, allocator)
+    {
+    }
+
+    PersistentSet(const PersistentSet& set)
+        : TBase(set.Compare_, TAllocator(set.Allocator_))
+        , Root_(Acquire(set.Root_))
+        , Size_(set.Size_)
+    {
+    }
+
+    PersistentSet(PersistentSet&& set) noexcept
+        : TBase(set.Compare_, TAllocator(set.Allocator_))
+        , Root_(std::exchange(set.Root_, nullptr))
+        , Size_(std::exchange(set.Size_, 0))
+    {
+    }
+
+    ~PersistentSet() {
+        Release(Root_);
+    }
+
+    // Nodes are shared only with a set whose allocator can free them, as in Set the elements are
+    // copied otherwise
+    PersistentSet& operator=(const PersistentSet& set);
+    PersistentSet& operator=(PersistentSet&& set) noexcept(
+           TNodeAllocatorTraits::propagate_on_container_move_assignment::value
+        || TNodeAllocatorTraits::is_always_equal::value
+    );
+
+    // The current version, it stays valid whatever happens to this object later
+    inline PersistentSet snapshot() const;
+
+    inline size_t size() const;
+    inline bool empty() const;
+
+    inline TAllocator get_allocator() const;
+
+    // Pointers stay valid as long as some version holds the node
+    const TValueType* find(const TValueType& wantedValue) const;
+    const TValueType* lower_bound(const TValueType& wantedValue) const;
+    bool contains(const TValueType& wantedValue) const;
+
+    // In-order visit of every element
+    template<class TFunction>
+    void for_each(TFunction&& function) const;
+
+    // O(log n) new nodes each; a missing or present key returns a copy of this version.
+    // A throwing copy or allocation leaves no trace
+    [[nodiscard]] PersistentSet insert(const TValueType& insertedValue) const;
+    [[nodiscard]] PersistentSet erase(const TValueType& erasedValue) const;
+
+private:
+    using TNodeType = TPersistentNode<TValueType>;
+    using TBase = TPathCopyTree<TNodeType, TValueType, TCompare, TAllocator, PersistentSet>;
+    using TNodeAllocatorTraits = typename TBase::TNodeAllocatorTraits;
+    friend TBase;
+
+    using TBase::Compare_;
+    using TBase::Allocator_;
+    using TBase::Version_;
+    using TBase::FreshNodes_;
+    using TBase::Insert;
+    using TBase::Erase;
+    using TBase::Find;
+    using TBase::LowerBound;
+    using TBase::DropFreshNodes;
+    using TBase::DestroyNode;
+
+    // Hook of TPathCopyTree: the old version keeps its references, new ones are counted by Commit()
+    inline void OnReplaced(const TNodeType*) {
+    }
+
+    // Runs one path-copying update on a new version, an update that changes nothing gives a copy of this one
+    template<class TUpdate>
+    inline PersistentSet Update(TUpdate&& update, size_t changedSize) const;
+    inline void Commit(const TNodeType* rootNode, size_t size);
+    inline void CopyElements(const PersistentSet& set);
+
+    template<class TFunction>
+    static inline void ForEach(const TNodeType* currentNode, TFunction& function);
+    static inline const TNodeType* Acquire(const TNodeType* currentNode);
+    inline void Release(const TNodeType* currentNode);
+
+private:
+    // Updates are told apart across all versions, so a stamp is fresh only for its own update
+    static inline std::atomic<uint64_t> LastVersion_ = 0;
+    // Lent to the running update as its FreshNodes_, so the list keeps its capacity from one version to the next
+    static inline thread_local std::vector<TNodeType*> FreshNodesBuffer_;
+
+    const TNodeType* Root_ = nullptr;
+    size_t Size_ = 0;
+};
+
+template<class TValueType, class TCompare, class TAllocator>
+PersistentSet<TValueType, TCompare, TAllocator>& PersistentSet<TValueType, TCompare, TAllocator>::operator=(const PersistentSet& set) {
+    if (this == &set) {
+        return *this;
+    }
+    if constexpr (!TNodeAllocatorTraits::propagate_on_container_copy_assignment::value && !TNodeAllocatorTraits::is_always_equal::value) {
+        if (Allocator_ != set.Allocator_) {
+            CopyElements(set);
+            return *this;
+        }
+    }
+    const TNodeType* rootNode = Acquire(set.Root_);
+    Release(Root_);
+    Root_ = rootNode;
+    Size_ = set.Size_;
+    Compare_ = set.Compare_;
+    if constexpr (TNodeAllocatorTraits::propagate_on_container_copy_assignment::value) {
+        Allocator_ = set.Allocator_;
+    }
+    return *this;
+}
+
+template<class TValueType, class TCompare, class TAllocator>
+PersistentSet<TValueType, TCompare, TAllocator>& PersistentSet<TValueType, TCompare, TAllocator>::operator=(PersistentSet&& set) noexcept(
+       TNodeAllocatorTraits::propagate_on_container_move_assignment::value
+    || TNodeAllocatorTraits::is_always_equal::value
+) {
+    if (this == &set) {
+        return *this;
+    }
+    if constexpr (!TNodeAllocatorTraits::propagate_on_container_move_assignment::value && !TNodeAllocatorTraits::is_always_equal::value) {
+        if (Allocator_ != set.Allocator_) {
+            CopyElements(set);
+            return *this;
+        }
+    }
+    Release(Root_);
+    Root_ = std::exchange(set.Root_, nullptr);
+    Size_ = std::exchange(set.Size_, 0);
+    Compare_ = set.Compare_;
+    if constexpr (TNodeAllocatorTraits::propagate_on_container_move_assignment::value) {
+        Allocator_ = set.Allocator_;
+    }
+    return *this;
+}
+
+template<class TValueType, class TCompare, class TAllocator>
+PersistentSet<TValueType, TCompare, TAllocator> PersistentSet<TValueType, TCompare, TAllocator>::snapshot() const {
+    return *this;
+}
+
+template<class TValueType, class TCompare, class TAllocator>
+size_t PersistentSet<TValueType, TCompare, TAllocator>::size() const {
+    return Size_;
+}
+
+template<class TValueType, class TCompare, class TAllocator>
+bool PersistentSet<TValueType, TCompare, TAllocator>::empty() const {
+    return (Size_ == 0);
+}
+
+template<class TValueType, class TCompare, class TAllocator>
+TAllocator PersistentSet<TValueType, TCompare, TAllocator>::get_allocator() const {
+    return TAllocator(Allocator_);
+}
+
+template<class TValueType, class TCompare, class TAllocator>
+const TValueType* PersistentSet<TValueType, TCompare, TAllocator>::find(const TValueType& wantedValue) const {
+    const TNodeType* foundNode = Find(Root_, wantedValue);
+    return (foundNode != nullptr ? &foundNode->Value : nullptr);
+}
+
+template<class TValueType, class TCompare, class TAllocator>
+const TValueType* PersistentSet<TValueType, TCompare, TAllocator>::lower_bound(const TValueType& wantedValue) const {
+    const TNodeType* resultNode = LowerBound(Root_, wantedValue);
+    return (resultNode != nullptr ? &resultNode->Value : nullptr);
+}
+
+template<class TValueType, class TCompare, class TAllocator>
+bool PersistentSet<TValueType, TCompare, TAllocator>::contains(const TValueType& wantedValue) const {
+    return (Find(Root_, wantedValue) != nullptr);
+}
+
+template<class TValueType, class TCompare, class TAllocator>
+template<class TFunction>
+void PersistentSet<TValueType, TCompare, TAllocator>::for_each(TFunction&& function) const {
+    ForEach(Root_, function);
+}
+
+template<class TValueType, class TCompare, class TAllocator>
+PersistentSet<TValueType, TCompare, TAllocator> PersistentSet<TValueType, TCompare, TAllocator>::insert(
+    const TValueType& insertedValue
+) const {
+    return Update([this, &insertedValue](PersistentSet& resultSet, bool& isInserted) {
+        return resultSet.Insert(Root_, insertedValue, isInserted);
+    }, Size_ + 1);
+}
+
+template<class TValueType, class TCompare, class TAllocator>
+PersistentSet<TValueType, TCompare, TAllocator> PersistentSet<TValueType, TCompare, TAllocator>::erase(
+    const TValueType& erasedValue
+) const {
+    return Update([this, &erasedValue](PersistentSet& resultSet, bool& isErased) {
+        return resultSet.Erase(Root_, erasedValue, isErased);
+    }, Size_ - 1);
+}
+
+// The descent itself finds out whether the key is there: a present key for insert() or a missing one
+// for erase() copies no node, so no separate search is made first
+template<class TValueType, class TCompare, class TAllocator>
+template<class TUpdate>
+PersistentSet<TValueType, TCompare, TAllocator> PersistentSet<TValueType, TCompare, TAllocator>::Update(
+      TUpdate&& update
+    , size_t changedSize
+) const {
+    PersistentSet resultSet(Compare_, TAllocator(Allocator_));
+    resultSet.Version_ = ++LastVersion_;
+    resultSet.FreshNodes_.swap(FreshNodesBuffer_);
+    const TNodeType* rootNode = nullptr;
+    bool isChanged = false;
+    try {
+        rootNode = update(resultSet, isChanged);
+    } catch (...) {
+        resultSet.DropFreshNodes();
+        resultSet.FreshNodes_.swap(FreshNodesBuffer_);
+        throw;
+    }
+    if (isChanged) {
+        resultSet.Commit(rootNode, changedSize);
+    }
+    resultSet.FreshNodes_.swap(FreshNodesBuffer_);
+    if (!isChanged) {
+        resultSet = *this;
+    }
+    return resultSet;
+}
+
+/*
+ *  References are only counted once the new version is complete: every fresh node is held by its
+ *  single fresh parent or by the root, every shared son of a fresh node gains one reference.
+ *  Nothing of the old version is touched before, so an exception just drops the fresh nodes.
+ */
+template<class TValueType, class TCompare, class TAllocator>
+void PersistentSet<TValueType, TCompare, TAllocator>::Commit(const TNodeType* rootNode, size_t size) {
+    for (TNodeType* freshNode : FreshNodes_) {
+        for (const TNodeType* sonNode : {freshNode->LeftNode, freshNode->RightNode}) {
+            if (sonNode != nullptr && sonNode->Version != Version_) {
+                Acquire(sonNode);
+            }
+        }
+    }
+    if (rootNode != nullptr && rootNode->Version != Version_) {
+        Acquire(rootNode);
+    }
+    FreshNodes_.clear();
+    Root_ = rootNode;
+    Size_ = size;
+}
+
+// The elements of a set whose nodes this allocator cannot free go into fresh nodes; a throw changes nothing
+template<class TValueType, class TCompare, class TAllocator>
+void PersistentSet<TValueType, TCompare, TAllocator>::CopyElements(const PersistentSet& set) {
+    PersistentSet copiedSet(set.Compare_, TAllocator(Allocator_));
+    set.for_each([&copiedSet](const TValueType& value) {
+        copiedSet = copiedSet.insert(value);
+    });
+    Release(Root_);
+    Root_ = std::exchange(copiedSet.Root_, nullptr);
+    Size_ = std::exchange(copiedSet.Size_, 0);
+    Compare_ = set.Compare_;
+}
+
+template<class TValueType, class TCompare, class TAllocator>
+template<class TFunction>
+void PersistentSet<TValueType, TCompare, TAllocator>::ForEach(const TNodeType* currentNode, TFunction& function) {
+    if (currentNode == nullptr) {
+        return;
+    }
+    ForEach(currentNode->LeftNode, function);
+    function(currentNode->Value);
+    ForEach(currentNode->RightNode, function);
+}
+
+template<class TValueType, class TCompare, class TAllocator>
+const typename PersistentSet<TValueType, TCompare, TAllocator>::TNodeType* PersistentSet<TValueType, TCompare, TAllocator>::Acquire(
+    const TNodeType* currentNode
+) {
+    if (currentNode != nullptr) {
+        currentNode->ReferenceCount.fetch_add(1, std::memory_order_relaxed);
+    }
+    return currentNode;
+}
+
+// The sons of a freed node lose a reference in turn; the recursion is bounded by the height
+template<class TValueType, class TCompare, class TAllocator>
+void PersistentSet<TValueType, TCompare, TAllocator>::Release(const TNodeType* currentNode) {
+    if (currentNode == nullptr || currentNode->ReferenceCount.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+        return;
+    }
+    Release(currentNode->LeftNode);
+    Release(currentNode->RightNode);
+    DestroyNode(currentNode);
+}
+
+//----------------TPersistentNode----------------
+
+template<class TValueType>
+struct TPersistentNode {
+    template<class... TArgs>
+    explicit TPersistentNode(std::in_place_t, TArgs&&... args) : Value(std::forward<TArgs>(args)...) {
+    }
+
+    const TPersistentNode* LeftNode = nullptr;
+    const TPersistentNode* RightNode = nullptr;
+    // The update that created the node, it may change the node in place until it is committed
+    uint64_t Version = 0;
+    mutable std::atomic<uint32_t> ReferenceCount = 1;
+    uint32_t Level = 1;
+    TValueType Value;
+};
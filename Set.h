@@ -5,54 +5,205 @@
  *   Code Style: Yandex
  */
 #pragma once
+#include "NodePool.h"
+#include "SetStats.h"
+#include "ThreadPool.h"
+
 #include <algorithm>
 #include <cstddef>
 #include <cstdint>
+#include <functional>
 #include <initializer_list>
+#include <iosfwd>
+#include <iterator>
+#include <memory>
+#include <optional>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// The whole value is the key
+struct TIdentityKey {
+    template<class TValueType>
+    using TKeyType = TValueType;
+
+    template<class TValueType>
+    static const TValueType& Key(const TValueType& value) {
+        return value;
+    }
+};
+
+// Compile-time knobs of Set: derive from it and override only what is needed
+struct TDefaultSetTraits {
+    // Keep subtree sizes in the nodes for rank(), nth_element() and count_range()
+    static constexpr bool CountSubtreeSize = false;
+    // Operation counters behind stats(), see SetStats.h
+    using TStats = TNoSetStats;
+    // Set by MultiSet, Map and MultiMap on top of the traits they are given
+    static constexpr bool IsMulti = false;
+    using TKeyOfValue = TIdentityKey;
+    // erase() only marks the node dead, see compact(); not together with CountSubtreeSize
+    static constexpr bool LazyErase = false;
+    // Share of dead nodes after which erase() compacts the tree, 100 leaves it to compact() alone
+    static constexpr uint32_t MaxTombstonePercent = 25;
+};
+
+struct TOrderStatisticsTraits : TDefaultSetTraits {
+    static constexpr bool CountSubtreeSize = true;
+};
+
+struct TInstrumentedSetTraits : TDefaultSetTraits {
+    using TStats = TSetStats;
+};
+
+struct TLazyEraseSetTraits : TDefaultSetTraits {
+    static constexpr bool LazyErase = true;
+};
+
+// Equal keys are kept, each insertion goes after the equal keys already present
+template<class TTraits>
+struct TMultiKeyTraits : TTraits {
+    static constexpr bool IsMulti = true;
+};
 
-template<class TValueType>
+template<class TValueType, class TTraits = TDefaultSetTraits, bool LazyErase = TTraits::LazyErase>
 struct TNode;
-template<class TValueType>
+template<class TSet>
 class TIterator;
+template<class TSet>
+class TNodeHandle;
+template<class TValueType, class TCompare, class TAllocator>
+class FrozenSet;
+
+// Marks input that is already sorted by the set comparator; equal neighbours are collapsed unless keys may repeat
+struct TSorted {
+};
+
+inline constexpr TSorted Sorted{};
 
-// Set_ based on AA tree structure
-template<class TValueType>
-class Set {
+/*
+ *  AA tree core behind Set, MultiSet, Map and MultiMap. Nodes hold whole values and are ordered by
+ *  TTraits::TKeyOfValue::Key(value); with TTraits::IsMulti equal keys may repeat. The join-based
+ *  set algebra and the batch operations need unique keys.
+ */
+template<
+      class TValueType
+    , class TCompare = std::less<TValueType>
+    , class TAllocator = std::allocator<TValueType>
+    , class TTraits = TDefaultSetTraits
+>
+class TAATree {
 public:
-    Set() = default;
+    using key_type = typename TTraits::TKeyOfValue::template TKeyType<TValueType>;
+    using value_type = TValueType;
+    using key_compare = TCompare;
+    using allocator_type = TAllocator;
+    using iterator = TIterator<TAATree>;
+    using node_type = TNodeHandle<TAATree>;
+
+    static_assert(!(TTraits::LazyErase && TTraits::CountSubtreeSize), "Subtree sizes would count the dead nodes");
+    static_assert(TTraits::MaxTombstonePercent > 0 && TTraits::MaxTombstonePercent <= 100, "MaxTombstonePercent is a percentage");
+
+    struct insert_return_type {
+        iterator position;
+        bool inserted = false;
+        // The rejected node when an equal key is present, empty otherwise
+        node_type node;
+    };
+
+    TAATree() = default;
+
+    explicit TAATree(const TCompare& compare, const TAllocator& allocator = TAllocator())
+        : Compare_(compare)
+        , Allocator_(allocator)
+    {
+    }
 
-    Set(const Set& set) {
-        for(const auto& currentValue : set) {
-            insert(currentValue);
-        }
+    explicit TAATree(const TAllocator& allocator) : Allocator_(allocator) {
     }
 
-    Set(const std::initializer_list<TValueType>& initializerList) {
-        for (const auto& currentValue : initializerList) {
-            Root_ = Insert(Root_, currentValue);
-        }
+    TAATree(const TAATree& set)
+        : Compare_(set.Compare_)
+        , Allocator_(TNodeAllocatorTraits::select_on_container_copy_construction(set.Allocator_))
+    {
+        Root_ = CloneTree(set.Root_, nullptr);
+        Size_ = set.Size_;
+        DeadCount_ = set.DeadCount_;
+        ResetExtremes();
+    }
+
+    // Steals the tree; the allocator is copied so that the source stays usable
+    TAATree(TAATree&& set) noexcept
+        : Root_(std::exchange(set.Root_, nullptr))
+        , Size_(std::exchange(set.Size_, 0))
+        , DeadCount_(std::exchange(set.DeadCount_, 0))
+        , Leftmost_(std::exchange(set.Leftmost_, nullptr))
+        , Rightmost_(std::exchange(set.Rightmost_, nullptr))
+        , Compare_(set.Compare_)
+        , Allocator_(set.Allocator_)
+    {
+    }
+
+    TAATree(
+          const std::initializer_list<TValueType>& initializerList
+        , const TCompare& compare = TCompare()
+        , const TAllocator& allocator = TAllocator()
+    )
+        : Compare_(compare)
+        , Allocator_(allocator)
+    {
+        Assign(initializerList.begin(), initializerList.end());
     }
 
+    // Sorted forward ranges are detected and built in O(n), anything else is inserted one by one
     template<typename Iterator>
-    Set(Iterator first, Iterator last) {
-        while (first != last) {
-            Root_ = Insert(Root_, *first);
-            ++first;
-        }
+    TAATree(Iterator first, Iterator last, const TCompare& compare = TCompare(), const TAllocator& allocator = TAllocator())
+        : Compare_(compare)
+        , Allocator_(allocator)
+    {
+        Assign(first, last);
     }
 
-    ~Set() {
-        if (Root_ != nullptr) {
-            Root_->Clear();
-        }
+    template<typename Iterator>
+    TAATree(
+          TSorted
+        , Iterator first
+        , Iterator last
+        , const TCompare& compare = TCompare()
+        , const TAllocator& allocator = TAllocator()
+    )
+        : Compare_(compare)
+        , Allocator_(allocator)
+    {
+        BuildSorted(first, last);
     }
 
-    Set& operator=(const Set& set);
+    ~TAATree() {
+        DestroyTree(Root_);
+    }
+
+    TAATree& operator=(const TAATree& set);
+    TAATree& operator=(TAATree&& set) noexcept(
+           TNodeAllocatorTraits::propagate_on_container_move_assignment::value
+        || TNodeAllocatorTraits::is_always_equal::value
+    );
+
+    void swap(TAATree& set) noexcept(
+           TNodeAllocatorTraits::is_always_equal::value
+        && std::is_nothrow_swappable_v<TCompare>
+    );
 
-    using iterator = TIterator<TValueType>;
+    template<typename Iterator>
+    static TAATree from_sorted(
+          Iterator first
+        , Iterator last
+        , const TCompare& compare = TCompare()
+        , const TAllocator& allocator = TAllocator()
+    );
 
-    friend struct TNode<TValueType>;
-    friend class TIterator<TValueType>;
+    friend class TIterator<TAATree>;
+    friend class TNodeHandle<TAATree>;
 
     inline size_t size() const;
     inline bool empty() const;
@@ -60,400 +211,3006 @@ public:
     iterator begin() const;
     iterator end() const;
 
-    iterator lower_bound(const TValueType& wantedValue) const;
-    iterator find(const TValueType& wantedValue) const;
-
-    void insert(const TValueType& insertedValue);
-    void erase(const TValueType& erasedValue);
+    // O(1) access to the extremes, the set must not be empty
+    inline const TValueType& min() const;
+    inline const TValueType& max() const;
+    TValueType pop_min();
+    TValueType pop_max();
+
+    iterator lower_bound(const key_type& wantedKey) const;
+    iterator upper_bound(const key_type& wantedKey) const;
+    iterator find(const key_type& wantedKey) const;
+    bool contains(const key_type& wantedKey) const;
+
+    // Heterogeneous lookup: any key type is accepted when TCompare declares is_transparent
+    template<class TKey, class TKeyCompare = TCompare, class = typename TKeyCompare::is_transparent>
+    iterator lower_bound(const TKey& wantedKey) const;
+    template<class TKey, class TKeyCompare = TCompare, class = typename TKeyCompare::is_transparent>
+    iterator upper_bound(const TKey& wantedKey) const;
+    template<class TKey, class TKeyCompare = TCompare, class = typename TKeyCompare::is_transparent>
+    iterator find(const TKey& wantedKey) const;
+    template<class TKey, class TKeyCompare = TCompare, class = typename TKeyCompare::is_transparent>
+    bool contains(const TKey& wantedKey) const;
+    size_t count(const key_type& wantedKey) const;
+    template<class TKey, class TKeyCompare = TCompare, class = typename TKeyCompare::is_transparent>
+    size_t count(const TKey& wantedKey) const;
+    std::pair<iterator, iterator> equal_range(const key_type& wantedKey) const;
+    template<class TKey, class TKeyCompare = TCompare, class = typename TKeyCompare::is_transparent>
+    std::pair<iterator, iterator> equal_range(const TKey& wantedKey) const;
+
+    // Finger search for correlated queries: the walk climbs from hint (end() starts at the maximum)
+    // only until the subtree around it covers wantedKey and descends from there. Close keys
+    // usually cost O(log d) for d elements between them; a neighbour across a high node costs
+    // a full climb, but a sweep that passes each hint to the next query pays O(1) amortized per step
+    iterator lower_bound(iterator hint, const key_type& wantedKey) const;
+    iterator find_from(iterator hint, const key_type& wantedKey) const;
+
+    // Write one iterator per key of the forward range. Up to BatchLookupWidth descents advance
+    // level by level together and prefetch their next nodes, so the cache misses overlap
+    template<class TKeyIterator, class TOutputIterator>
+    TOutputIterator find_batch(TKeyIterator first, TKeyIterator last, TOutputIterator out) const;
+    template<class TKeyIterator, class TOutputIterator>
+    TOutputIterator lower_bound_batch(TKeyIterator first, TKeyIterator last, TOutputIterator out) const;
+
+    // With TTraits::IsMulti the value is always inserted after its equal keys and the flag is always true
+    std::pair<iterator, bool> insert(const TValueType& insertedValue);
+    std::pair<iterator, bool> insert(TValueType&& insertedValue);
+    // Amortized O(1) when the value belongs right before hint
+    iterator insert(iterator hint, const TValueType& insertedValue);
+    iterator insert(iterator hint, TValueType&& insertedValue);
+    template<class... TArgs>
+    std::pair<iterator, bool> emplace(TArgs&&... args);
+    template<class... TArgs>
+    iterator emplace_hint(iterator hint, TArgs&&... args);
+
+    // Node handles move an element between sets without allocating or copying it,
+    // and let its key be changed in between. extract(key) takes the first element with the key.
+    // A node from a set with an unequal allocator is moved into a fresh node instead
+    node_type extract(iterator position);
+    node_type extract(const key_type& extractedKey);
+    insert_return_type insert(node_type&& node);
+    iterator insert(iterator hint, node_type&& node);
+
+    // Erases every element with the key
+    size_t erase(const key_type& erasedKey);
+    template<class TKey, class TKeyCompare = TCompare, class = typename TKeyCompare::is_transparent>
+    size_t erase(const TKey& erasedKey);
+    // Returns the element after the erased one; no comparisons are made
+    iterator erase(iterator position);
+    void clear();
+
+    // Range removal by split and join instead of one rebalancing per element: O(log n) plus freeing
+    // the k removed nodes, and plus counting them without TTraits::CountSubtreeSize.
+    // The key ranges are half-open, [lowerKey, upperKey); erase(first, last) makes no comparisons
+    iterator erase(iterator first, iterator last);
+    size_t erase_range(const key_type& lowerKey, const key_type& upperKey);
+    // Moves the elements of [lowerKey, upperKey) into the returned set
+    TAATree extract_range(const key_type& lowerKey, const key_type& upperKey);
+
+    // The batch is sorted when needed and applied in one pass: split across the subtrees when it is
+    // small, merged with the whole tree and rebuilt in O(n + m) when it is large compared to the set.
+    // Return the number of inserted or erased elements
+    template<typename Iterator>
+    size_t insert_batch(Iterator first, Iterator last);
+    template<typename Iterator>
+    size_t erase_batch(Iterator first, Iterator last);
+
+    // Join-based bulk operations. Nodes change owner instead of being copied when the allocators
+    // compare equal; with m <= n elements in the smaller input they take O(m log(n / m + 1)).
+    // Moves the elements not less than key into the returned set; O(log n) with
+    // TTraits::CountSubtreeSize, otherwise the returned part is also counted
+    TAATree split(const key_type& key);
+    // Every element of left must be less than every element of right; O(log n)
+    static TAATree join(TAATree&& left, TAATree&& right);
+    // Equal elements keep the node of the left operand
+    void merge_from(TAATree&& set);
+    static TAATree set_union(TAATree&& left, TAATree&& right);
+    static TAATree set_intersection(TAATree&& left, TAATree&& right);
+    static TAATree set_difference(TAATree&& left, TAATree&& right);
+
+    // Parallel forms: independent subtrees are handled by the pool. They run serially unless nodes
+    // may be allocated and freed from several threads at once, see TIsThreadSafeAllocator
+    template<typename Iterator>
+    static TAATree from_sorted(
+          TThreadPool& pool
+        , Iterator first
+        , Iterator last
+        , const TCompare& compare = TCompare()
+        , const TAllocator& allocator = TAllocator()
+    );
+    template<typename Iterator>
+    size_t insert_batch(TThreadPool& pool, Iterator first, Iterator last);
+    void merge_from(TThreadPool& pool, TAATree&& set);
+    static TAATree set_union(TThreadPool& pool, TAATree&& left, TAATree&& right);
+    static TAATree set_intersection(TThreadPool& pool, TAATree&& left, TAATree&& right);
+    static TAATree set_difference(TThreadPool& pool, TAATree&& left, TAATree&& right);
+    void clear(TThreadPool& pool);
+
+    // Order statistics, available with TTraits::CountSubtreeSize; all O(log n)
+    iterator nth_element(size_t index) const;
+    size_t rank(const key_type& wantedKey) const;
+    size_t count_range(const key_type& lowerKey, const key_type& upperKey) const;
+
+    // Read-only copy in one contiguous array, O(n); Set only, defined in FrozenSet.h
+    FrozenSet<TValueType, TCompare, TAllocator> freeze() const;
+
+    // Versioned binary file of the sorted keys for trivially copyable TValueType; Set only, defined in SetFile.h.
+    // load() checks the header and the order and builds the tree in O(n)
+    void save(std::ostream& out) const;
+    static TAATree load(std::istream& in, const TCompare& compare = TCompare(), const TAllocator& allocator = TAllocator());
+
+    /*
+     *  Tombstones of TTraits::LazyErase: erase() costs one descent with no rebalancing and no freeing.
+     *  Iterators and lookups step over dead nodes, and inserting a dead key again revives or drops its node.
+     *  begin(), min() and max() stay O(1): the first and the last live node move past each tombstone once.
+     *  compact() relinks the live nodes into a balanced tree in O(n), frees the dead ones and keeps
+     *  iterators to live elements valid. split(), join(), the set algebra and the batches compact first
+     */
+    void compact();
+    inline size_t tombstone_count() const;
+
+    // Counters of the operations made through this set, available with a counting TTraits::TStats
+    TSetStatistics stats() const;
+    void reset_stats();
+
+    // O(n) diagnostics without comparisons counted: validate() checks the AA level rules, the PreviousNode
+    // links, the size, the extremes, the subtree sizes and the order; shape_report() measures the tree
+    bool validate() const;
+    TSetShape shape_report() const;
+
+    inline TCompare key_comp() const;
+    inline TAllocator get_allocator() const;
 
 protected:
-    static inline TNode<TValueType>* Predecessor(TNode<TValueType>* currentNode);
-    static inline TNode<TValueType>* Successor(TNode<TValueType>* currentNode);
-    static inline bool IsLeaf(TNode<TValueType>* currentNode);
+    using TNodeType = TNode<TValueType, TTraits>;
+    using TNodeAllocator = typename std::allocator_traits<TAllocator>::template rebind_alloc<TNodeType>;
+    using TNodeAllocatorTraits = std::allocator_traits<TNodeAllocator>;
+
+    static inline TNodeType* Predecessor(TNodeType* currentNode);
+    static inline TNodeType* Successor(TNodeType* currentNode);
+    static inline TNodeType* NextInOrder(TNodeType* currentNode);
+    static inline TNodeType* PreviousInOrder(TNodeType* currentNode);
+    static inline bool IsLeaf(TNodeType* currentNode);
+
+    // One descent for Map::try_emplace: the node is built from the key and args only when the key is missing
+    template<class TKey, class... TArgs>
+    inline std::pair<iterator, bool> TryEmplace(TKey&& key, TArgs&&... args);
 
 private:
-    inline TNode<TValueType>* Insert(TNode<TValueType>* currentNode, const TValueType& insertedValue);
-    inline TNode<TValueType>* Erase(TNode<TValueType>* currentNode, const TValueType& erasedValue);
-    static inline TNode<TValueType>* Skew(TNode<TValueType>* currentNode);
-    static inline TNode<TValueType>* Split(TNode<TValueType>* currentNode);
-    static inline TNode<TValueType>* DecreaseLevel(TNode<TValueType>* currentNode);
+    using TStats = typename TTraits::TStats;
+
+    // Where a new leaf goes, or the node that already holds an equal value
+    struct TInsertPosition {
+        TNodeType* ParentNode = nullptr;
+        bool IsLeftSon = false;
+        TNodeType* EqualNode = nullptr;
+    };
+
+    template<class TKey>
+    inline TInsertPosition FindInsertPosition(const TKey& insertedKey) const;
+    template<class TKey>
+    inline TInsertPosition FindInsertPosition(TNodeType* hintNode, const TKey& insertedKey) const;
+    template<class TArg>
+    inline std::pair<TNodeType*, bool> Insert(const TInsertPosition& position, TArg&& insertedValue);
+    // hintNode points to the hinted node (nullptr inside means end()), nullptr means no hint
+    template<class... TArgs>
+    inline std::pair<TNodeType*, bool> Emplace(TNodeType* const* hintNode, TArgs&&... args);
+    // Leftmost_ and Rightmost_ are the first and the last live nodes; these are the nodes at the ends of the tree
+    inline TNodeType* FirstNode() const;
+    inline TNodeType* LastNode() const;
+    inline void ResetExtremes();
+    // A node that has just become live may be the new first or last live node
+    inline void ExtendExtremes(TNodeType* liveNode);
+    // Whether leftNode comes before rightNode in order, found through their lowest common ancestor
+    static inline bool IsBefore(const TNodeType* leftNode, const TNodeType* rightNode);
+    static inline bool IsDead(const TNodeType* currentNode);
+    // The node itself or the nearest live node after it (before it), nullptr when there is none
+    static inline TNodeType* NextLive(TNodeType* currentNode);
+    static inline TNodeType* PreviousLive(TNodeType* currentNode);
+    inline void MarkDead(TNodeType* erasedNode);
+    // Frees a dead node that holds the inserted key and finds the position again
+    template<class TKey>
+    inline void DropDeadEqual(TInsertPosition& position, const TKey& insertedKey);
+    inline void CompactIfNeeded();
+    // Makes the node of the handle a fresh leaf of this set's allocator and empties the handle
+    inline TNodeType* AdoptNode(node_type& node);
+    inline void LinkLeaf(TNodeType* insertedNode, TNodeType* previousNode, bool isLeftSon);
+    // Compare_ on the keys of values (anything else is taken as a key), seen through the statistics policy
+    template<class TLeft, class TRight>
+    inline bool Less(const TLeft& left, const TRight& right) const;
+    static inline const key_type& KeyOf(const TValueType& value);
+    template<class TKey>
+    static inline const TKey& KeyOf(const TKey& key);
+    inline auto CountingCompare() const;
+    template<class TKey>
+    inline TNodeType* LowerBound(const TKey& wantedKey) const;
+    template<class TKey>
+    inline TNodeType* LowerBound(TNodeType* fingerNode, const TKey& wantedKey) const;
+    template<class TKey>
+    inline TNodeType* UpperBound(const TKey& wantedKey) const;
+    template<class TKey>
+    inline TNodeType* Find(const TKey& wantedKey) const;
+    template<class TKey>
+    inline size_t Count(const TKey& wantedKey) const;
+    template<bool IsFind, class TKeyIterator, class TOutputIterator>
+    inline TOutputIterator LookupBatch(TKeyIterator first, TKeyIterator last, TOutputIterator out) const;
+    static inline void PrefetchNode(const TNodeType* currentNode);
+    template<class TKey>
+    inline size_t Erase(const TKey& erasedKey);
+    inline void UnlinkNode(TNodeType* erasedNode);
+    inline void ResetTree(TNodeType* rootNode, size_t size);
+    inline TNodeType* TakeTree(TAATree& set);
+    inline void ReplaceSon(TNodeType* parentNode, TNodeType* oldSon, TNodeType* newSon);
+    // Rebalancing only changes the nodes; it is const so that SplitTree can count it
+    inline TNodeType* Skew(TNodeType* currentNode) const;
+    inline TNodeType* Split(TNodeType* currentNode) const;
+    inline TNodeType* DecreaseLevel(TNodeType* currentNode) const;
+    static inline size_t SubtreeSize(const TNodeType* currentNode);
+    static inline void UpdateSubtreeSize(TNodeType* currentNode);
+
+    // A detached tree cut by a key: all of LessRoot < EqualNode < all of GreaterRoot
+    struct TSplitResult {
+        TNodeType* LessRoot = nullptr;
+        TNodeType* EqualNode = nullptr;
+        TNodeType* GreaterRoot = nullptr;
+    };
+
+    template<class TKey>
+    inline TSplitResult SplitTree(TNodeType* rootNode, const TKey& key) const;
+    inline TSplitResult SplitAtNode(TNodeType* splitNode) const;
+    inline TNodeType* CutRange(TNodeType* firstNode, TNodeType* lastNode, size_t& cutCount, size_t& cutDeadCount);
+    inline void MergeFrom(TAATree& set, TThreadPool* pool);
+    static inline TAATree Intersection(TAATree& left, TAATree& right, TThreadPool* pool);
+    static inline TAATree Difference(TAATree& left, TAATree& right, TThreadPool* pool);
+    inline TNodeType* UnionTrees(TNodeType* leftRoot, TNodeType* rightRoot, size_t& commonCount, TThreadPool* pool);
+    inline TNodeType* IntersectTrees(TNodeType* leftRoot, TNodeType* rightRoot, size_t& commonCount, TThreadPool* pool);
+    inline TNodeType* SubtractTrees(TNodeType* leftRoot, TNodeType* rightRoot, size_t& commonCount, TThreadPool* pool);
+    inline TNodeType* JoinTrees(TNodeType* leftRoot, TNodeType* middleNode, TNodeType* rightRoot) const;
+    inline TNodeType* ConcatTrees(TNodeType* leftRoot, TNodeType* rightRoot) const;
+    inline std::pair<TNodeType*, TNodeType*> SplitLast(TNodeType* rootNode) const;
+    static inline TNodeType* DetachNode(TNodeType* currentNode);
+    static inline uint32_t LevelOf(const TNodeType* currentNode);
+    static inline size_t CountNodes(TNodeType* rootNode);
+    template<class TVisitor>
+    inline bool VisitNodes(TVisitor&& visitor) const;
+
+    template<typename Iterator>
+    inline void Assign(Iterator first, Iterator last);
+    template<typename Iterator>
+    inline void BuildSorted(Iterator first, Iterator last, TThreadPool* pool = nullptr);
+    static inline TNodeType* LinkBalanced(TNodeType** nodes, size_t count, TNodeType* previousNode, TThreadPool* pool = nullptr);
+    template<typename Iterator>
+    inline void CreateNodes(Iterator first, Iterator last, std::vector<TNodeType*>& nodes, TThreadPool* pool);
+    template<typename Iterator>
+    inline size_t InsertBatch(Iterator first, Iterator last, TThreadPool* pool);
+    inline void CollectNodes(std::vector<TNodeType*>& nodes) const;
+    inline void RebuildFromNodes(std::vector<TNodeType*>& nodes, TThreadPool* pool = nullptr);
+    inline TNodeType* InsertSortedNodes(
+          TNodeType* rootNode
+        , TNodeType** first
+        , TNodeType** last
+        , size_t& insertedCount
+        , TThreadPool* pool
+    );
+    inline TNodeType* EraseSortedKeys(TNodeType* rootNode, const key_type* first, const key_type* last, size_t& erasedCount);
+    inline TNodeType* CloneTree(const TNodeType* sourceNode, TNodeType* previousNode);
+
+    template<class... TArgs>
+    inline TNodeType* CreateNode(TArgs&&... args);
+    inline void DestroyNode(TNodeType* currentNode);
+    inline void DestroyTree(TNodeType* currentNode);
+    inline void DestroyTree(TNodeType* currentNode, TThreadPool* pool);
+
+    // The pool, or nullptr when nodes cannot be allocated and freed concurrently
+    static inline TThreadPool* ParallelPool(TThreadPool& pool);
+    template<class TLeft, class TRight>
+    static inline void ForkJoin(TThreadPool* pool, bool isForked, TLeft&& left, TRight&& right);
 
 private:
-    TNode<TValueType>* Root_ = nullptr;
+    // Values that are their own unique keys, as freeze(), save() and load() expect
+    static constexpr bool IsPlainSet = (!TTraits::IsMulti && std::is_same_v<typename TTraits::TKeyOfValue, TIdentityKey>);
+    // Descents in flight in find_batch and lower_bound_batch
+    static constexpr size_t BatchLookupWidth = 16;
+    // A batch of at least Size_ / BatchRebuildRatio elements is merged with the whole tree
+    static constexpr size_t BatchRebuildRatio = 4;
+    // Parallel operations fork on subtrees of this level or more, that is of at least 2^level - 1 nodes
+    static constexpr uint32_t ParallelGrainLevel = 12;
+    static constexpr size_t ParallelGrainSize = (size_t(1) << ParallelGrainLevel) - 1;
+
+    TNodeType* Root_ = nullptr;
+    // Live elements only, the tree holds DeadCount_ more nodes
     size_t Size_ = 0;
+    size_t DeadCount_ = 0;
+    TNodeType* Leftmost_ = nullptr;
+    TNodeType* Rightmost_ = nullptr;
+    TCompare Compare_;
+    TNodeAllocator Allocator_;
+    // Empty unless TTraits asks for counters, which change under const lookups too
+    mutable TStats Stats_;
 };
 
-template<class TValueType>
-Set<TValueType>& Set<TValueType>::operator=(const Set& set) {
+template<
+      class TValueType
+    , class TCompare = std::less<TValueType>
+    , class TAllocator = std::allocator<TValueType>
+    , class TTraits = TDefaultSetTraits
+>
+using Set = TAATree<TValueType, TCompare, TAllocator, TTraits>;
+
+template<
+      class TValueType
+    , class TCompare = std::less<TValueType>
+    , class TAllocator = std::allocator<TValueType>
+    , class TTraits = TDefaultSetTraits
+>
+using MultiSet = TAATree<TValueType, TCompare, TAllocator, TMultiKeyTraits<TTraits>>;
+
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+TAATree<TValueType, TCompare, TAllocator, TTraits>& TAATree<TValueType, TCompare, TAllocator, TTraits>::operator=(const TAATree& set) {
+    if (this == &set) {
+        return *this;
+    }
+
+    clear();
+
+    Compare_ = set.Compare_;
+    if constexpr (TNodeAllocatorTraits::propagate_on_container_copy_assignment::value) {
+        Allocator_ = set.Allocator_;
+    }
+
+    Root_ = CloneTree(set.Root_, nullptr);
+    Size_ = set.Size_;
+    DeadCount_ = set.DeadCount_;
+    ResetExtremes();
+
+    return *this;
+}
+
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+TAATree<TValueType, TCompare, TAllocator, TTraits>& TAATree<TValueType, TCompare, TAllocator, TTraits>::operator=(TAATree&& set) noexcept(
+       TNodeAllocatorTraits::propagate_on_container_move_assignment::value
+    || TNodeAllocatorTraits::is_always_equal::value
+) {
     if (this == &set) {
         return *this;
     }
 
-    if(Root_ != nullptr) {
-        Root_->Clear();
-        Root_ = nullptr;
-        Size_ = 0;
+    clear();
+
+    Compare_ = set.Compare_;
+    if constexpr (TNodeAllocatorTraits::propagate_on_container_move_assignment::value) {
+        Allocator_ = set.Allocator_;
+    } else if (!TNodeAllocatorTraits::is_always_equal::value && Allocator_ != set.Allocator_) {
+        // Nodes of a foreign allocator cannot be adopted
+        Root_ = CloneTree(set.Root_, nullptr);
+        Size_ = set.Size_;
+        DeadCount_ = set.DeadCount_;
+        ResetExtremes();
+        return *this;
+    }
+
+    Root_ = std::exchange(set.Root_, nullptr);
+    Size_ = std::exchange(set.Size_, 0);
+    DeadCount_ = std::exchange(set.DeadCount_, 0);
+    Leftmost_ = std::exchange(set.Leftmost_, nullptr);
+    Rightmost_ = std::exchange(set.Rightmost_, nullptr);
+
+    return *this;
+}
+
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+void TAATree<TValueType, TCompare, TAllocator, TTraits>::swap(TAATree& set) noexcept(
+       TNodeAllocatorTraits::is_always_equal::value
+    && std::is_nothrow_swappable_v<TCompare>
+) {
+    using std::swap;
+    swap(Root_, set.Root_);
+    swap(Size_, set.Size_);
+    swap(DeadCount_, set.DeadCount_);
+    swap(Leftmost_, set.Leftmost_);
+    swap(Rightmost_, set.Rightmost_);
+    swap(Compare_, set.Compare_);
+    if constexpr (TNodeAllocatorTraits::propagate_on_container_swap::value) {
+        swap(Allocator_, set.Allocator_);
+    }
+}
+
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+inline void swap(TAATree<TValueType, TCompare, TAllocator, TTraits>& left, TAATree<TValueType, TCompare, TAllocator, TTraits>& right) noexcept(noexcept(left.swap(right))) {
+    left.swap(right);
+}
+
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+template<typename Iterator>
+TAATree<TValueType, TCompare, TAllocator, TTraits> TAATree<TValueType, TCompare, TAllocator, TTraits>::from_sorted(
+      Iterator first
+    , Iterator last
+    , const TCompare& compare
+    , const TAllocator& allocator
+) {
+    return TAATree(Sorted, first, last, compare, allocator);
+}
+
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+template<typename Iterator>
+TAATree<TValueType, TCompare, TAllocator, TTraits> TAATree<TValueType, TCompare, TAllocator, TTraits>::from_sorted(
+      TThreadPool& pool
+    , Iterator first
+    , Iterator last
+    , const TCompare& compare
+    , const TAllocator& allocator
+) {
+    TAATree resultSet(compare, allocator);
+    resultSet.BuildSorted(first, last, ParallelPool(pool));
+    return resultSet;
+}
+
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+size_t TAATree<TValueType, TCompare, TAllocator, TTraits>::size() const {
+    return Size_;
+}
+
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+bool TAATree<TValueType, TCompare, TAllocator, TTraits>::empty() const {
+    return (Size_ == 0);
+}
+
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+typename TAATree<TValueType, TCompare, TAllocator, TTraits>::iterator TAATree<TValueType, TCompare, TAllocator, TTraits>::begin() const {
+    return iterator(this, Leftmost_);
+}
+
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+typename TAATree<TValueType, TCompare, TAllocator, TTraits>::iterator TAATree<TValueType, TCompare, TAllocator, TTraits>::end() const {
+    return iterator(this);
+}
+
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+const TValueType& TAATree<TValueType, TCompare, TAllocator, TTraits>::min() const {
+    return Leftmost_->Value;
+}
+
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+const TValueType& TAATree<TValueType, TCompare, TAllocator, TTraits>::max() const {
+    return Rightmost_->Value;
+}
+
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+TValueType TAATree<TValueType, TCompare, TAllocator, TTraits>::pop_min() {
+    TNodeType* erasedNode = Leftmost_;
+    UnlinkNode(erasedNode);
+    TValueType erasedValue = std::move(erasedNode->Value);
+    DestroyNode(erasedNode);
+    return erasedValue;
+}
+
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+TValueType TAATree<TValueType, TCompare, TAllocator, TTraits>::pop_max() {
+    TNodeType* erasedNode = Rightmost_;
+    UnlinkNode(erasedNode);
+    TValueType erasedValue = std::move(erasedNode->Value);
+    DestroyNode(erasedNode);
+    return erasedValue;
+}
+
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+typename TAATree<TValueType, TCompare, TAllocator, TTraits>::iterator TAATree<TValueType, TCompare, TAllocator, TTraits>::lower_bound(
+    const key_type& wantedKey
+) const {
+    return iterator(this, LowerBound(wantedKey));
+}
+
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+template<class TKey, class TKeyCompare, class>
+typename TAATree<TValueType, TCompare, TAllocator, TTraits>::iterator TAATree<TValueType, TCompare, TAllocator, TTraits>::lower_bound(const TKey& wantedKey) const {
+    return iterator(this, LowerBound(wantedKey));
+}
+
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+typename TAATree<TValueType, TCompare, TAllocator, TTraits>::iterator TAATree<TValueType, TCompare, TAllocator, TTraits>::upper_bound(
+    const key_type& wantedKey
+) const {
+    return iterator(this, UpperBound(wantedKey));
+}
+
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+template<class TKey, class TKeyCompare, class>
+typename TAATree<TValueType, TCompare, TAllocator, TTraits>::iterator TAATree<TValueType, TCompare, TAllocator, TTraits>::upper_bound(const TKey& wantedKey) const {
+    return iterator(this, UpperBound(wantedKey));
+}
+
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+typename TAATree<TValueType, TCompare, TAllocator, TTraits>::iterator TAATree<TValueType, TCompare, TAllocator, TTraits>::find(
+    const key_type& wantedKey
+) const {
+    return iterator(this, Find(wantedKey));
+}
+
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+template<class TKey, class TKeyCompare, class>
+typename TAATree<TValueType, TCompare, TAllocator, TTraits>::iterator TAATree<TValueType, TCompare, TAllocator, TTraits>::find(const TKey& wantedKey) const {
+    return iterator(this, Find(wantedKey));
+}
+
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+bool TAATree<TValueType, TCompare, TAllocator, TTraits>::contains(
+    const key_type& wantedKey
+) const {
+    return (Find(wantedKey) != nullptr);
+}
+
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+template<class TKey, class TKeyCompare, class>
+bool TAATree<TValueType, TCompare, TAllocator, TTraits>::contains(const TKey& wantedKey) const {
+    return (Find(wantedKey) != nullptr);
+}
+
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+typename TAATree<TValueType, TCompare, TAllocator, TTraits>::iterator TAATree<TValueType, TCompare, TAllocator, TTraits>::lower_bound(
+      iterator hint
+    , const key_type& wantedKey
+) const {
+    return iterator(this, LowerBound(hint.IteratorNode_, wantedKey));
+}
+
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+typename TAATree<TValueType, TCompare, TAllocator, TTraits>::iterator TAATree<TValueType, TCompare, TAllocator, TTraits>::find_from(
+      iterator hint
+    , const key_type& wantedKey
+) const {
+    TNodeType* foundNode = LowerBound(hint.IteratorNode_, wantedKey);
+    if (foundNode != nullptr && Less(wantedKey, foundNode->Value)) {
+        foundNode = nullptr;
+    }
+    return iterator(this, foundNode);
+}
+
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+size_t TAATree<TValueType, TCompare, TAllocator, TTraits>::count(const key_type& wantedKey) const {
+    return Count(wantedKey);
+}
+
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+template<class TKey, class TKeyCompare, class>
+size_t TAATree<TValueType, TCompare, TAllocator, TTraits>::count(const TKey& wantedKey) const {
+    return Count(wantedKey);
+}
+
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+std::pair<typename TAATree<TValueType, TCompare, TAllocator, TTraits>::iterator, typename TAATree<TValueType, TCompare, TAllocator, TTraits>::iterator>
+TAATree<TValueType, TCompare, TAllocator, TTraits>::equal_range(const key_type& wantedKey) const {
+    return {iterator(this, LowerBound(wantedKey)), iterator(this, UpperBound(wantedKey))};
+}
+
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+template<class TKey, class TKeyCompare, class>
+std::pair<typename TAATree<TValueType, TCompare, TAllocator, TTraits>::iterator, typename TAATree<TValueType, TCompare, TAllocator, TTraits>::iterator>
+TAATree<TValueType, TCompare, TAllocator, TTraits>::equal_range(const TKey& wantedKey) const {
+    return {iterator(this, LowerBound(wantedKey)), iterator(this, UpperBound(wantedKey))};
+}
+
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+template<class TKeyIterator, class TOutputIterator>
+TOutputIterator TAATree<TValueType, TCompare, TAllocator, TTraits>::find_batch(
+      TKeyIterator first
+    , TKeyIterator last
+    , TOutputIterator out
+) const {
+    return LookupBatch<true>(first, last, out);
+}
+
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+template<class TKeyIterator, class TOutputIterator>
+TOutputIterator TAATree<TValueType, TCompare, TAllocator, TTraits>::lower_bound_batch(
+      TKeyIterator first
+    , TKeyIterator last
+    , TOutputIterator out
+) const {
+    return LookupBatch<false>(first, last, out);
+}
+
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+std::pair<typename TAATree<TValueType, TCompare, TAllocator, TTraits>::iterator, bool> TAATree<TValueType, TCompare, TAllocator, TTraits>::insert(
+    const TValueType& insertedValue
+) {
+    auto [insertedNode, isInserted] = Insert(FindInsertPosition(insertedValue), insertedValue);
+    return {iterator(this, insertedNode), isInserted};
+}
+
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+std::pair<typename TAATree<TValueType, TCompare, TAllocator, TTraits>::iterator, bool> TAATree<TValueType, TCompare, TAllocator, TTraits>::insert(
+    TValueType&& insertedValue
+) {
+    auto [insertedNode, isInserted] = Insert(FindInsertPosition(insertedValue), std::move(insertedValue));
+    return {iterator(this, insertedNode), isInserted};
+}
+
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+typename TAATree<TValueType, TCompare, TAllocator, TTraits>::iterator TAATree<TValueType, TCompare, TAllocator, TTraits>::insert(
+      iterator hint
+    , const TValueType& insertedValue
+) {
+    return iterator(this, Insert(FindInsertPosition(hint.IteratorNode_, insertedValue), insertedValue).first);
+}
+
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+typename TAATree<TValueType, TCompare, TAllocator, TTraits>::iterator TAATree<TValueType, TCompare, TAllocator, TTraits>::insert(
+      iterator hint
+    , TValueType&& insertedValue
+) {
+    return iterator(this, Insert(FindInsertPosition(hint.IteratorNode_, insertedValue), std::move(insertedValue)).first);
+}
+
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+template<class... TArgs>
+std::pair<typename TAATree<TValueType, TCompare, TAllocator, TTraits>::iterator, bool> TAATree<TValueType, TCompare, TAllocator, TTraits>::emplace(
+    TArgs&&... args
+) {
+    auto [insertedNode, isInserted] = Emplace(nullptr, std::forward<TArgs>(args)...);
+    return {iterator(this, insertedNode), isInserted};
+}
+
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+template<class... TArgs>
+typename TAATree<TValueType, TCompare, TAllocator, TTraits>::iterator TAATree<TValueType, TCompare, TAllocator, TTraits>::emplace_hint(
+      iterator hint
+    , TArgs&&... args
+) {
+    return iterator(this, Emplace(&hint.IteratorNode_, std::forward<TArgs>(args)...).first);
+}
+
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+size_t TAATree<TValueType, TCompare, TAllocator, TTraits>::erase(const key_type& erasedKey) {
+    return Erase(erasedKey);
+}
+
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+template<class TKey, class TKeyCompare, class>
+size_t TAATree<TValueType, TCompare, TAllocator, TTraits>::erase(const TKey& erasedKey) {
+    return Erase(erasedKey);
+}
+
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+typename TAATree<TValueType, TCompare, TAllocator, TTraits>::iterator TAATree<TValueType, TCompare, TAllocator, TTraits>::nth_element(
+    size_t index
+) const {
+    static_assert(TTraits::CountSubtreeSize, "nth_element() needs TTraits::CountSubtreeSize");
+    TNodeType* currentNode = Root_;
+    while (currentNode != nullptr) {
+        size_t leftSize = SubtreeSize(currentNode->LeftNode);
+        if (index < leftSize) {
+            currentNode = currentNode->LeftNode;
+        } else if (index == leftSize) {
+            break;
+        } else {
+            index -= leftSize + 1;
+            currentNode = currentNode->RightNode;
+        }
+    }
+    return iterator(this, currentNode);
+}
+
+// Number of elements less than wantedKey
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+size_t TAATree<TValueType, TCompare, TAllocator, TTraits>::rank(const key_type& wantedKey) const {
+    static_assert(TTraits::CountSubtreeSize, "rank() needs TTraits::CountSubtreeSize");
+    size_t lessCount = 0;
+    TNodeType* currentNode = Root_;
+    while (currentNode != nullptr) {
+        if (Less(currentNode->Value, wantedKey)) {
+            lessCount += SubtreeSize(currentNode->LeftNode) + 1;
+            currentNode = currentNode->RightNode;
+        } else {
+            currentNode = currentNode->LeftNode;
+        }
+    }
+    return lessCount;
+}
+
+// Number of elements in [lowerKey, upperKey)
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+size_t TAATree<TValueType, TCompare, TAllocator, TTraits>::count_range(
+      const key_type& lowerKey
+    , const key_type& upperKey
+) const {
+    if (!Less(lowerKey, upperKey)) {
+        return 0;
+    }
+    return rank(upperKey) - rank(lowerKey);
+}
+
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+typename TAATree<TValueType, TCompare, TAllocator, TTraits>::iterator TAATree<TValueType, TCompare, TAllocator, TTraits>::erase(iterator position) {
+    TNodeType* erasedNode = position.IteratorNode_;
+    if constexpr (TTraits::LazyErase) {
+        MarkDead(erasedNode);
+        TNodeType* nextNode = NextLive(erasedNode);
+        CompactIfNeeded();
+        return iterator(this, nextNode);
+    }
+    TNodeType* nextNode = NextInOrder(erasedNode);
+    UnlinkNode(erasedNode);
+    DestroyNode(erasedNode);
+    return iterator(this, nextNode);
+}
+
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+typename TAATree<TValueType, TCompare, TAllocator, TTraits>::node_type TAATree<TValueType, TCompare, TAllocator, TTraits>::extract(
+    iterator position
+) {
+    TNodeType* extractedNode = position.IteratorNode_;
+    UnlinkNode(extractedNode);
+    // The handle frees the node on its own, so the node is counted out of this set here
+    Stats_.OnFree();
+    return node_type(extractedNode, Allocator_);
+}
+
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+typename TAATree<TValueType, TCompare, TAllocator, TTraits>::node_type TAATree<TValueType, TCompare, TAllocator, TTraits>::extract(
+    const key_type& extractedKey
+) {
+    TNodeType* extractedNode = nullptr;
+    if constexpr (TTraits::IsMulti) {
+        extractedNode = LowerBound(extractedKey);
+        if (extractedNode != nullptr && Less(extractedKey, extractedNode->Value)) {
+            extractedNode = nullptr;
+        }
+    } else {
+        extractedNode = Find(extractedKey);
+    }
+    if (extractedNode == nullptr) {
+        return node_type();
+    }
+    return extract(iterator(this, extractedNode));
+}
+
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+typename TAATree<TValueType, TCompare, TAllocator, TTraits>::insert_return_type TAATree<TValueType, TCompare, TAllocator, TTraits>::insert(
+    node_type&& node
+) {
+    if (node.empty()) {
+        return {end(), false, node_type()};
+    }
+    TInsertPosition position = FindInsertPosition(KeyOf(node.Node_->Value));
+    DropDeadEqual(position, KeyOf(node.Node_->Value));
+    if (position.EqualNode != nullptr) {
+        return {iterator(this, position.EqualNode), false, std::move(node)};
+    }
+    TNodeType* insertedNode = AdoptNode(node);
+    LinkLeaf(insertedNode, position.ParentNode, position.IsLeftSon);
+    return {iterator(this, insertedNode), true, node_type()};
+}
+
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+typename TAATree<TValueType, TCompare, TAllocator, TTraits>::iterator TAATree<TValueType, TCompare, TAllocator, TTraits>::insert(
+      iterator hint
+    , node_type&& node
+) {
+    if (node.empty()) {
+        return end();
+    }
+    TInsertPosition position = FindInsertPosition(hint.IteratorNode_, KeyOf(node.Node_->Value));
+    DropDeadEqual(position, KeyOf(node.Node_->Value));
+    if (position.EqualNode != nullptr) {
+        return iterator(this, position.EqualNode);
+    }
+    TNodeType* insertedNode = AdoptNode(node);
+    LinkLeaf(insertedNode, position.ParentNode, position.IsLeftSon);
+    return iterator(this, insertedNode);
+}
+
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+void TAATree<TValueType, TCompare, TAllocator, TTraits>::clear() {
+    DestroyTree(Root_);
+    Root_ = nullptr;
+    Size_ = 0;
+    DeadCount_ = 0;
+    Leftmost_ = nullptr;
+    Rightmost_ = nullptr;
+}
+
+// The live nodes are still in order, so they are relinked as they are; a no-op without tombstones
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+void TAATree<TValueType, TCompare, TAllocator, TTraits>::compact() {
+    if constexpr (TTraits::LazyErase) {
+        if (DeadCount_ == 0) {
+            return;
+        }
+        std::vector<TNodeType*> nodes;
+        nodes.reserve(Size_ + DeadCount_);
+        CollectNodes(nodes);
+        size_t liveCount = 0;
+        for (TNodeType* currentNode : nodes) {
+            if (IsDead(currentNode)) {
+                DestroyNode(currentNode);
+            } else {
+                nodes[liveCount++] = currentNode;
+            }
+        }
+        nodes.resize(liveCount);
+        RebuildFromNodes(nodes);
+        DeadCount_ = 0;
+    }
+}
+
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+size_t TAATree<TValueType, TCompare, TAllocator, TTraits>::tombstone_count() const {
+    return DeadCount_;
+}
+
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+typename TAATree<TValueType, TCompare, TAllocator, TTraits>::iterator TAATree<TValueType, TCompare, TAllocator, TTraits>::erase(
+      iterator first
+    , iterator last
+) {
+    size_t erasedCount = 0;
+    size_t deadCount = 0;
+    DestroyTree(CutRange(first.IteratorNode_, last.IteratorNode_, erasedCount, deadCount));
+    return iterator(this, last.IteratorNode_);
+}
+
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+size_t TAATree<TValueType, TCompare, TAllocator, TTraits>::erase_range(const key_type& lowerKey, const key_type& upperKey) {
+    if (!Less(lowerKey, upperKey)) {
+        return 0;
+    }
+    size_t erasedCount = 0;
+    size_t deadCount = 0;
+    DestroyTree(CutRange(LowerBound(lowerKey), LowerBound(upperKey), erasedCount, deadCount));
+    return erasedCount;
+}
+
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+TAATree<TValueType, TCompare, TAllocator, TTraits> TAATree<TValueType, TCompare, TAllocator, TTraits>::extract_range(
+      const key_type& lowerKey
+    , const key_type& upperKey
+) {
+    TAATree extractedSet(Compare_, TAllocator(Allocator_));
+    if (!Less(lowerKey, upperKey)) {
+        return extractedSet;
+    }
+    size_t extractedCount = 0;
+    size_t deadCount = 0;
+    TNodeType* extractedRoot = CutRange(LowerBound(lowerKey), LowerBound(upperKey), extractedCount, deadCount);
+    extractedSet.ResetTree(extractedRoot, extractedCount);
+    extractedSet.DeadCount_ = deadCount;
+    return extractedSet;
+}
+
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+TAATree<TValueType, TCompare, TAllocator, TTraits> TAATree<TValueType, TCompare, TAllocator, TTraits>::split(const key_type& key) {
+    compact();
+    TAATree greaterSet(Compare_, TAllocator(Allocator_));
+    TSplitResult parts = SplitTree(Root_, key);
+    TNodeType* greaterRoot = parts.GreaterRoot;
+    if (parts.EqualNode != nullptr) {
+        greaterRoot = JoinTrees(nullptr, parts.EqualNode, greaterRoot);
+    }
+    size_t greaterSize = CountNodes(greaterRoot);
+    ResetTree(parts.LessRoot, Size_ - greaterSize);
+    greaterSet.ResetTree(greaterRoot, greaterSize);
+    return greaterSet;
+}
+
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+TAATree<TValueType, TCompare, TAllocator, TTraits> TAATree<TValueType, TCompare, TAllocator, TTraits>::join(TAATree&& left, TAATree&& right) {
+    left.compact();
+    right.compact();
+    TAATree resultSet(std::move(left));
+    size_t rightSize = right.Size_;
+    TNodeType* rightRoot = resultSet.TakeTree(right);
+    resultSet.ResetTree(resultSet.ConcatTrees(resultSet.Root_, rightRoot), resultSet.Size_ + rightSize);
+    return resultSet;
+}
+
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+void TAATree<TValueType, TCompare, TAllocator, TTraits>::merge_from(TAATree&& set) {
+    MergeFrom(set, nullptr);
+}
+
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+TAATree<TValueType, TCompare, TAllocator, TTraits> TAATree<TValueType, TCompare, TAllocator, TTraits>::set_union(TAATree&& left, TAATree&& right) {
+    TAATree resultSet(std::move(left));
+    resultSet.merge_from(std::move(right));
+    return resultSet;
+}
+
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+TAATree<TValueType, TCompare, TAllocator, TTraits> TAATree<TValueType, TCompare, TAllocator, TTraits>::set_intersection(TAATree&& left, TAATree&& right) {
+    return Intersection(left, right, nullptr);
+}
+
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+TAATree<TValueType, TCompare, TAllocator, TTraits> TAATree<TValueType, TCompare, TAllocator, TTraits>::set_difference(TAATree&& left, TAATree&& right) {
+    return Difference(left, right, nullptr);
+}
+
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+template<typename Iterator>
+size_t TAATree<TValueType, TCompare, TAllocator, TTraits>::insert_batch(TThreadPool& pool, Iterator first, Iterator last) {
+    return InsertBatch(first, last, ParallelPool(pool));
+}
+
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+void TAATree<TValueType, TCompare, TAllocator, TTraits>::merge_from(TThreadPool& pool, TAATree&& set) {
+    MergeFrom(set, ParallelPool(pool));
+}
+
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+TAATree<TValueType, TCompare, TAllocator, TTraits> TAATree<TValueType, TCompare, TAllocator, TTraits>::set_union(
+      TThreadPool& pool
+    , TAATree&& left
+    , TAATree&& right
+) {
+    TAATree resultSet(std::move(left));
+    resultSet.merge_from(pool, std::move(right));
+    return resultSet;
+}
+
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+TAATree<TValueType, TCompare, TAllocator, TTraits> TAATree<TValueType, TCompare, TAllocator, TTraits>::set_intersection(
+      TThreadPool& pool
+    , TAATree&& left
+    , TAATree&& right
+) {
+    return Intersection(left, right, ParallelPool(pool));
+}
+
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+TAATree<TValueType, TCompare, TAllocator, TTraits> TAATree<TValueType, TCompare, TAllocator, TTraits>::set_difference(
+      TThreadPool& pool
+    , TAATree&& left
+    , TAATree&& right
+) {
+    return Difference(left, right, ParallelPool(pool));
+}
+
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+void TAATree<TValueType, TCompare, TAllocator, TTraits>::clear(TThreadPool& pool) {
+    DestroyTree(Root_, ParallelPool(pool));
+    Root_ = nullptr;
+    Size_ = 0;
+    DeadCount_ = 0;
+    Leftmost_ = nullptr;
+    Rightmost_ = nullptr;
+}
+
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+template<typename Iterator>
+size_t TAATree<TValueType, TCompare, TAllocator, TTraits>::insert_batch(Iterator first, Iterator last) {
+    return InsertBatch(first, last, nullptr);
+}
+
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+template<typename Iterator>
+size_t TAATree<TValueType, TCompare, TAllocator, TTraits>::erase_batch(Iterator first, Iterator last) {
+    static_assert(!TTraits::IsMulti, "erase_batch() needs unique keys");
+    compact();
+    std::vector<key_type> keys(first, last);
+    if (!std::is_sorted(keys.begin(), keys.end(), CountingCompare())) {
+        std::sort(keys.begin(), keys.end(), CountingCompare());
+    }
+    if (keys.size() * BatchRebuildRatio < Size_) {
+        size_t erasedCount = 0;
+        TNodeType* rootNode = EraseSortedKeys(Root_, keys.data(), keys.data() + keys.size(), erasedCount);
+        ResetTree(rootNode, Size_ - erasedCount);
+        return erasedCount;
+    }
+
+    std::vector<TNodeType*> nodes;
+    nodes.reserve(Size_);
+    CollectNodes(nodes);
+    auto keyIterator = keys.cbegin();
+    size_t keptCount = 0;
+    for (TNodeType* currentNode : nodes) {
+        while (keyIterator != keys.cend() && Less(*keyIterator, currentNode->Value)) {
+            ++keyIterator;
+        }
+        if (keyIterator != keys.cend() && !Less(currentNode->Value, *keyIterator)) {
+            DestroyNode(currentNode);
+        } else {
+            nodes[keptCount++] = currentNode;
+        }
+    }
+    size_t erasedCount = nodes.size() - keptCount;
+    nodes.resize(keptCount);
+    RebuildFromNodes(nodes);
+    return erasedCount;
+}
+
+// The root level is folded in, since bulk builds and clones set levels without rebalancing
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+TSetStatistics TAATree<TValueType, TCompare, TAllocator, TTraits>::stats() const {
+    static_assert(TStats::IsEnabled, "stats() needs a counting TTraits::TStats, such as TSetStats");
+    TSetStatistics statistics = Stats_.Snapshot();
+    statistics.MaxLevel = std::max(statistics.MaxLevel, LevelOf(Root_));
+    return statistics;
+}
+
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+void TAATree<TValueType, TCompare, TAllocator, TTraits>::reset_stats() {
+    static_assert(TStats::IsEnabled, "reset_stats() needs a counting TTraits::TStats, such as TSetStats");
+    Stats_.Reset();
+}
+
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+bool TAATree<TValueType, TCompare, TAllocator, TTraits>::validate() const {
+    if (Root_ == nullptr) {
+        return (Size_ == 0 && DeadCount_ == 0 && Leftmost_ == nullptr && Rightmost_ == nullptr);
+    }
+    if (Root_->PreviousNode != nullptr) {
+        return false;
+    }
+    size_t count = 0;
+    size_t deadCount = 0;
+    bool isValid = VisitNodes([&](const TNodeType* currentNode, size_t) {
+        // Left sons are one level lower, right sons the same or one lower, right grandsons lower
+        uint32_t level = currentNode->Level;
+        const TNodeType* rightNode = currentNode->RightNode;
+        bool isBalanced = (
+               LevelOf(currentNode->LeftNode) + 1 == level
+            && (LevelOf(rightNode) == level || LevelOf(rightNode) + 1 == level)
+            && (rightNode == nullptr || LevelOf(rightNode->RightNode) < level)
+        );
+        if constexpr (TTraits::CountSubtreeSize) {
+            isBalanced = isBalanced && currentNode->SubtreeSize == SubtreeSize(currentNode->LeftNode) + SubtreeSize(rightNode) + 1;
+        }
+        if (IsDead(currentNode)) {
+            ++deadCount;
+        }
+        return (++count <= Size_ + DeadCount_ && isBalanced);
+    });
+    if (!isValid || count != Size_ + DeadCount_ || deadCount != DeadCount_) {
+        return false;
+    }
+
+    // The links are sound now, so the in-order walk ends
+    TNodeType* leftmostNode = Root_;
+    while (leftmostNode->LeftNode != nullptr) {
+        leftmostNode = leftmostNode->LeftNode;
+    }
+    if (NextLive(leftmostNode) != Leftmost_) {
+        return false;
+    }
+    TNodeType* currentNode = leftmostNode;
+    TNodeType* lastLiveNode = (IsDead(leftmostNode) ? nullptr : leftmostNode);
+    for (TNodeType* nextNode = NextInOrder(currentNode); nextNode != nullptr; nextNode = NextInOrder(nextNode)) {
+        bool isOrdered = (TTraits::IsMulti
+            ? !Compare_(KeyOf(nextNode->Value), KeyOf(currentNode->Value))
+            : Compare_(KeyOf(currentNode->Value), KeyOf(nextNode->Value)));
+        if (!isOrdered) {
+            return false;
+        }
+        currentNode = nextNode;
+        if (!IsDead(currentNode)) {
+            lastLiveNode = currentNode;
+        }
+    }
+    return (lastLiveNode == Rightmost_);
+}
+
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+TSetShape TAATree<TValueType, TCompare, TAllocator, TTraits>::shape_report() const {
+    TSetShape shape;
+    shape.Size = Size_ + DeadCount_;
+    shape.RootLevel = LevelOf(Root_);
+    shape.LevelCounts.assign(shape.RootLevel + 1, 0);
+    size_t depthSum = 0;
+    VisitNodes([&](const TNodeType* currentNode, size_t depth) {
+        if (shape.DepthCounts.size() <= depth) {
+            shape.DepthCounts.resize(depth + 1, 0);
+        }
+        ++shape.DepthCounts[depth];
+        ++shape.LevelCounts[currentNode->Level];
+        depthSum += depth;
+        return true;
+    });
+    shape.Height = (shape.DepthCounts.empty() ? 0 : shape.DepthCounts.size() - 1);
+
+    // A complete binary tree fills every depth before the next one
+    size_t optimalDepthSum = 0;
+    size_t remainingCount = shape.Size;
+    for (size_t width = 1; remainingCount != 0; width *= 2) {
+        size_t depthCount = std::min(width, remainingCount);
+        ++shape.OptimalHeight;
+        optimalDepthSum += depthCount * shape.OptimalHeight;
+        remainingCount -= depthCount;
+    }
+    if (shape.Size != 0) {
+        shape.AverageDepth = static_cast<double>(depthSum) / static_cast<double>(shape.Size);
+        shape.OptimalAverageDepth = static_cast<double>(optimalDepthSum) / static_cast<double>(shape.Size);
+    }
+    return shape;
+}
+
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+TCompare TAATree<TValueType, TCompare, TAllocator, TTraits>::key_comp() const {
+    return Compare_;
+}
+
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+TAllocator TAATree<TValueType, TCompare, TAllocator, TTraits>::get_allocator() const {
+    return TAllocator(Allocator_);
+}
+
+/*
+ *  ==================================================================================
+ *                                    Skew(node D)
+ *  ==================================================================================
+ *
+ *                             |                        |
+ *                             |                        |
+ *        node B <—————————— node D                   node B  ——————————> node D
+ *        /   \                  \         ==>        /                   /   \
+ *       /     \                  \                  /                   /     \
+ *      /       \                  \                /                   /       \
+ *   node A    node C            node F           node A             node C    node F
+ *  ==================================================================================
+ *                             Elimination of the left son
+ *  ==================================================================================
+ */
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+typename TAATree<TValueType, TCompare, TAllocator, TTraits>::TNodeType* TAATree<TValueType, TCompare, TAllocator, TTraits>::Skew(
+    TNodeType* currentNode
+) const {
+    if (
+           currentNode == nullptr
+        || currentNode->LeftNode == nullptr
+        || currentNode->Level != currentNode->LeftNode->Level
+    ) {
+        return currentNode;
+    }
+
+    Stats_.OnSkew();
+    TNodeType* leftNode = currentNode->LeftNode;
+    currentNode->LeftNode = leftNode->RightNode;
+    if (currentNode->LeftNode != nullptr) {
+        currentNode->LeftNode->PreviousNode = currentNode;
+    }
+    leftNode->RightNode = currentNode;
+    leftNode->PreviousNode = currentNode->PreviousNode;
+    currentNode->PreviousNode = leftNode;
+    UpdateSubtreeSize(currentNode);
+    UpdateSubtreeSize(leftNode);
+
+    return leftNode;
+}
+
+/*
+ *  ==================================================================================
+ *                                    Split(node B)
+ *  ==================================================================================
+ *
+ *                                                                     |
+ *          |                                                          |
+ *          |                                                        node C
+ *        node B  ——> node C  ——> node E                             /   \
+ *        /           /                         ==>                 /     \
+ *       /           /                                             /       \
+ *      /           /                                           node B    node E
+ *   node A      node D                                         /   \
+ *                                                             /     \
+ *                                                            /       \
+ *                                                         node A    node D
+ *  ==================================================================================
+ *                 Elimination of two consecutive right horizontal edges
+ *  ==================================================================================
+ */
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+typename TAATree<TValueType, TCompare, TAllocator, TTraits>::TNodeType* TAATree<TValueType, TCompare, TAllocator, TTraits>::Split(
+    TNodeType* currentNode
+) const {
+    if (
+           currentNode == nullptr
+        || currentNode->RightNode == nullptr
+        || currentNode->RightNode->RightNode == nullptr
+        || currentNode->Level != currentNode->RightNode->RightNode->Level
+    ) {
+        return currentNode;
+    }
+
+    TNodeType* rightNode = currentNode->RightNode;
+    currentNode->RightNode = rightNode->LeftNode;
+    if (currentNode->RightNode != nullptr) {
+        currentNode->RightNode->PreviousNode = currentNode;
+    }
+    rightNode->LeftNode = currentNode;
+    rightNode->PreviousNode = currentNode->PreviousNode;
+    currentNode->PreviousNode = rightNode;
+    ++rightNode->Level;
+    UpdateSubtreeSize(currentNode);
+    UpdateSubtreeSize(rightNode);
+    Stats_.OnSplit(rightNode->Level);
+
+    return rightNode;
+}
+
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+template<class TKey>
+typename TAATree<TValueType, TCompare, TAllocator, TTraits>::TInsertPosition TAATree<TValueType, TCompare, TAllocator, TTraits>::FindInsertPosition(
+    const TKey& insertedKey
+) const {
+    TInsertPosition position;
+    TNodeType* currentNode = Root_;
+    while (currentNode != nullptr) {
+        position.ParentNode = currentNode;
+        if (Less(insertedKey, currentNode->Value)) {
+            position.IsLeftSon = true;
+            currentNode = currentNode->LeftNode;
+        } else if (TTraits::IsMulti || Less(currentNode->Value, insertedKey)) {
+            position.IsLeftSon = false;
+            currentNode = currentNode->RightNode;
+        } else {
+            position.EqualNode = currentNode;
+            break;
+        }
+    }
+    return position;
+}
+
+/*
+ *  A correct hint is the node right after the inserted key (nullptr for end()).
+ *  The key then goes to the empty left son of the hint or to the empty right son of its predecessor,
+ *  which costs two comparisons instead of a descent from Root_. Wrong hints fall back to the descent.
+ *  With equal keys allowed the hint only has to lie between the equal keys and the next greater one.
+ */
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+template<class TKey>
+typename TAATree<TValueType, TCompare, TAllocator, TTraits>::TInsertPosition TAATree<TValueType, TCompare, TAllocator, TTraits>::FindInsertPosition(
+      TNodeType* hintNode
+    , const TKey& insertedKey
+) const {
+    TInsertPosition position;
+    if constexpr (TTraits::IsMulti) {
+        TNodeType* previousNode = (hintNode == nullptr ? LastNode() : PreviousInOrder(hintNode));
+        if (
+               (hintNode == nullptr || !Less(hintNode->Value, insertedKey))
+            && (previousNode == nullptr || !Less(insertedKey, previousNode->Value))
+        ) {
+            if (hintNode != nullptr && hintNode->LeftNode == nullptr) {
+                position.ParentNode = hintNode;
+                position.IsLeftSon = true;
+            } else {
+                position.ParentNode = previousNode;
+                position.IsLeftSon = false;
+            }
+            return position;
+        }
+        return FindInsertPosition(insertedKey);
+    }
+    if (hintNode == nullptr || Less(insertedKey, hintNode->Value)) {
+        TNodeType* previousNode = (hintNode == nullptr ? LastNode() : PreviousInOrder(hintNode));
+        if (previousNode == nullptr || Less(previousNode->Value, insertedKey)) {
+            if (hintNode != nullptr && hintNode->LeftNode == nullptr) {
+                position.ParentNode = hintNode;
+                position.IsLeftSon = true;
+            } else {
+                position.ParentNode = previousNode;
+                position.IsLeftSon = false;
+            }
+            return position;
+        }
+        if (!Less(insertedKey, previousNode->Value)) {
+            position.EqualNode = previousNode;
+            return position;
+        }
+    } else if (!Less(hintNode->Value, insertedKey)) {
+        position.EqualNode = hintNode;
+        return position;
+    }
+    return FindInsertPosition(insertedKey);
+}
+
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+template<class TArg>
+std::pair<typename TAATree<TValueType, TCompare, TAllocator, TTraits>::TNodeType*, bool> TAATree<TValueType, TCompare, TAllocator, TTraits>::Insert(
+      const TInsertPosition& position
+    , TArg&& insertedValue
+) {
+    TInsertPosition linkPosition = position;
+    if (linkPosition.EqualNode != nullptr) {
+        if (!IsDead(linkPosition.EqualNode)) {
+            return {linkPosition.EqualNode, false};
+        }
+        // The tombstone of the key takes the value back in place
+        if constexpr (TTraits::LazyErase && std::is_assignable_v<TValueType&, TArg&&>) {
+            TNodeType* revivedNode = linkPosition.EqualNode;
+            revivedNode->Value = std::forward<TArg>(insertedValue);
+            revivedNode->IsDead = false;
+            --DeadCount_;
+            ++Size_;
+            ExtendExtremes(revivedNode);
+            return {revivedNode, true};
+        }
+        DropDeadEqual(linkPosition, KeyOf(insertedValue));
+    }
+    TNodeType* insertedNode = CreateNode(std::forward<TArg>(insertedValue));
+    LinkLeaf(insertedNode, linkPosition.ParentNode, linkPosition.IsLeftSon);
+    return {insertedNode, true};
+}
+
+// The value is built in the node first, so the node is dropped again when the key is taken
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+template<class... TArgs>
+std::pair<typename TAATree<TValueType, TCompare, TAllocator, TTraits>::TNodeType*, bool> TAATree<TValueType, TCompare, TAllocator, TTraits>::Emplace(
+      TNodeType* const* hintNode
+    , TArgs&&... args
+) {
+    TNodeType* insertedNode = CreateNode(std::forward<TArgs>(args)...);
+    TInsertPosition position;
+    try {
+        position = (hintNode != nullptr
+            ? FindInsertPosition(*hintNode, insertedNode->Value)
+            : FindInsertPosition(insertedNode->Value));
+        DropDeadEqual(position, KeyOf(insertedNode->Value));
+    } catch (...) {
+        DestroyNode(insertedNode);
+        throw;
+    }
+    if (position.EqualNode != nullptr) {
+        DestroyNode(insertedNode);
+        return {position.EqualNode, false};
+    }
+    LinkLeaf(insertedNode, position.ParentNode, position.IsLeftSon);
+    return {insertedNode, true};
+}
+
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+template<class TKey, class... TArgs>
+std::pair<typename TAATree<TValueType, TCompare, TAllocator, TTraits>::iterator, bool> TAATree<TValueType, TCompare, TAllocator, TTraits>::TryEmplace(
+      TKey&& key
+    , TArgs&&... args
+) {
+    TInsertPosition position = FindInsertPosition(key);
+    DropDeadEqual(position, key);
+    if (position.EqualNode != nullptr) {
+        return {iterator(this, position.EqualNode), false};
+    }
+    TNodeType* insertedNode = CreateNode(
+          std::piecewise_construct
+        , std::forward_as_tuple(std::forward<TKey>(key))
+        , std::forward_as_tuple(std::forward<TArgs>(args)...)
+    );
+    LinkLeaf(insertedNode, position.ParentNode, position.IsLeftSon);
+    return {iterator(this, insertedNode), true};
+}
+
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+typename TAATree<TValueType, TCompare, TAllocator, TTraits>::TNodeType* TAATree<TValueType, TCompare, TAllocator, TTraits>::AdoptNode(
+    node_type& node
+) {
+    if constexpr (!TNodeAllocatorTraits::is_always_equal::value) {
+        if (*node.Allocator_ != Allocator_) {
+            TNodeType* copiedNode = CreateNode(std::move(node.Node_->Value));
+            node = node_type();
+            return copiedNode;
+        }
+    }
+    TNodeType* adoptedNode = std::exchange(node.Node_, nullptr);
+    node.Allocator_.reset();
+    Stats_.OnAllocate();
+    adoptedNode->PreviousNode = nullptr;
+    adoptedNode->LeftNode = nullptr;
+    adoptedNode->RightNode = nullptr;
+    adoptedNode->Level = 1;
+    UpdateSubtreeSize(adoptedNode);
+    return adoptedNode;
+}
+
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+bool TAATree<TValueType, TCompare, TAllocator, TTraits>::IsDead(const TNodeType* currentNode) {
+    if constexpr (TTraits::LazyErase) {
+        return (currentNode->IsDead != 0);
+    } else {
+        static_cast<void>(currentNode);
+        return false;
+    }
+}
+
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+typename TAATree<TValueType, TCompare, TAllocator, TTraits>::TNodeType* TAATree<TValueType, TCompare, TAllocator, TTraits>::NextLive(TNodeType* currentNode) {
+    if constexpr (TTraits::LazyErase) {
+        while (currentNode != nullptr && currentNode->IsDead) {
+            currentNode = NextInOrder(currentNode);
+        }
+    }
+    return currentNode;
+}
+
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+typename TAATree<TValueType, TCompare, TAllocator, TTraits>::TNodeType* TAATree<TValueType, TCompare, TAllocator, TTraits>::PreviousLive(TNodeType* currentNode) {
+    if constexpr (TTraits::LazyErase) {
+        while (currentNode != nullptr && currentNode->IsDead) {
+            currentNode = PreviousInOrder(currentNode);
+        }
+    }
+    return currentNode;
+}
+
+// The node keeps its place and its value until compact() or a reinsertion of its key
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+void TAATree<TValueType, TCompare, TAllocator, TTraits>::MarkDead(TNodeType* erasedNode) {
+    erasedNode->IsDead = true;
+    --Size_;
+    ++DeadCount_;
+    if (erasedNode == Leftmost_) {
+        Leftmost_ = NextLive(NextInOrder(erasedNode));
+    }
+    if (erasedNode == Rightmost_) {
+        Rightmost_ = PreviousLive(PreviousInOrder(erasedNode));
+    }
+}
+
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+template<class TKey>
+void TAATree<TValueType, TCompare, TAllocator, TTraits>::DropDeadEqual(TInsertPosition& position, const TKey& insertedKey) {
+    if constexpr (TTraits::LazyErase) {
+        if (position.EqualNode != nullptr && position.EqualNode->IsDead) {
+            TNodeType* deadNode = position.EqualNode;
+            // UnlinkNode counts a live element out
+            ++Size_;
+            --DeadCount_;
+            UnlinkNode(deadNode);
+            DestroyNode(deadNode);
+            position = FindInsertPosition(insertedKey);
+        }
+    } else {
+        static_cast<void>(position);
+        static_cast<void>(insertedKey);
+    }
+}
+
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+void TAATree<TValueType, TCompare, TAllocator, TTraits>::CompactIfNeeded() {
+    if (DeadCount_ * 100 > (Size_ + DeadCount_) * TTraits::MaxTombstonePercent) {
+        compact();
+    }
+}
+
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+void TAATree<TValueType, TCompare, TAllocator, TTraits>::ResetExtremes() {
+    Leftmost_ = Root_;
+    Rightmost_ = Root_;
+    if (Root_ != nullptr) {
+        while (Leftmost_->LeftNode != nullptr) {
+            Leftmost_ = Leftmost_->LeftNode;
+        }
+        while (Rightmost_->RightNode != nullptr) {
+            Rightmost_ = Rightmost_->RightNode;
+        }
+    }
+    Leftmost_ = NextLive(Leftmost_);
+    Rightmost_ = PreviousLive(Rightmost_);
+}
+
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+typename TAATree<TValueType, TCompare, TAllocator, TTraits>::TNodeType* TAATree<TValueType, TCompare, TAllocator, TTraits>::FirstNode() const {
+    if constexpr (TTraits::LazyErase) {
+        if (DeadCount_ != 0) {
+            TNodeType* firstNode = Root_;
+            while (firstNode->LeftNode != nullptr) {
+                firstNode = firstNode->LeftNode;
+            }
+            return firstNode;
+        }
+    }
+    return Leftmost_;
+}
+
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+typename TAATree<TValueType, TCompare, TAllocator, TTraits>::TNodeType* TAATree<TValueType, TCompare, TAllocator, TTraits>::LastNode() const {
+    if constexpr (TTraits::LazyErase) {
+        if (DeadCount_ != 0) {
+            TNodeType* lastNode = Root_;
+            while (lastNode->RightNode != nullptr) {
+                lastNode = lastNode->RightNode;
+            }
+            return lastNode;
+        }
+    }
+    return Rightmost_;
+}
+
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+void TAATree<TValueType, TCompare, TAllocator, TTraits>::ExtendExtremes(TNodeType* liveNode) {
+    if (Leftmost_ == nullptr) {
+        Leftmost_ = liveNode;
+        Rightmost_ = liveNode;
+    } else if (IsBefore(liveNode, Leftmost_)) {
+        Leftmost_ = liveNode;
+    } else if (IsBefore(Rightmost_, liveNode)) {
+        Rightmost_ = liveNode;
+    }
+}
+
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+bool TAATree<TValueType, TCompare, TAllocator, TTraits>::IsBefore(const TNodeType* leftNode, const TNodeType* rightNode) {
+    auto depthOf = [](const TNodeType* currentNode) {
+        size_t depth = 0;
+        for (; currentNode->PreviousNode != nullptr; currentNode = currentNode->PreviousNode) {
+            ++depth;
+        }
+        return depth;
+    };
+    size_t leftDepth = depthOf(leftNode);
+    size_t rightDepth = depthOf(rightNode);
+    // The sons through which each side reached the current node, nullptr while it is the node itself
+    const TNodeType* leftSon = nullptr;
+    const TNodeType* rightSon = nullptr;
+    for (; leftDepth > rightDepth; --leftDepth) {
+        leftSon = std::exchange(leftNode, leftNode->PreviousNode);
+    }
+    for (; rightDepth > leftDepth; --rightDepth) {
+        rightSon = std::exchange(rightNode, rightNode->PreviousNode);
+    }
+    while (leftNode != rightNode) {
+        leftSon = std::exchange(leftNode, leftNode->PreviousNode);
+        rightSon = std::exchange(rightNode, rightNode->PreviousNode);
+    }
+    if (leftSon == nullptr) {
+        return (rightSon != nullptr && rightSon == leftNode->RightNode);
+    }
+    return (leftSon == leftNode->LeftNode);
+}
+
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+void TAATree<TValueType, TCompare, TAllocator, TTraits>::LinkLeaf(TNodeType* insertedNode, TNodeType* previousNode, bool isLeftSon) {
+    insertedNode->PreviousNode = previousNode;
+    if (previousNode == nullptr) {
+        Root_ = insertedNode;
+        Leftmost_ = insertedNode;
+        Rightmost_ = insertedNode;
+    } else {
+        (isLeftSon ? previousNode->LeftNode : previousNode->RightNode) = insertedNode;
+        bool isNextToLive = true;
+        if constexpr (TTraits::LazyErase) {
+            // Below a dead node the leaf may lie in a dead run at either end, so its place is looked up
+            isNextToLive = (Leftmost_ != nullptr && !IsDead(previousNode));
+        }
+        if (!isNextToLive) {
+            ExtendExtremes(insertedNode);
+        } else if (isLeftSon && previousNode == Leftmost_) {
+            Leftmost_ = insertedNode;
+        } else if (!isLeftSon && previousNode == Rightmost_) {
+            Rightmost_ = insertedNode;
+        }
+    }
+    ++Size_;
+
+    // Once two consecutive ancestors keep their root and level, nothing above can change
+    // except subtree sizes, which are then merely counted up to the root
+    size_t unchangedSteps = 0;
+    TNodeType* currentNode = previousNode;
+    for (; currentNode != nullptr && unchangedSteps < 2; ) {
+        TNodeType* parentNode = currentNode->PreviousNode;
+        uint32_t oldLevel = currentNode->Level;
+        TNodeType* balancedNode = Split(Skew(currentNode));
+        UpdateSubtreeSize(balancedNode);
+        if (balancedNode == currentNode && balancedNode->Level == oldLevel) {
+            ++unchangedSteps;
+        } else {
+            unchangedSteps = 0;
+            ReplaceSon(parentNode, currentNode, balancedNode);
+        }
+        currentNode = parentNode;
+    }
+    if constexpr (TTraits::CountSubtreeSize) {
+        for (; currentNode != nullptr; currentNode = currentNode->PreviousNode) {
+            ++currentNode->SubtreeSize;
+        }
+    }
+}
+
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+template<class TLeft, class TRight>
+bool TAATree<TValueType, TCompare, TAllocator, TTraits>::Less(const TLeft& left, const TRight& right) const {
+    Stats_.OnCompare();
+    return Compare_(KeyOf(left), KeyOf(right));
+}
+
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+const typename TAATree<TValueType, TCompare, TAllocator, TTraits>::key_type& TAATree<TValueType, TCompare, TAllocator, TTraits>::KeyOf(
+    const TValueType& value
+) {
+    return TTraits::TKeyOfValue::Key(value);
+}
+
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+template<class TKey>
+const TKey& TAATree<TValueType, TCompare, TAllocator, TTraits>::KeyOf(const TKey& key) {
+    return key;
+}
+
+// For the standard algorithms over batches
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+auto TAATree<TValueType, TCompare, TAllocator, TTraits>::CountingCompare() const {
+    return [this](const auto& left, const auto& right) {
+        return Less(left, right);
+    };
+}
+
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+template<class TKey>
+typename TAATree<TValueType, TCompare, TAllocator, TTraits>::TNodeType* TAATree<TValueType, TCompare, TAllocator, TTraits>::LowerBound(
+    const TKey& wantedKey
+) const {
+    TNodeType* resultNode = nullptr;
+    TNodeType* currentNode = Root_;
+    size_t depth = 0;
+    for (; currentNode != nullptr; ++depth) {
+        if (Less(currentNode->Value, wantedKey)) {
+            currentNode = currentNode->RightNode;
+        } else {
+            resultNode = currentNode;
+            currentNode = currentNode->LeftNode;
+        }
+    }
+    Stats_.OnDescent(ESetDescent::LowerBound, depth);
+    return NextLive(resultNode);
+}
+
+/*
+ *  The subtree of a node holds exactly the keys between its nearest ancestors on the left and on the right.
+ *  Going up from a left son reaches the ancestor on the right, and from a right son the one on the left:
+ *
+ *        key above the finger:  climb until an ancestor on the right is not less than the key,
+ *                               it becomes the lower bound unless the subtree below has a smaller one
+ *        key up to the finger:  climb until an ancestor on the left is less than the key,
+ *                               the finger itself is the lower bound unless the subtree has a smaller one
+ *
+ *  Ancestors passed on the other side are never compared. The usual descent then starts at the top of the climb.
+ */
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+template<class TKey>
+typename TAATree<TValueType, TCompare, TAllocator, TTraits>::TNodeType* TAATree<TValueType, TCompare, TAllocator, TTraits>::LowerBound(
+      TNodeType* fingerNode
+    , const TKey& wantedKey
+) const {
+    if (fingerNode == nullptr) {
+        fingerNode = Rightmost_;
+        if (fingerNode == nullptr) {
+            return nullptr;
+        }
+    }
+    TNodeType* resultNode = nullptr;
+    TNodeType* currentNode = fingerNode;
+    size_t depth = 0;
+    bool isAboveFinger = Less(fingerNode->Value, wantedKey);
+    if (!isAboveFinger) {
+        resultNode = fingerNode;
+    }
+    for (TNodeType* parentNode = currentNode->PreviousNode; parentNode != nullptr; parentNode = currentNode->PreviousNode) {
+        ++depth;
+        if (isAboveFinger) {
+            if (parentNode->LeftNode == currentNode && !Less(parentNode->Value, wantedKey)) {
+                resultNode = parentNode;
+                break;
+            }
+        } else if (parentNode->RightNode == currentNode && Less(parentNode->Value, wantedKey)) {
+            break;
+        }
+        currentNode = parentNode;
+    }
+    for (; currentNode != nullptr; ++depth) {
+        if (Less(currentNode->Value, wantedKey)) {
+            currentNode = currentNode->RightNode;
+        } else {
+            resultNode = currentNode;
+            currentNode = currentNode->LeftNode;
+        }
+    }
+    Stats_.OnDescent(ESetDescent::Finger, depth);
+    return NextLive(resultNode);
+}
+
+/*
+ *  Group prefetching: in every round each unfinished descent takes one step and prefetches
+ *  the son it moved to. By the time the round comes back to it the son is usually in cache.
+ */
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+template<bool IsFind, class TKeyIterator, class TOutputIterator>
+TOutputIterator TAATree<TValueType, TCompare, TAllocator, TTraits>::LookupBatch(
+      TKeyIterator first
+    , TKeyIterator last
+    , TOutputIterator out
+) const {
+    TKeyIterator keyIterators[BatchLookupWidth];
+    TNodeType* currentNodes[BatchLookupWidth];
+    TNodeType* resultNodes[BatchLookupWidth];
+    while (first != last) {
+        size_t groupSize = 0;
+        for (; groupSize < BatchLookupWidth && first != last; ++groupSize, ++first) {
+            keyIterators[groupSize] = first;
+            currentNodes[groupSize] = Root_;
+            resultNodes[groupSize] = nullptr;
+        }
+
+        bool isActive = (Root_ != nullptr);
+        while (isActive) {
+            isActive = false;
+            for (size_t queryIndex = 0; queryIndex < groupSize; ++queryIndex) {
+                TNodeType* currentNode = currentNodes[queryIndex];
+                if (currentNode == nullptr) {
+                    continue;
+                }
+                if (Less(currentNode->Value, *keyIterators[queryIndex])) {
+                    currentNode = currentNode->RightNode;
+                } else {
+                    resultNodes[queryIndex] = currentNode;
+                    currentNode = currentNode->LeftNode;
+                }
+                currentNodes[queryIndex] = currentNode;
+                if (currentNode != nullptr) {
+                    PrefetchNode(currentNode);
+                    isActive = true;
+                }
+            }
+        }
+
+        for (size_t queryIndex = 0; queryIndex < groupSize; ++queryIndex) {
+            TNodeType* resultNode = NextLive(resultNodes[queryIndex]);
+            if constexpr (IsFind) {
+                if (resultNode != nullptr && Less(*keyIterators[queryIndex], resultNode->Value)) {
+                    resultNode = nullptr;
+                }
+            }
+            *out = iterator(this, resultNode);
+            ++out;
+        }
+    }
+    return out;
+}
+
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+void TAATree<TValueType, TCompare, TAllocator, TTraits>::PrefetchNode(const TNodeType* currentNode) {
+#if defined(__GNUC__) || defined(__clang__)
+    __builtin_prefetch(currentNode);
+#else
+    (void)currentNode;
+#endif
+}
+
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+template<class TKey>
+typename TAATree<TValueType, TCompare, TAllocator, TTraits>::TNodeType* TAATree<TValueType, TCompare, TAllocator, TTraits>::UpperBound(
+    const TKey& wantedKey
+) const {
+    TNodeType* resultNode = nullptr;
+    TNodeType* currentNode = Root_;
+    while (currentNode != nullptr) {
+        if (Less(wantedKey, currentNode->Value)) {
+            resultNode = currentNode;
+            currentNode = currentNode->LeftNode;
+        } else {
+            currentNode = currentNode->RightNode;
+        }
+    }
+    return NextLive(resultNode);
+}
+
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+template<class TKey>
+typename TAATree<TValueType, TCompare, TAllocator, TTraits>::TNodeType* TAATree<TValueType, TCompare, TAllocator, TTraits>::Find(
+    const TKey& wantedKey
+) const {
+    TNodeType* currentNode = Root_;
+    size_t depth = 0;
+    for (; currentNode != nullptr; ++depth) {
+        if (Less(wantedKey, currentNode->Value)) {
+            currentNode = currentNode->LeftNode;
+        } else if (Less(currentNode->Value, wantedKey)) {
+            currentNode = currentNode->RightNode;
+        } else {
+            Stats_.OnDescent(ESetDescent::Find, depth + 1);
+            // Equal keys of a multiset may keep a live node next to a dead one
+            if constexpr (TTraits::IsMulti && TTraits::LazyErase) {
+                if (IsDead(currentNode)) {
+                    TNodeType* lowerNode = LowerBound(wantedKey);
+                    return (lowerNode != nullptr && !Less(wantedKey, lowerNode->Value) ? lowerNode : nullptr);
+                }
+            }
+            return (IsDead(currentNode) ? nullptr : currentNode);
+        }
+    }
+    Stats_.OnDescent(ESetDescent::Find, depth);
+    return nullptr;
+}
+
+// Equal keys follow each other in order, so a multiset walks them from the lower bound
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+template<class TKey>
+size_t TAATree<TValueType, TCompare, TAllocator, TTraits>::Count(const TKey& wantedKey) const {
+    if constexpr (TTraits::IsMulti) {
+        size_t equalCount = 0;
+        TNodeType* currentNode = LowerBound(wantedKey);
+        for (; currentNode != nullptr && !Less(wantedKey, currentNode->Value); currentNode = NextInOrder(currentNode)) {
+            if (!IsDead(currentNode)) {
+                ++equalCount;
+            }
+        }
+        return equalCount;
+    } else {
+        return (Find(wantedKey) != nullptr ? 1 : 0);
+    }
+}
+
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+template<class TKey>
+size_t TAATree<TValueType, TCompare, TAllocator, TTraits>::Erase(const TKey& erasedKey) {
+    if constexpr (TTraits::LazyErase) {
+        // Dead nodes may lie among the equal keys of a multiset, a set has at most one live one
+        size_t erasedCount = 0;
+        TNodeType* erasedNode = LowerBound(erasedKey);
+        for (; erasedNode != nullptr && !Less(erasedKey, erasedNode->Value); erasedNode = NextLive(NextInOrder(erasedNode))) {
+            MarkDead(erasedNode);
+            ++erasedCount;
+            if constexpr (!TTraits::IsMulti) {
+                break;
+            }
+        }
+        CompactIfNeeded();
+        return erasedCount;
+    } else if constexpr (TTraits::IsMulti) {
+        // Unlinking relinks the nodes without moving values, so the next node stays valid
+        size_t erasedCount = 0;
+        TNodeType* erasedNode = LowerBound(erasedKey);
+        while (erasedNode != nullptr && !Less(erasedKey, erasedNode->Value)) {
+            TNodeType* nextNode = NextInOrder(erasedNode);
+            UnlinkNode(erasedNode);
+            DestroyNode(erasedNode);
+            erasedNode = nextNode;
+            ++erasedCount;
+        }
+        return erasedCount;
+    } else {
+        TNodeType* erasedNode = Find(erasedKey);
+        if (erasedNode == nullptr) {
+            return 0;
+        }
+        UnlinkNode(erasedNode);
+        DestroyNode(erasedNode);
+        return 1;
+    }
+}
+
+/*
+ *  Detaches a node without touching its value.
+ *  The in-order neighbour that replaces an inner node is always a leaf in an AA tree,
+ *  so it is moved into the place of the erased node and the tree is rebalanced from its old parent.
+ */
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+void TAATree<TValueType, TCompare, TAllocator, TTraits>::UnlinkNode(TNodeType* erasedNode) {
+    if (erasedNode == Leftmost_) {
+        Leftmost_ = NextLive(NextInOrder(erasedNode));
+    }
+    if (erasedNode == Rightmost_) {
+        Rightmost_ = PreviousLive(PreviousInOrder(erasedNode));
+    }
+
+    TNodeType* rebalancedNode = erasedNode->PreviousNode;
+    if (IsLeaf(erasedNode)) {
+        ReplaceSon(erasedNode->PreviousNode, erasedNode, nullptr);
+    } else {
+        TNodeType* replacementNode = (erasedNode->LeftNode != nullptr ? Predecessor(erasedNode) : Successor(erasedNode));
+        rebalancedNode = replacementNode->PreviousNode;
+        ReplaceSon(rebalancedNode, replacementNode, nullptr);
+        if (rebalancedNode == erasedNode) {
+            rebalancedNode = replacementNode;
+        }
+
+        replacementNode->LeftNode = erasedNode->LeftNode;
+        replacementNode->RightNode = erasedNode->RightNode;
+        replacementNode->Level = erasedNode->Level;
+        replacementNode->PreviousNode = erasedNode->PreviousNode;
+        if (replacementNode->LeftNode != nullptr) {
+            replacementNode->LeftNode->PreviousNode = replacementNode;
+        }
+        if (replacementNode->RightNode != nullptr) {
+            replacementNode->RightNode->PreviousNode = replacementNode;
+        }
+        ReplaceSon(erasedNode->PreviousNode, erasedNode, replacementNode);
+    }
+    erasedNode->PreviousNode = nullptr;
+    erasedNode->LeftNode = nullptr;
+    erasedNode->RightNode = nullptr;
+    --Size_;
+
+    while (rebalancedNode != nullptr) {
+        TNodeType* parentNode = rebalancedNode->PreviousNode;
+        TNodeType* currentNode = DecreaseLevel(rebalancedNode);
+        currentNode = Skew(currentNode);
+        currentNode->RightNode = Skew(currentNode->RightNode);
+        if (currentNode->RightNode != nullptr) {
+            currentNode->RightNode->RightNode = Skew(currentNode->RightNode->RightNode);
+        }
+        currentNode = Split(currentNode);
+        currentNode->RightNode = Split(currentNode->RightNode);
+        UpdateSubtreeSize(currentNode);
+        ReplaceSon(parentNode, rebalancedNode, currentNode);
+        rebalancedNode = parentNode;
+    }
+}
+
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+void TAATree<TValueType, TCompare, TAllocator, TTraits>::ResetTree(TNodeType* rootNode, size_t size) {
+    Root_ = rootNode;
+    Size_ = size;
+    ResetExtremes();
+    Stats_.OnLevel(LevelOf(rootNode));
+}
+
+// Hands the nodes of set over to this set; nodes of a foreign allocator are copied and set is cleared
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+typename TAATree<TValueType, TCompare, TAllocator, TTraits>::TNodeType* TAATree<TValueType, TCompare, TAllocator, TTraits>::TakeTree(TAATree& set) {
+    if constexpr (!TNodeAllocatorTraits::is_always_equal::value) {
+        if (Allocator_ != set.Allocator_) {
+            TNodeType* rootNode = CloneTree(set.Root_, nullptr);
+            set.clear();
+            return rootNode;
+        }
+    }
+    TNodeType* rootNode = std::exchange(set.Root_, nullptr);
+    set.Size_ = 0;
+    set.DeadCount_ = 0;
+    set.Leftmost_ = nullptr;
+    set.Rightmost_ = nullptr;
+    return rootNode;
+}
+
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+void TAATree<TValueType, TCompare, TAllocator, TTraits>::MergeFrom(TAATree& set, TThreadPool* pool) {
+    static_assert(!TTraits::IsMulti, "merge_from() and set_union() need unique keys");
+    if (this == &set) {
+        return;
+    }
+    compact();
+    set.compact();
+    size_t setSize = set.Size_;
+    TNodeType* setRoot = TakeTree(set);
+    size_t commonCount = 0;
+    TNodeType* rootNode = UnionTrees(Root_, setRoot, commonCount, pool);
+    ResetTree(rootNode, Size_ + setSize - commonCount);
+}
+
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+TAATree<TValueType, TCompare, TAllocator, TTraits> TAATree<TValueType, TCompare, TAllocator, TTraits>::Intersection(
+      TAATree& left
+    , TAATree& right
+    , TThreadPool* pool
+) {
+    static_assert(!TTraits::IsMulti, "set_intersection() needs unique keys");
+    left.compact();
+    right.compact();
+    TAATree resultSet(std::move(left));
+    if (&left == &right) {
+        return resultSet;
+    }
+    TNodeType* rightRoot = resultSet.TakeTree(right);
+    size_t commonCount = 0;
+    TNodeType* rootNode = resultSet.IntersectTrees(resultSet.Root_, rightRoot, commonCount, pool);
+    resultSet.ResetTree(rootNode, commonCount);
+    return resultSet;
+}
+
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+TAATree<TValueType, TCompare, TAllocator, TTraits> TAATree<TValueType, TCompare, TAllocator, TTraits>::Difference(
+      TAATree& left
+    , TAATree& right
+    , TThreadPool* pool
+) {
+    static_assert(!TTraits::IsMulti, "set_difference() needs unique keys");
+    left.compact();
+    right.compact();
+    TAATree resultSet(std::move(left));
+    if (&left == &right) {
+        resultSet.clear();
+        return resultSet;
+    }
+    TNodeType* rightRoot = resultSet.TakeTree(right);
+    size_t commonCount = 0;
+    TNodeType* rootNode = resultSet.SubtractTrees(resultSet.Root_, rightRoot, commonCount, pool);
+    resultSet.ResetTree(rootNode, resultSet.Size_ - commonCount);
+    return resultSet;
+}
+
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+void TAATree<TValueType, TCompare, TAllocator, TTraits>::ReplaceSon(TNodeType* parentNode, TNodeType* oldSon, TNodeType* newSon) {
+    if (parentNode == nullptr) {
+        Root_ = newSon;
+    } else if (parentNode->LeftNode == oldSon) {
+        parentNode->LeftNode = newSon;
+    } else {
+        parentNode->RightNode = newSon;
+    }
+}
+
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+typename TAATree<TValueType, TCompare, TAllocator, TTraits>::TNodeType* TAATree<TValueType, TCompare, TAllocator, TTraits>::DecreaseLevel(
+    TNodeType* currentNode
+) const {
+    // A missing son counts as level 0
+    uint32_t leftLevel = (currentNode->LeftNode != nullptr ? currentNode->LeftNode->Level : 0);
+    uint32_t rightLevel = (currentNode->RightNode != nullptr ? currentNode->RightNode->Level : 0);
+    uint32_t expectedLevel = std::min(leftLevel, rightLevel) + 1;
+    if (expectedLevel < currentNode->Level) {
+        Stats_.OnDecreaseLevel(expectedLevel);
+        currentNode->Level = expectedLevel;
+        if (expectedLevel < rightLevel) {
+            currentNode->RightNode->Level = expectedLevel;
+        }
+    }
+    return currentNode;
+}
+
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+size_t TAATree<TValueType, TCompare, TAllocator, TTraits>::SubtreeSize(const TNodeType* currentNode) {
+    return (currentNode != nullptr ? currentNode->SubtreeSize : 0);
+}
+
+// Recounts a node from its sons, compiled away unless TTraits::CountSubtreeSize is set
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+void TAATree<TValueType, TCompare, TAllocator, TTraits>::UpdateSubtreeSize(TNodeType* currentNode) {
+    if constexpr (TTraits::CountSubtreeSize) {
+        if (currentNode != nullptr) {
+            currentNode->SubtreeSize = SubtreeSize(currentNode->LeftNode) + SubtreeSize(currentNode->RightNode) + 1;
+        }
+    }
+}
+
+/*
+ *  ==================================================================================
+ *                              JoinTrees(L, node K, R)
+ *  ==================================================================================
+ *
+ *        L higher than R: walk down the right spine of L to the first node C
+ *        whose level is not above the level h of R and hang K there
+ *
+ *              node A                                     node A
+ *                  \                                          \
+ *                   \                  ==>                     \
+ *                  node C      R                              node K  (level h + 1)
+ *                                                             /    \
+ *                                                        node C      R
+ *  ==================================================================================
+ *        The spine is then repaired bottom-up by Skew and Split, as after an insertion
+ *  ==================================================================================
+ */
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+typename TAATree<TValueType, TCompare, TAllocator, TTraits>::TNodeType* TAATree<TValueType, TCompare, TAllocator, TTraits>::JoinTrees(
+      TNodeType* leftRoot
+    , TNodeType* middleNode
+    , TNodeType* rightRoot
+) const {
+    uint32_t leftLevel = LevelOf(leftRoot);
+    uint32_t rightLevel = LevelOf(rightRoot);
+    TNodeType* parentNode = nullptr;
+    if (leftLevel > rightLevel) {
+        parentNode = leftRoot;
+        while (parentNode->RightNode != nullptr && parentNode->RightNode->Level > rightLevel) {
+            parentNode = parentNode->RightNode;
+        }
+        leftRoot = parentNode->RightNode;
+        parentNode->RightNode = middleNode;
+    } else if (leftLevel < rightLevel) {
+        parentNode = rightRoot;
+        while (parentNode->LeftNode != nullptr && parentNode->LeftNode->Level > leftLevel) {
+            parentNode = parentNode->LeftNode;
+        }
+        rightRoot = parentNode->LeftNode;
+        parentNode->LeftNode = middleNode;
+    }
+
+    middleNode->PreviousNode = parentNode;
+    middleNode->LeftNode = leftRoot;
+    middleNode->RightNode = rightRoot;
+    middleNode->Level = std::min(leftLevel, rightLevel) + 1;
+    if (leftRoot != nullptr) {
+        leftRoot->PreviousNode = middleNode;
+    }
+    if (rightRoot != nullptr) {
+        rightRoot->PreviousNode = middleNode;
+    }
+    UpdateSubtreeSize(middleNode);
+
+    TNodeType* topNode = middleNode;
+    for (TNodeType* currentNode = parentNode; currentNode != nullptr; ) {
+        TNodeType* previousNode = currentNode->PreviousNode;
+        topNode = Split(Skew(currentNode));
+        UpdateSubtreeSize(topNode);
+        if (previousNode != nullptr) {
+            if (previousNode->LeftNode == currentNode) {
+                previousNode->LeftNode = topNode;
+            } else {
+                previousNode->RightNode = topNode;
+            }
+        }
+        currentNode = previousNode;
+    }
+    return topNode;
+}
+
+// JoinTrees without a middle node: the maximum of the left tree takes its place
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+typename TAATree<TValueType, TCompare, TAllocator, TTraits>::TNodeType* TAATree<TValueType, TCompare, TAllocator, TTraits>::ConcatTrees(
+      TNodeType* leftRoot
+    , TNodeType* rightRoot
+) const {
+    if (leftRoot == nullptr) {
+        return rightRoot;
+    }
+    if (rightRoot == nullptr) {
+        return leftRoot;
+    }
+    auto [restRoot, lastNode] = SplitLast(leftRoot);
+    return JoinTrees(restRoot, lastNode, rightRoot);
+}
+
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+std::pair<typename TAATree<TValueType, TCompare, TAllocator, TTraits>::TNodeType*, typename TAATree<TValueType, TCompare, TAllocator, TTraits>::TNodeType*>
+TAATree<TValueType, TCompare, TAllocator, TTraits>::SplitLast(TNodeType* rootNode) const {
+    TNodeType* leftSon = DetachNode(rootNode->LeftNode);
+    TNodeType* rightSon = DetachNode(rootNode->RightNode);
+    if (rightSon == nullptr) {
+        rootNode->LeftNode = nullptr;
+        return {leftSon, rootNode};
+    }
+    auto [restRoot, lastNode] = SplitLast(rightSon);
+    return {JoinTrees(leftSon, rootNode, restRoot), lastNode};
+}
+
+// Cuts a detached tree along the search path of key, joining the hanging subtrees on the way back
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+template<class TKey>
+typename TAATree<TValueType, TCompare, TAllocator, TTraits>::TSplitResult TAATree<TValueType, TCompare, TAllocator, TTraits>::SplitTree(
+      TNodeType* rootNode
+    , const TKey& key
+) const {
+    TSplitResult parts;
+    if (rootNode == nullptr) {
+        return parts;
+    }
+    TNodeType* leftSon = DetachNode(rootNode->LeftNode);
+    TNodeType* rightSon = DetachNode(rootNode->RightNode);
+    // Equal keys of a multiset all go to the greater part
+    if (Less(key, rootNode->Value) || (TTraits::IsMulti && !Less(rootNode->Value, key))) {
+        parts = SplitTree(leftSon, key);
+        parts.GreaterRoot = JoinTrees(parts.GreaterRoot, rootNode, rightSon);
+    } else if (Less(rootNode->Value, key)) {
+        parts = SplitTree(rightSon, key);
+        parts.LessRoot = JoinTrees(leftSon, rootNode, parts.LessRoot);
+    } else {
+        rootNode->PreviousNode = nullptr;
+        rootNode->LeftNode = nullptr;
+        rootNode->RightNode = nullptr;
+        parts = {leftSon, rootNode, rightSon};
+    }
+    return parts;
+}
+
+/*
+ *  SplitTree by position: splitNode is the EqualNode and no comparisons are made. The walk goes up
+ *  the PreviousNode links of its detached tree, so the subtrees are joined in the same bottom-up
+ *  order as on the way back of SplitTree and the joins telescope to O(log n).
+ */
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+typename TAATree<TValueType, TCompare, TAllocator, TTraits>::TSplitResult TAATree<TValueType, TCompare, TAllocator, TTraits>::SplitAtNode(
+    TNodeType* splitNode
+) const {
+    TSplitResult parts{DetachNode(splitNode->LeftNode), splitNode, DetachNode(splitNode->RightNode)};
+    TNodeType* childNode = splitNode;
+    TNodeType* parentNode = splitNode->PreviousNode;
+    splitNode->PreviousNode = nullptr;
+    splitNode->LeftNode = nullptr;
+    splitNode->RightNode = nullptr;
+    while (parentNode != nullptr) {
+        TNodeType* grandparentNode = parentNode->PreviousNode;
+        if (parentNode->LeftNode == childNode) {
+            parts.GreaterRoot = JoinTrees(parts.GreaterRoot, parentNode, DetachNode(parentNode->RightNode));
+        } else {
+            parts.LessRoot = JoinTrees(DetachNode(parentNode->LeftNode), parentNode, parts.LessRoot);
+        }
+        childNode = parentNode;
+        parentNode = grandparentNode;
+    }
+    return parts;
+}
+
+/*
+ *  Detaches the nodes of [firstNode, lastNode) as one tree, lastNode == nullptr means up to the end.
+ *
+ *        SplitAtNode(lastNode):   L1  |  lastNode  |  G1
+ *        SplitAtNode(firstNode):  L2  |  firstNode  |  G2       (inside L1)
+ *
+ *        cut tree:    JoinTrees(nullptr, firstNode, G2)
+ *        this tree:   JoinTrees(L2, lastNode, G1)
+ */
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+typename TAATree<TValueType, TCompare, TAllocator, TTraits>::TNodeType* TAATree<TValueType, TCompare, TAllocator, TTraits>::CutRange(
+      TNodeType* firstNode
+    , TNodeType* lastNode
+    , size_t& cutCount
+    , size_t& cutDeadCount
+) {
+    cutCount = 0;
+    cutDeadCount = 0;
+    if (firstNode == lastNode) {
+        return nullptr;
+    }
+    // Both ends of the range are live, so the live nodes left at the ends are known without a walk from the ends
+    TNodeType* leftmostNode = (firstNode == Leftmost_ ? lastNode : Leftmost_);
+    TNodeType* rightmostNode = Rightmost_;
+    if (lastNode == nullptr) {
+        rightmostNode = (firstNode == Leftmost_ ? nullptr : PreviousLive(PreviousInOrder(firstNode)));
+    }
+    TSplitResult upperParts;
+    if (lastNode != nullptr) {
+        upperParts = SplitAtNode(lastNode);
+    } else {
+        upperParts.LessRoot = Root_;
+    }
+    TSplitResult lowerParts = SplitAtNode(firstNode);
+    TNodeType* cutRoot = JoinTrees(nullptr, firstNode, lowerParts.GreaterRoot);
+    TNodeType* rootNode = lowerParts.LessRoot;
+    if (lastNode != nullptr) {
+        rootNode = JoinTrees(rootNode, lastNode, upperParts.GreaterRoot);
+    }
+    cutCount = CountNodes(cutRoot);
+    if constexpr (TTraits::LazyErase) {
+        for (TNodeType* currentNode = firstNode; currentNode != nullptr; currentNode = NextInOrder(currentNode)) {
+            if (IsDead(currentNode)) {
+                ++cutDeadCount;
+            }
+        }
+        cutCount -= cutDeadCount;
+        DeadCount_ -= cutDeadCount;
+    }
+    Root_ = rootNode;
+    Size_ -= cutCount;
+    Leftmost_ = leftmostNode;
+    Rightmost_ = rightmostNode;
+    Stats_.OnLevel(LevelOf(rootNode));
+    return cutRoot;
+}
+
+/*
+ *  Set algebra on detached trees: the left root splits the right tree, both halves are solved
+ *  recursively and joined back around the left root. Nodes of the left tree win on equal keys.
+ *  commonCount gets the number of keys found in both trees.
+ */
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+typename TAATree<TValueType, TCompare, TAllocator, TTraits>::TNodeType* TAATree<TValueType, TCompare, TAllocator, TTraits>::UnionTrees(
+      TNodeType* leftRoot
+    , TNodeType* rightRoot
+    , size_t& commonCount
+    , TThreadPool* pool
+) {
+    if (leftRoot == nullptr) {
+        return rightRoot;
+    }
+    if (rightRoot == nullptr) {
+        return leftRoot;
+    }
+    TNodeType* leftSon = DetachNode(leftRoot->LeftNode);
+    TNodeType* rightSon = DetachNode(leftRoot->RightNode);
+    bool isForked = (std::min(leftRoot->Level, rightRoot->Level) >= ParallelGrainLevel);
+    TSplitResult parts = SplitTree(rightRoot, leftRoot->Value);
+    if (parts.EqualNode != nullptr) {
+        DestroyNode(parts.EqualNode);
+        ++commonCount;
+    }
+    TNodeType* lessRoot = nullptr;
+    TNodeType* greaterRoot = nullptr;
+    size_t greaterCount = 0;
+    ForkJoin(
+          pool
+        , isForked
+        , [&] { lessRoot = UnionTrees(leftSon, parts.LessRoot, commonCount, pool); }
+        , [&] { greaterRoot = UnionTrees(rightSon, parts.GreaterRoot, greaterCount, pool); }
+    );
+    commonCount += greaterCount;
+    return JoinTrees(lessRoot, leftRoot, greaterRoot);
+}
+
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+typename TAATree<TValueType, TCompare, TAllocator, TTraits>::TNodeType* TAATree<TValueType, TCompare, TAllocator, TTraits>::IntersectTrees(
+      TNodeType* leftRoot
+    , TNodeType* rightRoot
+    , size_t& commonCount
+    , TThreadPool* pool
+) {
+    if (leftRoot == nullptr || rightRoot == nullptr) {
+        DestroyTree(leftRoot, pool);
+        DestroyTree(rightRoot, pool);
+        return nullptr;
+    }
+    TNodeType* leftSon = DetachNode(leftRoot->LeftNode);
+    TNodeType* rightSon = DetachNode(leftRoot->RightNode);
+    bool isForked = (std::min(leftRoot->Level, rightRoot->Level) >= ParallelGrainLevel);
+    TSplitResult parts = SplitTree(rightRoot, leftRoot->Value);
+    TNodeType* lessRoot = nullptr;
+    TNodeType* greaterRoot = nullptr;
+    size_t greaterCount = 0;
+    ForkJoin(
+          pool
+        , isForked
+        , [&] { lessRoot = IntersectTrees(leftSon, parts.LessRoot, commonCount, pool); }
+        , [&] { greaterRoot = IntersectTrees(rightSon, parts.GreaterRoot, greaterCount, pool); }
+    );
+    commonCount += greaterCount;
+    if (parts.EqualNode == nullptr) {
+        DestroyNode(leftRoot);
+        return ConcatTrees(lessRoot, greaterRoot);
+    }
+    DestroyNode(parts.EqualNode);
+    ++commonCount;
+    return JoinTrees(lessRoot, leftRoot, greaterRoot);
+}
+
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+typename TAATree<TValueType, TCompare, TAllocator, TTraits>::TNodeType* TAATree<TValueType, TCompare, TAllocator, TTraits>::SubtractTrees(
+      TNodeType* leftRoot
+    , TNodeType* rightRoot
+    , size_t& commonCount
+    , TThreadPool* pool
+) {
+    if (leftRoot == nullptr || rightRoot == nullptr) {
+        DestroyTree(rightRoot, pool);
+        return leftRoot;
+    }
+    TNodeType* leftSon = DetachNode(leftRoot->LeftNode);
+    TNodeType* rightSon = DetachNode(leftRoot->RightNode);
+    bool isForked = (std::min(leftRoot->Level, rightRoot->Level) >= ParallelGrainLevel);
+    TSplitResult parts = SplitTree(rightRoot, leftRoot->Value);
+    TNodeType* lessRoot = nullptr;
+    TNodeType* greaterRoot = nullptr;
+    size_t greaterCount = 0;
+    ForkJoin(
+          pool
+        , isForked
+        , [&] { lessRoot = SubtractTrees(leftSon, parts.LessRoot, commonCount, pool); }
+        , [&] { greaterRoot = SubtractTrees(rightSon, parts.GreaterRoot, greaterCount, pool); }
+    );
+    commonCount += greaterCount;
+    if (parts.EqualNode == nullptr) {
+        return JoinTrees(lessRoot, leftRoot, greaterRoot);
     }
+    DestroyNode(parts.EqualNode);
+    DestroyNode(leftRoot);
+    ++commonCount;
+    return ConcatTrees(lessRoot, greaterRoot);
+}
 
-    for(auto currentValue : set) {
-        insert(currentValue);
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+typename TAATree<TValueType, TCompare, TAllocator, TTraits>::TNodeType* TAATree<TValueType, TCompare, TAllocator, TTraits>::DetachNode(
+    TNodeType* currentNode
+) {
+    if (currentNode != nullptr) {
+        currentNode->PreviousNode = nullptr;
     }
+    return currentNode;
+}
 
-    return *this;
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+uint32_t TAATree<TValueType, TCompare, TAllocator, TTraits>::LevelOf(const TNodeType* currentNode) {
+    return (currentNode != nullptr ? currentNode->Level : 0);
 }
 
-template<class TValueType>
-size_t Set<TValueType>::size() const {
-    return Size_;
+// O(1) with subtree sizes, otherwise an in-order walk of the detached tree
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+size_t TAATree<TValueType, TCompare, TAllocator, TTraits>::CountNodes(TNodeType* rootNode) {
+    if constexpr (TTraits::CountSubtreeSize) {
+        return SubtreeSize(rootNode);
+    } else {
+        size_t count = 0;
+        if (rootNode == nullptr) {
+            return count;
+        }
+        while (rootNode->LeftNode != nullptr) {
+            rootNode = rootNode->LeftNode;
+        }
+        for (TNodeType* currentNode = rootNode; currentNode != nullptr; currentNode = NextInOrder(currentNode)) {
+            ++count;
+        }
+        return count;
+    }
 }
 
-template<class TValueType>
-bool Set<TValueType>::empty() const {
-    return (Size_ == 0);
+/*
+ *  Pre-order walk over the links without a stack, visitor(node, depth) with depth 1 at the root.
+ *  The walk stops when the visitor returns false or a son does not point back to its parent,
+ *  so it also ends on a broken tree whose root has no parent.
+ */
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+template<class TVisitor>
+bool TAATree<TValueType, TCompare, TAllocator, TTraits>::VisitNodes(TVisitor&& visitor) const {
+    const TNodeType* previousNode = nullptr;
+    const TNodeType* currentNode = Root_;
+    size_t depth = 1;
+    while (currentNode != nullptr) {
+        const TNodeType* nextNode = nullptr;
+        if (previousNode == currentNode->PreviousNode) {
+            if (!visitor(currentNode, depth)) {
+                return false;
+            }
+            nextNode = (currentNode->LeftNode != nullptr ? currentNode->LeftNode : currentNode->RightNode);
+        } else if (previousNode == currentNode->LeftNode) {
+            nextNode = currentNode->RightNode;
+        }
+        if (nextNode != nullptr) {
+            if (nextNode->PreviousNode != currentNode) {
+                return false;
+            }
+            ++depth;
+        } else {
+            nextNode = currentNode->PreviousNode;
+            --depth;
+        }
+        previousNode = currentNode;
+        currentNode = nextNode;
+    }
+    return true;
 }
 
-template<class TValueType>
-typename Set<TValueType>::iterator Set<TValueType>::begin() const {
-    if (Root_ == nullptr) {
-        return end();
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+typename TAATree<TValueType, TCompare, TAllocator, TTraits>::TNodeType* TAATree<TValueType, TCompare, TAllocator, TTraits>::Predecessor(
+    TNodeType* currentNode
+) {
+    currentNode = currentNode->LeftNode;
+    while (currentNode->RightNode != nullptr) {
+        currentNode = currentNode->RightNode;
     }
-    TNode<TValueType>* currentNode = Root_;
+    return currentNode;
+}
+
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+typename TAATree<TValueType, TCompare, TAllocator, TTraits>::TNodeType* TAATree<TValueType, TCompare, TAllocator, TTraits>::Successor(
+    TNodeType* currentNode
+) {
+    currentNode = currentNode->RightNode;
     while (currentNode->LeftNode != nullptr) {
         currentNode = currentNode->LeftNode;
     }
-    return iterator(this, currentNode);
+    return currentNode;
 }
 
-template<class TValueType>
-typename Set<TValueType>::iterator Set<TValueType>::end() const {
-    return iterator(this);
+// In-order neighbours are found by pointer identity of the sons, values are never compared
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+typename TAATree<TValueType, TCompare, TAllocator, TTraits>::TNodeType* TAATree<TValueType, TCompare, TAllocator, TTraits>::NextInOrder(
+    TNodeType* currentNode
+) {
+    if (currentNode->RightNode != nullptr) {
+        return Successor(currentNode);
+    }
+    while (currentNode->PreviousNode != nullptr && currentNode->PreviousNode->RightNode == currentNode) {
+        currentNode = currentNode->PreviousNode;
+    }
+    return currentNode->PreviousNode;
 }
 
-template<class TValueType>
-typename Set<TValueType>::iterator Set<TValueType>::lower_bound(const TValueType& wantedValue) const {
-    TNode<TValueType>* currentNode = Root_;
-    while(currentNode != nullptr) {
-        if(currentNode->Value < wantedValue) {
-            if (currentNode->RightNode == nullptr) {
-                return ++iterator(this, currentNode);
-            }
-            currentNode = currentNode->RightNode;
-        } else {
-            if (currentNode->LeftNode != nullptr && wantedValue < currentNode->Value) {
-                currentNode = currentNode->LeftNode;
-            } else {
-                break;
-            }
-        }
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+typename TAATree<TValueType, TCompare, TAllocator, TTraits>::TNodeType* TAATree<TValueType, TCompare, TAllocator, TTraits>::PreviousInOrder(
+    TNodeType* currentNode
+) {
+    if (currentNode->LeftNode != nullptr) {
+        return Predecessor(currentNode);
     }
-    return iterator(this, currentNode);
+    while (currentNode->PreviousNode != nullptr && currentNode->PreviousNode->LeftNode == currentNode) {
+        currentNode = currentNode->PreviousNode;
+    }
+    return currentNode->PreviousNode;
 }
 
-template<class TValueType>
-typename Set<TValueType>::iterator Set<TValueType>::find(const TValueType& wantedValue) const {
-    iterator iter = lower_bound(wantedValue);
-    if (iter != end() && (!(*iter < wantedValue) && !(wantedValue < *iter))) {
-        return iter;
-    }
-    return end();
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+bool TAATree<TValueType, TCompare, TAllocator, TTraits>::IsLeaf(TNodeType* currentNode) {
+    return (currentNode != nullptr && currentNode->LeftNode == nullptr && currentNode->RightNode == nullptr);
 }
 
-template<class TValueType>
-void Set<TValueType>::insert(const TValueType& insertedValue) {
-    Root_ = Insert(Root_, insertedValue);
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+template<typename Iterator>
+void TAATree<TValueType, TCompare, TAllocator, TTraits>::Assign(Iterator first, Iterator last) {
+    using TCategory = typename std::iterator_traits<Iterator>::iterator_category;
+    if constexpr (std::is_base_of_v<std::forward_iterator_tag, TCategory>) {
+        if (std::is_sorted(first, last, CountingCompare())) {
+            BuildSorted(first, last);
+            return;
+        }
+    }
+    while (first != last) {
+        Insert(FindInsertPosition(*first), *first);
+        ++first;
+    }
 }
 
-template<class TValueType>
-void Set<TValueType>::erase(const TValueType& erasedValue) {
-    Root_ = Erase(Root_, erasedValue);
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+template<typename Iterator>
+void TAATree<TValueType, TCompare, TAllocator, TTraits>::BuildSorted(Iterator first, Iterator last, TThreadPool* pool) {
+    std::vector<TNodeType*> nodes;
+    if constexpr (std::is_base_of_v<std::random_access_iterator_tag, typename std::iterator_traits<Iterator>::iterator_category>) {
+        if (pool != nullptr) {
+            // Every value starts a node unless it equals its neighbour on the left
+            nodes.assign(last - first, nullptr);
+            try {
+                pool->ParallelFor(0, nodes.size(), ParallelGrainSize, [&](size_t begin, size_t end) {
+                    for (size_t index = begin; index < end; ++index) {
+                        if (TTraits::IsMulti || index == 0 || Less(first[index - 1], first[index])) {
+                            nodes[index] = CreateNode(first[index]);
+                        }
+                    }
+                });
+            } catch (...) {
+                for (TNodeType* currentNode : nodes) {
+                    if (currentNode != nullptr) {
+                        DestroyNode(currentNode);
+                    }
+                }
+                throw;
+            }
+            nodes.erase(std::remove(nodes.begin(), nodes.end(), nullptr), nodes.end());
+            RebuildFromNodes(nodes, pool);
+            return;
+        }
+    }
+    if constexpr (std::is_base_of_v<std::forward_iterator_tag, typename std::iterator_traits<Iterator>::iterator_category>) {
+        nodes.reserve(std::distance(first, last));
+    }
+    try {
+        for (; first != last; ++first) {
+            if (!TTraits::IsMulti && !nodes.empty() && !Less(nodes.back()->Value, *first)) {
+                continue;
+            }
+            nodes.push_back(CreateNode(*first));
+        }
+    } catch (...) {
+        for (TNodeType* currentNode : nodes) {
+            DestroyNode(currentNode);
+        }
+        throw;
+    }
+    RebuildFromNodes(nodes);
 }
 
 /*
- *  ==================================================================================
- *                                    Skew(node D)
- *  ==================================================================================
- *
- *                             |                        |
- *                             |                        |
- *        node B <—————————— node D                   node B  ——————————> node D
- *        /   \                  \         ==>        /                   /   \
- *       /     \                  \                  /                   /     \
- *      /       \                  \                /                   /       \
- *   node A    node C            node F           node A             node C    node F
- *  ==================================================================================
- *                             Elimination of the left son
- *  ==================================================================================
+ *  Links nodes given in order into a perfectly balanced AA tree.
+ *  The middle node of n becomes the root with level floor(log2(n + 1)): the left part gets
+ *  exactly one level less, the right part one level less or the same level with a lower right son.
  */
-template<class TValueType>
-TNode<TValueType>* Set<TValueType>::Skew(TNode<TValueType>* currentNode) {
-    if (
-           currentNode == nullptr
-        || currentNode->LeftNode == nullptr
-        || currentNode->Level != currentNode->LeftNode->Level
-    ) {
-        return currentNode;
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+typename TAATree<TValueType, TCompare, TAllocator, TTraits>::TNodeType* TAATree<TValueType, TCompare, TAllocator, TTraits>::LinkBalanced(
+      TNodeType** nodes
+    , size_t count
+    , TNodeType* previousNode
+    , TThreadPool* pool
+) {
+    if (count == 0) {
+        return nullptr;
     }
-
-    auto* bufferNode = new TNode<TValueType>(
-          currentNode->LeftNode->Value
-        , currentNode->LeftNode->Level
-        , currentNode->PreviousNode
-        , currentNode->LeftNode->LeftNode
-        , new TNode<TValueType>(
-              currentNode->Value
-            , currentNode->Level
-            , nullptr
-            , currentNode->LeftNode->RightNode
-            , currentNode->RightNode
-        )
+    size_t middle = (count - 1) / 2;
+    TNodeType* currentNode = nodes[middle];
+    currentNode->PreviousNode = previousNode;
+    currentNode->Level = 0;
+    for (size_t width = count + 1; width > 1; width >>= 1) {
+        ++currentNode->Level;
+    }
+    ForkJoin(
+          pool
+        , count >= ParallelGrainSize
+        , [&] { currentNode->LeftNode = LinkBalanced(nodes, middle, currentNode, pool); }
+        , [&] { currentNode->RightNode = LinkBalanced(nodes + middle + 1, count - middle - 1, currentNode, pool); }
     );
-    bufferNode->RightNode->PreviousNode = bufferNode;
-    if (bufferNode->RightNode->LeftNode != nullptr) {
-        bufferNode->RightNode->LeftNode->PreviousNode = bufferNode->RightNode;
+    UpdateSubtreeSize(currentNode);
+    return currentNode;
+}
+
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+template<typename Iterator>
+void TAATree<TValueType, TCompare, TAllocator, TTraits>::CreateNodes(
+      Iterator first
+    , Iterator last
+    , std::vector<TNodeType*>& nodes
+    , TThreadPool* pool
+) {
+    if constexpr (std::is_base_of_v<std::random_access_iterator_tag, typename std::iterator_traits<Iterator>::iterator_category>) {
+        if (pool != nullptr) {
+            nodes.assign(last - first, nullptr);
+            try {
+                pool->ParallelFor(0, nodes.size(), ParallelGrainSize, [&](size_t begin, size_t end) {
+                    for (size_t index = begin; index < end; ++index) {
+                        nodes[index] = CreateNode(first[index]);
+                    }
+                });
+            } catch (...) {
+                for (TNodeType* currentNode : nodes) {
+                    if (currentNode != nullptr) {
+                        DestroyNode(currentNode);
+                    }
+                }
+                throw;
+            }
+            return;
+        }
+    }
+    try {
+        if constexpr (std::is_base_of_v<std::forward_iterator_tag, typename std::iterator_traits<Iterator>::iterator_category>) {
+            nodes.reserve(std::distance(first, last));
+        }
+        for (; first != last; ++first) {
+            nodes.push_back(CreateNode(*first));
+        }
+    } catch (...) {
+        for (TNodeType* currentNode : nodes) {
+            DestroyNode(currentNode);
+        }
+        throw;
+    }
+}
+
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+template<typename Iterator>
+size_t TAATree<TValueType, TCompare, TAllocator, TTraits>::InsertBatch(Iterator first, Iterator last, TThreadPool* pool) {
+    static_assert(!TTraits::IsMulti, "insert_batch() needs unique keys");
+    compact();
+    // All nodes are built up front, so a throwing allocation or constructor leaves the set untouched
+    std::vector<TNodeType*> nodes;
+
+    std::vector<TNodeType*> treeNodes;
+    bool isRebuilt = false;
+    auto compareNodes = [this](const TNodeType* leftNode, const TNodeType* rightNode) {
+        return Less(leftNode->Value, rightNode->Value);
+    };
+    CreateNodes(first, last, nodes, pool);
+    try {
+        // Stable, so that the first of equal values wins as with one insert() after another
+        if (!std::is_sorted(nodes.begin(), nodes.end(), compareNodes)) {
+            std::stable_sort(nodes.begin(), nodes.end(), compareNodes);
+        }
+        isRebuilt = (nodes.size() * BatchRebuildRatio >= Size_);
+        if (isRebuilt) {
+            treeNodes.reserve(Size_ + nodes.size());
+            CollectNodes(treeNodes);
+        }
+    } catch (...) {
+        for (TNodeType* currentNode : nodes) {
+            DestroyNode(currentNode);
+        }
+        throw;
     }
-    if (bufferNode->RightNode->RightNode != nullptr) {
-        bufferNode->RightNode->RightNode->PreviousNode = bufferNode->RightNode;
+
+    size_t uniqueCount = 0;
+    for (TNodeType* currentNode : nodes) {
+        if (uniqueCount != 0 && !Less(nodes[uniqueCount - 1]->Value, currentNode->Value)) {
+            DestroyNode(currentNode);
+        } else {
+            nodes[uniqueCount++] = currentNode;
+        }
     }
-    if (bufferNode->LeftNode != nullptr) {
-        bufferNode->LeftNode->PreviousNode = bufferNode;
+    nodes.resize(uniqueCount);
+
+    if (!isRebuilt) {
+        size_t insertedCount = 0;
+        TNodeType* rootNode = InsertSortedNodes(Root_, nodes.data(), nodes.data() + nodes.size(), insertedCount, pool);
+        ResetTree(rootNode, Size_ + insertedCount);
+        return insertedCount;
     }
-    delete currentNode->LeftNode;
-    delete currentNode;
 
-    return bufferNode;
+    // Merge-rebuild: the tree nodes win on equal keys
+    size_t treeSize = treeNodes.size();
+    treeNodes.resize(treeSize + nodes.size());
+    auto treeEnd = treeNodes.begin() + treeSize;
+    // The tree nodes are moved to the back, the merge then fills the vector from the front
+    auto treeFirst = std::copy_backward(treeNodes.begin(), treeEnd, treeNodes.end());
+    auto outputIterator = treeNodes.begin();
+    size_t insertedCount = 0;
+    for (TNodeType* batchNode : nodes) {
+        while (treeFirst != treeNodes.end() && Less((*treeFirst)->Value, batchNode->Value)) {
+            *outputIterator++ = *treeFirst++;
+        }
+        if (treeFirst != treeNodes.end() && !Less(batchNode->Value, (*treeFirst)->Value)) {
+            DestroyNode(batchNode);
+        } else {
+            *outputIterator++ = batchNode;
+            ++insertedCount;
+        }
+    }
+    outputIterator = std::copy(treeFirst, treeNodes.end(), outputIterator);
+    treeNodes.erase(outputIterator, treeNodes.end());
+    RebuildFromNodes(treeNodes, pool);
+    return insertedCount;
 }
 
-/*
- *  ==================================================================================
- *                                    Split(node B)
- *  ==================================================================================
- *
- *                                                                     |
- *          |                                                          |
- *          |                                                        node C
- *        node B  ——> node C  ——> node E                             /   \
- *        /           /                         ==>                 /     \
- *       /           /                                             /       \
- *      /           /                                           node B    node E
- *   node A      node D                                         /   \
- *                                                             /     \
- *                                                            /       \
- *                                                         node A    node D
- *  ==================================================================================
- *                 Elimination of two consecutive right horizontal edges
- *  ==================================================================================
- */
-template<class TValueType>
-TNode<TValueType>* Set<TValueType>::Split(TNode<TValueType>* currentNode) {
-    if (
-           currentNode == nullptr
-        || currentNode->RightNode == nullptr
-        || currentNode->RightNode->RightNode == nullptr
-        || currentNode->Level != currentNode->RightNode->RightNode->Level
-    ) {
-        return currentNode;
+
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+void TAATree<TValueType, TCompare, TAllocator, TTraits>::CollectNodes(std::vector<TNodeType*>& nodes) const {
+    for (TNodeType* currentNode = FirstNode(); currentNode != nullptr; currentNode = NextInOrder(currentNode)) {
+        nodes.push_back(currentNode);
     }
+}
 
-    auto* bufferNode = new TNode<TValueType>(
-          currentNode->RightNode->Value
-        , currentNode->RightNode->Level + 1
-        , currentNode->PreviousNode
-        , new TNode<TValueType>(
-              currentNode->Value
-            , currentNode->Level
-            , nullptr
-            , currentNode->LeftNode
-            , currentNode->RightNode->LeftNode
-        )
-        , currentNode->RightNode->RightNode
-    );
-    bufferNode->LeftNode->PreviousNode = bufferNode;
-    if (bufferNode->RightNode != nullptr) {
-        bufferNode->RightNode->PreviousNode = bufferNode;
+// The nodes must be all nodes of the set in order, possibly with some of them destroyed and dropped
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+void TAATree<TValueType, TCompare, TAllocator, TTraits>::RebuildFromNodes(std::vector<TNodeType*>& nodes, TThreadPool* pool) {
+    Root_ = LinkBalanced(nodes.data(), nodes.size(), nullptr, pool);
+    Stats_.OnLevel(LevelOf(Root_));
+    Size_ = nodes.size();
+    Leftmost_ = (nodes.empty() ? nullptr : nodes.front());
+    Rightmost_ = (nodes.empty() ? nullptr : nodes.back());
+}
+
+// Sorted unique nodes are spread over the subtrees by binary search and joined back around each root
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+typename TAATree<TValueType, TCompare, TAllocator, TTraits>::TNodeType* TAATree<TValueType, TCompare, TAllocator, TTraits>::InsertSortedNodes(
+      TNodeType* rootNode
+    , TNodeType** first
+    , TNodeType** last
+    , size_t& insertedCount
+    , TThreadPool* pool
+) {
+    if (first == last) {
+        return rootNode;
     }
-    if (bufferNode->LeftNode->RightNode != nullptr) {
-        bufferNode->LeftNode->RightNode->PreviousNode = bufferNode->LeftNode;
+    if (rootNode == nullptr) {
+        insertedCount += last - first;
+        return LinkBalanced(first, last - first, nullptr, pool);
     }
-    if (bufferNode->LeftNode->LeftNode != nullptr) {
-        bufferNode->LeftNode->LeftNode->PreviousNode = bufferNode->LeftNode;
+    TNodeType* leftSon = DetachNode(rootNode->LeftNode);
+    TNodeType* rightSon = DetachNode(rootNode->RightNode);
+    TNodeType** middle = std::lower_bound(first, last, rootNode, [this](const TNodeType* leftNode, const TNodeType* rightNode) {
+        return Less(leftNode->Value, rightNode->Value);
+    });
+    TNodeType** rightFirst = middle;
+    if (middle != last && !Less(rootNode->Value, (*middle)->Value)) {
+        DestroyNode(*middle);
+        ++rightFirst;
     }
-    delete currentNode->RightNode;
-    delete currentNode;
+    TNodeType* lessRoot = nullptr;
+    TNodeType* greaterRoot = nullptr;
+    size_t greaterCount = 0;
+    ForkJoin(
+          pool
+        , rootNode->Level >= ParallelGrainLevel && size_t(last - first) >= ParallelGrainSize
+        , [&] { lessRoot = InsertSortedNodes(leftSon, first, middle, insertedCount, pool); }
+        , [&] { greaterRoot = InsertSortedNodes(rightSon, rightFirst, last, greaterCount, pool); }
+    );
+    insertedCount += greaterCount;
+    return JoinTrees(lessRoot, rootNode, greaterRoot);
+}
 
-    return bufferNode;
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+typename TAATree<TValueType, TCompare, TAllocator, TTraits>::TNodeType* TAATree<TValueType, TCompare, TAllocator, TTraits>::EraseSortedKeys(
+      TNodeType* rootNode
+    , const key_type* first
+    , const key_type* last
+    , size_t& erasedCount
+) {
+    if (rootNode == nullptr || first == last) {
+        return rootNode;
+    }
+    TNodeType* leftSon = DetachNode(rootNode->LeftNode);
+    TNodeType* rightSon = DetachNode(rootNode->RightNode);
+    const key_type* middle = std::lower_bound(first, last, rootNode->Value, CountingCompare());
+    bool isErased = (middle != last && !Less(rootNode->Value, *middle));
+    TNodeType* lessRoot = EraseSortedKeys(leftSon, first, middle, erasedCount);
+    TNodeType* greaterRoot = EraseSortedKeys(rightSon, (isErased ? middle + 1 : middle), last, erasedCount);
+    if (isErased) {
+        DestroyNode(rootNode);
+        ++erasedCount;
+        return ConcatTrees(lessRoot, greaterRoot);
+    }
+    return JoinTrees(lessRoot, rootNode, greaterRoot);
 }
 
-template<class TValueType>
-TNode<TValueType>* Set<TValueType>::Insert(TNode<TValueType>* currentNode, const TValueType& insertedValue) {
-    if (currentNode == nullptr) {
-        ++Size_;
-        return new TNode<TValueType>(
-              insertedValue
-            , 1
-            , nullptr
-            , nullptr
-            , nullptr
-        );
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+typename TAATree<TValueType, TCompare, TAllocator, TTraits>::TNodeType* TAATree<TValueType, TCompare, TAllocator, TTraits>::CloneTree(
+      const TNodeType* sourceNode
+    , TNodeType* previousNode
+) {
+    if (sourceNode == nullptr) {
+        return nullptr;
     }
-    if (insertedValue < currentNode->Value) {
-        currentNode->LeftNode = Insert(currentNode->LeftNode, insertedValue);
-        if (currentNode->LeftNode != nullptr) {
-            currentNode->LeftNode->PreviousNode = currentNode;
-        }
+    TNodeType* currentNode = CreateNode(sourceNode->Value);
+    currentNode->Level = sourceNode->Level;
+    if constexpr (TTraits::LazyErase) {
+        currentNode->IsDead = sourceNode->IsDead;
     }
-    if (currentNode->Value < insertedValue) {
-        currentNode->RightNode = Insert(currentNode->RightNode, insertedValue);
-        if (currentNode->RightNode != nullptr) {
-            currentNode->RightNode->PreviousNode = currentNode;
-        }
+    currentNode->PreviousNode = previousNode;
+    try {
+        currentNode->LeftNode = CloneTree(sourceNode->LeftNode, currentNode);
+        currentNode->RightNode = CloneTree(sourceNode->RightNode, currentNode);
+    } catch (...) {
+        DestroyTree(currentNode);
+        throw;
     }
-    currentNode = Skew(currentNode);
-    currentNode = Split(currentNode);
+    UpdateSubtreeSize(currentNode);
     return currentNode;
 }
 
-template<class TValueType>
-TNode<TValueType>* Set<TValueType>::Erase(TNode<TValueType>* currentNode, const TValueType& erasedValue) {
-    if (currentNode == nullptr) {
-        return currentNode;
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+template<class... TArgs>
+typename TAATree<TValueType, TCompare, TAllocator, TTraits>::TNodeType* TAATree<TValueType, TCompare, TAllocator, TTraits>::CreateNode(
+    TArgs&&... args
+) {
+    TNodeType* currentNode = TNodeAllocatorTraits::allocate(Allocator_, 1);
+    try {
+        TNodeAllocatorTraits::construct(Allocator_, currentNode, std::in_place, std::forward<TArgs>(args)...);
+    } catch (...) {
+        TNodeAllocatorTraits::deallocate(Allocator_, currentNode, 1);
+        throw;
+    }
+    Stats_.OnAllocate();
+    return currentNode;
+}
+
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+void TAATree<TValueType, TCompare, TAllocator, TTraits>::DestroyNode(TNodeType* currentNode) {
+    Stats_.OnFree();
+    TNodeAllocatorTraits::destroy(Allocator_, currentNode);
+    TNodeAllocatorTraits::deallocate(Allocator_, currentNode, 1);
+}
+
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+void TAATree<TValueType, TCompare, TAllocator, TTraits>::DestroyTree(TNodeType* currentNode) {
+    // Arena memory goes away with the slabs, trivial values need no destructor calls.
+    // Counted frees still walk the subtree, so NodeFrees keeps up with NodeAllocations
+    if constexpr (
+           TIsMonotonicAllocator<TNodeAllocator>::value
+        && std::is_trivially_destructible_v<TValueType>
+        && !TStats::IsEnabled
+    ) {
+        return;
     }
-    if (erasedValue < currentNode->Value) {
-        currentNode->LeftNode = Erase(currentNode->LeftNode, erasedValue);
+    // Post-order walk over PreviousNode links, no recursion and no extra memory.
+    // The link from the parent of the subtree is left for the caller.
+    TNodeType* stopNode = (currentNode != nullptr ? currentNode->PreviousNode : nullptr);
+    while (currentNode != stopNode) {
         if (currentNode->LeftNode != nullptr) {
-            currentNode->LeftNode->PreviousNode = currentNode;
-        }
-    } else {
-        if (currentNode->Value < erasedValue) {
-            currentNode->RightNode = Erase(currentNode->RightNode, erasedValue);
-            if (currentNode->RightNode != nullptr) {
-                currentNode->RightNode->PreviousNode = currentNode;
-            }
+            currentNode = currentNode->LeftNode;
+        } else if (currentNode->RightNode != nullptr) {
+            currentNode = currentNode->RightNode;
         } else {
-            if (IsLeaf(currentNode)) {
-                delete currentNode;
-                --Size_;
-                return nullptr;
-            }
-            if (currentNode->LeftNode == nullptr) {
-                TValueType successorValue = Successor(currentNode)->Value;
-                currentNode->RightNode = Erase(currentNode->RightNode, successorValue);
-                if (currentNode->RightNode != nullptr) {
-                    currentNode->RightNode->PreviousNode = currentNode;
+            TNodeType* parentNode = currentNode->PreviousNode;
+            if (parentNode != stopNode) {
+                if (parentNode->LeftNode == currentNode) {
+                    parentNode->LeftNode = nullptr;
+                } else {
+                    parentNode->RightNode = nullptr;
                 }
-                currentNode->Value = successorValue;
-            } else {
-                TValueType predecessorValue = Predecessor(currentNode)->Value;
-                currentNode->LeftNode = Erase(currentNode->LeftNode, predecessorValue);
-                if (currentNode->LeftNode != nullptr) {
-                    currentNode->LeftNode->PreviousNode = currentNode;
-                }
-                currentNode->Value = predecessorValue;
             }
+            DestroyNode(currentNode);
+            currentNode = parentNode;
         }
     }
-
-    currentNode = DecreaseLevel(currentNode);
-    currentNode = Skew(currentNode);
-    currentNode->RightNode = Skew(currentNode->RightNode);
-    if (currentNode->RightNode != nullptr) {
-        currentNode->RightNode->RightNode = Skew(currentNode->RightNode->RightNode);
-    }
-    currentNode = Split(currentNode);
-    currentNode->RightNode = Split(currentNode->RightNode);
-    return currentNode;
 }
 
-template<class TValueType>
-TNode<TValueType>* Set<TValueType>::DecreaseLevel(TNode<TValueType>* currentNode) {
-    if (currentNode->LeftNode != nullptr && currentNode->RightNode != nullptr) {
-        uint32_t expectedLevel = std::min(currentNode->LeftNode->Level, currentNode->RightNode->Level) + 1;
-        if (expectedLevel < currentNode->Level) {
-            currentNode->Level = expectedLevel;
-            if (expectedLevel < currentNode->RightNode->Level) {
-                currentNode->RightNode->Level = expectedLevel;
-            }
-        }
+// Subtrees below ParallelGrainLevel are left to the serial walk
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+void TAATree<TValueType, TCompare, TAllocator, TTraits>::DestroyTree(TNodeType* currentNode, TThreadPool* pool) {
+    if (pool == nullptr || currentNode == nullptr || currentNode->Level < ParallelGrainLevel) {
+        DestroyTree(currentNode);
+        return;
     }
-    return currentNode;
+    TNodeType* leftSon = DetachNode(currentNode->LeftNode);
+    TNodeType* rightSon = DetachNode(currentNode->RightNode);
+    pool->ForkJoin(
+          [&] { DestroyTree(leftSon, pool); }
+        , [&] { DestroyTree(rightSon, pool); }
+    );
+    DestroyNode(currentNode);
 }
 
-template<class TValueType>
-TNode<TValueType>* Set<TValueType>::Predecessor(TNode<TValueType>* currentNode) {
-    currentNode = currentNode->LeftNode;
-    while (currentNode->RightNode != nullptr) {
-        currentNode = currentNode->RightNode;
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+TThreadPool* TAATree<TValueType, TCompare, TAllocator, TTraits>::ParallelPool(TThreadPool& pool) {
+    if constexpr (TIsThreadSafeAllocator<TNodeAllocator>::value) {
+        return &pool;
+    } else {
+        return nullptr;
     }
-    return currentNode;
 }
 
-template<class TValueType>
-TNode<TValueType>* Set<TValueType>::Successor(TNode<TValueType>* currentNode) {
-    currentNode = currentNode->RightNode;
-    while (currentNode->LeftNode != nullptr) {
-        currentNode = currentNode->LeftNode;
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+template<class TLeft, class TRight>
+void TAATree<TValueType, TCompare, TAllocator, TTraits>::ForkJoin(TThreadPool* pool, bool isForked, TLeft&& left, TRight&& right) {
+    if (pool != nullptr && isForked) {
+        pool->ForkJoin(std::forward<TLeft>(left), std::forward<TRight>(right));
+    } else {
+        left();
+        right();
     }
-    return currentNode;
-}
-
-template<class TValueType>
-bool Set<TValueType>::IsLeaf(TNode<TValueType>* currentNode) {
-    return (currentNode != nullptr && currentNode->LeftNode == nullptr && currentNode->RightNode == nullptr);
 }
 
 //----------------TNode----------------
 
-template<class TValueType>
-struct TNode : public Set<TValueType> {
-    TNode(
-          TValueType value
-        , uint32_t level
-        , TNode* previousNode
-        , TNode* leftNode
-        , TNode* rightNode
-    )
-        : Value(value)
-        , Level(level)
-        , PreviousNode(previousNode)
-        , LeftNode(leftNode)
-        , RightNode(rightNode)
-    {
+// Optional augmentation; the empty form takes no space in the node
+template<bool CountSubtreeSize>
+struct TSubtreeSize {
+};
+
+template<>
+struct TSubtreeSize<true> {
+    size_t SubtreeSize = 1;
+};
+
+// Three links, level and value packed together, the subtree size only when TTraits asks for it
+template<class TValueType, class TTraits, bool LazyErase>
+struct TNode : TSubtreeSize<TTraits::CountSubtreeSize> {
+    // Builds the value in place; a fresh node is an unlinked leaf of level 1
+    template<class... TArgs>
+    explicit TNode(std::in_place_t, TArgs&&... args) : Value(std::forward<TArgs>(args)...) {
     }
 
     ~TNode() = default;
 
-    inline void Clear();
-
-    TValueType Value;
-    uint32_t Level = 0;
     TNode* PreviousNode = nullptr;
     TNode* LeftNode = nullptr;
     TNode* RightNode = nullptr;
+    uint32_t Level = 1;
+    TValueType Value;
 };
 
-template<class TValueType>
-void TNode<TValueType>::Clear() {
-    if (LeftNode != nullptr) {
-        LeftNode->Clear();
+// The mark of TTraits::LazyErase takes the high bit of the level, so the node keeps its size
+template<class TValueType, class TTraits>
+struct TNode<TValueType, TTraits, true> : TSubtreeSize<TTraits::CountSubtreeSize> {
+    template<class... TArgs>
+    explicit TNode(std::in_place_t, TArgs&&... args) : Level(1), IsDead(0), Value(std::forward<TArgs>(args)...) {
     }
-    if (RightNode != nullptr) {
-        RightNode->Clear();
-    }
-    delete this;
-}
+
+    ~TNode() = default;
+
+    TNode* PreviousNode = nullptr;
+    TNode* LeftNode = nullptr;
+    TNode* RightNode = nullptr;
+    uint32_t Level : 31;
+    uint32_t IsDead : 1;
+    TValueType Value;
+};
+
+static_assert(sizeof(void*) != 8 || sizeof(TNode<int32_t>) == 32, "TNode<int32_t> must fit in 32 bytes");
+static_assert(sizeof(void*) != 8 || sizeof(TNode<uint32_t>) == 32, "TNode<uint32_t> must fit in 32 bytes");
+static_assert(sizeof(void*) != 8 || sizeof(TNode<float>) == 32, "TNode<float> must fit in 32 bytes");
+static_assert(sizeof(void*) != 8 || sizeof(TNode<int64_t>) == 40, "TNode<int64_t> must fit in 40 bytes");
+static_assert(sizeof(void*) != 8 || sizeof(TNode<uint64_t>) == 40, "TNode<uint64_t> must fit in 40 bytes");
+static_assert(sizeof(void*) != 8 || sizeof(TNode<double>) == 40, "TNode<double> must fit in 40 bytes");
+static_assert(
+       sizeof(void*) != 8
+    || sizeof(TNode<uint64_t, TOrderStatisticsTraits>) == 48
+    , "TNode<uint64_t, TOrderStatisticsTraits> must fit in 48 bytes"
+);
+static_assert(
+       sizeof(void*) != 8
+    || sizeof(TNode<int32_t, TLazyEraseSetTraits>) == 32
+    , "TNode<int32_t, TLazyEraseSetTraits> must fit in 32 bytes"
+);
+static_assert(
+       sizeof(void*) != 8
+    || sizeof(TNode<uint64_t, TLazyEraseSetTraits>) == 40
+    , "TNode<uint64_t, TLazyEraseSetTraits> must fit in 40 bytes"
+);
+static_assert(
+       sizeof(void*) != 8
+    || sizeof(TNode<double, TLazyEraseSetTraits>) == 40
+    , "TNode<double, TLazyEraseSetTraits> must fit in 40 bytes"
+);
 
 //----------------TIterator----------------
 
-template<class TValueType>
+template<class TSet>
 class TIterator {
 public:
+    using iterator_category = std::bidirectional_iterator_tag;
+    using value_type = typename TSet::value_type;
+    using difference_type = std::ptrdiff_t;
+    using pointer = value_type*;
+    using reference = value_type&;
+
     TIterator() = default;
 
-    explicit TIterator(const Set<TValueType>* set) : Set_(set) {
+    explicit TIterator(const TSet* set) : Set_(set) {
     }
 
-    TIterator(const Set<TValueType>* set, TNode<TValueType>* iteratorNode) : Set_(set), IteratorNode_(iteratorNode) {
+    TIterator(const TSet* set, typename TSet::TNodeType* iteratorNode) : Set_(set), IteratorNode_(iteratorNode) {
     }
 
+    TIterator(const TIterator& iter) = default;
+
+    friend TSet;
     TIterator& operator=(const TIterator& iter);
 
     TIterator& operator++();
@@ -462,19 +3219,19 @@ public:
     TIterator& operator--();
     const TIterator operator--(int);
 
-    constexpr inline TValueType& operator*() const;
-    constexpr inline TValueType* operator->() const;
+    constexpr inline value_type& operator*() const;
+    constexpr inline value_type* operator->() const;
 
     constexpr inline bool operator==(const TIterator& iter) const;
     constexpr inline bool operator!=(const TIterator& iter) const;
 
 private:
-    const Set<TValueType>* Set_ = nullptr;
-    TNode<TValueType>* IteratorNode_ = nullptr;
+    const TSet* Set_ = nullptr;
+    typename TSet::TNodeType* IteratorNode_ = nullptr;
 };
 
-template<class TValueType>
-TIterator<TValueType>& TIterator<TValueType>::operator=(const TIterator<TValueType>& iter) {
+template<class TSet>
+TIterator<TSet>& TIterator<TSet>::operator=(const TIterator<TSet>& iter) {
     if (this == &iter) {
         return *this;
     }
@@ -485,71 +3242,173 @@ TIterator<TValueType>& TIterator<TValueType>::operator=(const TIterator<TValueTy
     return *this;
 }
 
-template<class TValueType>
-TIterator<TValueType>& TIterator<TValueType>::operator++() {
-    if (IteratorNode_->RightNode != nullptr) {
-        IteratorNode_ = ::Set<TValueType>::Successor(IteratorNode_);
-    } else {
-        while (IteratorNode_->PreviousNode != nullptr && IteratorNode_->PreviousNode->Value < IteratorNode_->Value) {
-            IteratorNode_ = IteratorNode_->PreviousNode;
-        }
-        IteratorNode_ = IteratorNode_->PreviousNode;
-    }
+template<class TSet>
+TIterator<TSet>& TIterator<TSet>::operator++() {
+    IteratorNode_ = TSet::NextLive(TSet::NextInOrder(IteratorNode_));
     return *this;
 }
 
-template<class TValueType>
-const TIterator<TValueType> TIterator<TValueType>::operator++(int) {
+template<class TSet>
+const TIterator<TSet> TIterator<TSet>::operator++(int) {
     TIterator oldIter = *this;
     operator++();
     return oldIter;
 }
 
-template<class TValueType>
-TIterator<TValueType>& TIterator<TValueType>::operator--() {
+template<class TSet>
+TIterator<TSet>& TIterator<TSet>::operator--() {
     if (IteratorNode_ == nullptr) {
-        IteratorNode_ = Set_->Root_;
-        if (IteratorNode_ != nullptr) {
-            while (IteratorNode_->RightNode != nullptr) {
-                IteratorNode_ = IteratorNode_->RightNode;
-            }
-        }
+        IteratorNode_ = Set_->Rightmost_;
         return *this;
     }
-    if (IteratorNode_->LeftNode != nullptr) {
-        IteratorNode_ = ::Set<TValueType>::Predecessor(IteratorNode_);
-    } else {
-        while (IteratorNode_->PreviousNode != nullptr && IteratorNode_->Value < IteratorNode_->PreviousNode->Value) {
-            IteratorNode_ = IteratorNode_->PreviousNode;
-        }
-        IteratorNode_ = IteratorNode_->PreviousNode;
-    }
+    IteratorNode_ = TSet::PreviousLive(TSet::PreviousInOrder(IteratorNode_));
     return *this;
 }
 
-template<class TValueType>
-const TIterator<TValueType> TIterator<TValueType>::operator--(int) {
+template<class TSet>
+const TIterator<TSet> TIterator<TSet>::operator--(int) {
     TIterator oldIter = *this;
     operator--();
     return oldIter;
 }
 
-template<class TValueType>
-constexpr TValueType& TIterator<TValueType>::operator*() const {
+template<class TSet>
+constexpr typename TIterator<TSet>::value_type& TIterator<TSet>::operator*() const {
     return IteratorNode_->Value;
 }
 
-template<class TValueType>
-constexpr TValueType* TIterator<TValueType>::operator->() const {
+template<class TSet>
+constexpr typename TIterator<TSet>::value_type* TIterator<TSet>::operator->() const {
     return &IteratorNode_->Value;
 }
 
-template<class TValueType>
-constexpr bool TIterator<TValueType>::operator==(const TIterator<TValueType>& iter) const {
+template<class TSet>
+constexpr bool TIterator<TSet>::operator==(const TIterator<TSet>& iter) const {
     return (Set_ == iter.Set_ && IteratorNode_ == iter.IteratorNode_);
 }
 
-template<class TValueType>
-constexpr bool TIterator<TValueType>::operator!=(const TIterator<TValueType>& iter) const {
+template<class TSet>
+constexpr bool TIterator<TSet>::operator!=(const TIterator<TSet>& iter) const {
     return (Set_ != iter.Set_ || IteratorNode_ != iter.IteratorNode_);
 }
+
+//----------------TNodeHandle----------------
+
+// An element extracted from a set together with its node; a non-empty handle frees the node when it goes away
+template<class TSet>
+class TNodeHandle {
+public:
+    using key_type = typename TSet::key_type;
+    using value_type = typename TSet::value_type;
+    using allocator_type = typename TSet::allocator_type;
+
+    TNodeHandle() = default;
+    TNodeHandle(TNodeHandle&& handle) noexcept;
+    TNodeHandle(const TNodeHandle& handle) = delete;
+
+    ~TNodeHandle();
+
+    friend TSet;
+    TNodeHandle& operator=(TNodeHandle&& handle) noexcept;
+    TNodeHandle& operator=(const TNodeHandle& handle) = delete;
+
+    inline bool empty() const;
+    inline explicit operator bool() const;
+    // The handle must not be empty. The key of a plain set may be changed through value() before the node
+    // is inserted again. The key of a map node is const: a map is re-keyed by building a new element
+    // from the new key and the moved mapped(), e.g. map.try_emplace(newKey, std::move(node.mapped()))
+    inline value_type& value() const;
+    // mapped() is for key-value sets only
+    inline const key_type& key() const;
+    inline auto& mapped() const;
+    inline allocator_type get_allocator() const;
+
+    void swap(TNodeHandle& handle) noexcept;
+
+private:
+    using TNodeType = typename TSet::TNodeType;
+    using TNodeAllocator = typename TSet::TNodeAllocator;
+    using TNodeAllocatorTraits = typename TSet::TNodeAllocatorTraits;
+
+    TNodeHandle(TNodeType* node, const TNodeAllocator& allocator) : Node_(node), Allocator_(allocator) {
+    }
+
+    inline void Reset();
+
+    TNodeType* Node_ = nullptr;
+    // Engaged exactly when Node_ is set, so that an empty handle holds no allocator state
+    std::optional<TNodeAllocator> Allocator_;
+};
+
+template<class TSet>
+TNodeHandle<TSet>::TNodeHandle(TNodeHandle&& handle) noexcept
+    : Node_(std::exchange(handle.Node_, nullptr))
+    , Allocator_(std::move(handle.Allocator_))
+{
+    handle.Allocator_.reset();
+}
+
+template<class TSet>
+TNodeHandle<TSet>::~TNodeHandle() {
+    Reset();
+}
+
+template<class TSet>
+TNodeHandle<TSet>& TNodeHandle<TSet>::operator=(TNodeHandle<TSet>&& handle) noexcept {
+    if (this == &handle) {
+        return *this;
+    }
+
+    Reset();
+    Node_ = std::exchange(handle.Node_, nullptr);
+    Allocator_ = std::move(handle.Allocator_);
+    handle.Allocator_.reset();
+
+    return *this;
+}
+
+template<class TSet>
+bool TNodeHandle<TSet>::empty() const {
+    return (Node_ == nullptr);
+}
+
+template<class TSet>
+TNodeHandle<TSet>::operator bool() const {
+    return (Node_ != nullptr);
+}
+
+template<class TSet>
+typename TNodeHandle<TSet>::value_type& TNodeHandle<TSet>::value() const {
+    return Node_->Value;
+}
+
+template<class TSet>
+const typename TNodeHandle<TSet>::key_type& TNodeHandle<TSet>::key() const {
+    return TSet::KeyOf(Node_->Value);
+}
+
+template<class TSet>
+auto& TNodeHandle<TSet>::mapped() const {
+    return Node_->Value.second;
+}
+
+template<class TSet>
+typename TNodeHandle<TSet>::allocator_type TNodeHandle<TSet>::get_allocator() const {
+    return allocator_type(*Allocator_);
+}
+
+template<class TSet>
+void TNodeHandle<TSet>::swap(TNodeHandle<TSet>& handle) noexcept {
+    std::swap(Node_, handle.Node_);
+    std::swap(Allocator_, handle.Allocator_);
+}
+
+template<class TSet>
+void TNodeHandle<TSet>::Reset() {
+    if (Node_ != nullptr) {
+        TNodeAllocatorTraits::destroy(*Allocator_, Node_);
+        TNodeAllocatorTraits::deallocate(*Allocator_, Node_, 1);
+        Node_ = nullptr;
+        Allocator_.reset();
+    }
+}
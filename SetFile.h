@@ -0,0 +1,336 @@
+/*
+ *      Summary: Binary files of AA Tree sets and read-only file mapping
+ *         Date: 2022.01.30
+ *   Programmer: Kurdun Andrei
+ *   Code Style: Yandex
+ */
+#pragma once
+#include "FrozenSet.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <istream>
+#include <memory>
+#include <new>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Malformed, truncated or foreign files and failed reads and writes
+class TSetFileError : public std::runtime_error {
+public:
+    using std::runtime_error::runtime_error;
+};
+
+enum class ESetFileLayout : uint32_t {
+    // In-order keys, written by Set::save
+    Sorted = 0,
+    // Breadth-first keys of FrozenSet, may be mapped
+    Eytzinger = 1,
+};
+
+/*
+ *  The header is followed by the raw keys in native byte order:
+ *
+ *      | magic 8 | version 4 | layout 4 | value size 4 | byte order 4 | count 8 | keys ... |
+ *
+ *  Keys start at offset 32, so a page-aligned mapping serves them in place.
+ */
+struct TSetFileHeader {
+    static constexpr char FileMagic[8] = {'A', 'A', 'T', 'R', 'E', 'E', 'S', 'F'};
+    static constexpr uint32_t FormatVersion = 1;
+    static constexpr uint32_t ByteOrderMark = 0x01020304;
+
+    char Magic[8] = {};
+    uint32_t Version = 0;
+    uint32_t Layout = 0;
+    uint32_t ValueSize = 0;
+    uint32_t ByteOrder = 0;
+    uint64_t Count = 0;
+};
+
+static_assert(sizeof(TSetFileHeader) == 32, "Keys must start at offset 32");
+
+inline TSetFileHeader MakeSetFileHeader(ESetFileLayout layout, size_t valueSize, size_t count) {
+    TSetFileHeader header;
+    std::memcpy(header.Magic, TSetFileHeader::FileMagic, sizeof(header.Magic));
+    header.Version = TSetFileHeader::FormatVersion;
+    header.Layout = static_cast<uint32_t>(layout);
+    header.ValueSize = static_cast<uint32_t>(valueSize);
+    header.ByteOrder = TSetFileHeader::ByteOrderMark;
+    header.Count = count;
+    return header;
+}
+
+inline void CheckSetFileHeader(const TSetFileHeader& header, size_t valueSize) {
+    if (std::memcmp(header.Magic, TSetFileHeader::FileMagic, sizeof(header.Magic)) != 0) {
+        throw TSetFileError("not a set file");
+    }
+    if (header.Version != TSetFileHeader::FormatVersion) {
+        throw TSetFileError("unsupported set file version " + std::to_string(header.Version));
+    }
+    if (header.ByteOrder != TSetFileHeader::ByteOrderMark) {
+        throw TSetFileError("set file has a foreign byte order");
+    }
+    if (header.ValueSize != valueSize) {
+        throw TSetFileError("set file holds values of " + std::to_string(header.ValueSize) + " bytes");
+    }
+    if (header.Layout != static_cast<uint32_t>(ESetFileLayout::Sorted)
+        && header.Layout != static_cast<uint32_t>(ESetFileLayout::Eytzinger))
+    {
+        throw TSetFileError("unknown set file layout " + std::to_string(header.Layout));
+    }
+}
+
+inline void WriteSetFileBytes(std::ostream& out, const void* data, size_t size) {
+    if (size != 0 && !out.write(static_cast<const char*>(data), static_cast<std::streamsize>(size))) {
+        throw TSetFileError("set file write failed");
+    }
+}
+
+inline void ReadSetFileBytes(std::istream& in, void* data, size_t size) {
+    if (size != 0 && !in.read(static_cast<char*>(data), static_cast<std::streamsize>(size))) {
+        throw TSetFileError("set file is truncated");
+    }
+}
+
+inline TSetFileHeader ReadSetFileHeader(std::istream& in, size_t valueSize) {
+    TSetFileHeader header;
+    ReadSetFileBytes(in, &header, sizeof(header));
+    CheckSetFileHeader(header, valueSize);
+    return header;
+}
+
+// Reads by chunks, so a corrupted count fails on the missing data rather than on one huge allocation
+template<class TValueType>
+std::vector<TValueType> ReadSetFileKeys(std::istream& in, uint64_t count) {
+    constexpr size_t ChunkSize = size_t(1) << 16;
+    std::vector<TValueType> keys;
+    while (keys.size() < count) {
+        size_t oldSize = keys.size();
+        keys.resize(oldSize + static_cast<size_t>(std::min<uint64_t>(count - oldSize, ChunkSize)));
+        ReadSetFileBytes(in, keys.data() + oldSize, (keys.size() - oldSize) * sizeof(TValueType));
+    }
+    return keys;
+}
+
+//----------------TMappedFile----------------
+
+// Whole file mapped read-only; files of other systems are read into an aligned buffer instead
+class TMappedFile {
+public:
+    explicit TMappedFile(const std::string& path);
+
+    TMappedFile(const TMappedFile&) = delete;
+    TMappedFile& operator=(const TMappedFile&) = delete;
+
+    ~TMappedFile();
+
+    inline const char* Data() const;
+    inline size_t Size() const;
+
+private:
+    // Aligns the keys of the buffer the way a page aligns them in a mapping
+    static constexpr size_t BufferAlign = 64;
+
+    void* Data_ = nullptr;
+    size_t Size_ = 0;
+};
+
+#if defined(__unix__) || defined(__APPLE__)
+
+inline TMappedFile::TMappedFile(const std::string& path) {
+    int file = ::open(path.c_str(), O_RDONLY);
+    if (file < 0) {
+        throw TSetFileError("cannot open " + path);
+    }
+    struct stat fileStat;
+    if (::fstat(file, &fileStat) != 0) {
+        ::close(file);
+        throw TSetFileError("cannot stat " + path);
+    }
+    Size_ = static_cast<size_t>(fileStat.st_size);
+    if (Size_ != 0) {
+        void* data = ::mmap(nullptr, Size_, PROT_READ, MAP_PRIVATE, file, 0);
+        if (data == MAP_FAILED) {
+            ::close(file);
+            throw TSetFileError("cannot map " + path);
+        }
+        Data_ = data;
+    }
+    ::close(file);
+}
+
+inline TMappedFile::~TMappedFile() {
+    if (Data_ != nullptr) {
+        ::munmap(Data_, Size_);
+    }
+}
+
+#else
+
+inline TMappedFile::TMappedFile(const std::string& path) {
+    std::ifstream in(path, std::ios::binary | std::ios::ate);
+    if (!in) {
+        throw TSetFileError("cannot open " + path);
+    }
+    Size_ = static_cast<size_t>(in.tellg());
+    in.seekg(0);
+    Data_ = ::operator new(std::max<size_t>(Size_, 1), std::align_val_t(BufferAlign));
+    if (!in.read(static_cast<char*>(Data_), static_cast<std::streamsize>(Size_))) {
+        ::operator delete(Data_, std::align_val_t(BufferAlign));
+        throw TSetFileError("cannot read " + path);
+    }
+}
+
+inline TMappedFile::~TMappedFile() {
+    ::operator delete(Data_, std::align_val_t(BufferAlign));
+}
+
+#endif
+
+const char* TMappedFile::Data() const {
+    return static_cast<const char*>(Data_);
+}
+
+size_t TMappedFile::Size() const {
+    return Size_;
+}
+
+//----------------TAATree----------------
+
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+void TAATree<TValueType, TCompare, TAllocator, TTraits>::save(std::ostream& out) const {
+    static_assert(IsPlainSet, "save() needs a Set");
+    static_assert(std::is_trivially_copyable_v<TValueType>, "save() writes the bytes of the values");
+    constexpr size_t ChunkSize = size_t(1) << 12;
+
+    TSetFileHeader header = MakeSetFileHeader(ESetFileLayout::Sorted, sizeof(TValueType), Size_);
+    WriteSetFileBytes(out, &header, sizeof(header));
+    std::vector<TValueType> chunk;
+    chunk.reserve(std::min(Size_, ChunkSize));
+    for (iterator currentIterator = begin(); currentIterator != end(); ++currentIterator) {
+        chunk.push_back(*currentIterator);
+        if (chunk.size() == ChunkSize) {
+            WriteSetFileBytes(out, chunk.data(), chunk.size() * sizeof(TValueType));
+            chunk.clear();
+        }
+    }
+    WriteSetFileBytes(out, chunk.data(), chunk.size() * sizeof(TValueType));
+}
+
+template<class TValueType, class TCompare, class TAllocator, class TTraits>
+TAATree<TValueType, TCompare, TAllocator, TTraits> TAATree<TValueType, TCompare, TAllocator, TTraits>::load(
+      std::istream& in
+    , const TCompare& compare
+    , const TAllocator& allocator
+) {
+    static_assert(IsPlainSet, "load() needs a Set");
+    static_assert(std::is_trivially_copyable_v<TValueType>, "load() reads the bytes of the values");
+
+    TSetFileHeader header = ReadSetFileHeader(in, sizeof(TValueType));
+    if (header.Layout != static_cast<uint32_t>(ESetFileLayout::Sorted)) {
+        throw TSetFileError("set file is in the FrozenSet layout, load it with FrozenSet::load");
+    }
+    std::vector<TValueType> keys = ReadSetFileKeys<TValueType>(in, header.Count);
+    auto isNotIncreasing = [&compare](const TValueType& leftValue, const TValueType& rightValue) {
+        return !compare(leftValue, rightValue);
+    };
+    if (std::adjacent_find(keys.begin(), keys.end(), isNotIncreasing) != keys.end()) {
+        throw TSetFileError("set file keys are not strictly increasing");
+    }
+    return TAATree(Sorted, keys.begin(), keys.end(), compare, allocator);
+}
+
+//----------------FrozenSet----------------
+
+template<class TValueType, class TCompare, class TAllocator>
+void FrozenSet<TValueType, TCompare, TAllocator>::save(std::ostream& out) const {
+    static_assert(std::is_trivially_copyable_v<TValueType>, "save() writes the bytes of the keys");
+
+    TSetFileHeader header = MakeSetFileHeader(ESetFileLayout::Eytzinger, sizeof(TValueType), Size_);
+    WriteSetFileBytes(out, &header, sizeof(header));
+    WriteSetFileBytes(out, Keys_, Size_ * sizeof(TValueType));
+}
+
+// Both layouts are accepted; the order of the keys is checked in O(n) either way
+template<class TValueType, class TCompare, class TAllocator>
+FrozenSet<TValueType, TCompare, TAllocator> FrozenSet<TValueType, TCompare, TAllocator>::load(
+      std::istream& in
+    , const TCompare& compare
+    , const TAllocator& allocator
+) {
+    static_assert(std::is_trivially_copyable_v<TValueType>, "load() reads the bytes of the keys");
+
+    TSetFileHeader header = ReadSetFileHeader(in, sizeof(TValueType));
+    FrozenSet resultSet(compare, allocator);
+    if (header.Layout == static_cast<uint32_t>(ESetFileLayout::Sorted)) {
+        std::vector<TValueType> keys = ReadSetFileKeys<TValueType>(in, header.Count);
+        resultSet.BuildSorted(keys.begin(), keys.end());
+        if (resultSet.size() != keys.size()) {
+            throw TSetFileError("set file keys are not strictly increasing");
+        }
+        return resultSet;
+    }
+
+    // The layout of an Eytzinger file is the layout of the set; the keys are read by chunks first,
+    // so the count of the header is trusted only once the file really holds that many
+    std::vector<TValueType> keys = ReadSetFileKeys<TValueType>(in, header.Count);
+    if (!keys.empty()) {
+        resultSet.Keys_ = TAllocatorTraits::allocate(resultSet.Allocator_, keys.size());
+        resultSet.Size_ = keys.size();
+        std::memcpy(resultSet.Keys_, keys.data(), keys.size() * sizeof(TValueType));
+    }
+    for (iterator currentIterator = resultSet.begin(); currentIterator != resultSet.end(); ) {
+        iterator previousIterator = currentIterator++;
+        if (currentIterator != resultSet.end() && !compare(*previousIterator, *currentIterator)) {
+            throw TSetFileError("set file keys are not strictly increasing");
+        }
+    }
+    return resultSet;
+}
+
+// The keys stay in the mapping; only the header and the file size are checked, not the order
+template<class TValueType, class TCompare, class TAllocator>
+FrozenSet<TValueType, TCompare, TAllocator> FrozenSet<TValueType, TCompare, TAllocator>::map(
+      const std::string& path
+    , const TCompare& compare
+) {
+    static_assert(std::is_trivially_copyable_v<TValueType>, "map() serves the bytes of the keys");
+    static_assert(alignof(TValueType) <= sizeof(TSetFileHeader), "Mapped keys are aligned by the header size");
+
+    auto mappedFile = std::make_shared<TMappedFile>(path);
+    TSetFileHeader header;
+    if (mappedFile->Size() < sizeof(header)) {
+        throw TSetFileError("set file is truncated");
+    }
+    std::memcpy(&header, mappedFile->Data(), sizeof(header));
+    CheckSetFileHeader(header, sizeof(TValueType));
+    if (header.Layout != static_cast<uint32_t>(ESetFileLayout::Eytzinger)) {
+        throw TSetFileError("only files saved by FrozenSet can be mapped");
+    }
+    if ((mappedFile->Size() - sizeof(header)) / sizeof(TValueType) != header.Count
+        || (mappedFile->Size() - sizeof(header)) % sizeof(TValueType) != 0)
+    {
+        throw TSetFileError("set file size does not match its header");
+    }
+
+    FrozenSet resultSet(compare);
+    // The set never writes its keys, so the read-only mapping may stand behind a mutable pointer
+    resultSet.Keys_ = const_cast<TValueType*>(reinterpret_cast<const TValueType*>(mappedFile->Data() + sizeof(header)));
+    resultSet.Size_ = header.Count;
+    resultSet.Storage_ = std::move(mappedFile);
+    return resultSet;
+}
@@ -0,0 +1,216 @@
+/*
+ *      Summary: Operation counters of the AA Tree, chosen through TTraits::TStats, and shape diagnostics
+ *         Date: 2022.01.30
+ *   Programmer: Kurdun Andrei
+ *   Code Style: Yandex
+ */
+#pragma once
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/*
+ *  Tracepoints on rebalancing, allocation and lookup depth. Building with AA_TREE_USDT turns them into
+ *  USDT probes of provider aa_tree for perf and bpftrace; defining AA_TREE_PROBE(name, value) before
+ *  including Set.h routes them anywhere else. Only TSetStats fires them.
+ */
+#if !defined(AA_TREE_PROBE)
+#if defined(AA_TREE_USDT) && __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define AA_TREE_PROBE(name, value) DTRACE_PROBE1(aa_tree, name, value)
+#else
+#define AA_TREE_PROBE(name, value) static_cast<void>(value)
+#endif
+#endif
+
+enum class ESetDescent {
+    Find,
+    LowerBound,
+    // lower_bound(hint, key) and find_from(), counting the nodes climbed as well
+    Finger,
+};
+
+// Plain copy of the counters returned by Set::stats()
+struct TSetStatistics {
+    // Descents are counted by the number of nodes they visited, the last bucket takes all deeper ones
+    static constexpr size_t DescentDepthBuckets = 64;
+
+    uint64_t Comparisons = 0;
+    uint64_t NodeAllocations = 0;
+    uint64_t NodeFrees = 0;
+    // Only the calls that actually rotate or lower a level
+    uint64_t Skews = 0;
+    uint64_t Splits = 0;
+    uint64_t LevelDecreases = 0;
+    // Highest root level the set has reached
+    uint32_t MaxLevel = 0;
+    std::array<uint64_t, DescentDepthBuckets> FindDepths{};
+    std::array<uint64_t, DescentDepthBuckets> LowerBoundDepths{};
+    std::array<uint64_t, DescentDepthBuckets> FingerDepths{};
+};
+
+// Default policy: every hook is empty and the calls compile away
+struct TNoSetStats {
+    static constexpr bool IsEnabled = false;
+
+    void OnCompare() {
+    }
+
+    void OnAllocate() {
+    }
+
+    void OnFree() {
+    }
+
+    void OnSkew() {
+    }
+
+    void OnSplit(uint32_t) {
+    }
+
+    void OnDecreaseLevel(uint32_t) {
+    }
+
+    void OnLevel(uint32_t) {
+    }
+
+    void OnDescent(ESetDescent, size_t) {
+    }
+};
+
+/*
+ *  Counting policy. The hooks are plain relaxed loads and stores rather than atomic increments,
+ *  so they cost a few instructions; increments made by parallel operations at the same moment may be lost.
+ *  A policy that derives from TSetStats and hides some hooks is called instead of it, which is
+ *  the place for perf counters. Counters belong to one set and are neither copied nor moved with it.
+ */
+class TSetStats {
+public:
+    static constexpr bool IsEnabled = true;
+
+    TSetStats() = default;
+    TSetStats(const TSetStats&) = delete;
+    TSetStats& operator=(const TSetStats&) = delete;
+
+    void OnCompare() {
+        Increment(Comparisons_);
+    }
+
+    void OnAllocate() {
+        Increment(NodeAllocations_);
+        AA_TREE_PROBE(node_allocate, 1);
+    }
+
+    void OnFree() {
+        Increment(NodeFrees_);
+        AA_TREE_PROBE(node_free, 1);
+    }
+
+    void OnSkew() {
+        Increment(Skews_);
+        AA_TREE_PROBE(skew, 1);
+    }
+
+    // level is the raised level of the new subtree root
+    void OnSplit(uint32_t level) {
+        Increment(Splits_);
+        OnLevel(level);
+        AA_TREE_PROBE(split, level);
+    }
+
+    void OnDecreaseLevel(uint32_t level) {
+        Increment(LevelDecreases_);
+        AA_TREE_PROBE(decrease_level, level);
+    }
+
+    void OnLevel(uint32_t level) {
+        if (level > MaxLevel_.load(std::memory_order_relaxed)) {
+            MaxLevel_.store(level, std::memory_order_relaxed);
+        }
+    }
+
+    void OnDescent(ESetDescent descent, size_t depth) {
+        size_t bucket = std::min(depth, TSetStatistics::DescentDepthBuckets - 1);
+        switch (descent) {
+            case ESetDescent::Find:
+                Increment(FindDepths_[bucket]);
+                break;
+            case ESetDescent::LowerBound:
+                Increment(LowerBoundDepths_[bucket]);
+                break;
+            case ESetDescent::Finger:
+                Increment(FingerDepths_[bucket]);
+                break;
+        }
+        AA_TREE_PROBE(descent, depth);
+    }
+
+    TSetStatistics Snapshot() const;
+    void Reset();
+
+private:
+    static void Increment(std::atomic<uint64_t>& counter) {
+        counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    std::atomic<uint64_t> Comparisons_ = 0;
+    std::atomic<uint64_t> NodeAllocations_ = 0;
+    std::atomic<uint64_t> NodeFrees_ = 0;
+    std::atomic<uint64_t> Skews_ = 0;
+    std::atomic<uint64_t> Splits_ = 0;
+    std::atomic<uint64_t> LevelDecreases_ = 0;
+    std::atomic<uint32_t> MaxLevel_ = 0;
+    std::array<std::atomic<uint64_t>, TSetStatistics::DescentDepthBuckets> FindDepths_{};
+    std::array<std::atomic<uint64_t>, TSetStatistics::DescentDepthBuckets> LowerBoundDepths_{};
+    std::array<std::atomic<uint64_t>, TSetStatistics::DescentDepthBuckets> FingerDepths_{};
+};
+
+inline TSetStatistics TSetStats::Snapshot() const {
+    TSetStatistics statistics;
+    statistics.Comparisons = Comparisons_.load(std::memory_order_relaxed);
+    statistics.NodeAllocations = NodeAllocations_.load(std::memory_order_relaxed);
+    statistics.NodeFrees = NodeFrees_.load(std::memory_order_relaxed);
+    statistics.Skews = Skews_.load(std::memory_order_relaxed);
+    statistics.Splits = Splits_.load(std::memory_order_relaxed);
+    statistics.LevelDecreases = LevelDecreases_.load(std::memory_order_relaxed);
+    statistics.MaxLevel = MaxLevel_.load(std::memory_order_relaxed);
+    for (size_t bucket = 0; bucket < TSetStatistics::DescentDepthBuckets; ++bucket) {
+        statistics.FindDepths[bucket] = FindDepths_[bucket].load(std::memory_order_relaxed);
+        statistics.LowerBoundDepths[bucket] = LowerBoundDepths_[bucket].load(std::memory_order_relaxed);
+        statistics.FingerDepths[bucket] = FingerDepths_[bucket].load(std::memory_order_relaxed);
+    }
+    return statistics;
+}
+
+inline void TSetStats::Reset() {
+    Comparisons_.store(0, std::memory_order_relaxed);
+    NodeAllocations_.store(0, std::memory_order_relaxed);
+    NodeFrees_.store(0, std::memory_order_relaxed);
+    Skews_.store(0, std::memory_order_relaxed);
+    Splits_.store(0, std::memory_order_relaxed);
+    LevelDecreases_.store(0, std::memory_order_relaxed);
+    MaxLevel_.store(0, std::memory_order_relaxed);
+    for (size_t bucket = 0; bucket < TSetStatistics::DescentDepthBuckets; ++bucket) {
+        FindDepths_[bucket].store(0, std::memory_order_relaxed);
+        LowerBoundDepths_[bucket].store(0, std::memory_order_relaxed);
+        FingerDepths_[bucket].store(0, std::memory_order_relaxed);
+    }
+}
+
+// Returned by Set::shape_report(). The depth of a node is the number of nodes on its search path, the root has 1
+struct TSetShape {
+    // Nodes in the tree, the tombstones of TTraits::LazyErase included
+    size_t Size = 0;
+    size_t Height = 0;
+    uint32_t RootLevel = 0;
+    // Average search path of a present key, and the same for a complete binary tree of Size nodes
+    double AverageDepth = 0;
+    double OptimalAverageDepth = 0;
+    size_t OptimalHeight = 0;
+    // Indexed by depth and by AA level, index 0 stays empty
+    std::vector<size_t> DepthCounts;
+    std::vector<size_t> LevelCounts;
+};
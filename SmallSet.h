@@ -0,0 +1,576 @@
+/*
+ *      Summary: Set with an inline sorted buffer for a few keys, and a constexpr set of literal keys
+ *         Date: 2022.01.30
+ *   Programmer: Kurdun Andrei
+ *   Code Style: Yandex
+ */
+#pragma once
+#include "Set.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <initializer_list>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+
+template<class TSmallSet>
+class TSmallIterator;
+
+/*
+ *  Up to InlineCapacity keys live in a sorted array inside the object, with no node allocations:
+ *
+ *        inline:   [3 7 12 20 31 _ _ _]          size 5 of 8
+ *        tree:     Set<TKey> built from the full array when one more key arrives
+ *
+ *  The tree hands its keys back to the array once erasures leave it half of InlineCapacity or less,
+ *  so a set that hovers around the threshold does not switch on every call.
+ *  Iterators are invalidated by any insert or erase.
+ */
+template<
+      class TKey
+    , size_t InlineCapacity = 16
+    , class TCompare = std::less<TKey>
+    , class TAllocator = std::allocator<TKey>
+    , class TTraits = TDefaultSetTraits
+>
+class SmallSet {
+public:
+    using value_type = TKey;
+    using key_compare = TCompare;
+    using allocator_type = TAllocator;
+    using iterator = TSmallIterator<SmallSet>;
+
+    static_assert(InlineCapacity > 0, "SmallSet needs a non-empty inline buffer");
+
+    SmallSet() = default;
+
+    explicit SmallSet(const TCompare& compare, const TAllocator& allocator = TAllocator())
+        : Tree_(compare, allocator)
+        , Compare_(compare)
+    {
+    }
+
+    SmallSet(
+          const std::initializer_list<TKey>& initializerList
+        , const TCompare& compare = TCompare()
+        , const TAllocator& allocator = TAllocator()
+    )
+        : SmallSet(compare, allocator)
+    {
+        for (const TKey& key : initializerList) {
+            insert(key);
+        }
+    }
+
+    template<typename Iterator>
+    SmallSet(Iterator first, Iterator last, const TCompare& compare = TCompare(), const TAllocator& allocator = TAllocator())
+        : SmallSet(compare, allocator)
+    {
+        for (; first != last; ++first) {
+            insert(*first);
+        }
+    }
+
+    SmallSet(const SmallSet& set) = default;
+
+    // The moved-from set is left empty and inline
+    SmallSet(SmallSet&& set) noexcept(std::is_nothrow_default_constructible_v<TKey>)
+        : Tree_(std::move(set.Tree_))
+        , Compare_(set.Compare_)
+        , IsInline_(std::exchange(set.IsInline_, true))
+        , InlineSize_(std::exchange(set.InlineSize_, 0))
+    {
+        std::move(set.InlineKeys_, set.InlineKeys_ + InlineSize_, InlineKeys_);
+    }
+
+    SmallSet& operator=(const SmallSet& set) = default;
+    SmallSet& operator=(SmallSet&& set) noexcept(std::is_nothrow_move_assignable_v<TTree>);
+
+    friend class TSmallIterator<SmallSet>;
+
+    inline size_t size() const;
+    inline bool empty() const;
+    // Whether the keys are in the inline array rather than in the tree
+    inline bool is_inline() const;
+
+    iterator begin() const;
+    iterator end() const;
+
+    iterator lower_bound(const TKey& wantedKey) const;
+    iterator upper_bound(const TKey& wantedKey) const;
+    iterator find(const TKey& wantedKey) const;
+    bool contains(const TKey& wantedKey) const;
+    size_t count(const TKey& wantedKey) const;
+
+    std::pair<iterator, bool> insert(const TKey& insertedKey);
+    std::pair<iterator, bool> insert(TKey&& insertedKey);
+    size_t erase(const TKey& erasedKey);
+    void clear();
+
+    inline TCompare key_comp() const;
+    inline TAllocator get_allocator() const;
+
+private:
+    using TTree = Set<TKey, TCompare, TAllocator, TTraits>;
+    using TTreeIterator = typename TTree::iterator;
+
+    static_assert(std::is_default_constructible_v<TKey>, "Inline keys are default constructed");
+    static_assert(std::is_nothrow_move_assignable_v<TKey>, "Inline keys are shifted by moves");
+
+    // Index of the first inline key that is not less than the wanted one; a short linear scan
+    inline size_t InlineLowerBound(const TKey& wantedKey) const;
+    template<class TArg>
+    inline std::pair<iterator, bool> Insert(TArg&& insertedKey);
+    inline void MoveToTree();
+    inline void MoveToInline();
+
+private:
+    // Until it grows, the tree is an empty Set and allocates nothing
+    TTree Tree_;
+    TCompare Compare_ = TCompare();
+    bool IsInline_ = true;
+    uint32_t InlineSize_ = 0;
+    TKey InlineKeys_[InlineCapacity];
+};
+
+template<class TKey, size_t InlineCapacity, class TCompare, class TAllocator, class TTraits>
+size_t SmallSet<TKey, InlineCapacity, TCompare, TAllocator, TTraits>::size() const {
+    return (IsInline_ ? InlineSize_ : Tree_.size());
+}
+
+template<class TKey, size_t InlineCapacity, class TCompare, class TAllocator, class TTraits>
+bool SmallSet<TKey, InlineCapacity, TCompare, TAllocator, TTraits>::empty() const {
+    return (size() == 0);
+}
+
+template<class TKey, size_t InlineCapacity, class TCompare, class TAllocator, class TTraits>
+bool SmallSet<TKey, InlineCapacity, TCompare, TAllocator, TTraits>::is_inline() const {
+    return IsInline_;
+}
+
+template<class TKey, size_t InlineCapacity, class TCompare, class TAllocator, class TTraits>
+typename SmallSet<TKey, InlineCapacity, TCompare, TAllocator, TTraits>::iterator SmallSet<TKey, InlineCapacity, TCompare, TAllocator, TTraits>::begin() const {
+    if (IsInline_) {
+        return iterator(InlineKeys_);
+    }
+    return iterator(Tree_.begin());
+}
+
+template<class TKey, size_t InlineCapacity, class TCompare, class TAllocator, class TTraits>
+typename SmallSet<TKey, InlineCapacity, TCompare, TAllocator, TTraits>::iterator SmallSet<TKey, InlineCapacity, TCompare, TAllocator, TTraits>::end() const {
+    if (IsInline_) {
+        return iterator(InlineKeys_ + InlineSize_);
+    }
+    return iterator(Tree_.end());
+}
+
+template<class TKey, size_t InlineCapacity, class TCompare, class TAllocator, class TTraits>
+typename SmallSet<TKey, InlineCapacity, TCompare, TAllocator, TTraits>::iterator SmallSet<TKey, InlineCapacity, TCompare, TAllocator, TTraits>::lower_bound(
+    const TKey& wantedKey
+) const {
+    if (IsInline_) {
+        return iterator(InlineKeys_ + InlineLowerBound(wantedKey));
+    }
+    return iterator(Tree_.lower_bound(wantedKey));
+}
+
+template<class TKey, size_t InlineCapacity, class TCompare, class TAllocator, class TTraits>
+typename SmallSet<TKey, InlineCapacity, TCompare, TAllocator, TTraits>::iterator SmallSet<TKey, InlineCapacity, TCompare, TAllocator, TTraits>::upper_bound(
+    const TKey& wantedKey
+) const {
+    if (IsInline_) {
+        size_t keyIndex = InlineLowerBound(wantedKey);
+        if (keyIndex < InlineSize_ && !Compare_(wantedKey, InlineKeys_[keyIndex])) {
+            ++keyIndex;
+        }
+        return iterator(InlineKeys_ + keyIndex);
+    }
+    return iterator(Tree_.upper_bound(wantedKey));
+}
+
+template<class TKey, size_t InlineCapacity, class TCompare, class TAllocator, class TTraits>
+typename SmallSet<TKey, InlineCapacity, TCompare, TAllocator, TTraits>::iterator SmallSet<TKey, InlineCapacity, TCompare, TAllocator, TTraits>::find(
+    const TKey& wantedKey
+) const {
+    if (IsInline_) {
+        size_t keyIndex = InlineLowerBound(wantedKey);
+        if (keyIndex == InlineSize_ || Compare_(wantedKey, InlineKeys_[keyIndex])) {
+            return end();
+        }
+        return iterator(InlineKeys_ + keyIndex);
+    }
+    return iterator(Tree_.find(wantedKey));
+}
+
+template<class TKey, size_t InlineCapacity, class TCompare, class TAllocator, class TTraits>
+bool SmallSet<TKey, InlineCapacity, TCompare, TAllocator, TTraits>::contains(const TKey& wantedKey) const {
+    return (find(wantedKey) != end());
+}
+
+template<class TKey, size_t InlineCapacity, class TCompare, class TAllocator, class TTraits>
+size_t SmallSet<TKey, InlineCapacity, TCompare, TAllocator, TTraits>::count(const TKey& wantedKey) const {
+    return (contains(wantedKey) ? 1 : 0);
+}
+
+template<class TKey, size_t InlineCapacity, class TCompare, class TAllocator, class TTraits>
+std::pair<typename SmallSet<TKey, InlineCapacity, TCompare, TAllocator, TTraits>::iterator, bool>
+SmallSet<TKey, InlineCapacity, TCompare, TAllocator, TTraits>::insert(const TKey& insertedKey) {
+    return Insert(insertedKey);
+}
+
+template<class TKey, size_t InlineCapacity, class TCompare, class TAllocator, class TTraits>
+std::pair<typename SmallSet<TKey, InlineCapacity, TCompare, TAllocator, TTraits>::iterator, bool>
+SmallSet<TKey, InlineCapacity, TCompare, TAllocator, TTraits>::insert(TKey&& insertedKey) {
+    return Insert(std::move(insertedKey));
+}
+
+template<class TKey, size_t InlineCapacity, class TCompare, class TAllocator, class TTraits>
+size_t SmallSet<TKey, InlineCapacity, TCompare, TAllocator, TTraits>::erase(const TKey& erasedKey) {
+    if (!IsInline_) {
+        size_t erasedCount = Tree_.erase(erasedKey);
+        if (Tree_.size() <= InlineCapacity / 2) {
+            MoveToInline();
+        }
+        return erasedCount;
+    }
+    size_t erasedIndex = InlineLowerBound(erasedKey);
+    if (erasedIndex == InlineSize_ || Compare_(erasedKey, InlineKeys_[erasedIndex])) {
+        return 0;
+    }
+    std::move(InlineKeys_ + erasedIndex + 1, InlineKeys_ + InlineSize_, InlineKeys_ + erasedIndex);
+    --InlineSize_;
+    return 1;
+}
+
+template<class TKey, size_t InlineCapacity, class TCompare, class TAllocator, class TTraits>
+SmallSet<TKey, InlineCapacity, TCompare, TAllocator, TTraits>& SmallSet<TKey, InlineCapacity, TCompare, TAllocator, TTraits>::operator=(
+    SmallSet&& set
+) noexcept(std::is_nothrow_move_assignable_v<TTree>) {
+    if (this == &set) {
+        return *this;
+    }
+
+    Tree_ = std::move(set.Tree_);
+    // A tree of a foreign allocator is copied rather than stolen
+    set.Tree_.clear();
+    Compare_ = set.Compare_;
+    IsInline_ = std::exchange(set.IsInline_, true);
+    InlineSize_ = std::exchange(set.InlineSize_, 0);
+    std::move(set.InlineKeys_, set.InlineKeys_ + InlineSize_, InlineKeys_);
+
+    return *this;
+}
+
+template<class TKey, size_t InlineCapacity, class TCompare, class TAllocator, class TTraits>
+void SmallSet<TKey, InlineCapacity, TCompare, TAllocator, TTraits>::clear() {
+    Tree_.clear();
+    IsInline_ = true;
+    InlineSize_ = 0;
+}
+
+template<class TKey, size_t InlineCapacity, class TCompare, class TAllocator, class TTraits>
+TCompare SmallSet<TKey, InlineCapacity, TCompare, TAllocator, TTraits>::key_comp() const {
+    return Compare_;
+}
+
+template<class TKey, size_t InlineCapacity, class TCompare, class TAllocator, class TTraits>
+TAllocator SmallSet<TKey, InlineCapacity, TCompare, TAllocator, TTraits>::get_allocator() const {
+    return Tree_.get_allocator();
+}
+
+template<class TKey, size_t InlineCapacity, class TCompare, class TAllocator, class TTraits>
+size_t SmallSet<TKey, InlineCapacity, TCompare, TAllocator, TTraits>::InlineLowerBound(const TKey& wantedKey) const {
+    size_t keyIndex = 0;
+    while (keyIndex < InlineSize_ && Compare_(InlineKeys_[keyIndex], wantedKey)) {
+        ++keyIndex;
+    }
+    return keyIndex;
+}
+
+template<class TKey, size_t InlineCapacity, class TCompare, class TAllocator, class TTraits>
+template<class TArg>
+std::pair<typename SmallSet<TKey, InlineCapacity, TCompare, TAllocator, TTraits>::iterator, bool>
+SmallSet<TKey, InlineCapacity, TCompare, TAllocator, TTraits>::Insert(TArg&& insertedKey) {
+    if (IsInline_) {
+        size_t insertedIndex = InlineLowerBound(insertedKey);
+        if (insertedIndex < InlineSize_ && !Compare_(insertedKey, InlineKeys_[insertedIndex])) {
+            return {iterator(InlineKeys_ + insertedIndex), false};
+        }
+        if (InlineSize_ < InlineCapacity) {
+            // Built before the shift, so a throwing copy leaves the array as it was
+            TKey keyCopy(std::forward<TArg>(insertedKey));
+            std::move_backward(InlineKeys_ + insertedIndex, InlineKeys_ + InlineSize_, InlineKeys_ + InlineSize_ + 1);
+            InlineKeys_[insertedIndex] = std::move(keyCopy);
+            ++InlineSize_;
+            return {iterator(InlineKeys_ + insertedIndex), true};
+        }
+        MoveToTree();
+    }
+    auto [treeIterator, isInserted] = Tree_.insert(std::forward<TArg>(insertedKey));
+    return {iterator(treeIterator), isInserted};
+}
+
+// The full array is sorted and unique, so the tree is linked in O(n) without comparisons. The keys are
+// copied, at most InlineCapacity of them, so a failed allocation leaves the array intact
+template<class TKey, size_t InlineCapacity, class TCompare, class TAllocator, class TTraits>
+void SmallSet<TKey, InlineCapacity, TCompare, TAllocator, TTraits>::MoveToTree() {
+    Tree_ = TTree(Sorted, InlineKeys_, InlineKeys_ + InlineSize_, Compare_, Tree_.get_allocator());
+    for (size_t keyIndex = 0; keyIndex < InlineSize_; ++keyIndex) {
+        InlineKeys_[keyIndex] = TKey();
+    }
+    IsInline_ = false;
+    InlineSize_ = 0;
+}
+
+template<class TKey, size_t InlineCapacity, class TCompare, class TAllocator, class TTraits>
+void SmallSet<TKey, InlineCapacity, TCompare, TAllocator, TTraits>::MoveToInline() {
+    InlineSize_ = 0;
+    for (TKey& key : Tree_) {
+        InlineKeys_[InlineSize_++] = std::move(key);
+    }
+    Tree_.clear();
+    IsInline_ = true;
+}
+
+//----------------TSmallIterator----------------
+
+// A key of the inline array or a tree iterator; end() of the inline array is the key past the last one
+template<class TSmallSet>
+class TSmallIterator {
+public:
+    using iterator_category = std::bidirectional_iterator_tag;
+    using value_type = typename TSmallSet::value_type;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const value_type*;
+    using reference = const value_type&;
+
+    TSmallIterator() = default;
+
+    explicit TSmallIterator(const value_type* inlineKey) : InlineKey_(inlineKey) {
+    }
+
+    explicit TSmallIterator(typename TSmallSet::TTreeIterator treeIterator) : TreeIterator_(treeIterator) {
+    }
+
+    friend TSmallSet;
+
+    TSmallIterator& operator++();
+    const TSmallIterator operator++(int);
+
+    TSmallIterator& operator--();
+    const TSmallIterator operator--(int);
+
+    inline const value_type& operator*() const;
+    inline const value_type* operator->() const;
+
+    inline bool operator==(const TSmallIterator& iter) const;
+    inline bool operator!=(const TSmallIterator& iter) const;
+
+private:
+    const value_type* InlineKey_ = nullptr;
+    typename TSmallSet::TTreeIterator TreeIterator_;
+};
+
+template<class TSmallSet>
+TSmallIterator<TSmallSet>& TSmallIterator<TSmallSet>::operator++() {
+    if (InlineKey_ != nullptr) {
+        ++InlineKey_;
+    } else {
+        ++TreeIterator_;
+    }
+    return *this;
+}
+
+template<class TSmallSet>
+const TSmallIterator<TSmallSet> TSmallIterator<TSmallSet>::operator++(int) {
+    TSmallIterator<TSmallSet> copy = *this;
+    ++*this;
+    return copy;
+}
+
+template<class TSmallSet>
+TSmallIterator<TSmallSet>& TSmallIterator<TSmallSet>::operator--() {
+    if (InlineKey_ != nullptr) {
+        --InlineKey_;
+    } else {
+        --TreeIterator_;
+    }
+    return *this;
+}
+
+template<class TSmallSet>
+const TSmallIterator<TSmallSet> TSmallIterator<TSmallSet>::operator--(int) {
+    TSmallIterator<TSmallSet> copy = *this;
+    --*this;
+    return copy;
+}
+
+template<class TSmallSet>
+const typename TSmallIterator<TSmallSet>::value_type& TSmallIterator<TSmallSet>::operator*() const {
+    return (InlineKey_ != nullptr ? *InlineKey_ : *TreeIterator_);
+}
+
+template<class TSmallSet>
+const typename TSmallIterator<TSmallSet>::value_type* TSmallIterator<TSmallSet>::operator->() const {
+    return &**this;
+}
+
+template<class TSmallSet>
+bool TSmallIterator<TSmallSet>::operator==(const TSmallIterator& iter) const {
+    return (InlineKey_ == iter.InlineKey_ && TreeIterator_ == iter.TreeIterator_);
+}
+
+template<class TSmallSet>
+bool TSmallIterator<TSmallSet>::operator!=(const TSmallIterator& iter) const {
+    return !(*this == iter);
+}
+
+//----------------StaticSet----------------
+
+/*
+ *  Sorted array of Size unique literal keys, built and searched in constant expressions,
+ *  so a table declared constexpr is sorted by the compiler and lookups on constants fold away:
+ *
+ *        constexpr auto Tags = MakeStaticSet<std::string_view>({"db", "cache", "auth"});
+ *        static_assert(Tags.contains("cache"));
+ *
+ *  Duplicate keys or a list of a different length throw, which fails a constant evaluation.
+ */
+template<class TKey, size_t Size, class TCompare = std::less<TKey>>
+class StaticSet {
+public:
+    using value_type = TKey;
+    using key_compare = TCompare;
+    using iterator = const TKey*;
+
+    constexpr StaticSet(const TKey (&keys)[Size], const TCompare& compare = TCompare())
+        : Compare_(compare)
+    {
+        for (size_t keyIndex = 0; keyIndex < Size; ++keyIndex) {
+            Keys_[keyIndex] = keys[keyIndex];
+        }
+        Sort();
+    }
+
+    constexpr StaticSet(std::initializer_list<TKey> initializerList, const TCompare& compare = TCompare())
+        : Compare_(compare)
+    {
+        if (initializerList.size() != Size) {
+            throw std::invalid_argument("StaticSet: the list length differs from Size");
+        }
+        size_t keyIndex = 0;
+        for (const TKey& key : initializerList) {
+            Keys_[keyIndex++] = key;
+        }
+        Sort();
+    }
+
+    constexpr size_t size() const {
+        return Size;
+    }
+
+    constexpr bool empty() const {
+        return (Size == 0);
+    }
+
+    constexpr iterator begin() const {
+        return Keys_;
+    }
+
+    constexpr iterator end() const {
+        return Keys_ + Size;
+    }
+
+    constexpr iterator lower_bound(const TKey& wantedKey) const;
+    constexpr iterator upper_bound(const TKey& wantedKey) const;
+    constexpr iterator find(const TKey& wantedKey) const;
+    constexpr bool contains(const TKey& wantedKey) const;
+    constexpr size_t count(const TKey& wantedKey) const;
+
+    constexpr TCompare key_comp() const {
+        return Compare_;
+    }
+
+private:
+    // Insertion sort, the standard sort is not constexpr before C++20
+    constexpr void Sort();
+
+private:
+    // One spare key keeps the array valid for Size == 0
+    TKey Keys_[Size + 1] = {};
+    TCompare Compare_ = TCompare();
+};
+
+template<class TKey, size_t Size>
+StaticSet(const TKey (&)[Size]) -> StaticSet<TKey, Size>;
+
+// MakeStaticSet({...}) counts the keys itself; string literals need MakeStaticSet<std::string_view>({...})
+template<class TKey, size_t Size>
+constexpr StaticSet<TKey, Size> MakeStaticSet(const TKey (&keys)[Size]) {
+    return StaticSet<TKey, Size>(keys);
+}
+
+template<class TKey, size_t Size, class TCompare>
+constexpr typename StaticSet<TKey, Size, TCompare>::iterator StaticSet<TKey, Size, TCompare>::lower_bound(const TKey& wantedKey) const {
+    size_t lowerIndex = 0;
+    size_t upperIndex = Size;
+    while (lowerIndex < upperIndex) {
+        size_t middleIndex = lowerIndex + (upperIndex - lowerIndex) / 2;
+        if (Compare_(Keys_[middleIndex], wantedKey)) {
+            lowerIndex = middleIndex + 1;
+        } else {
+            upperIndex = middleIndex;
+        }
+    }
+    return Keys_ + lowerIndex;
+}
+
+template<class TKey, size_t Size, class TCompare>
+constexpr typename StaticSet<TKey, Size, TCompare>::iterator StaticSet<TKey, Size, TCompare>::upper_bound(const TKey& wantedKey) const {
+    iterator foundIterator = lower_bound(wantedKey);
+    if (foundIterator != end() && !Compare_(wantedKey, *foundIterator)) {
+        ++foundIterator;
+    }
+    return foundIterator;
+}
+
+template<class TKey, size_t Size, class TCompare>
+constexpr typename StaticSet<TKey, Size, TCompare>::iterator StaticSet<TKey, Size, TCompare>::find(const TKey& wantedKey) const {
+    iterator foundIterator = lower_bound(wantedKey);
+    if (foundIterator == end() || Compare_(wantedKey, *foundIterator)) {
+        return end();
+    }
+    return foundIterator;
+}
+
+template<class TKey, size_t Size, class TCompare>
+constexpr bool StaticSet<TKey, Size, TCompare>::contains(const TKey& wantedKey) const {
+    return (find(wantedKey) != end());
+}
+
+template<class TKey, size_t Size, class TCompare>
+constexpr size_t StaticSet<TKey, Size, TCompare>::count(const TKey& wantedKey) const {
+    return (contains(wantedKey) ? 1 : 0);
+}
+
+template<class TKey, size_t Size, class TCompare>
+constexpr void StaticSet<TKey, Size, TCompare>::Sort() {
+    for (size_t keyIndex = 1; keyIndex < Size; ++keyIndex) {
+        TKey key = Keys_[keyIndex];
+        size_t insertedIndex = keyIndex;
+        for (; insertedIndex > 0 && Compare_(key, Keys_[insertedIndex - 1]); --insertedIndex) {
+            Keys_[insertedIndex] = Keys_[insertedIndex - 1];
+        }
+        Keys_[insertedIndex] = key;
+    }
+    for (size_t keyIndex = 1; keyIndex < Size; ++keyIndex) {
+        if (!Compare_(Keys_[keyIndex - 1], Keys_[keyIndex])) {
+            throw std::invalid_argument("StaticSet: duplicate keys");
+        }
+    }
+}
@@ -0,0 +1,214 @@
+/*
+ *      Summary: Work-stealing fork-join pool for parallel bulk operations of AA Tree
+ *         Date: 2022.01.30
+ *   Programmer: Kurdun Andrei
+ *   Code Style: Yandex
+ */
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// Every worker owns a deque: it pops its own newest task and steals the oldest task of the others.
+// A thread waiting in ForkJoin runs queued tasks meanwhile, so nested forks never block a worker.
+// Threads outside the pool may fork as well, they share one extra deque.
+class TThreadPool {
+public:
+    explicit TThreadPool(size_t threadCount = std::max(std::thread::hardware_concurrency(), 1u));
+
+    TThreadPool(const TThreadPool&) = delete;
+    TThreadPool& operator=(const TThreadPool&) = delete;
+
+    ~TThreadPool();
+
+    inline size_t ThreadCount() const;
+
+    // Runs both functions, the right one possibly on another thread; rethrows the first exception
+    template<class TLeft, class TRight>
+    void ForkJoin(TLeft&& left, TRight&& right);
+
+    // Calls function(begin, end) on chunks of at most grainSize indices of [first, last)
+    template<class TFunction>
+    void ParallelFor(size_t first, size_t last, size_t grainSize, TFunction&& function);
+
+private:
+    struct TTask {
+        void (*Run)(void* function) = nullptr;
+        void* Function = nullptr;
+        std::exception_ptr Error;
+        std::atomic<bool> IsDone = false;
+    };
+
+    struct TWorkerQueue {
+        std::mutex Mutex;
+        std::deque<TTask*> Tasks;
+    };
+
+    inline void WorkerLoop(size_t queueIndex);
+    inline size_t QueueIndex() const;
+    inline void Push(TTask* task);
+    inline TTask* TakeTask(size_t queueIndex);
+    static inline void Execute(TTask* task);
+
+private:
+    static inline thread_local const TThreadPool* CurrentPool_ = nullptr;
+    static inline thread_local size_t CurrentQueueIndex_ = 0;
+
+    // One queue per worker and the last one for outside threads
+    std::vector<std::unique_ptr<TWorkerQueue>> Queues_;
+    std::vector<std::thread> Workers_;
+    std::atomic<size_t> PendingCount_ = 0;
+    std::atomic<bool> IsStopped_ = false;
+    std::mutex SleepMutex_;
+    std::condition_variable WakeUp_;
+};
+
+inline TThreadPool::TThreadPool(size_t threadCount) {
+    for (size_t queueIndex = 0; queueIndex <= threadCount; ++queueIndex) {
+        Queues_.push_back(std::make_unique<TWorkerQueue>());
+    }
+    Workers_.reserve(threadCount);
+    for (size_t queueIndex = 0; queueIndex < threadCount; ++queueIndex) {
+        Workers_.emplace_back([this, queueIndex] { WorkerLoop(queueIndex); });
+    }
+}
+
+inline TThreadPool::~TThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(SleepMutex_);
+        IsStopped_ = true;
+    }
+    WakeUp_.notify_all();
+    for (std::thread& worker : Workers_) {
+        worker.join();
+    }
+}
+
+size_t TThreadPool::ThreadCount() const {
+    return Workers_.size();
+}
+
+template<class TLeft, class TRight>
+void TThreadPool::ForkJoin(TLeft&& left, TRight&& right) {
+    TTask task;
+    task.Run = [](void* function) {
+        (*static_cast<std::remove_reference_t<TRight>*>(function))();
+    };
+    task.Function = const_cast<void*>(static_cast<const volatile void*>(std::addressof(right)));
+    Push(&task);
+
+    std::exception_ptr leftError;
+    try {
+        left();
+    } catch (...) {
+        leftError = std::current_exception();
+    }
+
+    // The task is either still queued and comes back from our own deque, or it has been stolen
+    size_t queueIndex = QueueIndex();
+    while (!task.IsDone.load(std::memory_order_acquire)) {
+        if (TTask* queuedTask = TakeTask(queueIndex)) {
+            Execute(queuedTask);
+        } else {
+            std::this_thread::yield();
+        }
+    }
+
+    if (leftError) {
+        std::rethrow_exception(leftError);
+    }
+    if (task.Error) {
+        std::rethrow_exception(task.Error);
+    }
+}
+
+template<class TFunction>
+void TThreadPool::ParallelFor(size_t first, size_t last, size_t grainSize, TFunction&& function) {
+    if (last - first <= std::max<size_t>(grainSize, 1)) {
+        if (first < last) {
+            function(first, last);
+        }
+        return;
+    }
+    size_t middle = first + (last - first) / 2;
+    ForkJoin(
+          [&] { ParallelFor(first, middle, grainSize, function); }
+        , [&] { ParallelFor(middle, last, grainSize, function); }
+    );
+}
+
+void TThreadPool::WorkerLoop(size_t queueIndex) {
+    CurrentPool_ = this;
+    CurrentQueueIndex_ = queueIndex;
+    while (true) {
+        if (TTask* task = TakeTask(queueIndex)) {
+            Execute(task);
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(SleepMutex_);
+        WakeUp_.wait(lock, [this] { return (IsStopped_ || PendingCount_ != 0); });
+        if (IsStopped_ && PendingCount_ == 0) {
+            return;
+        }
+    }
+}
+
+size_t TThreadPool::QueueIndex() const {
+    return (CurrentPool_ == this ? CurrentQueueIndex_ : Workers_.size());
+}
+
+void TThreadPool::Push(TTask* task) {
+    ++PendingCount_;
+    TWorkerQueue& queue = *Queues_[QueueIndex()];
+    {
+        std::lock_guard<std::mutex> lock(queue.Mutex);
+        queue.Tasks.push_back(task);
+    }
+    // Taking the mutex orders the push before the check of a worker that is about to sleep
+    {
+        std::lock_guard<std::mutex> lock(SleepMutex_);
+    }
+    WakeUp_.notify_one();
+}
+
+TThreadPool::TTask* TThreadPool::TakeTask(size_t queueIndex) {
+    {
+        TWorkerQueue& queue = *Queues_[queueIndex];
+        std::lock_guard<std::mutex> lock(queue.Mutex);
+        if (!queue.Tasks.empty()) {
+            TTask* task = queue.Tasks.back();
+            queue.Tasks.pop_back();
+            --PendingCount_;
+            return task;
+        }
+    }
+    for (size_t offset = 1; offset < Queues_.size(); ++offset) {
+        TWorkerQueue& queue = *Queues_[(queueIndex + offset) % Queues_.size()];
+        std::lock_guard<std::mutex> lock(queue.Mutex);
+        if (!queue.Tasks.empty()) {
+            TTask* task = queue.Tasks.front();
+            queue.Tasks.pop_front();
+            --PendingCount_;
+            return task;
+        }
+    }
+    return nullptr;
+}
+
+void TThreadPool::Execute(TTask* task) {
+    try {
+        task->Run(task->Function);
+    } catch (...) {
+        task->Error = std::current_exception();
+    }
+    // The task lives on the stack of the forking thread and may vanish right after this store
+    task->IsDone.store(true, std::memory_order_release);
+}
@@ -0,0 +1,96 @@
+/*
+ *      Summary: Global operator new and delete counting the allocations of the benchmarks
+ *         Date: 2022.01.30
+ *   Programmer: Kurdun Andrei
+ *   Code Style: Yandex
+ */
+#include "BenchCommon.h"
+
+#include <cstdlib>
+#include <new>
+
+TAllocationStats& AllocationStats() {
+    static TAllocationStats allocationStats;
+    return allocationStats;
+}
+
+// Live bytes need the size of a freed block, which only glibc reports for any pointer
+#if defined(__GLIBC__)
+#include <malloc.h>
+
+namespace {
+    void* CountedAllocate(size_t size, size_t align) {
+        void* memory = nullptr;
+        if (align <= alignof(std::max_align_t)) {
+            memory = std::malloc(size == 0 ? 1 : size);
+        } else if (posix_memalign(&memory, align, size == 0 ? 1 : size) != 0) {
+            memory = nullptr;
+        }
+        if (memory == nullptr) {
+            throw std::bad_alloc();
+        }
+        TAllocationStats& allocationStats = AllocationStats();
+        allocationStats.AllocationCount.fetch_add(1, std::memory_order_relaxed);
+        allocationStats.AllocatedBytes.fetch_add(size, std::memory_order_relaxed);
+        allocationStats.LiveBytes.fetch_add(static_cast<int64_t>(malloc_usable_size(memory)), std::memory_order_relaxed);
+        return memory;
+    }
+
+    void CountedDeallocate(void* memory) noexcept {
+        if (memory == nullptr) {
+            return;
+        }
+        AllocationStats().LiveBytes.fetch_sub(static_cast<int64_t>(malloc_usable_size(memory)), std::memory_order_relaxed);
+        std::free(memory);
+    }
+}
+
+void* operator new(size_t size) {
+    return CountedAllocate(size, alignof(std::max_align_t));
+}
+
+void* operator new[](size_t size) {
+    return CountedAllocate(size, alignof(std::max_align_t));
+}
+
+void* operator new(size_t size, std::align_val_t align) {
+    return CountedAllocate(size, static_cast<size_t>(align));
+}
+
+void* operator new[](size_t size, std::align_val_t align) {
+    return CountedAllocate(size, static_cast<size_t>(align));
+}
+
+void operator delete(void* memory) noexcept {
+    CountedDeallocate(memory);
+}
+
+void operator delete[](void* memory) noexcept {
+    CountedDeallocate(memory);
+}
+
+void operator delete(void* memory, size_t) noexcept {
+    CountedDeallocate(memory);
+}
+
+void operator delete[](void* memory, size_t) noexcept {
+    CountedDeallocate(memory);
+}
+
+void operator delete(void* memory, std::align_val_t) noexcept {
+    CountedDeallocate(memory);
+}
+
+void operator delete[](void* memory, std::align_val_t) noexcept {
+    CountedDeallocate(memory);
+}
+
+void operator delete(void* memory, size_t, std::align_val_t) noexcept {
+    CountedDeallocate(memory);
+}
+
+void operator delete[](void* memory, size_t, std::align_val_t) noexcept {
+    CountedDeallocate(memory);
+}
+
+#endif
@@ -0,0 +1,181 @@
+/*
+ *      Summary: Keys, counters and adapters shared by the AA Tree benchmarks
+ *         Date: 2022.01.30
+ *   Programmer: Kurdun Andrei
+ *   Code Style: Yandex
+ */
+#pragma once
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <numeric>
+#include <random>
+#include <string>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#endif
+
+#ifndef AA_TREE_BENCH_MAX_SIZE
+#define AA_TREE_BENCH_MAX_SIZE 1000000
+#endif
+
+// Filled by the global operator new and delete of AllocationCounter.cpp
+struct TAllocationStats {
+    std::atomic<uint64_t> AllocationCount = 0;
+    std::atomic<uint64_t> AllocatedBytes = 0;
+    std::atomic<int64_t> LiveBytes = 0;
+};
+
+TAllocationStats& AllocationStats();
+
+// Allocations made between construction and Report, per benchmark iteration
+class TAllocationScope {
+public:
+    TAllocationScope()
+        : AllocationCount_(AllocationStats().AllocationCount.load())
+        , AllocatedBytes_(AllocationStats().AllocatedBytes.load())
+    {
+    }
+
+    void Report(benchmark::State& state, double operationsPerIteration) const {
+        double operationCount = std::max(1.0, static_cast<double>(state.iterations()) * operationsPerIteration);
+        state.counters["allocs/op"] = static_cast<double>(AllocationStats().AllocationCount.load() - AllocationCount_) / operationCount;
+        state.counters["bytes/op"] = static_cast<double>(AllocationStats().AllocatedBytes.load() - AllocatedBytes_) / operationCount;
+    }
+
+    // Allocations between Pause and Resume are left out, such as the setup made with the timer paused
+    void Pause() {
+        PausedCount_ = AllocationStats().AllocationCount.load();
+        PausedBytes_ = AllocationStats().AllocatedBytes.load();
+    }
+
+    void Resume() {
+        AllocationCount_ += AllocationStats().AllocationCount.load() - PausedCount_;
+        AllocatedBytes_ += AllocationStats().AllocatedBytes.load() - PausedBytes_;
+    }
+
+private:
+    uint64_t AllocationCount_ = 0;
+    uint64_t AllocatedBytes_ = 0;
+    uint64_t PausedCount_ = 0;
+    uint64_t PausedBytes_ = 0;
+};
+
+// Peak resident set of the whole process so far, it only grows from one benchmark to the next
+inline void ReportPeakRss(benchmark::State& state) {
+#if defined(__unix__) || defined(__APPLE__)
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#if defined(__APPLE__)
+    double peakBytes = static_cast<double>(usage.ru_maxrss);
+#else
+    double peakBytes = static_cast<double>(usage.ru_maxrss) * 1024;
+#endif
+    state.counters["peak_rss_MB"] = peakBytes / (1024 * 1024);
+#else
+    (void)state;
+#endif
+}
+
+// Time of one operation when every iteration makes operationCount of them
+inline void ReportTimePerOperation(benchmark::State& state, double operationCount) {
+    state.SetItemsProcessed(static_cast<int64_t>(static_cast<double>(state.iterations()) * operationCount));
+    state.counters["time/op"] = benchmark::Counter(
+          operationCount
+        , benchmark::Counter::kIsIterationInvariantRate | benchmark::Counter::kInvert
+    );
+}
+
+// Key number i in the order of every key type: present keys are even, missing keys are odd
+template<class TKey>
+TKey MakeKey(uint64_t keyNumber) {
+    if constexpr (std::is_same_v<TKey, std::string>) {
+        // Longer than the small string buffer, zero padded so that the order is numeric
+        char buffer[32];
+        std::snprintf(buffer, sizeof(buffer), "key-%020llu", static_cast<unsigned long long>(keyNumber));
+        return TKey(buffer);
+    } else {
+        return static_cast<TKey>(keyNumber);
+    }
+}
+
+template<class TKey>
+std::vector<TKey> SortedKeys(size_t count) {
+    std::vector<TKey> keys;
+    keys.reserve(count);
+    for (size_t keyNumber = 0; keyNumber < count; ++keyNumber) {
+        keys.push_back(MakeKey<TKey>(2 * keyNumber));
+    }
+    return keys;
+}
+
+template<class TKey>
+std::vector<TKey> ShuffledKeys(size_t count, uint64_t seed = 42) {
+    std::vector<TKey> keys = SortedKeys<TKey>(count);
+    std::shuffle(keys.begin(), keys.end(), std::mt19937_64(seed));
+    return keys;
+}
+
+// Keys between the present ones, in random order
+template<class TKey>
+std::vector<TKey> MissingKeys(size_t count, uint64_t seed = 43) {
+    std::vector<TKey> keys;
+    keys.reserve(count);
+    for (size_t keyNumber = 0; keyNumber < count; ++keyNumber) {
+        keys.push_back(MakeKey<TKey>(2 * keyNumber + 1));
+    }
+    std::shuffle(keys.begin(), keys.end(), std::mt19937_64(seed));
+    return keys;
+}
+
+// Powers of ten from 1e3 up to AA_TREE_BENCH_MAX_SIZE
+inline void SizeRange(benchmark::internal::Benchmark* benchmark) {
+    for (int64_t size = 1000; size <= static_cast<int64_t>(AA_TREE_BENCH_MAX_SIZE); size *= 10) {
+        benchmark->Arg(size);
+    }
+}
+
+// Sorted, deduplicated vector answering the same lookups
+template<class TKey>
+class TSortedVector {
+public:
+    using value_type = TKey;
+    using iterator = typename std::vector<TKey>::const_iterator;
+
+    template<class Iterator>
+    void Assign(Iterator first, Iterator last) {
+        Keys_.assign(first, last);
+        std::sort(Keys_.begin(), Keys_.end());
+        Keys_.erase(std::unique(Keys_.begin(), Keys_.end()), Keys_.end());
+    }
+
+    size_t size() const {
+        return Keys_.size();
+    }
+
+    iterator begin() const {
+        return Keys_.begin();
+    }
+
+    iterator end() const {
+        return Keys_.end();
+    }
+
+    iterator lower_bound(const TKey& wantedKey) const {
+        return std::lower_bound(Keys_.begin(), Keys_.end(), wantedKey);
+    }
+
+    iterator find(const TKey& wantedKey) const {
+        iterator foundIterator = lower_bound(wantedKey);
+        return (foundIterator != end() && !(wantedKey < *foundIterator) ? foundIterator : end());
+    }
+
+private:
+    std::vector<TKey> Keys_;
+};
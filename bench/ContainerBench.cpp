@@ -0,0 +1,266 @@
+/*
+ *      Summary: Set against std::set, absl::btree_set, a sorted vector and the other AA Tree containers
+ *         Date: 2022.01.30
+ *   Programmer: Kurdun Andrei
+ *   Code Style: Yandex
+ */
+#include "BenchCommon.h"
+
+#include "BlockSet.h"
+#include "FrozenSet.h"
+#include "Set.h"
+
+#include <optional>
+#include <set>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#if defined(AA_TREE_BENCH_HAVE_ABSL)
+#include <absl/container/btree_set.h>
+#endif
+
+namespace {
+    enum class EKeyOrder {
+        Random,
+        Sorted,
+        Reverse,
+    };
+
+    // Lookups cycle through at most this many keys
+    constexpr size_t MaxQueryCount = size_t(1) << 20;
+
+    // Containers that are only built in bulk
+    template<class TContainer>
+    struct TIsMutable : std::true_type {
+    };
+
+    template<class TKey>
+    struct TIsMutable<TSortedVector<TKey>> : std::false_type {
+    };
+
+    template<class TKey>
+    struct TIsMutable<FrozenSet<TKey>> : std::false_type {
+    };
+
+    template<class TContainer, class TKey>
+    void Fill(TContainer& container, const std::vector<TKey>& keys) {
+        for (const TKey& key : keys) {
+            container.insert(key);
+        }
+    }
+
+    template<class TKey>
+    void Fill(TSortedVector<TKey>& container, const std::vector<TKey>& keys) {
+        container.Assign(keys.begin(), keys.end());
+    }
+
+    template<class TKey>
+    void Fill(FrozenSet<TKey>& container, const std::vector<TKey>& keys) {
+        TSortedVector<TKey> sortedKeys;
+        sortedKeys.Assign(keys.begin(), keys.end());
+        container = FrozenSet<TKey>(Sorted, sortedKeys.begin(), sortedKeys.end());
+    }
+
+    template<class TKey>
+    std::vector<TKey> OrderedKeys(size_t size, EKeyOrder keyOrder) {
+        if (keyOrder == EKeyOrder::Random) {
+            return ShuffledKeys<TKey>(size);
+        }
+        std::vector<TKey> keys = SortedKeys<TKey>(size);
+        if (keyOrder == EKeyOrder::Reverse) {
+            std::reverse(keys.begin(), keys.end());
+        }
+        return keys;
+    }
+
+    template<class TContainer>
+    TContainer MakeContainer(size_t size) {
+        TContainer container;
+        Fill(container, ShuffledKeys<typename TContainer::value_type>(size));
+        return container;
+    }
+
+    // Also reports the memory held by the built container
+    template<class TContainer, EKeyOrder KeyOrder>
+    void BM_Insert(benchmark::State& state) {
+        using TKey = typename TContainer::value_type;
+        size_t size = static_cast<size_t>(state.range(0));
+        std::vector<TKey> keys = OrderedKeys<TKey>(size, KeyOrder);
+        std::optional<TContainer> container;
+        int64_t containerBytes = 0;
+        TAllocationScope allocationScope;
+        for (auto _ : state) {
+            int64_t liveBytes = AllocationStats().LiveBytes.load();
+            container.emplace();
+            Fill(*container, keys);
+            benchmark::DoNotOptimize(*container);
+            state.PauseTiming();
+            containerBytes = AllocationStats().LiveBytes.load() - liveBytes;
+            container.reset();
+            state.ResumeTiming();
+        }
+        ReportTimePerOperation(state, static_cast<double>(size));
+        allocationScope.Report(state, static_cast<double>(size));
+        state.counters["container_bytes/key"] = static_cast<double>(containerBytes) / static_cast<double>(size);
+        ReportPeakRss(state);
+    }
+
+    template<class TContainer>
+    void BM_Erase(benchmark::State& state) {
+        using TKey = typename TContainer::value_type;
+        size_t size = static_cast<size_t>(state.range(0));
+        std::vector<TKey> keys = ShuffledKeys<TKey>(size);
+        std::vector<TKey> sortedKeys = SortedKeys<TKey>(size);
+        // Only the erase loop is counted: a node container should make no allocations in it
+        TAllocationScope allocationScope;
+        for (auto _ : state) {
+            state.PauseTiming();
+            allocationScope.Pause();
+            TContainer container;
+            Fill(container, sortedKeys);
+            allocationScope.Resume();
+            state.ResumeTiming();
+            for (const TKey& key : keys) {
+                container.erase(key);
+            }
+            benchmark::DoNotOptimize(container);
+        }
+        ReportTimePerOperation(state, static_cast<double>(size));
+        allocationScope.Report(state, static_cast<double>(size));
+        ReportPeakRss(state);
+    }
+
+    template<class TContainer, bool IsHit>
+    void BM_Find(benchmark::State& state) {
+        using TKey = typename TContainer::value_type;
+        size_t size = static_cast<size_t>(state.range(0));
+        TContainer container = MakeContainer<TContainer>(size);
+        std::vector<TKey> queries = (IsHit ? ShuffledKeys<TKey>(size, 7) : MissingKeys<TKey>(size));
+        queries.resize(std::min(queries.size(), MaxQueryCount));
+        size_t queryIndex = 0;
+        TAllocationScope allocationScope;
+        for (auto _ : state) {
+            benchmark::DoNotOptimize(container.find(queries[queryIndex]) != container.end());
+            if (++queryIndex == queries.size()) {
+                queryIndex = 0;
+            }
+        }
+        ReportTimePerOperation(state, 1);
+        allocationScope.Report(state, 1);
+        ReportPeakRss(state);
+    }
+
+    template<class TContainer>
+    void BM_LowerBound(benchmark::State& state) {
+        using TKey = typename TContainer::value_type;
+        size_t size = static_cast<size_t>(state.range(0));
+        TContainer container = MakeContainer<TContainer>(size);
+        std::vector<TKey> queries = MissingKeys<TKey>(size);
+        queries.resize(std::min(queries.size(), MaxQueryCount));
+        size_t queryIndex = 0;
+        TAllocationScope allocationScope;
+        for (auto _ : state) {
+            auto foundIterator = container.lower_bound(queries[queryIndex]);
+            benchmark::DoNotOptimize(foundIterator);
+            if (++queryIndex == queries.size()) {
+                queryIndex = 0;
+            }
+        }
+        ReportTimePerOperation(state, 1);
+        allocationScope.Report(state, 1);
+        ReportPeakRss(state);
+    }
+
+    template<class TContainer>
+    void BM_Scan(benchmark::State& state) {
+        using TKey = typename TContainer::value_type;
+        size_t size = static_cast<size_t>(state.range(0));
+        TContainer container = MakeContainer<TContainer>(size);
+        TAllocationScope allocationScope;
+        for (auto _ : state) {
+            for (const TKey& key : container) {
+                benchmark::DoNotOptimize(&key);
+            }
+        }
+        ReportTimePerOperation(state, static_cast<double>(size));
+        allocationScope.Report(state, static_cast<double>(size));
+        ReportPeakRss(state);
+    }
+
+    template<class TContainer>
+    void BM_Copy(benchmark::State& state) {
+        size_t size = static_cast<size_t>(state.range(0));
+        TContainer container = MakeContainer<TContainer>(size);
+        std::optional<TContainer> copy;
+        TAllocationScope allocationScope;
+        for (auto _ : state) {
+            copy.emplace(container);
+            benchmark::DoNotOptimize(*copy);
+            state.PauseTiming();
+            copy.reset();
+            state.ResumeTiming();
+        }
+        ReportTimePerOperation(state, static_cast<double>(size));
+        allocationScope.Report(state, static_cast<double>(size));
+        ReportPeakRss(state);
+    }
+
+    template<class TContainer>
+    void BM_Destroy(benchmark::State& state) {
+        size_t size = static_cast<size_t>(state.range(0));
+        TContainer container = MakeContainer<TContainer>(size);
+        std::optional<TContainer> copy;
+        TAllocationScope allocationScope;
+        for (auto _ : state) {
+            state.PauseTiming();
+            allocationScope.Pause();
+            copy.emplace(container);
+            allocationScope.Resume();
+            state.ResumeTiming();
+            copy.reset();
+        }
+        ReportTimePerOperation(state, static_cast<double>(size));
+        allocationScope.Report(state, static_cast<double>(size));
+        ReportPeakRss(state);
+    }
+
+    template<class TContainer>
+    void RegisterContainer(const std::string& containerName) {
+        auto add = [&containerName](const char* operationName, void (*function)(benchmark::State&)) {
+            benchmark::RegisterBenchmark((containerName + "/" + operationName).c_str(), function)->Apply(SizeRange);
+        };
+        // Bulk-built containers sort their input, so the key order only matters for the trees
+        add("InsertRandom", BM_Insert<TContainer, EKeyOrder::Random>);
+        add("InsertSorted", BM_Insert<TContainer, EKeyOrder::Sorted>);
+        add("InsertReverse", BM_Insert<TContainer, EKeyOrder::Reverse>);
+        if constexpr (TIsMutable<TContainer>::value) {
+            add("Erase", BM_Erase<TContainer>);
+        }
+        add("FindHit", BM_Find<TContainer, true>);
+        add("FindMiss", BM_Find<TContainer, false>);
+        add("LowerBound", BM_LowerBound<TContainer>);
+        add("Scan", BM_Scan<TContainer>);
+        add("Copy", BM_Copy<TContainer>);
+        add("Destroy", BM_Destroy<TContainer>);
+    }
+
+    template<class TKey>
+    void RegisterKey(const std::string& keyName) {
+        RegisterContainer<Set<TKey>>("Set<" + keyName + ">");
+        RegisterContainer<std::set<TKey>>("std::set<" + keyName + ">");
+#if defined(AA_TREE_BENCH_HAVE_ABSL)
+        RegisterContainer<absl::btree_set<TKey>>("absl::btree_set<" + keyName + ">");
+#endif
+        RegisterContainer<TSortedVector<TKey>>("SortedVector<" + keyName + ">");
+        RegisterContainer<BlockSet<TKey>>("BlockSet<" + keyName + ">");
+        RegisterContainer<FrozenSet<TKey>>("FrozenSet<" + keyName + ">");
+    }
+
+    [[maybe_unused]] const bool IsRegistered = [] {
+        RegisterKey<int>("int");
+        RegisterKey<uint64_t>("uint64");
+        RegisterKey<std::string>("string");
+        return true;
+    }();
+}
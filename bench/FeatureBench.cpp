@@ -0,0 +1,507 @@
+/*
+ *      Summary: Benchmarks of bulk, parallel, concurrent, batched and file operations of AA Tree
+ *         Date: 2022.01.30
+ *   Programmer: Kurdun Andrei
+ *   Code Style: Yandex
+ */
+#include "BenchCommon.h"
+
+#include "BlockSearch.h"
+#include "ConcurrentSet.h"
+#include "FrozenSet.h"
+#include "Set.h"
+#include "SetFile.h"
+#include "SmallSet.h"
+#include "ThreadPool.h"
+
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <optional>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+    using TKey = uint64_t;
+
+    // Sizes of the scaling and batch benchmarks
+    constexpr int64_t ParallelSize = std::min<int64_t>(int64_t(1) << 22, AA_TREE_BENCH_MAX_SIZE * 4);
+    constexpr int64_t ConcurrentSize = std::min<int64_t>(int64_t(1) << 20, AA_TREE_BENCH_MAX_SIZE);
+
+    //----------------Sorted build----------------
+
+    void BM_FromSorted(benchmark::State& state) {
+        size_t size = static_cast<size_t>(state.range(0));
+        std::vector<TKey> keys = SortedKeys<TKey>(size);
+        std::optional<Set<TKey>> set;
+        TAllocationScope allocationScope;
+        for (auto _ : state) {
+            set.emplace(Set<TKey>::from_sorted(keys.begin(), keys.end()));
+            benchmark::DoNotOptimize(*set);
+            state.PauseTiming();
+            set.reset();
+            state.ResumeTiming();
+        }
+        ReportTimePerOperation(state, static_cast<double>(size));
+        allocationScope.Report(state, static_cast<double>(size));
+    }
+
+    void BM_InsertBatch(benchmark::State& state) {
+        size_t size = static_cast<size_t>(state.range(0));
+        std::vector<TKey> keys = SortedKeys<TKey>(size);
+        Set<TKey> set = Set<TKey>::from_sorted(keys.begin(), keys.end());
+        // A tenth of the size, all new keys
+        std::vector<TKey> batch = MissingKeys<TKey>(size);
+        batch.resize(size / 10);
+        std::optional<Set<TKey>> copy;
+        for (auto _ : state) {
+            state.PauseTiming();
+            copy.emplace(set);
+            state.ResumeTiming();
+            copy->insert_batch(batch.begin(), batch.end());
+            benchmark::DoNotOptimize(*copy);
+        }
+        ReportTimePerOperation(state, static_cast<double>(batch.size()));
+    }
+
+    //----------------Insert and erase latency----------------
+
+    // One insert and one erase of a missing key per iteration, so the set keeps its size and depth.
+    // The keys fall between random neighbours, or all go past the maximum down the right spine
+    template<bool IsAppend>
+    void BM_InsertEraseLatency(benchmark::State& state) {
+        size_t size = static_cast<size_t>(state.range(0));
+        std::vector<TKey> keys = SortedKeys<TKey>(size);
+        Set<TKey> set(Sorted, keys.begin(), keys.end());
+        std::vector<TKey> queries = (IsAppend ? std::vector<TKey>{keys.back() + 1} : MissingKeys<TKey>(size));
+        size_t queryIndex = 0;
+        for (auto _ : state) {
+            set.insert(queries[queryIndex]);
+            set.erase(queries[queryIndex]);
+            if (++queryIndex == queries.size()) {
+                queryIndex = 0;
+            }
+        }
+        benchmark::DoNotOptimize(set);
+        ReportTimePerOperation(state, 2);
+    }
+
+    //----------------Parallel scaling----------------
+
+    void BM_ParallelFromSorted(benchmark::State& state) {
+        size_t size = static_cast<size_t>(state.range(0));
+        TThreadPool pool(static_cast<size_t>(state.range(1)));
+        std::vector<TKey> keys = SortedKeys<TKey>(size);
+        std::optional<Set<TKey>> set;
+        for (auto _ : state) {
+            set.emplace(Set<TKey>::from_sorted(pool, keys.begin(), keys.end()));
+            benchmark::DoNotOptimize(*set);
+            state.PauseTiming();
+            set->clear(pool);
+            state.ResumeTiming();
+        }
+        ReportTimePerOperation(state, static_cast<double>(size));
+    }
+
+    void BM_ParallelUnion(benchmark::State& state) {
+        size_t size = static_cast<size_t>(state.range(0));
+        TThreadPool pool(static_cast<size_t>(state.range(1)));
+        std::vector<TKey> evenKeys = SortedKeys<TKey>(size);
+        std::vector<TKey> oddKeys = MissingKeys<TKey>(size);
+        std::sort(oddKeys.begin(), oddKeys.end());
+        Set<TKey> left = Set<TKey>::from_sorted(evenKeys.begin(), evenKeys.end());
+        Set<TKey> right = Set<TKey>::from_sorted(oddKeys.begin(), oddKeys.end());
+        for (auto _ : state) {
+            state.PauseTiming();
+            Set<TKey> leftCopy = left;
+            Set<TKey> rightCopy = right;
+            state.ResumeTiming();
+            Set<TKey> unionSet = Set<TKey>::set_union(pool, std::move(leftCopy), std::move(rightCopy));
+            benchmark::DoNotOptimize(unionSet);
+            state.PauseTiming();
+            unionSet.clear(pool);
+            state.ResumeTiming();
+        }
+        ReportTimePerOperation(state, static_cast<double>(2 * size));
+    }
+
+    //----------------Concurrent readers and writers----------------
+
+    ConcurrentSet<TKey>& SharedConcurrentSet() {
+        static ConcurrentSet<TKey> sharedSet;
+        [[maybe_unused]] static const bool isFilled = [] {
+            for (TKey key : ShuffledKeys<TKey>(ConcurrentSize)) {
+                sharedSet.insert(key);
+            }
+            return true;
+        }();
+        return sharedSet;
+    }
+
+    // range(0) is the percentage of reads; writers insert a missing key and erase it again
+    void BM_ConcurrentMix(benchmark::State& state) {
+        ConcurrentSet<TKey>& concurrentSet = SharedConcurrentSet();
+        uint64_t readPercent = static_cast<uint64_t>(state.range(0));
+        std::mt19937_64 random(state.thread_index() + 1);
+        bool isInserting = true;
+        TKey writtenKey = 0;
+        for (auto _ : state) {
+            TKey key = 2 * (random() % ConcurrentSize);
+            if (random() % 100 < readPercent) {
+                benchmark::DoNotOptimize(concurrentSet.contains(key));
+            } else if (isInserting) {
+                writtenKey = key + 1;
+                concurrentSet.insert(writtenKey);
+                isInserting = false;
+            } else {
+                concurrentSet.erase(writtenKey);
+                isInserting = true;
+            }
+        }
+        if (!isInserting) {
+            concurrentSet.erase(writtenKey);
+        }
+        ReportTimePerOperation(state, 1);
+    }
+
+    //----------------Block search----------------
+
+    template<bool IsPortable>
+    void BM_BlockCountLess(benchmark::State& state) {
+        // One BlockSet block of uint32_t keys
+        std::vector<uint32_t> keys(31);
+        for (size_t keyIndex = 0; keyIndex < keys.size(); ++keyIndex) {
+            keys[keyIndex] = static_cast<uint32_t>(2 * keyIndex);
+        }
+        std::mt19937 random(1);
+        std::vector<uint32_t> queries(1024);
+        for (uint32_t& query : queries) {
+            query = random() % 64;
+        }
+        size_t queryIndex = 0;
+        for (auto _ : state) {
+            if constexpr (IsPortable) {
+                benchmark::DoNotOptimize(BlockCountLessPortable(keys.data(), keys.size(), queries[queryIndex]));
+            } else {
+                benchmark::DoNotOptimize(BlockCountLess(keys.data(), keys.size(), queries[queryIndex]));
+            }
+            queryIndex = (queryIndex + 1) % queries.size();
+        }
+        ReportTimePerOperation(state, 1);
+    }
+
+    //----------------Batched lookups----------------
+
+    // range(1) lookups per iteration, one by one or as one find_batch
+    template<bool IsBatch>
+    void BM_FindInterleaved(benchmark::State& state) {
+        size_t size = static_cast<size_t>(state.range(0));
+        size_t batchSize = static_cast<size_t>(state.range(1));
+        std::vector<TKey> keys = SortedKeys<TKey>(size);
+        Set<TKey> set = Set<TKey>::from_sorted(keys.begin(), keys.end());
+        std::vector<TKey> queries = ShuffledKeys<TKey>(size, 7);
+        queries.resize(std::max(queries.size() / batchSize * batchSize, batchSize));
+        std::vector<Set<TKey>::iterator> results(batchSize);
+        size_t queryIndex = 0;
+        for (auto _ : state) {
+            const TKey* batch = queries.data() + queryIndex;
+            if constexpr (IsBatch) {
+                set.find_batch(batch, batch + batchSize, results.begin());
+            } else {
+                for (size_t resultIndex = 0; resultIndex < batchSize; ++resultIndex) {
+                    results[resultIndex] = set.find(batch[resultIndex]);
+                }
+            }
+            benchmark::DoNotOptimize(results.data());
+            queryIndex += batchSize;
+            if (queryIndex + batchSize > queries.size()) {
+                queryIndex = 0;
+            }
+        }
+        ReportTimePerOperation(state, static_cast<double>(batchSize));
+    }
+
+    void InterleavedRange(benchmark::internal::Benchmark* benchmark) {
+        for (int64_t size = 1000; size <= static_cast<int64_t>(AA_TREE_BENCH_MAX_SIZE); size *= 10) {
+            for (int64_t batchSize : {16, 32, 64}) {
+                benchmark->Args({size, batchSize});
+            }
+        }
+    }
+
+    //----------------Files----------------
+
+    void BM_SaveLoad(benchmark::State& state) {
+        size_t size = static_cast<size_t>(state.range(0));
+        std::vector<TKey> keys = SortedKeys<TKey>(size);
+        Set<TKey> set = Set<TKey>::from_sorted(keys.begin(), keys.end());
+        std::stringstream stream;
+        set.save(stream);
+        std::string file = stream.str();
+        for (auto _ : state) {
+            std::istringstream in(file);
+            Set<TKey> loadedSet = Set<TKey>::load(in);
+            benchmark::DoNotOptimize(loadedSet);
+        }
+        ReportTimePerOperation(state, static_cast<double>(size));
+    }
+
+    // What load() replaces: inserting the dumped keys one by one
+    void BM_InsertRebuild(benchmark::State& state) {
+        size_t size = static_cast<size_t>(state.range(0));
+        std::vector<TKey> keys = SortedKeys<TKey>(size);
+        for (auto _ : state) {
+            Set<TKey> rebuiltSet;
+            for (TKey key : keys) {
+                rebuiltSet.insert(key);
+            }
+            benchmark::DoNotOptimize(rebuiltSet);
+        }
+        ReportTimePerOperation(state, static_cast<double>(size));
+    }
+
+    // Mapping plus one lookup, which touches only the pages on its path
+    void BM_MapFrozen(benchmark::State& state) {
+        size_t size = static_cast<size_t>(state.range(0));
+        std::vector<TKey> keys = SortedKeys<TKey>(size);
+        std::string path = (std::filesystem::temp_directory_path() / "aa_tree_bench.frozen").string();
+        {
+            FrozenSet<TKey> frozenSet(Sorted, keys.begin(), keys.end());
+            std::ofstream out(path, std::ios::binary);
+            frozenSet.save(out);
+        }
+        for (auto _ : state) {
+            FrozenSet<TKey> mappedSet = FrozenSet<TKey>::map(path);
+            benchmark::DoNotOptimize(mappedSet.contains(keys[keys.size() / 2]));
+        }
+        std::remove(path.c_str());
+    }
+
+    //----------------Range erase----------------
+
+    // Expiring the oldest tenth of the keys, one erase() per key or one erase_range()
+    template<bool IsRange>
+    void BM_EraseWindow(benchmark::State& state) {
+        size_t size = static_cast<size_t>(state.range(0));
+        std::vector<TKey> keys = SortedKeys<TKey>(size);
+        TKey upperKey = keys[size / 10];
+        std::optional<Set<TKey>> set;
+        for (auto _ : state) {
+            state.PauseTiming();
+            set.emplace(Sorted, keys.begin(), keys.end());
+            state.ResumeTiming();
+            if constexpr (IsRange) {
+                set->erase_range(keys.front(), upperKey);
+            } else {
+                for (size_t index = 0; index < size / 10; ++index) {
+                    set->erase(keys[index]);
+                }
+            }
+            benchmark::DoNotOptimize(*set);
+            state.PauseTiming();
+            set.reset();
+            state.ResumeTiming();
+        }
+        ReportTimePerOperation(state, static_cast<double>(size / 10));
+    }
+
+    //----------------Finger search----------------
+
+    // A sweep of the gaps between the keys, each lower bound searched from the previous result or from the root
+    template<bool IsFinger>
+    void BM_SweepLowerBound(benchmark::State& state) {
+        size_t size = static_cast<size_t>(state.range(0));
+        std::vector<TKey> keys = SortedKeys<TKey>(size);
+        Set<TKey> set(Sorted, keys.begin(), keys.end());
+        std::vector<TKey> queries = MissingKeys<TKey>(size);
+        std::sort(queries.begin(), queries.end());
+        for (auto _ : state) {
+            Set<TKey>::iterator foundIterator = set.begin();
+            for (TKey query : queries) {
+                foundIterator = (IsFinger ? set.lower_bound(foundIterator, query) : set.lower_bound(query));
+                benchmark::DoNotOptimize(foundIterator);
+            }
+        }
+        ReportTimePerOperation(state, static_cast<double>(queries.size()));
+    }
+
+    //----------------Node handles----------------
+
+    // Moving every key to another set and back, by copy and erase or by extract and insert of the node
+    template<bool IsNodeHandle>
+    void BM_MoveKeys(benchmark::State& state) {
+        size_t size = static_cast<size_t>(state.range(0));
+        std::vector<TKey> sortedKeys = SortedKeys<TKey>(size);
+        std::vector<TKey> keys = ShuffledKeys<TKey>(size);
+        Set<TKey> set(Sorted, sortedKeys.begin(), sortedKeys.end());
+        Set<TKey> otherSet;
+        TAllocationScope allocationScope;
+        for (auto _ : state) {
+            for (TKey key : keys) {
+                if constexpr (IsNodeHandle) {
+                    otherSet.insert(set.extract(key));
+                } else {
+                    otherSet.insert(key);
+                    set.erase(key);
+                }
+            }
+            std::swap(set, otherSet);
+        }
+        ReportTimePerOperation(state, static_cast<double>(size));
+        allocationScope.Report(state, static_cast<double>(size));
+    }
+
+    //----------------Small sets----------------
+
+    // Per-request tag sets: a few keys inserted and probed, then the set is dropped
+    template<class TContainer>
+    void BM_TinySet(benchmark::State& state) {
+        size_t size = static_cast<size_t>(state.range(0));
+        std::vector<TKey> keys = ShuffledKeys<TKey>(size);
+        TAllocationScope allocationScope;
+        for (auto _ : state) {
+            TContainer set;
+            for (TKey key : keys) {
+                set.insert(key);
+            }
+            for (TKey key : keys) {
+                benchmark::DoNotOptimize(set.contains(key));
+            }
+            benchmark::DoNotOptimize(set);
+        }
+        ReportTimePerOperation(state, static_cast<double>(size));
+        allocationScope.Report(state, static_cast<double>(size));
+    }
+
+    //----------------Lazy erase----------------
+
+    // Tombstones are only dropped when the set is gone
+    struct TLazyEraseManualTraits : TLazyEraseSetTraits {
+        static constexpr uint32_t MaxTombstonePercent = 100;
+    };
+
+    // Churn that erases half of the keys and probes the rest, with erase() relinking or marking nodes dead
+    template<class TTraits>
+    void BM_EraseHalf(benchmark::State& state) {
+        size_t size = static_cast<size_t>(state.range(0));
+        std::vector<TKey> sortedKeys = SortedKeys<TKey>(size);
+        std::vector<TKey> keys = ShuffledKeys<TKey>(size);
+        for (auto _ : state) {
+            state.PauseTiming();
+            Set<TKey, std::less<TKey>, std::allocator<TKey>, TTraits> set(Sorted, sortedKeys.begin(), sortedKeys.end());
+            state.ResumeTiming();
+            for (size_t keyIndex = 0; keyIndex < size; keyIndex += 2) {
+                set.erase(keys[keyIndex]);
+                benchmark::DoNotOptimize(set.contains(keys[keyIndex + 1 < size ? keyIndex + 1 : 0]));
+            }
+            benchmark::DoNotOptimize(set);
+        }
+        ReportTimePerOperation(state, static_cast<double>(size / 2));
+    }
+
+    // Expiry sweep: the oldest key goes first, so a dead run left at the front would be walked by every begin()
+    template<class TTraits>
+    void BM_EraseBegin(benchmark::State& state) {
+        size_t size = static_cast<size_t>(state.range(0));
+        std::vector<TKey> sortedKeys = SortedKeys<TKey>(size);
+        for (auto _ : state) {
+            state.PauseTiming();
+            Set<TKey, std::less<TKey>, std::allocator<TKey>, TTraits> set(Sorted, sortedKeys.begin(), sortedKeys.end());
+            state.ResumeTiming();
+            while (!set.empty()) {
+                benchmark::DoNotOptimize(set.min());
+                set.erase(set.begin());
+            }
+            benchmark::DoNotOptimize(set);
+        }
+        ReportTimePerOperation(state, static_cast<double>(size));
+    }
+
+    //----------------Tree shape----------------
+
+    // Hit lookups next to the search path lengths of the tree, so that balancing changes are judged on both
+    template<bool IsSortedInsert>
+    void BM_ShapeFind(benchmark::State& state) {
+        size_t size = static_cast<size_t>(state.range(0));
+        Set<TKey> set;
+        for (TKey key : (IsSortedInsert ? SortedKeys<TKey>(size) : ShuffledKeys<TKey>(size))) {
+            set.insert(key);
+        }
+        if (!set.validate()) {
+            state.SkipWithError("the tree breaks an AA invariant");
+            return;
+        }
+        std::vector<TKey> queries = ShuffledKeys<TKey>(std::min<size_t>(size, size_t(1) << 20), 7);
+        size_t queryIndex = 0;
+        for (auto _ : state) {
+            benchmark::DoNotOptimize(set.find(queries[queryIndex]) != set.end());
+            if (++queryIndex == queries.size()) {
+                queryIndex = 0;
+            }
+        }
+        TSetShape shape = set.shape_report();
+        state.counters["avg_depth"] = shape.AverageDepth;
+        state.counters["optimal_avg_depth"] = shape.OptimalAverageDepth;
+        state.counters["height"] = static_cast<double>(shape.Height);
+        state.counters["optimal_height"] = static_cast<double>(shape.OptimalHeight);
+        ReportTimePerOperation(state, 1);
+    }
+
+    [[maybe_unused]] const bool IsRegistered = [] {
+        benchmark::RegisterBenchmark("Set<uint64>/FromSorted", BM_FromSorted)->Apply(SizeRange);
+        benchmark::RegisterBenchmark("Set<uint64>/InsertBatch", BM_InsertBatch)->Apply(SizeRange);
+        benchmark::RegisterBenchmark("Set<uint64>/InsertEraseRandom", BM_InsertEraseLatency<false>)->Apply(SizeRange);
+        benchmark::RegisterBenchmark("Set<uint64>/InsertEraseAppend", BM_InsertEraseLatency<true>)->Apply(SizeRange);
+
+        benchmark::RegisterBenchmark("Set<uint64>/ParallelFromSorted", BM_ParallelFromSorted)
+            ->ArgsProduct({{ParallelSize}, {1, 2, 4, 8, 16, 32, 64}})
+            ->ArgNames({"size", "threads"})
+            ->UseRealTime();
+        benchmark::RegisterBenchmark("Set<uint64>/ParallelUnion", BM_ParallelUnion)
+            ->ArgsProduct({{ParallelSize / 2}, {1, 2, 4, 8, 16, 32, 64}})
+            ->ArgNames({"size", "threads"})
+            ->UseRealTime();
+
+        benchmark::RegisterBenchmark("ConcurrentSet<uint64>/Mix", BM_ConcurrentMix)
+            ->ArgName("read_percent")
+            ->Arg(95)
+            ->Arg(50)
+            ->ThreadRange(1, 64)
+            ->UseRealTime();
+
+        benchmark::RegisterBenchmark("BlockCountLess<uint32>/Portable", BM_BlockCountLess<true>);
+        benchmark::RegisterBenchmark("BlockCountLess<uint32>/Dispatched", BM_BlockCountLess<false>);
+
+        benchmark::RegisterBenchmark("Set<uint64>/FindLoop", BM_FindInterleaved<false>)
+            ->Apply(InterleavedRange)
+            ->ArgNames({"size", "batch"});
+        benchmark::RegisterBenchmark("Set<uint64>/FindBatch", BM_FindInterleaved<true>)
+            ->Apply(InterleavedRange)
+            ->ArgNames({"size", "batch"});
+
+        benchmark::RegisterBenchmark("Set<uint64>/Load", BM_SaveLoad)->Apply(SizeRange);
+        benchmark::RegisterBenchmark("Set<uint64>/InsertRebuild", BM_InsertRebuild)->Apply(SizeRange);
+        benchmark::RegisterBenchmark("FrozenSet<uint64>/Map", BM_MapFrozen)->Apply(SizeRange);
+
+        benchmark::RegisterBenchmark("Set<uint64>/EraseWindowLoop", BM_EraseWindow<false>)->Apply(SizeRange);
+        benchmark::RegisterBenchmark("Set<uint64>/EraseWindowRange", BM_EraseWindow<true>)->Apply(SizeRange);
+        benchmark::RegisterBenchmark("Set<uint64>/SweepLowerBoundRoot", BM_SweepLowerBound<false>)->Apply(SizeRange);
+        benchmark::RegisterBenchmark("Set<uint64>/SweepLowerBoundFinger", BM_SweepLowerBound<true>)->Apply(SizeRange);
+        benchmark::RegisterBenchmark("Set<uint64>/MoveKeysCopy", BM_MoveKeys<false>)->Apply(SizeRange);
+        benchmark::RegisterBenchmark("Set<uint64>/MoveKeysNodeHandle", BM_MoveKeys<true>)->Apply(SizeRange);
+        benchmark::RegisterBenchmark("Set<uint64>/Tiny", BM_TinySet<Set<TKey>>)->Arg(4)->Arg(8)->Arg(16);
+        benchmark::RegisterBenchmark("SmallSet<uint64>/Tiny", BM_TinySet<SmallSet<TKey>>)->Arg(4)->Arg(8)->Arg(16);
+        benchmark::RegisterBenchmark("Set<uint64>/EraseHalf", BM_EraseHalf<TDefaultSetTraits>)->Apply(SizeRange);
+        benchmark::RegisterBenchmark("Set<uint64>/EraseHalfLazy", BM_EraseHalf<TLazyEraseSetTraits>)->Apply(SizeRange);
+        benchmark::RegisterBenchmark("Set<uint64>/EraseHalfLazyNoCompact", BM_EraseHalf<TLazyEraseManualTraits>)->Apply(SizeRange);
+        benchmark::RegisterBenchmark("Set<uint64>/EraseBegin", BM_EraseBegin<TDefaultSetTraits>)->Apply(SizeRange);
+        benchmark::RegisterBenchmark("Set<uint64>/EraseBeginLazy", BM_EraseBegin<TLazyEraseSetTraits>)->Apply(SizeRange);
+        benchmark::RegisterBenchmark("Set<uint64>/EraseBeginLazyNoCompact", BM_EraseBegin<TLazyEraseManualTraits>)->Apply(SizeRange);
+        benchmark::RegisterBenchmark("Set<uint64>/ShapeRandomInsert", BM_ShapeFind<false>)->Apply(SizeRange);
+        benchmark::RegisterBenchmark("Set<uint64>/ShapeSortedInsert", BM_ShapeFind<true>)->Apply(SizeRange);
+        return true;
+    }();
+}
@@ -0,0 +1,353 @@
+/*
+ *      Summary: Differential tests of BlockSet, SmallSet, StaticSet, FrozenSet and the set files
+ *         Date: 2022.01.30
+ *   Programmer: Kurdun Andrei
+ *   Code Style: Yandex
+ */
+#include "TestCommon.h"
+
+#include "BlockSet.h"
+#include "FrozenSet.h"
+#include "Set.h"
+#include "SetFile.h"
+#include "SmallSet.h"
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <set>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace {
+    //----------------BlockSet----------------
+
+    template<class TBlockSet, class TKeyMaker>
+    void RunBlockSetDifferential(TKeyMaker makeKey) {
+        using TKey = typename TBlockSet::value_type;
+        TBlockSet set;
+        std::set<TKey> reference;
+        for (size_t step = 0; step < DifferentialSteps * 2; ++step) {
+            TKey key = makeKey(RandomKey(3000));
+            switch (RandomKey(8)) {
+                case 0: {
+                    auto result = set.insert(key);
+                    AA_TREE_CHECK(result.second == reference.insert(key).second);
+                    AA_TREE_CHECK(*result.first == key);
+                    break;
+                }
+                case 1: {
+                    TKey movedKey = key;
+                    AA_TREE_CHECK(set.emplace(std::move(movedKey)).second == reference.insert(key).second);
+                    break;
+                }
+                case 2: {
+                    auto hint = set.lower_bound(key);
+                    if (RandomKey(2) == 0 && hint != set.begin()) {
+                        --hint;
+                    }
+                    AA_TREE_CHECK(*set.insert(hint, key) == key);
+                    reference.insert(key);
+                    break;
+                }
+                case 3: {
+                    AA_TREE_CHECK(*set.emplace_hint(RandomKey(2) == 0 ? set.end() : set.begin(), key) == key);
+                    reference.insert(key);
+                    break;
+                }
+                case 4: {
+                    AA_TREE_CHECK(set.erase(key) == reference.erase(key));
+                    break;
+                }
+                case 5: {
+                    auto foundIterator = set.find(key);
+                    AA_TREE_REQUIRE((foundIterator == set.end()) == (reference.count(key) == 0));
+                    if (foundIterator != set.end()) {
+                        auto nextIterator = set.erase(foundIterator);
+                        AA_TREE_CHECK(SamePosition(set, nextIterator, reference, reference.erase(reference.find(key))));
+                    }
+                    break;
+                }
+                default: {
+                    AA_TREE_CHECK(set.count(key) == reference.count(key));
+                    auto range = set.equal_range(key);
+                    auto referenceRange = reference.equal_range(key);
+                    AA_TREE_CHECK(SamePosition(set, range.first, reference, referenceRange.first));
+                    AA_TREE_CHECK(SamePosition(set, range.second, reference, referenceRange.second));
+                    AA_TREE_CHECK(SamePosition(set, set.upper_bound(key), reference, reference.upper_bound(key)));
+                    break;
+                }
+            }
+            AA_TREE_REQUIRE(set.size() == reference.size());
+            if (step % 256 == 0) {
+                AA_TREE_REQUIRE(SameElements(set, reference));
+            }
+        }
+        AA_TREE_REQUIRE(SameElements(set, reference));
+
+        std::vector<TKey> sortedKeys(reference.begin(), reference.end());
+        AA_TREE_CHECK(SameElements(TBlockSet(sortedKeys.begin(), sortedKeys.end()), reference));
+        AA_TREE_CHECK(SameElements(TBlockSet(Sorted, reference.begin(), reference.end()), reference));
+        AA_TREE_CHECK(SameElements(TBlockSet(sortedKeys.rbegin(), sortedKeys.rend()), reference));
+        AA_TREE_CHECK(SameElements(TBlockSet(set.begin(), set.end()), reference));
+
+        TBlockSet other;
+        other.swap(set);
+        AA_TREE_CHECK(set.empty());
+        AA_TREE_CHECK(SameElements(other, reference));
+    }
+
+    AA_TREE_TEST(TBlockSetTest, RandomOperations) {
+        RunBlockSetDifferential<BlockSet<int>>([](int key) {
+            return key;
+        });
+        // The vector searches flip the sign bit of unsigned keys, so those cross it
+        RunBlockSetDifferential<BlockSet<uint32_t>>([](int key) {
+            return static_cast<uint32_t>(key) * 1500007u;
+        });
+        RunBlockSetDifferential<BlockSet<int64_t>>([](int key) {
+            return static_cast<int64_t>(key - 1500) * (int64_t(1) << 32);
+        });
+        RunBlockSetDifferential<BlockSet<double>>([](int key) {
+            return (key - 1500) * 0.25;
+        });
+        RunBlockSetDifferential<BlockSet<std::string, std::less<std::string>, std::allocator<std::string>, 256>>([](int key) {
+            return StringKey(key);
+        });
+    }
+
+    AA_TREE_TEST(TBlockSetTest, SortedBuildPacksBlocks) {
+        std::vector<int> keys;
+        for (int key = 0; key < 10000; ++key) {
+            keys.push_back(key / 2);
+        }
+        BlockSet<int> set(keys.begin(), keys.end());
+        AA_TREE_CHECK(set.size() == 5000u);
+        AA_TREE_CHECK(set.block_count() < set.size() / (BlockSet<int>::BlockCapacity / 2));
+        AA_TREE_CHECK(SameElements(set, std::set<int>(keys.begin(), keys.end())));
+        AA_TREE_CHECK(SameElements(BlockSet<int>{3, 1, 2, 3}, std::set<int>{1, 2, 3}));
+    }
+
+    AA_TREE_TEST(TBlockSetTest, MovedFromSetIsEmpty) {
+        std::set<int> reference;
+        BlockSet<int> source;
+        for (int key = 0; key < 100; ++key) {
+            source.insert(key);
+            reference.insert(key);
+        }
+        BlockSet<int> target(std::move(source));
+        AA_TREE_CHECK(source.size() == 0u && source.empty() && source.begin() == source.end());
+        AA_TREE_CHECK(SameElements(target, reference));
+
+        source.insert(7);
+        source = std::move(target);
+        AA_TREE_CHECK(target.size() == 0u && target.empty() && target.begin() == target.end());
+        AA_TREE_CHECK(SameElements(source, reference));
+        target.insert(7);
+        AA_TREE_CHECK(SameElements(target, std::set<int>{7}));
+    }
+
+    // A block that cannot link its upper half keeps all of its keys
+    AA_TREE_TEST(TBlockSetTest, FailedSplitKeepsTheKeys) {
+        BlockSet<int, std::less<int>, TFailingAllocator<int>> set;
+        std::set<int> reference;
+        for (int round = 0; round < 3000; ++round) {
+            int key = RandomKey(5000);
+            AllocationBudget() = RandomKey(2);
+            try {
+                set.insert(key);
+                reference.insert(key);
+            } catch (const std::bad_alloc&) {
+            }
+            AllocationBudget() = -1;
+            AA_TREE_REQUIRE(SameElements(set, reference));
+        }
+    }
+
+    //----------------SmallSet and StaticSet----------------
+
+    AA_TREE_TEST(TSmallSetTest, CrossesTheInlineCapacity) {
+        SmallSet<int, 8> set;
+        std::set<int> reference;
+        for (size_t step = 0; step < DifferentialSteps; ++step) {
+            // The key range drifts so the set keeps growing past the buffer and shrinking back
+            int keyRange = (step / 2000) % 2 == 0 ? 12 : 40;
+            int key = RandomKey(keyRange);
+            if (RandomKey(2) == 0) {
+                auto result = set.insert(key);
+                AA_TREE_CHECK(result.second == reference.insert(key).second);
+                AA_TREE_CHECK(*result.first == key);
+            } else {
+                AA_TREE_CHECK(set.erase(key) == reference.erase(key));
+            }
+            AA_TREE_CHECK(set.count(key) == reference.count(key));
+            AA_TREE_CHECK(SamePosition(set, set.lower_bound(key), reference, reference.lower_bound(key)));
+            AA_TREE_CHECK(SamePosition(set, set.upper_bound(key), reference, reference.upper_bound(key)));
+            AA_TREE_REQUIRE(SameElements(set, reference));
+            if (set.size() > 8) {
+                AA_TREE_CHECK(!set.is_inline());
+            }
+        }
+    }
+
+    AA_TREE_TEST(TSmallSetTest, FailedSpillKeepsTheKeys) {
+        SmallSet<std::string, 4, std::less<std::string>, TFailingAllocator<std::string>> set;
+        std::set<std::string> reference;
+        for (int key = 0; key < 4; ++key) {
+            set.insert(StringKey(key));
+            reference.insert(StringKey(key));
+        }
+        AllocationBudget() = 0;
+        AA_TREE_CHECK_THROWS(set.insert(StringKey(10)), std::bad_alloc);
+        AllocationBudget() = -1;
+        AA_TREE_CHECK(set.is_inline());
+        AA_TREE_CHECK(SameElements(set, reference));
+
+        set.insert(StringKey(10));
+        reference.insert(StringKey(10));
+        AA_TREE_CHECK(!set.is_inline());
+        AA_TREE_CHECK(SameElements(set, reference));
+    }
+
+    // Both the inline array and the tree are left empty, so the moved-from set takes keys again
+    AA_TREE_TEST(TSmallSetTest, MovedFromSetIsEmpty) {
+        using TStringSet = SmallSet<std::string, 4>;
+        TStringSet inlineSet{"a", "b", "c"};
+        TStringSet target(std::move(inlineSet));
+        AA_TREE_CHECK(inlineSet.empty() && inlineSet.is_inline() && inlineSet.begin() == inlineSet.end());
+        AA_TREE_CHECK(SameElements(target, std::set<std::string>{"a", "b", "c"}));
+        AA_TREE_CHECK(inlineSet.insert("").second);
+        AA_TREE_CHECK(SameElements(inlineSet, std::set<std::string>{""}));
+
+        TStringSet treeSet{"a", "b", "c", "d", "e"};
+        AA_TREE_REQUIRE(!treeSet.is_inline());
+        target = std::move(treeSet);
+        AA_TREE_CHECK(treeSet.empty() && treeSet.is_inline() && treeSet.begin() == treeSet.end());
+        AA_TREE_CHECK(SameElements(target, std::set<std::string>{"a", "b", "c", "d", "e"}));
+
+        inlineSet = std::move(target);
+        AA_TREE_CHECK(target.empty() && target.is_inline());
+        AA_TREE_CHECK(SameElements(inlineSet, std::set<std::string>{"a", "b", "c", "d", "e"}));
+        AA_TREE_CHECK(target.insert("").second);
+        AA_TREE_CHECK(SameElements(target, std::set<std::string>{""}));
+    }
+
+    AA_TREE_TEST(TStaticSetTest, ConstantLookups) {
+        constexpr auto Tags = MakeStaticSet<std::string_view>({"db", "cache", "auth", "queue"});
+        static_assert(Tags.contains("cache"));
+        static_assert(!Tags.contains("disk"));
+        static_assert(Tags.size() == 4);
+        AA_TREE_CHECK(SameElements(Tags, std::set<std::string_view>{"auth", "cache", "db", "queue"}));
+    }
+
+    //----------------FrozenSet----------------
+
+    AA_TREE_TEST(TFrozenSetTest, MatchesTheSet) {
+        for (size_t size : {0, 1, 2, 7, 8, 100, 1000, 4097}) {
+            std::vector<int> keys = RandomKeys(size, 10000);
+            std::set<int> reference(keys.begin(), keys.end());
+            Set<int> set(keys.begin(), keys.end());
+            FrozenSet<int> frozenSet = set.freeze();
+            AA_TREE_REQUIRE(SameElements(frozenSet, reference));
+            for (int key = -1; key <= 10000; key += 7) {
+                AA_TREE_CHECK(SamePosition(frozenSet, frozenSet.lower_bound(key), reference, reference.lower_bound(key)));
+                AA_TREE_CHECK(SamePosition(frozenSet, frozenSet.upper_bound(key), reference, reference.upper_bound(key)));
+                AA_TREE_CHECK(SamePosition(frozenSet, frozenSet.find(key), reference, reference.find(key)));
+            }
+            AA_TREE_CHECK(SameTree(frozenSet.thaw(), reference));
+            FrozenSet<int> copy = frozenSet;
+            AA_TREE_CHECK(SameElements(copy, reference));
+        }
+    }
+
+    AA_TREE_TEST(TFrozenSetTest, OwnsNonTrivialKeys) {
+        std::optional<FrozenSet<std::string>> frozenSet;
+        std::set<std::string> reference;
+        for (int key : RandomKeys(300)) {
+            reference.insert(StringKey(key));
+        }
+        frozenSet.emplace(Sorted, reference.begin(), reference.end());
+        AA_TREE_CHECK(SameElements(*frozenSet, reference));
+        std::optional<FrozenSet<std::string>> moved = std::move(frozenSet);
+        frozenSet.reset();
+        AA_TREE_CHECK(SameElements(*moved, reference));
+    }
+
+    //----------------Set files----------------
+
+    std::string SavedBytes(const Set<int>& set) {
+        std::stringstream out;
+        set.save(out);
+        return out.str();
+    }
+
+    std::string SavedBytes(const FrozenSet<int>& set) {
+        std::stringstream out;
+        set.save(out);
+        return out.str();
+    }
+
+    // The count field of the header is at offset 24
+    std::string WithCount(std::string bytes, uint64_t count) {
+        std::memcpy(&bytes[24], &count, sizeof(count));
+        return bytes;
+    }
+
+    AA_TREE_TEST(TSetFileTest, RoundTrips) {
+        std::vector<int> keys = RandomKeys(5000, 100000);
+        std::set<int> reference(keys.begin(), keys.end());
+        Set<int> set(keys.begin(), keys.end());
+
+        std::istringstream sortedIn(SavedBytes(set));
+        AA_TREE_CHECK(SameTree(Set<int>::load(sortedIn), reference));
+        std::istringstream frozenIn(SavedBytes(set));
+        AA_TREE_CHECK(SameElements(FrozenSet<int>::load(frozenIn), reference));
+
+        std::string eytzingerBytes = SavedBytes(set.freeze());
+        std::istringstream eytzingerIn(eytzingerBytes);
+        AA_TREE_CHECK(SameElements(FrozenSet<int>::load(eytzingerIn), reference));
+        std::istringstream wrongLayoutIn(eytzingerBytes);
+        AA_TREE_CHECK_THROWS(Set<int>::load(wrongLayoutIn), TSetFileError);
+
+        std::filesystem::path path = std::filesystem::temp_directory_path() / "aa_tree_set_file_test.bin";
+        {
+            std::ofstream out(path, std::ios::binary);
+            out.write(eytzingerBytes.data(), static_cast<std::streamsize>(eytzingerBytes.size()));
+        }
+        {
+            FrozenSet<int> mappedSet = FrozenSet<int>::map(path.string());
+            AA_TREE_CHECK(SameElements(mappedSet, reference));
+            FrozenSet<int> sharedCopy = mappedSet;
+            AA_TREE_CHECK(SameElements(sharedCopy, reference));
+        }
+        std::filesystem::remove(path);
+    }
+
+    // Corrupted files fail with TSetFileError before anything of the claimed size is allocated
+    AA_TREE_TEST(TSetFileTest, RejectsCorruptedFiles) {
+        Set<int> set{1, 2, 3, 5, 8};
+        std::string sortedBytes = SavedBytes(set);
+        std::string eytzingerBytes = SavedBytes(set.freeze());
+        for (uint64_t count : {uint64_t(6), uint64_t(0x7f7f7f7f7f7f7f7fULL), ~uint64_t(0)}) {
+            std::istringstream sortedIn(WithCount(sortedBytes, count));
+            AA_TREE_CHECK_THROWS(Set<int>::load(sortedIn), TSetFileError);
+            std::istringstream frozenIn(WithCount(sortedBytes, count));
+            AA_TREE_CHECK_THROWS(FrozenSet<int>::load(frozenIn), TSetFileError);
+            std::istringstream eytzingerIn(WithCount(eytzingerBytes, count));
+            AA_TREE_CHECK_THROWS(FrozenSet<int>::load(eytzingerIn), TSetFileError);
+        }
+
+        std::istringstream truncatedIn(sortedBytes.substr(0, 20));
+        AA_TREE_CHECK_THROWS(Set<int>::load(truncatedIn), TSetFileError);
+        std::string unsortedBytes = sortedBytes;
+        std::swap(unsortedBytes[32], unsortedBytes[36]);
+        std::istringstream unsortedIn(unsortedBytes);
+        AA_TREE_CHECK_THROWS(Set<int>::load(unsortedIn), TSetFileError);
+        std::istringstream wrongValueIn(sortedBytes);
+        AA_TREE_CHECK_THROWS(Set<int64_t>::load(wrongValueIn), TSetFileError);
+    }
+}
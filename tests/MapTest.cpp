@@ -0,0 +1,176 @@
+/*
+ *      Summary: Differential tests of Map, MultiSet and MultiMap against the std containers
+ *         Date: 2022.01.30
+ *   Programmer: Kurdun Andrei
+ *   Code Style: Yandex
+ */
+#include "TestCommon.h"
+
+#include "Map.h"
+#include "Set.h"
+
+#include <map>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace {
+    AA_TREE_TEST(TMapTest, RandomOperations) {
+        Map<int, std::string> map;
+        std::map<int, std::string> reference;
+        for (size_t step = 0; step < DifferentialSteps; ++step) {
+            int key = RandomKey();
+            std::string value = StringKey(RandomKey());
+            switch (RandomKey(8)) {
+                case 0: {
+                    map[key] = value;
+                    reference[key] = value;
+                    break;
+                }
+                case 1: {
+                    auto result = map.try_emplace(key, value);
+                    auto referenceResult = reference.try_emplace(key, value);
+                    AA_TREE_CHECK(result.second == referenceResult.second);
+                    AA_TREE_CHECK(result.first->second == referenceResult.first->second);
+                    break;
+                }
+                case 2: {
+                    AA_TREE_CHECK(map.insert_or_assign(key, value).second == reference.insert_or_assign(key, value).second);
+                    break;
+                }
+                case 3: {
+                    AA_TREE_CHECK(map.insert({key, value}).second == reference.insert({key, value}).second);
+                    break;
+                }
+                case 4:
+                case 5: {
+                    AA_TREE_CHECK(map.erase(key) == reference.erase(key));
+                    break;
+                }
+                case 6: {
+                    auto referenceIterator = reference.find(key);
+                    if (referenceIterator == reference.end()) {
+                        AA_TREE_CHECK_THROWS(map.at(key), std::out_of_range);
+                        AA_TREE_CHECK(map.find(key) == map.end());
+                    } else {
+                        AA_TREE_CHECK(map.at(key) == referenceIterator->second);
+                        map.at(key) += "!";
+                        referenceIterator->second += "!";
+                    }
+                    break;
+                }
+                default: {
+                    AA_TREE_CHECK(SamePosition(map, map.lower_bound(key), reference, reference.lower_bound(key)));
+                    AA_TREE_CHECK(SamePosition(map, map.upper_bound(key), reference, reference.upper_bound(key)));
+                    break;
+                }
+            }
+            AA_TREE_REQUIRE(SameTree(map, reference));
+        }
+    }
+
+    // A node goes back with a new mapped value; a new key takes a new element built from the moved mapped value
+    AA_TREE_TEST(TMapTest, NodeHandlesRoundTrip) {
+        Map<int, std::string> map{{1, "one"}, {2, "two"}, {3, "three"}};
+        Map<int, std::string>::node_type node = map.extract(2);
+        AA_TREE_REQUIRE(!node.empty());
+        AA_TREE_CHECK(node.key() == 2);
+        AA_TREE_CHECK(node.mapped() == "two");
+        const std::pair<const int, std::string>* nodeValue = &node.value();
+
+        node.mapped() = "deux";
+        auto result = map.insert(std::move(node));
+        AA_TREE_CHECK(result.inserted);
+        AA_TREE_CHECK(&*result.position == nodeValue);
+        AA_TREE_CHECK(SameTree(map, std::map<int, std::string>{{1, "one"}, {2, "deux"}, {3, "three"}}));
+
+        node = map.extract(2);
+        AA_TREE_CHECK(map.try_emplace(5, std::move(node.mapped())).second);
+        node = Map<int, std::string>::node_type();
+        AA_TREE_CHECK(SameTree(map, std::map<int, std::string>{{1, "one"}, {3, "three"}, {5, "deux"}}));
+
+        // A clashing key hands the node back unchanged
+        Map<int, std::string> other{{3, "drei"}};
+        result = map.insert(other.extract(3));
+        AA_TREE_CHECK(!result.inserted);
+        AA_TREE_CHECK(result.node.key() == 3 && result.node.mapped() == "drei");
+        AA_TREE_CHECK(other.empty());
+        AA_TREE_CHECK(SameTree(map, std::map<int, std::string>{{1, "one"}, {3, "three"}, {5, "deux"}}));
+    }
+
+    AA_TREE_TEST(TMultiSetTest, RandomOperations) {
+        MultiSet<int> set;
+        std::multiset<int> reference;
+        for (size_t step = 0; step < DifferentialSteps; ++step) {
+            int key = RandomKey(200);
+            switch (RandomKey(7)) {
+                case 0:
+                case 1: {
+                    AA_TREE_CHECK(*set.insert(key).first == key);
+                    reference.insert(key);
+                    break;
+                }
+                case 2: {
+                    AA_TREE_CHECK(*set.insert(set.lower_bound(key), key) == key);
+                    reference.insert(key);
+                    break;
+                }
+                case 3: {
+                    AA_TREE_CHECK(set.erase(key) == reference.erase(key));
+                    break;
+                }
+                case 4: {
+                    auto foundIterator = set.find(key);
+                    if (foundIterator != set.end()) {
+                        set.erase(foundIterator);
+                        reference.erase(reference.find(key));
+                    }
+                    break;
+                }
+                case 5: {
+                    AA_TREE_CHECK(set.erase_range(key, key + 10) == static_cast<size_t>(std::distance(
+                          reference.lower_bound(key)
+                        , reference.lower_bound(key + 10)
+                    )));
+                    reference.erase(reference.lower_bound(key), reference.lower_bound(key + 10));
+                    break;
+                }
+                default: {
+                    AA_TREE_CHECK(set.count(key) == reference.count(key));
+                    auto range = set.equal_range(key);
+                    AA_TREE_CHECK(static_cast<size_t>(std::distance(range.first, range.second)) == reference.count(key));
+                    AA_TREE_CHECK(SamePosition(set, set.lower_bound(key), reference, reference.lower_bound(key)));
+                    AA_TREE_CHECK(SamePosition(set, set.upper_bound(key), reference, reference.upper_bound(key)));
+                    break;
+                }
+            }
+            AA_TREE_REQUIRE(SameTree(set, reference));
+        }
+
+        std::vector<int> keys = RandomKeys(500, 50);
+        std::multiset<int> batchReference(keys.begin(), keys.end());
+        MultiSet<int> batchSet(keys.begin(), keys.end());
+        AA_TREE_CHECK(SameTree(batchSet, batchReference));
+    }
+
+    // Equal keys keep their insertion order, as in std::multimap
+    AA_TREE_TEST(TMultiMapTest, KeepsInsertionOrder) {
+        MultiMap<int, int> map;
+        std::multimap<int, int> reference;
+        for (size_t step = 0; step < DifferentialSteps; ++step) {
+            int key = RandomKey(100);
+            if (RandomKey(4) == 0) {
+                AA_TREE_CHECK(map.erase(key) == reference.erase(key));
+            } else {
+                map.insert({key, static_cast<int>(step)});
+                reference.insert({key, static_cast<int>(step)});
+            }
+            if (step % 64 == 0) {
+                AA_TREE_REQUIRE(SameTree(map, reference));
+            }
+        }
+        AA_TREE_REQUIRE(SameTree(map, reference));
+    }
+}
@@ -0,0 +1,568 @@
+/*
+ *      Summary: Differential tests of Set against std::set
+ *         Date: 2022.01.30
+ *   Programmer: Kurdun Andrei
+ *   Code Style: Yandex
+ */
+#include "TestCommon.h"
+
+#include "NodePool.h"
+#include "Set.h"
+#include "ThreadPool.h"
+
+#include <iterator>
+#include <set>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace {
+    template<class TAllocatorType, class TTraitsType>
+    struct TSetCase {
+        using TTraits = TTraitsType;
+        using TSet = Set<int, std::less<int>, TAllocatorType, TTraitsType>;
+    };
+
+    // One fresh set per run, checked against std::set after every step
+    template<class TCase>
+    class TSetDifferentialRun {
+    public:
+        void RandomOperations() {
+            for (size_t step = 0; step < DifferentialSteps; ++step) {
+                Step();
+                AA_TREE_REQUIRE(SameTree(Set_, Reference_));
+            }
+        }
+
+        void CopyMoveAndSwap() {
+            for (int key : RandomKeys(500)) {
+                Set_.insert(key);
+                Reference_.insert(key);
+            }
+            TSet copy = Set_;
+            AA_TREE_REQUIRE(SameTree(copy, Reference_));
+            copy.erase(*Reference_.begin());
+            AA_TREE_REQUIRE(SameTree(Set_, Reference_));
+
+            TSet moved = std::move(copy);
+            AA_TREE_CHECK(copy.empty());
+            AA_TREE_CHECK(copy.validate());
+            copy.insert(1);
+            AA_TREE_CHECK(SameTree(copy, std::set<int>{1}));
+
+            moved.swap(copy);
+            AA_TREE_CHECK(SameTree(moved, std::set<int>{1}));
+            AA_TREE_CHECK(copy.size() == Reference_.size() - 1);
+
+            copy = Set_;
+            AA_TREE_CHECK(SameTree(copy, Reference_));
+        }
+
+    private:
+        using TTraits = typename TCase::TTraits;
+        using TSet = typename TCase::TSet;
+        using TReference = std::set<int>;
+
+        void CheckLookups(int key) {
+            AA_TREE_CHECK(SamePosition(Set_, Set_.lower_bound(key), Reference_, Reference_.lower_bound(key)));
+            AA_TREE_CHECK(SamePosition(Set_, Set_.upper_bound(key), Reference_, Reference_.upper_bound(key)));
+            AA_TREE_CHECK(SamePosition(Set_, Set_.find(key), Reference_, Reference_.find(key)));
+            AA_TREE_CHECK(Set_.contains(key) == (Reference_.count(key) != 0));
+            AA_TREE_CHECK(Set_.count(key) == Reference_.count(key));
+            auto range = Set_.equal_range(key);
+            auto referenceRange = Reference_.equal_range(key);
+            AA_TREE_CHECK(SamePosition(Set_, range.first, Reference_, referenceRange.first));
+            AA_TREE_CHECK(SamePosition(Set_, range.second, Reference_, referenceRange.second));
+        }
+
+        // Any hint is allowed, a far one only costs a longer climb
+        void CheckFingerSearch(int key) {
+            typename TSet::iterator hint = (RandomKey(4) == 0 ? Set_.end() : Set_.lower_bound(RandomKey()));
+            AA_TREE_CHECK(SamePosition(Set_, Set_.lower_bound(hint, key), Reference_, Reference_.lower_bound(key)));
+            AA_TREE_CHECK(SamePosition(Set_, Set_.find_from(hint, key), Reference_, Reference_.find(key)));
+        }
+
+        void CheckBatchLookups() {
+            std::vector<int> keys = RandomKeys(40);
+            std::vector<typename TSet::iterator> found;
+            std::vector<typename TSet::iterator> lowerBounds;
+            Set_.find_batch(keys.begin(), keys.end(), std::back_inserter(found));
+            Set_.lower_bound_batch(keys.begin(), keys.end(), std::back_inserter(lowerBounds));
+            AA_TREE_REQUIRE(found.size() == keys.size());
+            AA_TREE_REQUIRE(lowerBounds.size() == keys.size());
+            for (size_t keyIndex = 0; keyIndex < keys.size(); ++keyIndex) {
+                AA_TREE_CHECK(SamePosition(Set_, found[keyIndex], Reference_, Reference_.find(keys[keyIndex])));
+                AA_TREE_CHECK(SamePosition(Set_, lowerBounds[keyIndex], Reference_, Reference_.lower_bound(keys[keyIndex])));
+            }
+        }
+
+        void CheckOrderStatistics(int key) {
+            if constexpr (TTraits::CountSubtreeSize) {
+                size_t lessCount = static_cast<size_t>(std::distance(Reference_.begin(), Reference_.lower_bound(key)));
+                AA_TREE_CHECK(Set_.rank(key) == lessCount);
+                AA_TREE_CHECK(Set_.count_range(key, key + 50) == static_cast<size_t>(std::distance(
+                      Reference_.lower_bound(key)
+                    , Reference_.lower_bound(key + 50)
+                )));
+                if (!Reference_.empty()) {
+                    size_t index = static_cast<size_t>(RandomKey(static_cast<int>(Reference_.size())));
+                    AA_TREE_CHECK(*Set_.nth_element(index) == *std::next(Reference_.begin(), static_cast<std::ptrdiff_t>(index)));
+                }
+                AA_TREE_CHECK(Set_.nth_element(Reference_.size()) == Set_.end());
+            }
+        }
+
+        void Step() {
+            int key = RandomKey();
+            switch (RandomKey(14)) {
+                case 0: {
+                    auto result = Set_.insert(key);
+                    auto referenceResult = Reference_.insert(key);
+                    AA_TREE_CHECK(result.second == referenceResult.second);
+                    AA_TREE_CHECK(*result.first == key);
+                    break;
+                }
+                case 1: {
+                    typename TSet::iterator hint = (RandomKey(2) == 0 ? Set_.lower_bound(key) : Set_.begin());
+                    AA_TREE_CHECK(*Set_.insert(hint, key) == key);
+                    Reference_.insert(key);
+                    break;
+                }
+                case 2: {
+                    AA_TREE_CHECK(Set_.emplace(key).second == Reference_.emplace(key).second);
+                    break;
+                }
+                case 3:
+                case 4: {
+                    AA_TREE_CHECK(Set_.erase(key) == Reference_.erase(key));
+                    break;
+                }
+                case 5: {
+                    if (!Reference_.empty()) {
+                        AA_TREE_CHECK(Set_.min() == *Reference_.begin());
+                        AA_TREE_CHECK(Set_.max() == *Reference_.rbegin());
+                        if (RandomKey(2) == 0) {
+                            AA_TREE_CHECK(Set_.pop_min() == *Reference_.begin());
+                            Reference_.erase(Reference_.begin());
+                        } else {
+                            AA_TREE_CHECK(Set_.pop_max() == *Reference_.rbegin());
+                            Reference_.erase(std::prev(Reference_.end()));
+                        }
+                    }
+                    break;
+                }
+                case 6: {
+                    TSet upperPart = Set_.split(key);
+                    AA_TREE_REQUIRE(SameTree(Set_, TReference(Reference_.begin(), Reference_.lower_bound(key))));
+                    AA_TREE_REQUIRE(SameTree(upperPart, TReference(Reference_.lower_bound(key), Reference_.end())));
+                    Set_ = TSet::join(std::move(Set_), std::move(upperPart));
+                    break;
+                }
+                case 7: {
+                    std::vector<int> keys = RandomKeys(static_cast<size_t>(RandomKey(2) == 0 ? 8 : 300));
+                    size_t insertedCount = 0;
+                    for (int insertedKey : keys) {
+                        insertedCount += Reference_.insert(insertedKey).second;
+                    }
+                    AA_TREE_CHECK(Set_.insert_batch(keys.begin(), keys.end()) == insertedCount);
+                    break;
+                }
+                case 8: {
+                    std::vector<int> keys = RandomKeys(static_cast<size_t>(RandomKey(2) == 0 ? 8 : 300));
+                    size_t erasedCount = 0;
+                    for (int erasedKey : keys) {
+                        erasedCount += Reference_.erase(erasedKey);
+                    }
+                    AA_TREE_CHECK(Set_.erase_batch(keys.begin(), keys.end()) == erasedCount);
+                    break;
+                }
+                case 9: {
+                    typename TSet::iterator foundIterator = Set_.find(key);
+                    if (foundIterator != Set_.end()) {
+                        typename TSet::iterator nextIterator = Set_.erase(foundIterator);
+                        auto referenceNext = Reference_.erase(Reference_.find(key));
+                        AA_TREE_CHECK(SamePosition(Set_, nextIterator, Reference_, referenceNext));
+                    }
+                    break;
+                }
+                case 10: {
+                    CheckBatchLookups();
+                    if constexpr (TTraits::LazyErase) {
+                        if (RandomKey(4) == 0) {
+                            Set_.compact();
+                            AA_TREE_CHECK(Set_.tombstone_count() == 0u);
+                        }
+                    }
+                    break;
+                }
+                case 11: {
+                    auto referenceFirst = Reference_.lower_bound(key);
+                    auto referenceLast = Reference_.lower_bound(key + 20);
+                    switch (RandomKey(3)) {
+                        case 0: {
+                            typename TSet::iterator nextIterator = Set_.erase(Set_.lower_bound(key), Set_.lower_bound(key + 20));
+                            auto referenceNext = Reference_.erase(referenceFirst, referenceLast);
+                            AA_TREE_CHECK(SamePosition(Set_, nextIterator, Reference_, referenceNext));
+                            break;
+                        }
+                        case 1: {
+                            size_t erasedCount = static_cast<size_t>(std::distance(referenceFirst, referenceLast));
+                            Reference_.erase(referenceFirst, referenceLast);
+                            AA_TREE_CHECK(Set_.erase_range(key, key + 20) == erasedCount);
+                            break;
+                        }
+                        default: {
+                            TReference extractedReference(referenceFirst, referenceLast);
+                            Reference_.erase(referenceFirst, referenceLast);
+                            AA_TREE_CHECK(SameTree(Set_.extract_range(key, key + 20), extractedReference));
+                            break;
+                        }
+                    }
+                    break;
+                }
+                case 12: {
+                    // The key of an extracted node may change before it goes back
+                    typename TSet::node_type node = Set_.extract(key);
+                    AA_TREE_CHECK(!node.empty() == (Reference_.erase(key) != 0));
+                    if (!node.empty()) {
+                        int newKey = RandomKey();
+                        node.value() = newKey;
+                        auto result = Set_.insert(std::move(node));
+                        AA_TREE_CHECK(result.inserted == Reference_.insert(newKey).second);
+                        AA_TREE_CHECK(result.node.empty() == result.inserted);
+                    }
+                    break;
+                }
+                default: {
+                    CheckLookups(key);
+                    CheckFingerSearch(key);
+                    CheckOrderStatistics(key);
+                    break;
+                }
+            }
+        }
+
+        TSet Set_;
+        TReference Reference_;
+    };
+
+    // A comparator whose copies may throw
+    struct TThrowingCopyLess {
+        TThrowingCopyLess() = default;
+
+        TThrowingCopyLess(const TThrowingCopyLess&) noexcept(false) {
+        }
+
+        TThrowingCopyLess& operator=(const TThrowingCopyLess&) noexcept(false) {
+            return *this;
+        }
+
+        bool operator()(int left, int right) const {
+            return left < right;
+        }
+    };
+
+    // swap is noexcept only when neither the allocators nor the comparators can get in the way, as in std::set
+    static_assert(std::is_nothrow_swappable_v<Set<int>>);
+    static_assert(!std::is_nothrow_swappable_v<Set<int, TThrowingCopyLess>>);
+
+    template<class... TCases>
+    void RunSetCases() {
+        (TSetDifferentialRun<TCases>().RandomOperations(), ...);
+        (TSetDifferentialRun<TCases>().CopyMoveAndSwap(), ...);
+    }
+
+    AA_TREE_TEST(TSetTest, RandomOperations) {
+        RunSetCases<
+              TSetCase<std::allocator<int>, TDefaultSetTraits>
+            , TSetCase<std::allocator<int>, TOrderStatisticsTraits>
+            , TSetCase<std::allocator<int>, TLazyEraseSetTraits>
+            , TSetCase<TPoolAllocator<int>, TOrderStatisticsTraits>
+            , TSetCase<TPoolAllocator<int>, TInstrumentedSetTraits>
+            , TSetCase<TArenaAllocator<int>, TDefaultSetTraits>
+        >();
+    }
+
+    AA_TREE_TEST(TSetTest, BuildsFromRanges) {
+        std::vector<int> keys = RandomKeys(1000);
+        std::set<int> reference(keys.begin(), keys.end());
+
+        Set<int> unsortedSet(keys.begin(), keys.end());
+        AA_TREE_CHECK(SameTree(unsortedSet, reference));
+
+        // Sorted input with duplicates takes the O(n) build
+        std::vector<int> sortedKeys = keys;
+        std::sort(sortedKeys.begin(), sortedKeys.end());
+        Set<int> sortedSet(sortedKeys.begin(), sortedKeys.end());
+        AA_TREE_CHECK(SameTree(sortedSet, reference));
+        AA_TREE_CHECK(SameTree(Set<int>::from_sorted(sortedKeys.begin(), sortedKeys.end()), reference));
+        AA_TREE_CHECK(SameTree(Set<int>(Sorted, reference.begin(), reference.end()), reference));
+
+        // Ranges of the set's own iterators
+        Set<int> copiedSet(sortedSet.begin(), sortedSet.end());
+        AA_TREE_CHECK(SameTree(copiedSet, reference));
+        Set<int> batchSet;
+        AA_TREE_CHECK(batchSet.insert_batch(sortedSet.begin(), sortedSet.end()) == reference.size());
+        AA_TREE_CHECK(SameTree(batchSet, reference));
+        Set<int, std::less<int>, std::allocator<int>, TOrderStatisticsTraits> countedSet(sortedSet.begin(), sortedSet.end());
+        AA_TREE_CHECK(SameTree(countedSet, reference));
+
+        Set<int> listSet{5, 3, 3, 1};
+        AA_TREE_CHECK(SameTree(listSet, std::set<int>{1, 3, 5}));
+    }
+
+    AA_TREE_TEST(TSetTest, SetAlgebra) {
+        for (int round = 0; round < 50; ++round) {
+            std::vector<int> leftKeys = RandomKeys(static_cast<size_t>(RandomKey(400)));
+            std::vector<int> rightKeys = RandomKeys(static_cast<size_t>(RandomKey(400)));
+            std::set<int> leftReference(leftKeys.begin(), leftKeys.end());
+            std::set<int> rightReference(rightKeys.begin(), rightKeys.end());
+            std::set<int> unionReference;
+            std::set<int> intersectionReference;
+            std::set<int> differenceReference;
+            std::set_union(
+                  leftReference.begin(), leftReference.end(), rightReference.begin(), rightReference.end()
+                , std::inserter(unionReference, unionReference.end())
+            );
+            std::set_intersection(
+                  leftReference.begin(), leftReference.end(), rightReference.begin(), rightReference.end()
+                , std::inserter(intersectionReference, intersectionReference.end())
+            );
+            std::set_difference(
+                  leftReference.begin(), leftReference.end(), rightReference.begin(), rightReference.end()
+                , std::inserter(differenceReference, differenceReference.end())
+            );
+
+            Set<int> left(leftKeys.begin(), leftKeys.end());
+            Set<int> right(rightKeys.begin(), rightKeys.end());
+            AA_TREE_CHECK(SameTree(Set<int>::set_union(Set<int>(left), Set<int>(right)), unionReference));
+            AA_TREE_CHECK(SameTree(Set<int>::set_intersection(Set<int>(left), Set<int>(right)), intersectionReference));
+            AA_TREE_CHECK(SameTree(Set<int>::set_difference(Set<int>(left), Set<int>(right)), differenceReference));
+            left.merge_from(std::move(right));
+            AA_TREE_CHECK(SameTree(left, unionReference));
+        }
+    }
+
+    AA_TREE_TEST(TSetTest, ParallelOperations) {
+        TThreadPool pool(4);
+        std::vector<int> leftKeys = RandomKeys(60000, 200000);
+        std::vector<int> rightKeys = RandomKeys(60000, 200000);
+        std::set<int> leftReference(leftKeys.begin(), leftKeys.end());
+        std::set<int> rightReference(rightKeys.begin(), rightKeys.end());
+        std::set<int> unionReference = leftReference;
+        unionReference.insert(rightReference.begin(), rightReference.end());
+        std::set<int> intersectionReference;
+        std::set_intersection(
+              leftReference.begin(), leftReference.end(), rightReference.begin(), rightReference.end()
+            , std::inserter(intersectionReference, intersectionReference.end())
+        );
+
+        Set<int> left = Set<int>::from_sorted(pool, leftReference.begin(), leftReference.end());
+        AA_TREE_REQUIRE(SameTree(left, leftReference));
+        Set<int> right;
+        AA_TREE_CHECK(right.insert_batch(pool, rightKeys.begin(), rightKeys.end()) == rightReference.size());
+        AA_TREE_REQUIRE(SameTree(right, rightReference));
+
+        AA_TREE_CHECK(SameTree(Set<int>::set_union(pool, Set<int>(left), Set<int>(right)), unionReference));
+        AA_TREE_CHECK(SameTree(Set<int>::set_intersection(pool, Set<int>(left), Set<int>(right)), intersectionReference));
+        Set<int> difference = Set<int>::set_difference(pool, Set<int>(left), Set<int>(right));
+        AA_TREE_CHECK(difference.size() == leftReference.size() - intersectionReference.size());
+        AA_TREE_CHECK(difference.validate());
+        left.merge_from(pool, std::move(right));
+        AA_TREE_CHECK(SameTree(left, unionReference));
+        left.clear(pool);
+        AA_TREE_CHECK(SameTree(left, std::set<int>()));
+    }
+
+    AA_TREE_TEST(TSetTest, HeterogeneousLookup) {
+        Set<std::string, std::less<>> set;
+        std::set<std::string, std::less<>> reference;
+        for (int key : RandomKeys(300)) {
+            set.insert(StringKey(key));
+            reference.insert(StringKey(key));
+        }
+        for (int key = 0; key < DifferentialKeyRange; ++key) {
+            std::string wantedKey = StringKey(key);
+            std::string_view wantedView = wantedKey;
+            AA_TREE_CHECK(set.contains(wantedView) == (reference.count(wantedKey) != 0));
+            AA_TREE_CHECK(SamePosition(set, set.lower_bound(wantedView), reference, reference.lower_bound(wantedKey)));
+            AA_TREE_CHECK(SamePosition(set, set.find(wantedKey.c_str()), reference, reference.find(wantedKey)));
+        }
+        AA_TREE_CHECK(set.erase(std::string_view(*reference.begin())) == 1u);
+        reference.erase(reference.begin());
+        AA_TREE_CHECK(SameTree(set, reference));
+    }
+
+    struct TCountingLess {
+        static inline size_t CallCount = 0;
+
+        bool operator()(int left, int right) const {
+            ++CallCount;
+            return left < right;
+        }
+    };
+
+    AA_TREE_TEST(TSetTest, ScanMakesNoComparisons) {
+        std::vector<int> keys = RandomKeys(1000);
+        Set<int, TCountingLess> set(keys.begin(), keys.end());
+        std::set<int> reference(keys.begin(), keys.end());
+        TCountingLess::CallCount = 0;
+        AA_TREE_CHECK(SameElements(set, reference));
+        AA_TREE_CHECK(TCountingLess::CallCount == 0u);
+    }
+
+    AA_TREE_TEST(TSetTest, NodeHandlesMoveBetweenSets) {
+        Set<std::string> source{"a", "b", "c"};
+        Set<std::string> target{"c"};
+        Set<std::string>::node_type node = source.extract(source.find("b"));
+        AA_TREE_REQUIRE(!node.empty());
+        AA_TREE_CHECK(node.value() == "b");
+        AA_TREE_CHECK(target.insert(std::move(node)).inserted);
+        AA_TREE_CHECK(node.empty());
+
+        auto result = target.insert(source.extract("c"));
+        AA_TREE_CHECK(!result.inserted);
+        AA_TREE_CHECK(result.node.value() == "c");
+        AA_TREE_CHECK(SameTree(source, std::set<std::string>{"a"}));
+        AA_TREE_CHECK(SameTree(target, std::set<std::string>{"b", "c"}));
+    }
+
+    template<class TAllocator>
+    void RunNodeHandleCounts() {
+        using TCountedSet = Set<int, std::less<int>, TAllocator, TInstrumentedSetTraits>;
+        TCountedSet source{1, 2, 3, 4};
+        TCountedSet target{4};
+        target.insert(source.extract(1));
+        target.insert(target.end(), source.extract(2));
+        static_cast<void>(source.extract(3));
+        AA_TREE_CHECK(!target.insert(source.extract(4)).inserted);
+        for (TCountedSet* set : {&source, &target}) {
+            TSetStatistics stats = set->stats();
+            AA_TREE_CHECK(stats.NodeAllocations - stats.NodeFrees == set->size());
+            set->clear();
+            AA_TREE_CHECK(set->stats().NodeFrees == set->stats().NodeAllocations);
+        }
+    }
+
+    AA_TREE_TEST(TSetTest, StatsCountEveryNode) {
+        using TCountedSet = Set<int, std::less<int>, TArenaAllocator<int>, TInstrumentedSetTraits>;
+        TCountedSet set;
+        for (int key = 0; key < 1000; ++key) {
+            set.insert(key);
+        }
+        set.erase_range(100, 200);
+        set.erase(500);
+        set.clear();
+        TSetStatistics stats = set.stats();
+        AA_TREE_CHECK(stats.NodeAllocations == 1000u);
+        AA_TREE_CHECK(stats.NodeFrees == stats.NodeAllocations);
+
+        // Erasing by iterator makes no comparisons
+        for (int key = 0; key < 100; ++key) {
+            set.insert(key);
+        }
+        TCountedSet::iterator erasedIterator = set.find(50);
+        set.reset_stats();
+        set.erase(erasedIterator);
+        AA_TREE_CHECK(set.stats().Comparisons == 0u);
+
+        // A node counts as freed by the set it leaves and as allocated by the set that adopts it
+        RunNodeHandleCounts<std::allocator<int>>();
+        RunNodeHandleCounts<TArenaAllocator<int>>();
+    }
+
+    struct TCountedLazyTraits : TLazyEraseSetTraits {
+        using TStats = TSetStats;
+        static constexpr uint32_t MaxTombstonePercent = 100;
+    };
+
+    // An expiry sweep through begin() only marks nodes dead and steps over the tombstones after them
+    AA_TREE_TEST(TSetTest, LazyEraseOfBeginDoesNotRebalance) {
+        Set<int, std::less<int>, std::allocator<int>, TCountedLazyTraits> set;
+        for (int key = 0; key < 1000; ++key) {
+            set.insert(key);
+        }
+        for (int key = 1; key < 500; ++key) {
+            set.erase(key);
+        }
+        set.reset_stats();
+        set.erase(set.begin());
+        TSetStatistics stats = set.stats();
+        AA_TREE_CHECK(stats.Comparisons == 0u);
+        AA_TREE_CHECK(stats.Skews + stats.Splits + stats.LevelDecreases == 0u);
+        AA_TREE_CHECK(set.min() == 500 && *set.begin() == 500);
+        AA_TREE_CHECK(set.tombstone_count() == 500u);
+        AA_TREE_CHECK(set.validate());
+
+        while (!set.empty()) {
+            set.erase(set.begin());
+        }
+        stats = set.stats();
+        AA_TREE_CHECK(stats.Skews + stats.Splits + stats.LevelDecreases == 0u);
+        AA_TREE_CHECK(stats.NodeFrees == 0u);
+        AA_TREE_CHECK(set.begin() == set.end());
+        AA_TREE_CHECK(set.validate());
+    }
+
+    AA_TREE_TEST(TSetTest, ShapeOfSortedBuild) {
+        std::vector<int> keys(1023);
+        for (size_t keyIndex = 0; keyIndex < keys.size(); ++keyIndex) {
+            keys[keyIndex] = static_cast<int>(keyIndex);
+        }
+        Set<int> set = Set<int>::from_sorted(keys.begin(), keys.end());
+        TSetShape shape = set.shape_report();
+        AA_TREE_CHECK(shape.Size == keys.size());
+        AA_TREE_CHECK(shape.Height == shape.OptimalHeight);
+        AA_TREE_CHECK(shape.RootLevel == 10u);
+    }
+
+    // Long monotone runs build the deepest trees; iterators to the other elements survive each erase
+    AA_TREE_TEST(TSetTest, LongSortedRuns) {
+        constexpr int KeyCount = 100000;
+        Set<int> set;
+        for (int key = 0; key < KeyCount; ++key) {
+            set.insert(key);
+        }
+        Set<int>::iterator lastIterator = set.find(KeyCount - 1);
+        for (int key = KeyCount - 2; key >= 0; key -= 2) {
+            set.erase(key);
+        }
+        AA_TREE_REQUIRE(set.size() == static_cast<size_t>(KeyCount / 2));
+        AA_TREE_CHECK(*lastIterator == KeyCount - 1);
+        int expectedKey = 1;
+        for (int key : set) {
+            AA_TREE_REQUIRE(key == expectedKey);
+            expectedKey += 2;
+        }
+        for (int key = 1; key < KeyCount; key += 2) {
+            set.erase(key);
+        }
+        AA_TREE_CHECK(set.empty());
+    }
+
+    AA_TREE_TEST(TSetTest, FailedAllocationsLeaveTheSetIntact) {
+        using TFailingSet = Set<int, std::less<int>, TFailingAllocator<int>>;
+        TFailingSet set;
+        std::set<int> reference;
+        for (int round = 0; round < 2000; ++round) {
+            int key = RandomKey();
+            std::vector<int> keys = RandomKeys(20);
+            bool isBatch = (RandomKey(2) == 0);
+            AllocationBudget() = RandomKey(isBatch ? 20 : 2);
+            try {
+                if (isBatch) {
+                    set.insert_batch(keys.begin(), keys.end());
+                    reference.insert(keys.begin(), keys.end());
+                } else {
+                    set.insert(key);
+                    reference.insert(key);
+                }
+            } catch (const std::bad_alloc&) {
+            }
+            AllocationBudget() = -1;
+            AA_TREE_REQUIRE(SameTree(set, reference));
+        }
+    }
+}
@@ -0,0 +1,214 @@
+/*
+ *      Summary: Reference checks shared by the AA Tree tests
+ *         Date: 2022.01.30
+ *   Programmer: Kurdun Andrei
+ *   Code Style: Yandex
+ */
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <exception>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <random>
+#include <string>
+#include <vector>
+
+/*
+ *  A test is a function registered by AA_TREE_TEST(TSuite, Name). AA_TREE_CHECK reports a failed
+ *  condition and goes on, AA_TREE_REQUIRE also returns from the enclosing void function.
+ *  RunTests() runs the tests whose name contains the first argument, all of them without one.
+ */
+struct TTestCase {
+    const char* Name = nullptr;
+    void (*Function)() = nullptr;
+};
+
+inline std::vector<TTestCase>& TestCases() {
+    static std::vector<TTestCase> testCases;
+    return testCases;
+}
+
+inline size_t& FailureCount() {
+    static size_t failureCount = 0;
+    return failureCount;
+}
+
+struct TTestRegistration {
+    TTestRegistration(const char* name, void (*function)()) {
+        TestCases().push_back({name, function});
+    }
+};
+
+inline bool ReportFailure(const char* file, int line, const char* condition) {
+    ++FailureCount();
+    std::fprintf(stderr, "%s:%d: check failed: %s\n", file, line, condition);
+    return false;
+}
+
+#define AA_TREE_TEST(TSuite, Name) \
+    void TSuite##_##Name(); \
+    const TTestRegistration TSuite##_##Name##Registration(#TSuite "." #Name, &TSuite##_##Name); \
+    void TSuite##_##Name()
+
+#define AA_TREE_CHECK(condition) ((condition) ? true : ReportFailure(__FILE__, __LINE__, #condition))
+
+#define AA_TREE_REQUIRE(condition) \
+    do { \
+        if (!AA_TREE_CHECK(condition)) { \
+            return; \
+        } \
+    } while (false)
+
+#define AA_TREE_CHECK_THROWS(expression, TException) \
+    do { \
+        bool isThrown = false; \
+        try { \
+            expression; \
+        } catch (const TException&) { \
+            isThrown = true; \
+        } \
+        if (!isThrown) { \
+            ReportFailure(__FILE__, __LINE__, #expression " throws " #TException); \
+        } \
+    } while (false)
+
+inline int RunTests(int argc, char** argv) {
+    std::string filter = (argc > 1 ? argv[1] : "");
+    size_t failedCount = 0;
+    for (const TTestCase& testCase : TestCases()) {
+        if (std::string(testCase.Name).find(filter) == std::string::npos) {
+            continue;
+        }
+        std::printf("[ RUN    ] %s\n", testCase.Name);
+        std::fflush(stdout);
+        size_t oldFailureCount = FailureCount();
+        try {
+            testCase.Function();
+        } catch (const std::exception& exception) {
+            ReportFailure(__FILE__, __LINE__, exception.what());
+        }
+        bool isPassed = (FailureCount() == oldFailureCount);
+        failedCount += !isPassed;
+        std::printf("[ %s ] %s\n", isPassed ? "    OK" : "FAILED", testCase.Name);
+    }
+    std::printf("%zu failed\n", failedCount);
+    return (failedCount == 0 ? 0 : 1);
+}
+
+// Operations of a differential run; small key ranges keep hits, misses and rebalancing all frequent
+constexpr size_t DifferentialSteps = 20000;
+constexpr int DifferentialKeyRange = 600;
+
+// Allocations left before TFailingAllocator throws std::bad_alloc, negative for no limit
+inline int64_t& AllocationBudget() {
+    static int64_t budget = -1;
+    return budget;
+}
+
+template<class TValueType>
+class TFailingAllocator {
+public:
+    using value_type = TValueType;
+
+    TFailingAllocator() = default;
+
+    template<class TOtherType>
+    TFailingAllocator(const TFailingAllocator<TOtherType>&) noexcept {
+    }
+
+    TValueType* allocate(size_t count) {
+        if (AllocationBudget() == 0) {
+            throw std::bad_alloc();
+        }
+        if (AllocationBudget() > 0) {
+            --AllocationBudget();
+        }
+        return std::allocator<TValueType>().allocate(count);
+    }
+
+    void deallocate(TValueType* pointer, size_t count) noexcept {
+        std::allocator<TValueType>().deallocate(pointer, count);
+    }
+
+    template<class TOtherType>
+    bool operator==(const TFailingAllocator<TOtherType>&) const noexcept {
+        return true;
+    }
+
+    template<class TOtherType>
+    bool operator!=(const TFailingAllocator<TOtherType>&) const noexcept {
+        return false;
+    }
+};
+
+// The same generator for every run, so a failure repeats
+inline std::mt19937& TestRandom() {
+    static std::mt19937 random(20220130);
+    return random;
+}
+
+inline int RandomKey(int keyRange = DifferentialKeyRange) {
+    return static_cast<int>(TestRandom()() % static_cast<uint32_t>(keyRange));
+}
+
+inline std::vector<int> RandomKeys(size_t count, int keyRange = DifferentialKeyRange) {
+    std::vector<int> keys(count);
+    for (int& key : keys) {
+        key = RandomKey(keyRange);
+    }
+    return keys;
+}
+
+inline std::string StringKey(int key) {
+    std::string digits = std::to_string(key);
+    return std::string(6 - std::min<size_t>(digits.size(), 6), '0') + digits;
+}
+
+// Same elements in the same order, walked forwards and backwards
+template<class TContainer, class TReference>
+bool SameElements(const TContainer& container, const TReference& reference) {
+    if (container.size() != reference.size()) {
+        std::fprintf(stderr, "size %zu, expected %zu\n", static_cast<size_t>(container.size()), reference.size());
+        return false;
+    }
+    auto containerIterator = container.begin();
+    for (auto referenceIterator = reference.begin(); referenceIterator != reference.end(); ++referenceIterator) {
+        if (!(*containerIterator == *referenceIterator)) {
+            std::fprintf(stderr, "elements differ from the reference\n");
+            return false;
+        }
+        ++containerIterator;
+    }
+    // containerIterator is at end() now
+    for (auto referenceIterator = reference.rbegin(); referenceIterator != reference.rend(); ++referenceIterator) {
+        --containerIterator;
+        if (!(*containerIterator == *referenceIterator)) {
+            std::fprintf(stderr, "backward walk differs from the reference\n");
+            return false;
+        }
+    }
+    return true;
+}
+
+// The AA tree invariants of validate() plus the elements
+template<class TSet, class TReference>
+bool SameTree(const TSet& set, const TReference& reference) {
+    if (!set.validate()) {
+        std::fprintf(stderr, "validate() failed\n");
+        return false;
+    }
+    return SameElements(set, reference);
+}
+
+// The iterator of set at the position of the reference iterator
+template<class TSet, class TReference>
+bool SamePosition(const TSet& set, typename TSet::iterator setIterator, const TReference& reference, typename TReference::const_iterator referenceIterator) {
+    if (referenceIterator == reference.end()) {
+        return (setIterator == set.end());
+    }
+    return (setIterator != set.end() && *setIterator == *referenceIterator);
+}
@@ -0,0 +1,11 @@
+/*
+ *      Summary: Entry point of the AA Tree tests
+ *         Date: 2022.01.30
+ *   Programmer: Kurdun Andrei
+ *   Code Style: Yandex
+ */
+#include "TestCommon.h"
+
+int main(int argc, char** argv) {
+    return RunTests(argc, argv);
+}
@@ -0,0 +1,177 @@
+/*
+ *      Summary: Tests of the path-copying PersistentSet and ConcurrentSet
+ *         Date: 2022.01.30
+ *   Programmer: Kurdun Andrei
+ *   Code Style: Yandex
+ */
+#include "TestCommon.h"
+
+#include "ConcurrentSet.h"
+#include "NodePool.h"
+#include "PersistentSet.h"
+
+#include <atomic>
+#include <optional>
+#include <set>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace {
+    template<class TSet>
+    std::set<int> PersistentElements(const TSet& set) {
+        std::set<int> elements;
+        set.for_each([&elements](int value) {
+            elements.insert(value);
+        });
+        return elements;
+    }
+
+    // Every old version keeps its elements whatever happens to the newer ones
+    AA_TREE_TEST(TPersistentSetTest, VersionsStayIntact) {
+        PersistentSet<int> set;
+        std::set<int> reference;
+        std::vector<std::pair<PersistentSet<int>, std::set<int>>> versions;
+        for (size_t step = 0; step < DifferentialSteps; ++step) {
+            int key = RandomKey();
+            if (RandomKey(3) != 0) {
+                set = set.insert(key);
+                reference.insert(key);
+            } else {
+                set = set.erase(key);
+                reference.erase(key);
+            }
+            AA_TREE_REQUIRE(set.size() == reference.size());
+            AA_TREE_REQUIRE(set.contains(key) == (reference.count(key) != 0));
+            if (step % 500 == 0) {
+                versions.emplace_back(set.snapshot(), reference);
+            }
+        }
+        for (int key = -1; key <= DifferentialKeyRange; ++key) {
+            auto referenceIterator = reference.lower_bound(key);
+            const int* lowerBound = set.lower_bound(key);
+            AA_TREE_REQUIRE((lowerBound == nullptr) == (referenceIterator == reference.end()));
+            if (lowerBound != nullptr) {
+                AA_TREE_CHECK(*lowerBound == *referenceIterator);
+            }
+            const int* foundValue = set.find(key);
+            AA_TREE_CHECK((foundValue != nullptr) == (reference.count(key) != 0));
+        }
+        for (const auto& [version, versionReference] : versions) {
+            AA_TREE_CHECK(version.size() == versionReference.size());
+            AA_TREE_CHECK(PersistentElements(version) == versionReference);
+        }
+    }
+
+    AA_TREE_TEST(TPersistentSetTest, FailedUpdatesLeaveNoTrace) {
+        PersistentSet<int, std::less<int>, TFailingAllocator<int>> set;
+        std::set<int> reference;
+        for (int round = 0; round < 3000; ++round) {
+            int key = RandomKey();
+            AllocationBudget() = RandomKey(6);
+            try {
+                if (RandomKey(3) != 0) {
+                    set = set.insert(key);
+                    reference.insert(key);
+                } else {
+                    set = set.erase(key);
+                    reference.erase(key);
+                }
+            } catch (const std::bad_alloc&) {
+            }
+            AllocationBudget() = -1;
+            AA_TREE_REQUIRE(PersistentElements(set) == reference);
+        }
+    }
+
+    // Pools do not propagate on copy assignment, so the elements move into the pool of the target
+    AA_TREE_TEST(TPersistentSetTest, AssignmentFollowsTheAllocator) {
+        using TPoolSet = PersistentSet<int, std::less<int>, TPoolAllocator<int>>;
+        TPoolSet source;
+        std::set<int> reference;
+        for (int key : RandomKeys(300)) {
+            source = source.insert(key);
+            reference.insert(key);
+        }
+        TPoolSet target;
+        TPoolAllocator<int> targetAllocator = target.get_allocator();
+        target = source;
+        AA_TREE_CHECK(target.get_allocator() == targetAllocator);
+        AA_TREE_CHECK(target.get_allocator() != source.get_allocator());
+        source = TPoolSet();
+        AA_TREE_CHECK(PersistentElements(target) == reference);
+
+        // A move takes the allocator along with the nodes
+        TPoolSet moved;
+        moved = std::move(target);
+        AA_TREE_CHECK(moved.get_allocator() == targetAllocator);
+        AA_TREE_CHECK(PersistentElements(moved) == reference);
+    }
+
+    AA_TREE_TEST(TConcurrentSetTest, MatchesTheReference) {
+        ConcurrentSet<int> set;
+        std::set<int> reference;
+        for (size_t step = 0; step < DifferentialSteps; ++step) {
+            int key = RandomKey();
+            if (RandomKey(3) != 0) {
+                AA_TREE_CHECK(set.insert(key) == reference.insert(key).second);
+            } else {
+                AA_TREE_CHECK(set.erase(key) == (reference.erase(key) != 0));
+            }
+            AA_TREE_REQUIRE(set.size() == reference.size());
+            int wantedKey = RandomKey();
+            AA_TREE_CHECK(set.contains(wantedKey) == (reference.count(wantedKey) != 0));
+            auto referenceIterator = reference.lower_bound(wantedKey);
+            std::optional<int> lowerBound = set.lower_bound(wantedKey);
+            AA_TREE_REQUIRE(lowerBound.has_value() == (referenceIterator != reference.end()));
+            if (lowerBound) {
+                AA_TREE_CHECK(*lowerBound == *referenceIterator);
+            }
+        }
+        set.reclaim();
+        for (int key = 0; key < DifferentialKeyRange; ++key) {
+            AA_TREE_CHECK(set.find(key).has_value() == (reference.count(key) != 0));
+        }
+    }
+
+    // Readers never miss the stable even keys while the writer churns the odd ones
+    AA_TREE_TEST(TConcurrentSetTest, ReadersSeeConsistentVersions) {
+        constexpr int KeyCount = 2000;
+        ConcurrentSet<int> set;
+        for (int key = 0; key < KeyCount; key += 2) {
+            set.insert(key);
+        }
+        std::atomic<bool> isDone = false;
+        std::atomic<size_t> missCount = 0;
+        std::vector<std::thread> readers;
+        for (int readerIndex = 0; readerIndex < 4; ++readerIndex) {
+            readers.emplace_back([&set, &isDone, &missCount, readerIndex] {
+                int key = readerIndex * 2;
+                while (!isDone.load()) {
+                    if (!set.contains(key)) {
+                        ++missCount;
+                    }
+                    std::optional<int> lowerBound = set.lower_bound(key);
+                    if (!lowerBound || *lowerBound != key) {
+                        ++missCount;
+                    }
+                    key = (key + 2) % KeyCount;
+                }
+            });
+        }
+        for (int round = 0; round < 20000; ++round) {
+            int key = RandomKey(KeyCount / 2) * 2 + 1;
+            if (round % 2 == 0) {
+                set.insert(key);
+            } else {
+                set.erase(key);
+            }
+        }
+        isDone.store(true);
+        for (std::thread& reader : readers) {
+            reader.join();
+        }
+        AA_TREE_CHECK(missCount.load() == 0u);
+        AA_TREE_CHECK(set.size() >= static_cast<size_t>(KeyCount / 2));
+    }
+}